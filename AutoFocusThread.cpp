@@ -0,0 +1,354 @@
+#include "AutoFocusThread.h"
+#include "ImageKernels.h"
+#include <QtCore/QElapsedTimer>
+#include <cmath>
+#include <string.h>
+
+string AutoFocusThread::OBJECT_NAME = "AutoFocusThread";
+
+ImageRegion Get_ValidFocusRegion(const ImageRegion& region, int image_width, int image_height)
+{
+	ImageRegion valid = region;
+	if (valid.width <= 0 || valid.height <= 0){
+		valid.width = min(AUTOFOCUS::DEFAULT_REGION_SIZE, image_width);
+		valid.height = min(AUTOFOCUS::DEFAULT_REGION_SIZE, image_height);
+		valid.x_offset = (image_width-valid.width)/2;
+		valid.y_offset = (image_height-valid.height)/2;
+	}
+	valid.x_offset = max(0, min(valid.x_offset, image_width-1));
+	valid.y_offset = max(0, min(valid.y_offset, image_height-1));
+	valid.width = min(valid.width, image_width-valid.x_offset);
+	valid.height = min(valid.height, image_height-valid.y_offset);
+	return valid;
+}
+
+double Get_FocusMeasure(FocusMetric metric, const ushort* image, int image_width, int image_height)
+{
+	ImageRegion region;
+	region.x_offset = 0;
+	region.y_offset = 0;
+	region.width = image_width;
+	region.height = image_height;
+	if (image == NULL){
+		return 0.0;
+	}
+	if (metric == LAPLACIAN_VARIANCE){
+		return LaplacianVariance_SSE2(image, image_width, region);
+	}
+	return BrennerGradient_SSE2(image, image_width, region);
+}
+
+AutoFocusThread::AutoFocusThread(Stage* stage, QObject* parent) : QThread(parent), stage(stage)
+{
+	isStopFocus = true;
+	focusMetric = BRENNER_GRADIENT;
+	focusRegion.x_offset = 0;
+	focusRegion.y_offset = 0;
+	focusRegion.width = 0;
+	focusRegion.height = 0;
+	focusChannel = 0;
+	hasLatestFrame = false;
+	latestFrameIndex = 0;
+	isWaitingFrame = false;
+	acceptFrameIndex = 0;
+	frameCaptured = false;
+	regionWidth = 0;
+	regionHeight = 0;
+}
+
+AutoFocusThread::~AutoFocusThread()
+{
+	StopFocus();
+	stage = NULL;
+}
+
+void AutoFocusThread::StartFocus()
+{
+	if (isRunning() || stage == NULL){
+		return;
+	}
+	frameMutex.lock();
+	hasLatestFrame = false;
+	isWaitingFrame = false;
+	frameCaptured = false;
+	frameMutex.unlock();
+	isStopFocus = false;
+	start();
+}
+
+void AutoFocusThread::StopFocus()
+{
+	isStopFocus = true;
+	frameReady.wakeAll();
+	wait();
+}
+
+void AutoFocusThread::Set_FocusRegion(ImageRegion region)
+{
+	QMutexLocker locker(&frameMutex);
+	focusRegion = region;
+}
+
+void AutoFocusThread::Set_FocusMetric(FocusMetric metric)
+{
+	focusMetric = metric;
+}
+
+void AutoFocusThread::Set_FocusChannel(char channel)
+{
+	QMutexLocker locker(&frameMutex);
+	focusChannel = channel;
+}
+
+vector<FocusPoint> AutoFocusThread::Get_FocusCurve()
+{
+	QMutexLocker locker(&curveMutex);
+	return focusCurve;
+}
+
+/*
+	Called in the acquisition thread: remember the latest frame index and copy
+	the focus region of the first settled frame the focus thread is waiting for
+*/
+void AutoFocusThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopFocus || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+
+	QMutexLocker locker(&frameMutex);
+	if (focusChannel != 0 && (info.channel == GCAMP_CHANNEL || info.channel == RFP_CHANNEL)
+		&& info.channel != focusChannel){
+		return;
+	}
+	hasLatestFrame = true;
+	latestFrameIndex = info.frame_index;
+	if (!isWaitingFrame || info.frame_index < acceptFrameIndex){
+		return;
+	}
+
+	ImageRegion region = Get_ValidFocusRegion(focusRegion, info.image_width, info.image_height);
+
+	regionBuffer.resize((size_t)region.width*region.height);
+	for (int row=0; row<region.height; ++row){
+		const uchar* src = data + (size_t)(region.y_offset+row)*info.row_bytes + region.x_offset*sizeof(ushort);
+		memcpy(&regionBuffer[(size_t)row*region.width], src, region.width*sizeof(ushort));
+	}
+	regionWidth = region.width;
+	regionHeight = region.height;
+
+	isWaitingFrame = false;
+	frameCaptured = true;
+	frameReady.wakeAll();
+}
+
+/*
+	Each step waits for the stage, reads its position and waits for a frame
+	exposed after the motion, then issues the next move before evaluating the
+	frame, so that the metric computation overlaps with the stage motion
+*/
+void AutoFocusThread::run()
+{
+	QElapsedTimer timer;
+	timer.start();
+	bool success = false;
+	double focusPosition = 0;
+	double originalSpeed = 0;
+	vector<FocusPoint> coarsePoints, finePoints;
+
+	curveMutex.lock();
+	focusCurve.clear();
+	curveMutex.unlock();
+
+	try{
+		originalSpeed = stage->Get_Speed();
+		stage->Set_Speed(AUTOFOCUS::SWEEP_SPEED);
+
+		//coarse sweep, recentered when the peak lies on the edge of the sweep
+		double center = stage->Get_CurrentPosition();
+		double coarseStep = Z1_STAGE::Z1_COARSEFOCUS_STEP/Z1_STAGE::Z1_PRECISION;
+		int peak = 0;
+		bool swept = false;
+		for (int retry=0; retry<=AUTOFOCUS::MAX_COARSE_RETRY; ++retry){
+			coarsePoints.clear();
+			swept = Sweep(center, coarseStep, Z1_STAGE::Z1_COARSEFOCUS_TIMES, coarsePoints);
+			if (!swept){
+				break;
+			}
+			center = FitPeak(coarsePoints, peak);
+			if (peak > 0 && peak < (int)coarsePoints.size()-1){
+				break;
+			}
+		}
+
+		//fine sweep around the coarse peak
+		double fineStep = Z1_STAGE::Z1_FINEFOCUS_STEP/Z1_STAGE::Z1_PRECISION;
+		if (swept && Sweep(center, fineStep, Z1_STAGE::Z1_FINEFOCUS_TIMES, finePoints)){
+			focusPosition = ClipPosition(FitPeak(finePoints, peak));
+			if (WaitMotion()){
+				stage->Move_Closeloop_Unrealtime(focusPosition-stage->Get_CurrentPosition());
+				success = !isStopFocus;
+			}
+		}
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+
+	try{
+		if (originalSpeed > 0){
+			stage->Set_Speed(originalSpeed);
+		}
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+
+	curveMutex.lock();
+	focusCurve = coarsePoints;
+	focusCurve.insert(focusCurve.end(), finePoints.begin(), finePoints.end());
+	curveMutex.unlock();
+
+	isStopFocus = true;
+	emit FocusFinishedSignal(success, focusPosition, (double)timer.elapsed());
+}
+
+bool AutoFocusThread::Sweep(double center, double step, int times, vector<FocusPoint>& points)
+{
+	if (times <= 0){
+		return false;
+	}
+	vector<double> targets(times);
+	for (int i=0; i<times; ++i){
+		targets[i] = ClipPosition(center + (i-(times-1)/2.0)*step);
+	}
+
+	if (!WaitMotion()){
+		return false;
+	}
+	stage->Move_Openloop_Realtime(targets[0]-stage->Get_CurrentPosition());
+
+	for (int i=0; i<times; ++i){
+		if (!WaitMotion()){
+			return false;
+		}
+		double position = stage->Get_CurrentPosition();
+		if (!WaitFrame()){
+			return false;
+		}
+		if (i+1 < times){
+			stage->Move_Openloop_Realtime(targets[i+1]-position);
+		}
+
+		FocusPoint point;
+		point.position = position;
+		point.metric = ComputeMetric();
+		points.push_back(point);
+		emit FocusPointSignal(point.position, point.metric);
+	}
+	return true;
+}
+
+bool AutoFocusThread::WaitMotion()
+{
+	QElapsedTimer timer;
+	timer.start();
+	while (!isStopFocus){
+		if (!stage->IsMoving()){
+			return true;
+		}
+		if (timer.elapsed() > AUTOFOCUS::MOTION_TIMEOUT){
+			cout<<OBJECT_NAME<<": motion timeout"<<endl;
+			return false;
+		}
+		msleep(AUTOFOCUS::MOTION_WAITING);
+	}
+	return false;
+}
+
+//wait for a frame whose exposure starts after the stage stopped
+bool AutoFocusThread::WaitFrame()
+{
+	QMutexLocker locker(&frameMutex);
+	acceptFrameIndex = hasLatestFrame ? latestFrameIndex+AUTOFOCUS::SETTLE_FRAMES : 0;
+	frameCaptured = false;
+	isWaitingFrame = true;
+
+	QElapsedTimer timer;
+	timer.start();
+	while (!frameCaptured && !isStopFocus){
+		long remain = AUTOFOCUS::FRAME_TIMEOUT - (long)timer.elapsed();
+		if (remain <= 0){
+			break;
+		}
+		frameReady.wait(&frameMutex, remain);
+	}
+	isWaitingFrame = false;
+	if (!frameCaptured && !isStopFocus){
+		cout<<OBJECT_NAME<<": no frame received, is the camera live?"<<endl;
+	}
+	return frameCaptured;
+}
+
+//the region buffer is not written by the acquisition thread until the next WaitFrame
+double AutoFocusThread::ComputeMetric()
+{
+	if (regionBuffer.empty()){
+		return 0.0;
+	}
+	return Get_FocusMeasure(focusMetric, &regionBuffer[0], regionWidth, regionHeight);
+}
+
+/*
+	The focus curve is close to a gaussian around its peak, so a parabola is
+	fitted to the logarithm of the three points around the maximum. The maximum
+	point itself is returned when it lies on the edge or the fit is not concave.
+*/
+double AutoFocusThread::FitPeak(const vector<FocusPoint>& points, int& peak_index)
+{
+	peak_index = 0;
+	for (size_t i=1; i<points.size(); ++i){
+		if (points[i].metric > points[peak_index].metric){
+			peak_index = (int)i;
+		}
+	}
+	if (points.empty()){
+		return 0.0;
+	}
+	if (peak_index == 0 || peak_index == (int)points.size()-1){
+		return points[peak_index].position;
+	}
+
+	const FocusPoint& p0 = points[peak_index-1];
+	const FocusPoint& p1 = points[peak_index];
+	const FocusPoint& p2 = points[peak_index+1];
+	if (p0.metric <= 0 || p2.metric <= 0){
+		return p1.position;
+	}
+	//positions relative to the peak keep the squares small
+	double x0 = p0.position-p1.position, x1 = 0, x2 = p2.position-p1.position;
+	double y0 = log(p0.metric), y1 = log(p1.metric), y2 = log(p2.metric);
+	double denominator = (x0-x1)*(x0-x2)*(x1-x2);
+	if (denominator == 0){
+		return p1.position;
+	}
+	double a = (x2*(y1-y0) + x1*(y0-y2) + x0*(y2-y1))/denominator;
+	double b = (x2*x2*(y0-y1) + x1*x1*(y2-y0) + x0*x0*(y1-y2))/denominator;
+	if (a >= 0){
+		return p1.position;
+	}
+	double vertex = -b/(2*a);
+	if (vertex < min(x0, x2) || vertex > max(x0, x2)){
+		return p1.position;
+	}
+	return p1.position + vertex;
+}
+
+double AutoFocusThread::ClipPosition(double position)
+{
+	if (position < 0){
+		return 0;
+	}
+	if (position > Z1_STAGE::Z1_UPLIMIT){
+		return Z1_STAGE::Z1_UPLIMIT;
+	}
+	return position;
+}
@@ -0,0 +1,83 @@
+/*****************************************************************
+AutoFocusThread : Coarse to fine image based autofocus which sweeps
+                  the z stage while measuring the focus region of
+                  the streaming frames
+******************************************************************/
+#ifndef _AUTOFOCUS_THREAD_H_
+#define _AUTOFOCUS_THREAD_H_
+
+#include "FrameProcessor.h"
+#include "Stage.h"
+#include "Stage_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <vector>
+
+enum FocusMetric{ BRENNER_GRADIENT, LAPLACIAN_VARIANCE };
+
+struct FocusPoint{
+	double position; //measured stage position, pulse
+	double metric;
+};
+
+//region clipped to the image, a region of zero width becomes the default region at the image center
+ImageRegion Get_ValidFocusRegion(const ImageRegion& region, int image_width, int image_height);
+//focus metric of a compact image
+double Get_FocusMeasure(FocusMetric metric, const ushort* image, int image_width, int image_height);
+
+class AutoFocusThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit AutoFocusThread(Stage* stage, QObject* parent = 0);
+	~AutoFocusThread();
+
+	void StartFocus();
+	void StopFocus();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	void Set_FocusRegion(ImageRegion region); //zero width means the center of the image
+	void Set_FocusMetric(FocusMetric metric);
+	void Set_FocusChannel(char channel);      //0 measures every frame
+	vector<FocusPoint> Get_FocusCurve();
+
+signals:
+	void FocusPointSignal(double, double);         //position and metric of a measured point
+	void FocusFinishedSignal(bool, double, double); //success, focus position and elapsed ms
+
+protected:
+	virtual void run();
+	bool Sweep(double center, double step, int times, vector<FocusPoint>& points);
+	bool WaitMotion();
+	bool WaitFrame();
+	double ComputeMetric();
+	double FitPeak(const vector<FocusPoint>& points, int& peak_index);
+	double ClipPosition(double position);
+
+private:
+	Stage* stage;
+	volatile bool isStopFocus;
+	FocusMetric focusMetric;
+
+	//frame exchange with the acquisition thread
+	QMutex frameMutex;
+	QWaitCondition frameReady;
+	ImageRegion focusRegion;
+	char focusChannel;
+	bool hasLatestFrame;
+	unsigned long latestFrameIndex;
+	bool isWaitingFrame;
+	unsigned long acceptFrameIndex;
+	bool frameCaptured;
+	vector<ushort> regionBuffer;
+	int regionWidth;
+	int regionHeight;
+
+	QMutex curveMutex;
+	vector<FocusPoint> focusCurve;
+};
+
+#endif //_AUTOFOCUS_THREAD_H_
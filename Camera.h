@@ -3,11 +3,13 @@
 #define _CAMERA_H_
 
 #include "Util.h"
+#include "FrameProcessor.h"
 #include <QtCore/QObject>
 #include <string>
 #include <iostream>
 
-class Camera : public QObject
+//frame processors registered on a camera get every acquired frame in the acquisition thread
+class Camera : public QObject, public FrameDispatcher
 {
 	Q_OBJECT
 public:
@@ -23,7 +25,9 @@ public:
 
 	virtual void Get_CameraInfo() = 0;
 	virtual bool Set_ImageSize(int left, int top, int width, int height) = 0;
-	virtual bool Get_ImageSize(ImageSize &) = 0;
+	virtual bool Get_ImageSize(ImageSize &) = 0;  //size of the frames, after binning
+	virtual bool Set_Binning(int binning) = 0;    //1, 2 or 4 in both directions
+	virtual bool Get_Binning(int &) = 0;
 	virtual bool Set_TriggerMode(std::string mode) = 0;
 	virtual bool Get_TriggerMode(std::string &) = 0;
 
@@ -33,6 +37,7 @@ public:
 	virtual bool Get_FrameRateRange(Range &) = 0;
 	virtual bool Set_FrameRate(double) = 0;
 	virtual bool Get_FrameRate(double &) = 0;
+	virtual bool Get_CurrentTemperature(double &) = 0; //sensor, Celsius degree
 };
 
 #endif //_CAMERA_H_
\ No newline at end of file
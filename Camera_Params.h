@@ -5,6 +5,20 @@
 namespace HAMAMATSU_PARAMS{
 	const int FULLIMAGE_WIDTH = 2048;
 	const int FULLIMAGE_HEIGHT = 2048;
+	const int SUBARRAY_STEP = 4;   //offset and size of the subarray, pixel
+	const double LINE_TIME = 9.74e-6;              //readout of one line pair of the rolling shutter, s
+	const int MIN_DRIVER_FRAMES = 3;               //frames of the ring of the driver
+	const int MAX_DRIVER_FRAMES = 1000;
+	const double MAX_DRIVER_MEMORY = 1.0e9;        //bytes of the ring of the driver
+	const double STALL_TOLERANCE = 1.0;            //stall of the acquiring thread absorbed by the ring, s
+	const double FRAME_PERIOD_FILTER = 0.1;        //weight of a new period in the frame period estimate
+	const unsigned long SNAP_TIMEOUT = 10000;      //wait for a snapped frame beyond the exposure, ms, a triggered frame may be late
+	const double MIN_FRAME_RATE = 0.1;             //internal trigger, Hz
+}
+
+//the sequencer, the z-stack and the simulated camera drive the same line
+namespace CAMERA_TRIGGER{
+	const int CONTROLLER_OUTPUT = 1;               //controller output wired to the camera trigger input
 }
 
 namespace ANDOR_PARAMS{
@@ -16,4 +30,61 @@ namespace IO_PARAMS{
 	const int FULLIMAGE_WIDTH = 2048;
 	const int FULLIMAGE_HEIGHT = 2048;
 }
+
+namespace RATIO_IMAGING{
+	const int FRAME_POOL_SIZE = 8;        //frames waiting for pairing
+	const int DISPLAY_BUFFER_SIZE = 4;
+	const int DISPLAY_PERIOD = 40;        //ms, limit the ratio display to 25Hz
+	const float DISPLAY_SCALE = 64.0f;    //ratio 1.0 is shown as gray level 64
+	const float MIN_DENOMINATOR = 16.0f;  //background subtracted rfp value below it gives ratio 0
+}
+
+namespace MOTION_CORRECTION{
+	const int FRAME_POOL_SIZE = 16;                //frames in flight between acquisition and results
+	const int REGISTRATION_SIZE = 512;             //side of the central patch used for phase correlation
+	const double TEMPLATE_ALPHA = 0.05;            //weight of the new frame in the running template
+	const int TEMPLATE_UPDATE_INTERVAL = 10;       //frames between two template spectrum updates
+	const double MIN_PEAK = 0.03;                  //frames with a lower correlation peak do not update the template
+	const int DISPLAY_PERIOD = 100;                //ms
+}
+
+namespace OBJECT_TRACKING{
+	const int DOWNSAMPLE = 4;                      //binning of the frames before the detection, power of 2
+	const double THRESHOLD_RATIO = 0.5;            //threshold between the mean and the max of the binned frame
+	const int MIN_CONTRAST = 50;                   //max above mean below which the target is lost, gray level
+	const int MIN_AREA = 4;                        //smallest object, binned pixels
+	const double DEADBAND = 2.0;                   //position error left uncorrected, pixel
+	const double GAIN = 0.7;                       //fraction of the error corrected by one move
+	const int DISPLAY_PERIOD = 100;                //ms
+}
+
+namespace EXCITATION_SEQUENCER{
+	const int GATE_OUTPUT_488 = 2;                 //controller output wired to the digital modulation input of the 488 laser
+	const int GATE_OUTPUT_561 = 3;                 //same for the 561 laser
+	const double LINE_TIME = HAMAMATSU_PARAMS::LINE_TIME;
+	const double LASER_SWITCH_TIME = 0.00005;      //rise and fall of the digital modulation, s
+	const double SCHEDULE_MARGIN = 0.0005;         //jitter of the host schedule added to the frame period, s
+	const int TIMING_COMMANDS = 5;                 //commands measuring the round trip of the controller
+	const long FRAME_DELAY = 20;                   //max delay of the first frame after the middle of its exposure, ms
+	const int HISTORY_SIZE = 256;                  //triggers kept to find the channel of the frames
+	const double DELAY_FILTER = 0.1;               //weight of a new frame in the mean frame delay
+}
+
+namespace SIMULATED_CAMERA{
+	const int IMAGE_WIDTH = 512;
+	const int IMAGE_HEIGHT = 512;
+	const double EXPOSURE_TIME = 0.01;             //default exposure, s
+	const double MIN_EXPOSURE_TIME = 0.001;        //s
+	const double MAX_EXPOSURE_TIME = 1.0;          //s
+	const double READOUT_TIME = 0.01;              //readout of the full image after the exposure, s
+	const double SENSOR_TEMPERATURE = -10.0;       //cooled sensor, Celsius degree
+	const int SPOT_SPACING = 32;                   //pixels between the beads of the synthetic sample
+	const double SPOT_SIGMA = 1.5;                 //bead size in focus, pixel
+	const double FOCUS_POSITION = 28500;           //z1 encoder position where the sample is in focus, pulse
+	const double DEFOCUS_BLUR = 0.5;               //blur per um of defocus, pixel
+
+	const double SPOT_INTENSITY = 3000;
+	const double BACKGROUND = 100;
+}
+
 #endif //_CONST_PARAMS_H_
\ No newline at end of file
@@ -0,0 +1,323 @@
+
+#include "CloseloopThread.h"
+#include <cmath>
+#include <stdio.h>
+
+string CloseloopThread::OBJECT_NAME = "CloseloopThread";
+
+/********************************** Closed Loop Motion **********************************/
+bool CloseloopMotion::IsFinished() const
+{
+	if (state.isNull()){
+		return true;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->result != CLOSELOOP_RUNNING;
+}
+
+bool CloseloopMotion::Wait(unsigned long time_ms) const
+{
+	if (state.isNull()){
+		return true;
+	}
+	QElapsedTimer timer;
+	timer.start();
+	QMutexLocker locker(&state->mutex);
+	while (state->result == CLOSELOOP_RUNNING){
+		long long remain = (long long)time_ms - timer.elapsed();
+		if (remain <= 0){
+			return false;
+		}
+		state->finished.wait(&state->mutex, (unsigned long)remain);
+	}
+	return true;
+}
+
+void CloseloopMotion::Cancel() const
+{
+	if (!state.isNull()){
+		state->isCancelRequested = true;
+	}
+}
+
+CloseloopResult CloseloopMotion::Get_Result() const
+{
+	if (state.isNull()){
+		return CLOSELOOP_FAILED;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->result;
+}
+
+double CloseloopMotion::Get_Target() const
+{
+	if (state.isNull()){
+		return 0;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->target;
+}
+
+double CloseloopMotion::Get_Position() const
+{
+	if (state.isNull()){
+		return 0;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->position;
+}
+
+int CloseloopMotion::Get_Corrections() const
+{
+	if (state.isNull()){
+		return 0;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->corrections;
+}
+
+string CloseloopMotion::Get_Error() const
+{
+	if (state.isNull()){
+		return CloseloopThread::OBJECT_NAME + ": invalid motion";
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->error;
+}
+
+/********************************** Closed Loop Thread **********************************/
+CloseloopThread::CloseloopThread(StageController* controller, char axis, double encoder_to_motor, long tolerance, QObject* parent)
+	: QThread(parent), controller(controller), axis(axis), encoderToMotor(encoder_to_motor), tolerance(tolerance)
+{
+	isStopThread = true;
+	hasTarget = false;
+	pendingDistance = 0;
+	target = 0;
+	commandedEnd = 0;
+	stableStart = -1;
+	lastPosition = 0;
+}
+
+CloseloopThread::~CloseloopThread()
+{
+	StopThread();
+	controller = NULL;
+}
+
+void CloseloopThread::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	isStopThread = false;
+	start();
+}
+
+void CloseloopThread::StopThread()
+{
+	isStopThread = true;
+	motionReady.wakeAll();
+	wait();
+	Reset(CLOSELOOP_CANCELLED);
+}
+
+CloseloopMotion CloseloopThread::MoveBy(double distance, long timeout_ms, const SettleCriterion& settle)
+{
+	CloseloopMotion motion;
+	motion.state = QSharedPointer<CloseloopState>(new CloseloopState);
+	motion.state->result = CLOSELOOP_RUNNING;
+	motion.state->isCancelRequested = false;
+	motion.state->target = 0;
+	motion.state->position = 0;
+	motion.state->corrections = 0;
+	motion.state->timeout = timeout_ms;
+	motion.state->settle = settle;
+
+	motionMutex.lock();
+	if (isStopThread){
+		motionMutex.unlock();
+		Finish(motion.state, CLOSELOOP_FAILED, OBJECT_NAME + ": thread stopped");
+		return motion;
+	}
+	QSharedPointer<CloseloopState> former = current;
+	current = motion.state;
+	pendingDistance += distance;
+	motionReady.wakeOne();
+	motionMutex.unlock();
+
+	if (!former.isNull()){
+		Finish(former, CLOSELOOP_SUPERSEDED);
+	}
+	return motion;
+}
+
+void CloseloopThread::Reset(CloseloopResult result)
+{
+	QMutexLocker trackLocker(&trackMutex);
+	motionMutex.lock();
+	QSharedPointer<CloseloopState> motion = current;
+	current.clear();
+	hasTarget = false;
+	pendingDistance = 0;
+	motionMutex.unlock();
+
+	if (!motion.isNull()){
+		Finish(motion, result);
+	}
+}
+
+void CloseloopThread::run()
+{
+	QSharedPointer<CloseloopState> tracked;
+	while (!isStopThread){
+		motionMutex.lock();
+		if (current.isNull()){
+			motionReady.wait(&motionMutex, 100);
+		}
+		QSharedPointer<CloseloopState> motion = current;
+		motionMutex.unlock();
+		if (motion.isNull()){
+			tracked.clear();
+			continue;
+		}
+
+		//a new request restarts the timeout and the settle time
+		if (motion != tracked){
+			tracked = motion;
+			motionTimer.start();
+			stableStart = -1;
+		}
+		Track(motion);
+
+		if (motion->settle.poll_interval > 0){
+			msleep(motion->settle.poll_interval);
+		}
+	}
+}
+
+/*
+	One tracking step: sample the profiler and the encoder in one round trip. While the
+	profile runs, its end is moved onto the target when the target changed; once it stopped
+	the remaining error is corrected until the encoder settles within the tolerance.
+*/
+void CloseloopThread::Track(const QSharedPointer<CloseloopState>& motion)
+{
+	QMutexLocker trackLocker(&trackMutex);
+	CloseloopResult result = CLOSELOOP_RUNNING;
+	string error;
+	try{
+		motionMutex.lock();
+		bool isCurrent = (current == motion);
+		motionMutex.unlock();
+		if (!isCurrent){
+			return;
+		}
+
+		char strCommand[32];
+		if (motion->isCancelRequested){
+			sprintf(strCommand, "ST%c\r", axis);
+			controller->write(string(strCommand));
+			result = CLOSELOOP_CANCELLED;
+		} else{
+			double moving = 1, position = 0;
+			sprintf(strCommand, "MG _BG%c, _TP%c", axis, axis);
+			if (sscanf(controller->command(string(strCommand)).c_str(), "%lf %lf", &moving, &position) != 2){
+				throw string("Invalid response to " + string(strCommand));
+			}
+
+			motionMutex.lock();
+			if (!hasTarget){
+				target = position;
+				commandedEnd = position;
+				lastPosition = position;
+				hasTarget = true;
+			}
+			target += pendingDistance;
+			pendingDistance = 0;
+			motionMutex.unlock();
+
+			motion->mutex.lock();
+			motion->target = target;
+			motion->position = position;
+			int corrections = motion->corrections;
+			motion->mutex.unlock();
+
+			if (moving != 0){
+				if (fabs(target-commandedEnd) >= tolerance && Increment(target-commandedEnd)){
+					motion->mutex.lock();
+					++motion->corrections;
+					motion->mutex.unlock();
+				}
+				stableStart = -1;
+			} else if (fabs(target-position) >= tolerance){
+				if (corrections >= CLOSELOOP::MAX_CORRECTIONS){
+					throw string("Target not reached after the max corrections");
+				}
+				commandedEnd = position;
+				if (Increment(target-position)){
+					motion->mutex.lock();
+					++motion->corrections;
+					motion->mutex.unlock();
+				}
+				stableStart = -1;
+			} else if (fabs(position-lastPosition) <= motion->settle.tolerance){
+				if (stableStart < 0){
+					stableStart = motionTimer.elapsed();
+				}
+				if (motionTimer.elapsed()-stableStart >= motion->settle.settle_time){
+					result = CLOSELOOP_REACHED;
+				}
+			} else{
+				stableStart = -1;
+			}
+			lastPosition = position;
+
+			if (result == CLOSELOOP_RUNNING && motionTimer.elapsed() > motion->timeout){
+				result = CLOSELOOP_TIMEOUT;
+			}
+		}
+	} catch (string e){
+		result = CLOSELOOP_FAILED;
+		error = OBJECT_NAME + ": " + e;
+	}
+
+	if (result == CLOSELOOP_RUNNING){
+		return;
+	}
+	motionMutex.lock();
+	if (current == motion){
+		current.clear();
+		//the target stays valid for the next request only when it was reached
+		if (result != CLOSELOOP_REACHED){
+			hasTarget = false;
+			pendingDistance = 0;
+		}
+	}
+	motionMutex.unlock();
+	Finish(motion, result, error);
+}
+
+//an increment during the motion extends the running profile
+bool CloseloopThread::Increment(double encoder_distance)
+{
+	long step = long(encoder_distance*encoderToMotor);
+	if (step == 0){
+		return false;
+	}
+	char strCommand[32];
+	sprintf(strCommand, "IP%c=%ld", axis, step);
+	controller->command(string(strCommand));
+	commandedEnd += step/encoderToMotor;
+	return true;
+}
+
+void CloseloopThread::Finish(const QSharedPointer<CloseloopState>& motion, CloseloopResult result, const string& error)
+{
+	QMutexLocker locker(&motion->mutex);
+	if (motion->result != CLOSELOOP_RUNNING){
+		return;
+	}
+	motion->result = result;
+	motion->error = error;
+	motion->finished.wakeAll();
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+	CloseloopThread: realtime closed loop motion of one axis. The thread
+	streams the profiler state and the encoder position while a target is
+	active and appends incremental corrections as the axis approaches it,
+	so the caller never blocks. Every request returns a CloseloopMotion
+	handle which can be awaited or cancelled.
+****************************************************************************/
+
+#ifndef _CLOSELOOP_THREAD_H_
+#define _CLOSELOOP_THREAD_H_
+
+#include "StageController.h"
+#include "Stage.h"
+#include "Stage_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QElapsedTimer>
+
+enum CloseloopResult{
+	CLOSELOOP_RUNNING,
+	CLOSELOOP_REACHED,     //encoder settled within the tolerance of the target
+	CLOSELOOP_SUPERSEDED,  //a later request or another motion took over the axis
+	CLOSELOOP_CANCELLED,
+	CLOSELOOP_TIMEOUT,
+	CLOSELOOP_FAILED       //controller error or too many corrections
+};
+
+struct CloseloopState{
+	QMutex mutex;
+	QWaitCondition finished;
+	CloseloopResult result;
+	volatile bool isCancelRequested;
+	double target;       //encoder pulse
+	double position;     //last measured encoder position
+	int corrections;
+	long timeout;        //ms
+	SettleCriterion settle;
+	string error;
+};
+
+class CloseloopMotion
+{
+public:
+	bool IsValid() const { return !state.isNull(); }
+	bool IsFinished() const;
+	bool Wait(unsigned long time_ms) const;  //false if the motion is still running after time_ms
+	void Cancel() const;                     //stops the axis, the motion finishes as cancelled
+	CloseloopResult Get_Result() const;
+	double Get_Target() const;
+	double Get_Position() const;
+	int Get_Corrections() const;
+	string Get_Error() const;
+
+private:
+	friend class CloseloopThread;
+	QSharedPointer<CloseloopState> state;
+};
+
+class CloseloopThread : public QThread
+{
+public:
+	static string OBJECT_NAME;
+
+	//encoder_to_motor converts an encoder distance into the IP increment of the axis
+	CloseloopThread(StageController* controller, char axis, double encoder_to_motor, long tolerance, QObject* parent = 0);
+	~CloseloopThread();
+
+	void StartThread();
+	void StopThread();
+
+	//the distances accumulate on the target of the running motion, which finishes as superseded
+	CloseloopMotion MoveBy(double distance, long timeout_ms, const SettleCriterion& settle);
+	//forget the target after another motion, the running motion finishes with the given result
+	void Reset(CloseloopResult result = CLOSELOOP_SUPERSEDED);
+
+protected:
+	virtual void run();
+	void Track(const QSharedPointer<CloseloopState>& motion);
+	void Finish(const QSharedPointer<CloseloopState>& motion, CloseloopResult result, const string& error = "");
+	bool Increment(double encoder_distance);  //false if the distance is below one motor pulse
+
+private:
+	StageController* controller;
+	char axis;
+	double encoderToMotor;
+	long tolerance;
+	volatile bool isStopThread;
+
+	QMutex motionMutex;      //request exchange with the caller threads
+	QWaitCondition motionReady;
+	QSharedPointer<CloseloopState> current;
+	bool hasTarget;
+	double pendingDistance;  //requested distance not yet folded into the target
+
+	QMutex trackMutex;       //held during one tracking step, Reset waits for it
+	double target;
+	double commandedEnd;     //encoder position where the issued increments end
+	long long stableStart;
+	double lastPosition;
+	QElapsedTimer motionTimer;
+};
+
+#endif
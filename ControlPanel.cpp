@@ -4,6 +4,7 @@
 #include <QtWidgets/QVBoxLayout>
 #include <QtWidgets/QGridLayout>
 #include <QtCore/QString>
+#include <QtCore/QDateTime>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QInputDialog>
 #include <QtGui/QFont>
@@ -24,24 +25,80 @@ double FluoImageEvaluation_Direct(const T*, const ImageRegion&, const int);
 ControlPanel::ControlPanel(QWidget* parent) : QWidget(parent)
 {
 	controller = NULL;
+	stageQueue = NULL;
 	z1_stage = NULL;
+	z3_stage = NULL;
+	focusMotion = NULL;
+	z1PositionSampler = NULL;
+	z1_positionQueryId = 0;
 	z1_ref_point = AUTOFOCUS_INITIAL_POINT;
 	z1MotionThread = NULL;
+	autoFocusThread = NULL;
+	focusLockThread = NULL;
+	zStackThread = NULL;
+	volumeImagingThread = NULL;
+	excitationSequencer = NULL;
+	z1_focusRegion.x_offset = 0;
+	z1_focusRegion.y_offset = 0;
+	z1_focusRegion.width = 0;
+	z1_focusRegion.height = 0;
 	hamamatsuImageSaveWidget = NULL;
+	ratioImagingThread = new RatioImagingThread;
+	motionCorrectionThread = new MotionCorrectionThread;
+	objectTrackingThread = new ObjectTrackingThread;
+	deviceManager = new DeviceManager;
+	deviceStatusPoller = new DeviceStatusPoller;
+	deviceStatusPoller->StartPolling();
 	laser488 = NULL;
 	laser561 = NULL;
 	objectiveLens = NO_SELECTED;
 
 	CreateLayout();
-	Connect_Controller();
-
 	InitCamera();
 	InitZ1Stage();
 	InitLasers();
+	BringUpDevices();
 }
 
 ControlPanel::~ControlPanel()
 {
+	//an operation which timed out may still be running on a device
+	if (deviceManager != NULL){
+		delete deviceManager;
+		deviceManager = NULL;
+	}
+	if (deviceStatusPoller != NULL){
+		delete deviceStatusPoller;
+		deviceStatusPoller = NULL;
+	}
+	if (autoFocusThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(autoFocusThread);
+		}
+		delete autoFocusThread;
+		autoFocusThread = NULL;
+	}
+	if (focusLockThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(focusLockThread);
+		}
+		delete focusLockThread;
+		focusLockThread = NULL;
+	}
+	if (zStackThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(zStackThread);
+		}
+		delete zStackThread;
+		zStackThread = NULL;
+	}
+	if (volumeImagingThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(volumeImagingThread);
+		}
+		delete volumeImagingThread;
+		volumeImagingThread = NULL;
+	}
 	Disconect_Controller();
 	if (z1MotionThread != NULL){
 		delete z1MotionThread;
@@ -51,6 +108,27 @@ ControlPanel::~ControlPanel()
 		delete hamamatsuImageSaveWidget;
 		hamamatsuImageSaveWidget = NULL;
 	}
+	if (ratioImagingThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(ratioImagingThread);
+		}
+		delete ratioImagingThread;
+		ratioImagingThread = NULL;
+	}
+	if (motionCorrectionThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(motionCorrectionThread);
+		}
+		delete motionCorrectionThread;
+		motionCorrectionThread = NULL;
+	}
+	if (objectTrackingThread != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(objectTrackingThread);
+		}
+		delete objectTrackingThread;
+		objectTrackingThread = NULL;
+	}
 	if (laser488 != NULL){
 		laser488->Disconnect();
 		delete laser488;
@@ -93,6 +171,21 @@ void ControlPanel::CreateLayout()
 	hamamatsuFrameRateRangeLabel->setMaximumWidth(220);
 	hamamatsuFrameRateRangeLabel->setFrameStyle(QFrame::StyledPanel | QFrame::Plain);
 
+	hamamatsuDriverFramesEdit = new QLineEdit("0");
+	hamamatsuDriverFramesEdit->setMaximumWidth(80);
+	hamamatsuDriverFramesEdit->setMinimumWidth(70);
+	hamamatsuDriverFramesEdit->setToolTip("Frames of the ring of the driver, 0 sizes it from the frame rate");
+	hamamatsuDriverRingLabel = new QLabel(tr("Ring: -"));
+	hamamatsuDriverRingLabel->setMinimumWidth(180);
+	hamamatsuDriverRingLabel->setMaximumWidth(220);
+	hamamatsuDriverRingLabel->setFrameStyle(QFrame::StyledPanel | QFrame::Plain);
+	hamamatsuLiveRateLabel = new QLabel(tr("Live: -"));
+	hamamatsuLiveRateLabel->setMinimumWidth(180);
+	hamamatsuLiveRateLabel->setMaximumWidth(220);
+	hamamatsuLiveRateLabel->setFrameStyle(QFrame::StyledPanel | QFrame::Plain);
+	hamamatsuRingTimer = new QTimer;
+	hamamatsuRingTimer->setInterval(DEVICE_STATUS::DISPLAY_PERIOD);
+
 	hamamatsuOrientationBox = new QComboBox;
 	hamamatsuOrientationBox->setMaximumWidth(130);
 	hamamatsuOrientationBox->setMinimumWidth(125);
@@ -102,12 +195,20 @@ void ControlPanel::CreateLayout()
 	hamamatsuCaptureModeBox = new QComboBox;
 	hamamatsuCaptureModeBox->setMaximumWidth(130);
 	hamamatsuCaptureModeBox->setMinimumWidth(125);
+	hamamatsuPixelEncodingBox = new QComboBox;
+	hamamatsuPixelEncodingBox->setMaximumWidth(130);
+	hamamatsuPixelEncodingBox->setMinimumWidth(125);
+	hamamatsuPixelEncodingBox->setToolTip("12 bits packed transfers 2 pixels in 3 bytes, they are unpacked only for display and processing");
 	hamamatsuExternalTriggerPositiveButton = new QRadioButton( tr("Pos") );
 	hamamatsuExternalTriggerNegativeButton = new QRadioButton( tr("Neg") );
 
 	//Hamamatsu fov setting
 	hamamatsuImageSizeBox = new QComboBox;
 	hamamatsuImageSizeApplyButton = new QPushButton("Apply");
+	hamamatsuFocusRegionFovButton = new QPushButton("Focus Region");
+	hamamatsuBinningBox = new QComboBox;
+	hamamatsuBinningBox->setMaximumWidth(85);
+	hamamatsuBinningBox->setMinimumWidth(80);
 	hamamatsuFovWidth = new QLineEdit;
 	hamamatsuFovHeight = new QLineEdit;
 	hamamatsuFovXOffset = new QLineEdit;
@@ -116,12 +217,14 @@ void ControlPanel::CreateLayout()
 	hamamatsuImageSizeBox->setMaximumWidth(160);
 	hamamatsuImageSizeApplyButton->setMinimumWidth(120);
 	hamamatsuImageSizeApplyButton->setMaximumWidth(130);
+	hamamatsuFocusRegionFovButton->setToolTip("Read out the focus region only (ctrl + drag in the image)");
 
 	QGroupBox* hamamatsuFovSettingBox = new QGroupBox( tr("FOV Setting") );
 	QHBoxLayout* hamamatsuImageSizeLayout = new QHBoxLayout;
 	hamamatsuImageSizeLayout->addWidget( new QLabel("Image Area") );
 	hamamatsuImageSizeLayout->addWidget( hamamatsuImageSizeBox );
 	hamamatsuImageSizeLayout->addWidget( hamamatsuImageSizeApplyButton );
+	hamamatsuImageSizeLayout->addWidget( hamamatsuFocusRegionFovButton );
 
 	QGridLayout* hamamatsuImageSizeSettingLayout = new QGridLayout;
 	hamamatsuImageSizeSettingLayout->addWidget( new QLabel("X Offset"), 0, 0 );
@@ -132,13 +235,16 @@ void ControlPanel::CreateLayout()
 	hamamatsuImageSizeSettingLayout->addWidget( hamamatsuFovWidth, 1, 1 );
 	hamamatsuImageSizeSettingLayout->addWidget( new QLabel("Height"), 1, 2 );
 	hamamatsuImageSizeSettingLayout->addWidget( hamamatsuFovHeight, 1, 3 );
+	hamamatsuImageSizeSettingLayout->addWidget( new QLabel("Binning"), 2, 0 );
+	hamamatsuImageSizeSettingLayout->addWidget( hamamatsuBinningBox, 2, 1 );
 
 	QVBoxLayout* hamamatsuFovSettingLayout = new QVBoxLayout;
 	hamamatsuFovSettingLayout->addLayout(hamamatsuImageSizeLayout);
 	hamamatsuFovSettingLayout->addLayout(hamamatsuImageSizeSettingLayout);
 	hamamatsuFovSettingBox->setLayout(hamamatsuFovSettingLayout);
 
-	//Set hamamatsu frame rate setting be disabled
+	//the frame rate is set with the internal trigger only
+	hamamatsuFrameRateEdit->setText("0");
 	hamamatsuFrameRateEdit->setEnabled(false);
 	hamamatsuFrameRateRangeLabel->setEnabled(false);
 
@@ -154,6 +260,17 @@ void ControlPanel::CreateLayout()
 	hamamatsuFrameRateLayout->addWidget(hamamatsuFrameRateEdit);
 	hamamatsuFrameRateLayout->addWidget(hamamatsuFrameRateRangeLabel);
 
+	//Hamamatsu driver ring layout
+	QHBoxLayout* hamamatsuDriverRingLayout = new QHBoxLayout;
+	hamamatsuDriverRingLayout->addWidget(new QLabel(tr("Driver Frames")));
+	hamamatsuDriverRingLayout->addWidget(hamamatsuDriverFramesEdit);
+	hamamatsuDriverRingLayout->addWidget(hamamatsuDriverRingLabel);
+
+	QHBoxLayout* hamamatsuLiveRateLayout = new QHBoxLayout;
+	hamamatsuLiveRateLayout->addWidget(new QLabel(tr("Frame Handling")));
+	hamamatsuLiveRateLayout->addWidget(hamamatsuLiveRateLabel);
+	hamamatsuLiveRateLayout->addStretch();
+
 	QHBoxLayout* hamamatsuHLayout1 = new QHBoxLayout;
 	hamamatsuHLayout1->addWidget( new QLabel( tr("Orientation ") ) );
 	hamamatsuHLayout1->addWidget( hamamatsuOrientationBox );
@@ -161,6 +278,11 @@ void ControlPanel::CreateLayout()
 	hamamatsuHLayout1->addWidget( hamamatsuDataMapBox );
 	hamamatsuHLayout1->addStretch();
 
+	QHBoxLayout* hamamatsuPixelEncodingLayout = new QHBoxLayout;
+	hamamatsuPixelEncodingLayout->addWidget( new QLabel( tr("Pixel Encoding") ) );
+	hamamatsuPixelEncodingLayout->addWidget( hamamatsuPixelEncodingBox );
+	hamamatsuPixelEncodingLayout->addStretch();
+
 	QHBoxLayout* hamamatsuCaptureModeLayout = new QHBoxLayout;
 	hamamatsuCaptureModeLayout->addWidget( new QLabel(tr("Trigger Mode")) );
 	hamamatsuCaptureModeLayout->addWidget( hamamatsuCaptureModeBox );
@@ -174,12 +296,30 @@ void ControlPanel::CreateLayout()
     hamamatsuCompositeChannelsButton = new QRadioButton (tr("Multi Channel"));
     hamamatsuImagingChannelsSeqBox = new QComboBox;
 	hamamatsuAdjustImagingChannel = new QPushButton("Adjust Channel Offset");
+	hamamatsuExcitationCheck = new QCheckBox(tr("Excitation Sequencer"));
+	hamamatsuExcitationLabel = new QLabel(tr("Max rate: -"));
+	hamamatsuRatioImagingCheck = new QCheckBox(tr("G/R Ratio"));
+	hamamatsuGCaMPBackgroundEdit = new QLineEdit("0");
+	hamamatsuGCaMPBackgroundEdit->setMaximumWidth(50);
+	hamamatsuRFPBackgroundEdit = new QLineEdit("0");
+	hamamatsuRFPBackgroundEdit->setMaximumWidth(50);
+	hamamatsuMotionCorrectionCheck = new QCheckBox(tr("Motion Correction"));
+	hamamatsuMotionShiftLabel = new QLabel(tr("Shift: -"));
+	hamamatsuTrackingCheck = new QCheckBox(tr("Tracking"));
+	hamamatsuTrackingLabel = new QLabel(tr("Target: -"));
+	hamamatsuRatioRecordButton = new QPushButton(tr("Record Analysis"));
+	hamamatsuRatioRecordButton->setCheckable(true);
+	hamamatsuRatioRecordButton->setEnabled(false);
+	hamamatsuRatioValueLabel = new QLabel(tr("Ratio: -"));
 
 	//Hamamatsu control layout
 	QVBoxLayout* hamamatsuLayout = new QVBoxLayout;
 	hamamatsuLayout->addLayout(hamamatsuFrameRateLayout);
 	hamamatsuLayout->addLayout(hamamatsuExposreTimeLayout);
+	hamamatsuLayout->addLayout(hamamatsuDriverRingLayout);
+	hamamatsuLayout->addLayout(hamamatsuLiveRateLayout);
 	hamamatsuLayout->addLayout(hamamatsuHLayout1);
+	hamamatsuLayout->addLayout(hamamatsuPixelEncodingLayout);
 	hamamatsuLayout->addLayout(hamamatsuCaptureModeLayout);
 	hamamatsuLayout->setSpacing(5);
 	hamamatsuLayout->addStretch();
@@ -205,16 +345,46 @@ void ControlPanel::CreateLayout()
 
 	QHBoxLayout* hamamatsuAdjustImagingChannelLayout = new QHBoxLayout;
 	hamamatsuAdjustImagingChannelLayout->addWidget(hamamatsuAdjustImagingChannel);
+	hamamatsuAdjustImagingChannelLayout->addWidget(hamamatsuExcitationCheck);
+	hamamatsuAdjustImagingChannelLayout->addWidget(hamamatsuExcitationLabel);
 	hamamatsuAdjustImagingChannelLayout->addStretch();
 
+	QHBoxLayout* hamamatsuMotionCorrectionLayout = new QHBoxLayout;
+	hamamatsuMotionCorrectionLayout->addWidget(hamamatsuMotionCorrectionCheck);
+	hamamatsuMotionCorrectionLayout->addWidget(hamamatsuMotionShiftLabel);
+	hamamatsuMotionCorrectionLayout->addStretch();
+
+	QHBoxLayout* hamamatsuTrackingLayout = new QHBoxLayout;
+	hamamatsuTrackingLayout->addWidget(hamamatsuTrackingCheck);
+	hamamatsuTrackingLayout->addWidget(hamamatsuTrackingLabel);
+	hamamatsuTrackingLayout->addStretch();
+
+	QHBoxLayout* hamamatsuRatioImagingLayout = new QHBoxLayout;
+	hamamatsuRatioImagingLayout->addWidget(hamamatsuRatioImagingCheck);
+	hamamatsuRatioImagingLayout->addWidget(new QLabel(tr("Background G")));
+	hamamatsuRatioImagingLayout->addWidget(hamamatsuGCaMPBackgroundEdit);
+	hamamatsuRatioImagingLayout->addWidget(new QLabel(tr("R")));
+	hamamatsuRatioImagingLayout->addWidget(hamamatsuRFPBackgroundEdit);
+	hamamatsuRatioImagingLayout->addStretch();
+
+	QHBoxLayout* hamamatsuRatioRecordLayout = new QHBoxLayout;
+	hamamatsuRatioRecordLayout->addWidget(hamamatsuRatioRecordButton);
+	hamamatsuRatioRecordLayout->addWidget(hamamatsuRatioValueLabel);
+	hamamatsuRatioRecordLayout->addStretch();
+
 	QVBoxLayout* hamamatsuImagingChannelMainLayout = new QVBoxLayout;
 	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuImagingChannelSeqLayout);
 	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuAdjustImagingChannelLayout);
+	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuMotionCorrectionLayout);
+	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuTrackingLayout);
+	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuRatioImagingLayout);
+	hamamatsuImagingChannelMainLayout->addLayout(hamamatsuRatioRecordLayout);
 
 	hamamatsuImagingChannelSeqBox->setLayout(hamamatsuImagingChannelMainLayout);
 
 	//connect signals to the slots
 	QObject::connect( hamamatsuExposureTimeEdit, SIGNAL(editingFinished()), this, SLOT(On_HamamatsuExposureTimeEdit()) );
+	QObject::connect( hamamatsuFrameRateEdit, SIGNAL(editingFinished()), this, SLOT(On_HamamatsuFrameRateEdit()) );
 	QObject::connect( hamamatsuOrientationBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuOrientationBox()) );
 	QObject::connect( hamamatsuDataMapBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuDataMapBox()) );
 	QObject::connect( hamamatsuCaptureModeBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuCaptureModeBox()) );
@@ -222,17 +392,36 @@ void ControlPanel::CreateLayout()
 	QObject::connect( hamamatsuExternalTriggerNegativeButton, SIGNAL( pressed() ), this, SLOT(On_HamamatsuExternalTriggerOptionButton()) );
 	QObject::connect( hamamatsuSaveImagesButton, SIGNAL( pressed() ), this, SLOT(On_HamamatsuSaveImagesButton()) );
 	QObject::connect( hamamatsuSaveOneImageButton, SIGNAL( pressed() ), this, SLOT(On_HamamatsuSaveOneImageButton()) );
+	QObject::connect( hamamatsuImageSizeBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuImageSizeBox()) );
+	QObject::connect( hamamatsuImageSizeApplyButton, SIGNAL( pressed() ), this, SLOT(On_HamamatsuFovChanged()) );
+	QObject::connect( hamamatsuFocusRegionFovButton, SIGNAL( pressed() ), this, SLOT(On_HamamatsuFocusRegionFov()) );
+	QObject::connect( hamamatsuBinningBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuBinningBox()) );
+	QObject::connect( hamamatsuPixelEncodingBox, SIGNAL( activated(int) ), this, SLOT(On_HamamatsuPixelEncodingBox()) );
+	QObject::connect( hamamatsuDriverFramesEdit, SIGNAL(editingFinished()), this, SLOT(On_HamamatsuDriverFramesEdit()) );
+	QObject::connect( hamamatsuRingTimer, SIGNAL(timeout()), this, SLOT(On_HamamatsuRefreshRingStatus()) );
 
 	QObject::connect( hamamatsuSingleChannelButton, SIGNAL(clicked()), this, SLOT( On_HamamatsuImagingChannelChanged() ) );
 	QObject::connect( hamamatsuCompositeChannelsButton, SIGNAL(clicked()), this, SLOT( On_HamamatsuImagingChannelChanged() ) );
 	QObject::connect( hamamatsuImagingChannelsSeqBox, SIGNAL( activated(int) ), this, SLOT( On_HamamatsuImagingChannelSeqBox() ) );
 	QObject::connect( hamamatsuAdjustImagingChannel, SIGNAL(pressed()), this, SLOT( On_HamamatsuAdjustImagingChannel() ) );
+	QObject::connect( hamamatsuRatioImagingCheck, SIGNAL(clicked()), this, SLOT( On_HamamatsuRatioImaging() ) );
+	QObject::connect( hamamatsuGCaMPBackgroundEdit, SIGNAL(editingFinished()), this, SLOT( On_HamamatsuRatioBackgroundEdit() ) );
+	QObject::connect( hamamatsuRFPBackgroundEdit, SIGNAL(editingFinished()), this, SLOT( On_HamamatsuRatioBackgroundEdit() ) );
+	QObject::connect( hamamatsuRatioRecordButton, SIGNAL(clicked()), this, SLOT( On_HamamatsuRatioRecordButton() ) );
+	QObject::connect( ratioImagingThread, SIGNAL(RatioValuesSignal(unsigned long, QVector<double>)), this, SLOT( ShowRatioValues(unsigned long, QVector<double>) ), Qt::QueuedConnection );
+	QObject::connect( hamamatsuMotionCorrectionCheck, SIGNAL(clicked()), this, SLOT( On_HamamatsuMotionCorrection() ) );
+	QObject::connect( motionCorrectionThread, SIGNAL(ShiftSignal(double, double, double)), this, SLOT( ShowMotionShift(double, double, double) ), Qt::QueuedConnection );
+	QObject::connect( hamamatsuTrackingCheck, SIGNAL(clicked()), this, SLOT( On_HamamatsuTracking() ) );
+	QObject::connect( hamamatsuExcitationCheck, SIGNAL(clicked()), this, SLOT( On_HamamatsuExcitationSequencer() ) );
+	QObject::connect( objectTrackingThread, SIGNAL(TrackingSignal(double, double, double)), this, SLOT( ShowTracking(double, double, double) ), Qt::QueuedConnection );
 
 	//Fill some boxes
 	FillHamamatsuOrientationBox();
 	FillHamamatsuDataMapBox();
 	FillHamamatsuCaptureModeBox();
 	FillHamamatsuImageSizeBox();
+	FillHamamatsuBinningBox();
+	FillHamamatsuPixelEncodingBox();
 	FillHamamatsuImageChannelsSeqBox();
 
 	FillLaserModeBox(laser488ModeBox);
@@ -471,10 +660,25 @@ QGroupBox* ControlPanel::Create_Z1Setting_Layout()
 	z1_StepEdit = new QLineEdit;
 	z1_UpButton = new QPushButton(tr("Move Up"));
 	z1_DownButton = new QPushButton(tr("Move Down"));
+	z1_WithZ3Check = new QCheckBox(tr("With Z3"));
 	z1_CurrentPositionButton = new QPushButton("Current Position");
 	z1_StopButton = new QPushButton(tr("Stop"));
 	z1_ReturnOrigin = new QPushButton(tr("Return Origin"));
 	z1_RefPointButton = new QPushButton("Go Ref Position");
+	z1_AutoFocusButton = new QPushButton(tr("Auto Focus"));
+	z1_FocusMetricBox = new QComboBox;
+	z1_FocusMetricBox->addItem("Brenner Gradient");
+	z1_FocusMetricBox->addItem("Laplacian Variance");
+	z1_FocusLockCheck = new QCheckBox(tr("Focus Lock"));
+	z1_FocusLockLabel = new QLabel(tr("Focus: -"));
+	z1_ZStackButton = new QPushButton(tr("Z Stack"));
+	z1_ZStackPlanesBox = new QSpinBox;
+	z1_ZStackPlanesBox->setRange(1, ZSTACK::MAX_PLANES);
+	z1_ZStackPlanesBox->setValue(21);
+	z1_ZStackStepEdit = new QLineEdit("1");
+	z1_ZStackStepEdit->setMaximumWidth(60);
+	z1_VolumeCheck = new QCheckBox(tr("Volumes"));
+	z1_VolumeLabel = new QLabel(tr("Volume: -"));
 
 	z1_UpButton->setFont(font);
 	z1_UpButton->setStyleSheet("color:blue");
@@ -492,6 +696,12 @@ QGroupBox* ControlPanel::Create_Z1Setting_Layout()
 	z1_ReturnOrigin->setFont(font);
 	z1_RefPointButton->setStyleSheet("color: #ff008f");
 	z1_RefPointButton->setFont(font);
+	z1_AutoFocusButton->setMinimumHeight(35);
+	z1_AutoFocusButton->setStyleSheet("color: darkGreen");
+	z1_AutoFocusButton->setFont(font);
+	z1_ZStackButton->setMinimumHeight(35);
+	z1_ZStackButton->setStyleSheet("color: darkGreen");
+	z1_ZStackButton->setFont(font);
 
 	QObject::connect( z1_StepEdit, SIGNAL(returnPressed()), this, SLOT( On_Z1StepChanged() ));
 	QObject::connect( z1_CurrentPositionButton, SIGNAL(pressed()), this, SLOT(On_Z1CurrentPositionButton() ));
@@ -500,6 +710,10 @@ QGroupBox* ControlPanel::Create_Z1Setting_Layout()
 	QObject::connect( z1_StopButton, SIGNAL(pressed()), this, SLOT( On_Z1StopButton() ));
 	QObject::connect( z1_ReturnOrigin, SIGNAL(pressed()), this, SLOT( On_Z1ReturnOrigin() ));
 	QObject::connect( z1_RefPointButton, SIGNAL(pressed()), this, SLOT( On_Z1RefPointButton() ));
+	QObject::connect( z1_AutoFocusButton, SIGNAL(pressed()), this, SLOT( On_Z1AutoFocusButton() ));
+	QObject::connect( z1_FocusLockCheck, SIGNAL(clicked()), this, SLOT( On_Z1FocusLock() ));
+	QObject::connect( z1_ZStackButton, SIGNAL(pressed()), this, SLOT( On_Z1ZStackButton() ));
+	QObject::connect( z1_VolumeCheck, SIGNAL(clicked()), this, SLOT( On_Z1VolumeCheck() ));
 
 	//z1 initial control
 	QGroupBox* z1ControlBox = new QGroupBox(tr("Z1 Stage Control"));
@@ -508,6 +722,7 @@ QGroupBox* ControlPanel::Create_Z1Setting_Layout()
 	QHBoxLayout* z1MoveButtonsLayout = new QHBoxLayout;
 	z1MoveButtonsLayout->addWidget(z1_UpButton);
 	z1MoveButtonsLayout->addWidget(z1_DownButton);
+	z1MoveButtonsLayout->addWidget(z1_WithZ3Check);
 	z1MoveButtonsLayout->setSpacing(20);
 
 	QHBoxLayout* z1StepLayout = new QHBoxLayout;
@@ -524,9 +739,36 @@ QGroupBox* ControlPanel::Create_Z1Setting_Layout()
 	z1ControlButtonsLayout->addWidget(z1_RefPointButton);
 	z1ControlButtonsLayout->setSpacing(20);
 
+	QHBoxLayout* z1FocusLayout = new QHBoxLayout;
+	z1FocusLayout->addWidget(z1_AutoFocusButton);
+	z1FocusLayout->addWidget(z1_FocusMetricBox);
+	z1FocusLayout->addWidget(z1_FocusLockCheck);
+	z1FocusLayout->setSpacing(20);
+
+	QHBoxLayout* z1FocusLockLayout = new QHBoxLayout;
+	z1FocusLockLayout->addWidget(z1_FocusLockLabel);
+
+	//planes centered on the current position
+	QHBoxLayout* z1ZStackLayout = new QHBoxLayout;
+	z1ZStackLayout->addWidget(z1_ZStackButton);
+	z1ZStackLayout->addWidget(new QLabel(tr("Planes ")));
+	z1ZStackLayout->addWidget(z1_ZStackPlanesBox);
+	z1ZStackLayout->addWidget(new QLabel(tr("Step ")));
+	z1ZStackLayout->addWidget(z1_ZStackStepEdit);
+	z1ZStackLayout->addWidget(new QLabel("um"));
+	z1ZStackLayout->addWidget(z1_VolumeCheck);
+	z1ZStackLayout->setSpacing(5);
+
+	QHBoxLayout* z1VolumeLayout = new QHBoxLayout;
+	z1VolumeLayout->addWidget(z1_VolumeLabel);
+
 	z1ControlLayout->addLayout(z1MoveButtonsLayout);
 	z1ControlLayout->addLayout(z1StepLayout);
 	z1ControlLayout->addLayout(z1ControlButtonsLayout);	
+	z1ControlLayout->addLayout(z1FocusLayout);
+	z1ControlLayout->addLayout(z1FocusLockLayout);
+	z1ControlLayout->addLayout(z1ZStackLayout);
+	z1ControlLayout->addLayout(z1VolumeLayout);
 	z1ControlLayout->insertSpacing(2, 10);
 	z1ControlLayout->insertSpacing(1, 5);
 	z1ControlBox->setLayout(z1ControlLayout);
@@ -544,6 +786,14 @@ void ControlPanel::InitCamera()
 	hamamatsu_maxExposureTime = 0.0;
 	hamamatsu_minExposureTime = 0.0;
 	hamamatsu_exposureTime = 0.0;
+	hamamatsu_maxFrameRate = 0.0;
+	hamamatsu_minFrameRate = 0.0;
+	hamamatsu_frameRate = 0.0;
+	hamamatsu_imageWidth = HAMAMATSU_PARAMS::FULLIMAGE_WIDTH;
+	hamamatsu_imageHeight = HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT;
+	hamamatsu_imageXOffset = 0;
+	hamamatsu_imageYOffset = 0;
+	UpdateHamamatsuFovSetting();
 	EnableHamamatsuGroup(false);
 	EnableHamamatsuFovCustomGroup(false);
 }
@@ -589,7 +839,11 @@ void ControlPanel::StartSaveImage(int windowFlag)
 		if (HamamatsuStartSaveImage){
 			hamamatsuCamera->Get_ImageSize(size);
 			HamamatsuSaveImageNum = hamamatsuImageSaveWidget->Get_ImageNum();
-			HamamatsuImageBuffers = hamamatsuImageSaveWidget->Allocate(size, USHORT_TYPE);
+			//the packed frames are recorded as they come from the driver, so not binned in software
+			PixelEncodingType encoding = Mono16;
+			hamamatsuCamera->Get_PixelEncoding(encoding);
+			bool packed = (encoding == Mono12Packed && hamamatsuCamera->Get_SoftwareBinning() == 1 && hamamatsuImageSaveWidget->Get_KeepPacked());
+			HamamatsuImageBuffers = hamamatsuImageSaveWidget->Allocate(size, packed ? MONO12P_TYPE : USHORT_TYPE);
 		}
 	}
 }
@@ -671,6 +925,66 @@ void ControlPanel::On_HamamatsuExposureTimeEdit()
 	} catch (QException e){
 		cout<<e.getMessage()<<endl;
 	}
+	Hamamatsu_UpdateFrameRateRange();
+}
+
+//the range is the one of the current exposure and subarray
+void ControlPanel::Hamamatsu_UpdateFrameRateRange()
+{
+	try{
+		if (hamamatsuCamera!=NULL && hamamatsuCamera->IsConnected()){
+			Range range;
+			if (!hamamatsuCamera->Get_FrameRateRange(range)){
+				return;
+			}
+			hamamatsu_maxFrameRate = range.max;
+			hamamatsu_minFrameRate = range.min;
+
+			QString frameRateRange = tr("Min: ") + PrecisionConvert(hamamatsu_minFrameRate) + tr(" Max: ") + PrecisionConvert(hamamatsu_maxFrameRate, 4);
+			hamamatsuFrameRateRangeLabel->setText(frameRateRange);
+			hamamatsuFrameRateRangeLabel->setToolTip(tr("Reached: ") + PrecisionConvert(range.current, 4) + " Hz");
+		}
+	} catch(QException e){
+		cout<<e.getMessage()<<endl;
+	}
+}
+
+/*
+	The camera takes the slowest readout reaching the rate and stretches the frame
+	interval to it, a rate of 0 runs as fast as the exposure and the readout allow.
+	The rate reached is reported, a longer exposure lowers it.
+*/
+void ControlPanel::On_HamamatsuFrameRateEdit()
+{
+	double frameRate = hamamatsuFrameRateEdit->text().toDouble();
+	if (frameRate > 0){
+		frameRate = std::min(std::max(frameRate, hamamatsu_minFrameRate), hamamatsu_maxFrameRate);
+	} else{
+		frameRate = 0;
+	}
+	hamamatsuFrameRateEdit->setText(PrecisionConvert(frameRate, 4));
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || frameRate == hamamatsu_frameRate){
+		return;
+	}
+
+	bool success = false;
+	try{
+		success = hamamatsuCamera->Set_FrameRate(frameRate);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	if (!success){
+		stateBox->append("Frame rate: fail to set the frame rate");
+		hamamatsuFrameRateEdit->setText(PrecisionConvert(hamamatsu_frameRate, 4));
+		return;
+	}
+	hamamatsu_frameRate = frameRate;
+	Hamamatsu_UpdateFrameRateRange();
+
+	double rate = 0, readout = 0;
+	hamamatsuCamera->Get_FrameRate(rate);
+	hamamatsuCamera->Get_ReadoutTime(readout);
+	stateBox->append("Frame rate: " + QString::number(rate, 'f', 1) + " Hz, readout " + QString::number(readout*1.0e3, 'f', 2) + " ms");
 }
 
 void ControlPanel::FillHamamatsuImageSizeBox()
@@ -680,6 +994,22 @@ void ControlPanel::FillHamamatsuImageSizeBox()
 	hamamatsuImageSizeBox->addItem( "Custom" );
 }
 
+void ControlPanel::FillHamamatsuBinningBox()
+{
+	hamamatsuBinningBox->addItem( "1x1", 1 );
+	hamamatsuBinningBox->addItem( "2x2", 2 );
+	hamamatsuBinningBox->addItem( "4x4", 4 );
+	hamamatsuBinningBox->setCurrentIndex(0);
+}
+
+void ControlPanel::FillHamamatsuPixelEncodingBox()
+{
+	hamamatsuPixelEncodingBox->addItem( tr("16 Bits"), (int)Mono16 );
+	hamamatsuPixelEncodingBox->addItem( tr("12 Bits"), (int)Mono12 );
+	hamamatsuPixelEncodingBox->addItem( tr("12 Bits Packed"), (int)Mono12Packed );
+	hamamatsuPixelEncodingBox->setCurrentIndex(0);
+}
+
 void ControlPanel::FillHamamatsuOrientationBox()
 {
 	hamamatsuOrientationBox->addItem( tr("Normal") );
@@ -717,6 +1047,7 @@ void ControlPanel::FillHamamatsuCaptureModeBox()
 	hamamatsuCaptureModeBox->addItem( tr("Internal") );
 	hamamatsuCaptureModeBox->addItem( tr("External Trigger") ); //External Level Trigger
 	hamamatsuCaptureModeBox->addItem( tr("Global Reset") );
+	hamamatsuCaptureModeBox->addItem( tr("External Edge") );
 	//hamamatsuCaptureModeBox->addItem( tr("Synchronous Readout") );
 	hamamatsuCaptureModeBox->setCurrentIndex(0);
 	hamamatsuExternalTriggerPositiveButton->setEnabled(false);
@@ -761,8 +1092,199 @@ void ControlPanel::On_HamamatsuImageSizeBox()
 	}
 }
 
+/*
+	The subarray is changed in place while live, so the field of view is traded for
+	frame rate without restarting the stream. The focus region of the former image
+	does not hold on the new one.
+*/
 void ControlPanel::On_HamamatsuFovChanged()
 {
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+		return;
+	}
+	if (HamamatsuStartSaveImage){
+		stateBox->append("Image area: wait until the images are saved");
+		UpdateHamamatsuFovSetting();
+		return;
+	}
+	if (hamamatsuImageSizeBox->currentText() == "Custom"){
+		hamamatsu_imageWidth = hamamatsuFovWidth->text().toInt();
+		hamamatsu_imageHeight = hamamatsuFovHeight->text().toInt();
+		hamamatsu_imageXOffset = hamamatsuFovXOffset->text().toInt();
+		hamamatsu_imageYOffset = hamamatsuFovYOffset->text().toInt();
+	}
+
+	//snap to the step of the subarray inside the sensor
+	const int step = HAMAMATSU_PARAMS::SUBARRAY_STEP;
+	hamamatsu_imageWidth = std::min(std::max(hamamatsu_imageWidth/step*step, step), HAMAMATSU_PARAMS::FULLIMAGE_WIDTH);
+	hamamatsu_imageHeight = std::min(std::max(hamamatsu_imageHeight/step*step, step), HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT);
+	hamamatsu_imageXOffset = std::min(std::max(hamamatsu_imageXOffset/step*step, 0), HAMAMATSU_PARAMS::FULLIMAGE_WIDTH - hamamatsu_imageWidth);
+	hamamatsu_imageYOffset = std::min(std::max(hamamatsu_imageYOffset/step*step, 0), HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT - hamamatsu_imageHeight);
+
+	bool success = false;
+	long long start = Get_HostTime();
+	try{
+		success = hamamatsuCamera->Set_ImageSize(hamamatsu_imageXOffset, hamamatsu_imageYOffset, hamamatsu_imageWidth, hamamatsu_imageHeight);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	double elapsed = (Get_HostTime()-start)/1.0e3;
+	hamamatsuCamera->Get_SubArray(hamamatsu_imageXOffset, hamamatsu_imageYOffset, hamamatsu_imageWidth, hamamatsu_imageHeight);
+	UpdateHamamatsuFovSetting();
+	if (!success){
+		stateBox->append("Image area: fail to set the subarray");
+		return;
+	}
+
+	ImageSize size;
+	hamamatsuCamera->Get_ImageSize(size);
+	z1_focusRegion.width = 0;
+	z1_focusRegion.height = 0;
+	UpdateZ1FocusImageRegion();
+	emit Hamamatsu_ImageSizeChanged(size.width, size.height);
+	Hamamatsu_UpdateFrameRateRange();
+	stateBox->append("Image area: " + QString::number(hamamatsu_imageWidth) + "x" + QString::number(hamamatsu_imageHeight)
+		+ " at (" + QString::number(hamamatsu_imageXOffset) + ", " + QString::number(hamamatsu_imageYOffset) + "), "
+		+ QString::number(elapsed, 'f', 0) + " ms");
+}
+
+//the focus region is relative to the current subarray, in binned pixels
+void ControlPanel::On_HamamatsuFocusRegionFov()
+{
+	if (z1_focusRegion.width <= 0 || z1_focusRegion.height <= 0){
+		stateBox->append("Image area: ctrl + drag a focus region in the image first");
+		return;
+	}
+	int binning = 1;
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->Get_Binning(binning);
+	}
+	hamamatsu_imageXOffset += z1_focusRegion.x_offset*binning;
+	hamamatsu_imageYOffset += z1_focusRegion.y_offset*binning;
+	hamamatsu_imageWidth = z1_focusRegion.width*binning;
+	hamamatsu_imageHeight = z1_focusRegion.height*binning;
+	UpdateHamamatsuFovSetting();
+	hamamatsuImageSizeBox->setCurrentIndex(hamamatsuImageSizeBox->findText("Custom"));
+	EnableHamamatsuFovCustomGroup(true);
+	On_HamamatsuFovChanged();
+}
+
+/*
+	The binning is changed in place like the subarray. The sensor bins when it can,
+	the acquiring thread bins the rest before the frames are copied, so the display,
+	the processors and the recorder get the smaller frames.
+*/
+void ControlPanel::On_HamamatsuBinningBox()
+{
+	int binning = hamamatsuBinningBox->itemData(hamamatsuBinningBox->currentIndex()).toInt();
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+		return;
+	}
+	if (HamamatsuStartSaveImage){
+		stateBox->append("Binning: wait until the images are saved");
+		hamamatsuCamera->Get_Binning(binning);
+		hamamatsuBinningBox->setCurrentIndex(hamamatsuBinningBox->findData(binning));
+		return;
+	}
+
+	bool success = false;
+	try{
+		success = hamamatsuCamera->Set_Binning(binning);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	if (!success){
+		stateBox->append("Binning: fail to set the binning");
+		hamamatsuCamera->Get_Binning(binning);
+		hamamatsuBinningBox->setCurrentIndex(hamamatsuBinningBox->findData(binning));
+		return;
+	}
+
+	ImageSize size;
+	hamamatsuCamera->Get_ImageSize(size);
+	z1_focusRegion.width = 0;
+	z1_focusRegion.height = 0;
+	UpdateZ1FocusImageRegion();
+	emit Hamamatsu_ImageSizeChanged(size.width, size.height);
+	Hamamatsu_UpdateFrameRateRange();
+	stateBox->append("Binning " + QString::number(binning) + "x" + QString::number(binning)
+		+ (hamamatsuCamera->Get_SoftwareBinning() > 1 ? " in software, " : " on the sensor, ")
+		+ QString::number(size.width) + "x" + QString::number(size.height));
+}
+
+//the frames of the driver are reallocated for the new encoding, the display and the processors still get 16 bits
+void ControlPanel::On_HamamatsuPixelEncodingBox()
+{
+	PixelEncodingType encoding = (PixelEncodingType)hamamatsuPixelEncodingBox->itemData(hamamatsuPixelEncodingBox->currentIndex()).toInt();
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+		return;
+	}
+	if (HamamatsuStartSaveImage){
+		stateBox->append("Pixel encoding: wait until the images are saved");
+		hamamatsuCamera->Get_PixelEncoding(encoding);
+		hamamatsuPixelEncodingBox->setCurrentIndex(std::max(0, hamamatsuPixelEncodingBox->findData((int)encoding)));
+		return;
+	}
+
+	bool success = false;
+	try{
+		success = hamamatsuCamera->Set_PixelEncoding(encoding);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	if (!success){
+		stateBox->append("Pixel encoding: fail to set the pixel encoding");
+		hamamatsuCamera->Get_PixelEncoding(encoding);
+		hamamatsuPixelEncodingBox->setCurrentIndex(std::max(0, hamamatsuPixelEncodingBox->findData((int)encoding)));
+		return;
+	}
+	stateBox->append("Pixel encoding: " + hamamatsuPixelEncodingBox->currentText());
+}
+
+void ControlPanel::On_HamamatsuDriverFramesEdit()
+{
+	int frames = hamamatsuDriverFramesEdit->text().toInt();
+	frames = std::max(0, std::min(frames, HAMAMATSU_PARAMS::MAX_DRIVER_FRAMES));
+	hamamatsuDriverFramesEdit->setText(QString::number(frames));
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+		return;
+	}
+	bool success = false;
+	try{
+		success = hamamatsuCamera->Set_DriverFrames(frames);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	if (!success){
+		stateBox->append("Driver Frames: fail to resize the ring of the driver");
+	}
+}
+
+//the frames waiting in the ring of the driver at the last drain and the frames it overwrote
+void ControlPanel::On_HamamatsuRefreshRingStatus()
+{
+	DriverRingStatus ringStatus;
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->Get_DriverRingStatus(ringStatus)){
+		hamamatsuDriverRingLabel->setStyleSheet("");
+		hamamatsuDriverRingLabel->setText(tr("Ring: -"));
+		hamamatsuLiveRateLabel->setStyleSheet("");
+		hamamatsuLiveRateLabel->setText(tr("Live: -"));
+		return;
+	}
+	hamamatsuDriverRingLabel->setStyleSheet(ringStatus.lostFrames > 0 ? "color:red" : "");
+	hamamatsuDriverRingLabel->setText(tr("Ring: ") + QString::number(ringStatus.frames)
+		+ tr(" Backlog: ") + QString::number(ringStatus.backlog) + "/" + QString::number(ringStatus.maxBacklog)
+		+ tr(" Lost: ") + QString::number(ringStatus.lostFrames));
+
+	//the acquiring thread copies, displays and saves the frames, it has to finish each one within the period
+	if (!hamamatsuCamera->acquireImageThread->IsStreaming() || ringStatus.framePeriod <= 0 || ringStatus.processTime <= 0){
+		hamamatsuLiveRateLabel->setStyleSheet("");
+		hamamatsuLiveRateLabel->setText(tr("Live: -"));
+		return;
+	}
+	hamamatsuLiveRateLabel->setStyleSheet(ringStatus.processTime > ringStatus.framePeriod ? "color:red" : "");
+	hamamatsuLiveRateLabel->setText(tr("Live: ") + QString::number(1.0e6/ringStatus.framePeriod, 'f', 1)
+		+ tr(" Hz Sustained: ") + QString::number(1.0e6/ringStatus.processTime, 'f', 0) + " Hz");
 }
 
 void ControlPanel::On_HamamatsuOrientationBox()
@@ -792,6 +1314,287 @@ void ControlPanel::On_HamamatsuAdjustImagingChannel(){
 	++hamamatsuWindowInfo.channelOffset;
 }
 
+/*
+	Start or stop the online G/R ratio, the ratio thread is registered as
+	a frame processor of the camera while it is checked
+*/
+void ControlPanel::On_HamamatsuRatioImaging(){
+	if (hamamatsuRatioImagingCheck->isChecked()){
+		if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+			hamamatsuRatioImagingCheck->setChecked(false);
+			stateBox->append("Connect Hamamatsu camera before starting ratio imaging");
+			return;
+		}
+		On_HamamatsuRatioBackgroundEdit();
+		ratioImagingThread->StartThread();
+		AttachRatioImaging(true);
+		hamamatsuRatioRecordButton->setEnabled(true);
+		stateBox->append("Start G/R ratio imaging");
+	} else{
+		AttachRatioImaging(false);
+		ratioImagingThread->StopThread();
+		ratioImagingThread->StopRecording();
+		if (!hamamatsuMotionCorrectionCheck->isChecked()){
+			hamamatsuRatioRecordButton->setChecked(false);
+			hamamatsuRatioRecordButton->setEnabled(false);
+		}
+
+		RatioStatistics statistics = ratioImagingThread->Get_Statistics();
+		stateBox->append("Stop G/R ratio imaging: " + QString::number(statistics.pairs) + " pairs, "
+			+ QString::number(statistics.droppedFrames) + " dropped, " + QString::number(statistics.unpairedFrames) + " unpaired, "
+			+ PrecisionConvert(statistics.averageProcessTime) + " ms/pair");
+	}
+}
+
+void ControlPanel::On_HamamatsuRatioBackgroundEdit(){
+	int gcampBackground = hamamatsuGCaMPBackgroundEdit->text().toInt();
+	int rfpBackground = hamamatsuRFPBackgroundEdit->text().toInt();
+	gcampBackground = std::max(0, std::min(gcampBackground, 65535));
+	rfpBackground = std::max(0, std::min(rfpBackground, 65535));
+	hamamatsuGCaMPBackgroundEdit->setText(QString::number(gcampBackground));
+	hamamatsuRFPBackgroundEdit->setText(QString::number(rfpBackground));
+	ratioImagingThread->Set_Background((ushort)gcampBackground, (ushort)rfpBackground);
+}
+
+/*
+	Ratio imaging reads the motion corrected frames while motion correction is on,
+	otherwise the frames of the camera
+*/
+void ControlPanel::AttachRatioImaging(bool attach){
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->RemoveFrameProcessor(ratioImagingThread);
+	}
+	motionCorrectionThread->RemoveFrameProcessor(ratioImagingThread);
+	if (!attach){
+		return;
+	}
+	if (hamamatsuMotionCorrectionCheck->isChecked()){
+		motionCorrectionThread->AddFrameProcessor(ratioImagingThread);
+	} else if (hamamatsuCamera != NULL){
+		hamamatsuCamera->AddFrameProcessor(ratioImagingThread);
+	}
+}
+
+void ControlPanel::On_HamamatsuMotionCorrection(){
+	if (hamamatsuMotionCorrectionCheck->isChecked()){
+		if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+			hamamatsuMotionCorrectionCheck->setChecked(false);
+			stateBox->append("Connect Hamamatsu camera before starting motion correction");
+			return;
+		}
+		motionCorrectionThread->Set_CorrectFrames(true);
+		motionCorrectionThread->StartThread();
+		hamamatsuCamera->AddFrameProcessor(motionCorrectionThread);
+		hamamatsuRatioRecordButton->setEnabled(true);
+		stateBox->append("Start motion correction");
+	} else{
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(motionCorrectionThread);
+		}
+		motionCorrectionThread->StopThread();
+		motionCorrectionThread->StopRecording();
+		if (!hamamatsuRatioImagingCheck->isChecked()){
+			hamamatsuRatioRecordButton->setChecked(false);
+			hamamatsuRatioRecordButton->setEnabled(false);
+		}
+
+		MotionStatistics statistics = motionCorrectionThread->Get_Statistics();
+		stateBox->append("Stop motion correction: " + QString::number(statistics.frames) + " frames, "
+			+ QString::number(statistics.droppedFrames) + " dropped, " + PrecisionConvert(statistics.averageProcessTime) + " ms/frame on "
+			+ QString::number(statistics.workers) + " workers, latency " + PrecisionConvert(statistics.averageLatency) + "/"
+			+ PrecisionConvert(statistics.maxLatency) + " ms (mean/max), frame period " + PrecisionConvert(statistics.framePeriod) + " ms");
+	}
+	if (hamamatsuRatioImagingCheck->isChecked()){
+		AttachRatioImaging(true);
+	}
+}
+
+//record the ratios and the motion shifts of the running analysis into one folder
+void ControlPanel::On_HamamatsuRatioRecordButton(){
+	if (hamamatsuRatioRecordButton->isChecked()){
+		QString folder = QFileDialog::getExistingDirectory(this, tr("Analysis Folder"), "E:\\");
+		if (folder.isEmpty()){
+			hamamatsuRatioRecordButton->setChecked(false);
+			return;
+		}
+		QString prefix = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+		bool ok = true;
+		if (hamamatsuRatioImagingCheck->isChecked()){
+			ok = ratioImagingThread->StartRecording(folder, prefix, true);
+		}
+		if (ok && hamamatsuMotionCorrectionCheck->isChecked()){
+			ok = motionCorrectionThread->StartRecording(folder, prefix);
+		}
+		if (ok && focusLockThread != NULL && z1_FocusLockCheck->isChecked()){
+			ok = focusLockThread->StartRecording(folder, prefix);
+		}
+		if (ok && volumeImagingThread != NULL && z1_VolumeCheck->isChecked()){
+			ok = volumeImagingThread->StartRecording(folder, prefix);
+		}
+		if (!ok){
+			ratioImagingThread->StopRecording();
+			motionCorrectionThread->StopRecording();
+			hamamatsuRatioRecordButton->setChecked(false);
+			return;
+		}
+		stateBox->append("Record analysis into " + folder);
+	} else{
+		ratioImagingThread->StopRecording();
+		motionCorrectionThread->StopRecording();
+		if (focusLockThread != NULL){
+			focusLockThread->StopRecording();
+		}
+		if (volumeImagingThread != NULL){
+			volumeImagingThread->StopRecording();
+		}
+		stateBox->append("Stop recording analysis");
+	}
+}
+
+void ControlPanel::ShowMotionShift(double dx, double dy, double latency){
+	hamamatsuMotionShiftLabel->setText(tr("Shift: ") + PrecisionConvert(dx, 3) + ", " + PrecisionConvert(dy, 3)
+		+ tr(" px, latency ") + PrecisionConvert(latency, 3) + " ms");
+}
+
+/*
+	There is no xy stage in the system yet, so the tracking measures the error of the
+	target and its latency; a stage is attached by Set_StageMotion
+*/
+void ControlPanel::On_HamamatsuTracking(){
+	if (hamamatsuTrackingCheck->isChecked()){
+		if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+			hamamatsuTrackingCheck->setChecked(false);
+			stateBox->append("Connect Hamamatsu camera before starting tracking");
+			return;
+		}
+		objectTrackingThread->StartThread();
+		hamamatsuCamera->AddFrameProcessor(objectTrackingThread);
+		stateBox->append("Start tracking");
+	} else{
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->RemoveFrameProcessor(objectTrackingThread);
+		}
+		objectTrackingThread->StopThread();
+
+		TrackingStatistics statistics = objectTrackingThread->Get_Statistics();
+		stateBox->append("Stop tracking: " + QString::number(statistics.frames) + " frames, "
+			+ QString::number(statistics.droppedFrames) + " dropped, " + QString::number(statistics.lostFrames) + " lost, "
+			+ QString::number(statistics.moves) + " moves, " + PrecisionConvert(statistics.averageProcessTime) + " ms/frame, latency "
+			+ PrecisionConvert(statistics.averageLatency) + "/" + PrecisionConvert(statistics.maxLatency) + " ms (mean/max), "
+			+ QString::number(statistics.lateFrames) + " over the frame period " + PrecisionConvert(statistics.framePeriod) + " ms");
+	}
+}
+
+void ControlPanel::ShowTracking(double dx, double dy, double latency){
+	hamamatsuTrackingLabel->setText(tr("Target: ") + PrecisionConvert(dx, 3) + ", " + PrecisionConvert(dy, 3)
+		+ tr(" px, latency ") + PrecisionConvert(latency, 3) + " ms");
+}
+
+/*
+	The sequencer gates the lasers and triggers the camera through the controller,
+	so the camera waits for external edges. While it runs, the channel of every frame
+	comes from its trigger and the channel offset is not used
+*/
+void ControlPanel::On_HamamatsuExcitationSequencer(){
+	if (!hamamatsuExcitationCheck->isChecked()){
+		if (excitationSequencer != NULL){
+			excitationSequencer->StopSequence();
+		}
+		return;
+	}
+	QString error;
+	if (excitationSequencer == NULL){
+		error = "stage controller no connection";
+	} else if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || hamamatsuWindowInfo.isLive == 0){
+		error = "camera is not live";
+	} else if (hamamatsuCaptureModeBox->currentText() != "External Edge"){
+		error = "the capture mode must be External Edge";
+	} else if (hamamatsuWindowInfo.imagingChannelSeq == SINGLE){
+		error = "select a multi channel sequence";
+	} else if (laser488 == NULL || !laser488->IsConnected() || laser561 == NULL || !laser561->IsConnected()){
+		error = "connect both lasers";
+	}
+	if (!error.isEmpty()){
+		hamamatsuExcitationCheck->setChecked(false);
+		stateBox->append("Excitation sequencer: " + error);
+		return;
+	}
+
+	ExcitationPlan plan;
+	int left, top, width, height;
+	plan.sequence = hamamatsuWindowInfo.imagingChannelSeq;
+	plan.exposure = 0;
+	hamamatsuCamera->Get_ExposureTime(plan.exposure);
+	ImageSize imageSize;
+	imageSize.width = 0;
+	imageSize.height = 0;
+	hamamatsuCamera->Get_ImageSize(imageSize);
+	plan.image_width = imageSize.width;
+	plan.image_height = imageSize.height;
+	//all the rows of the subarray are read out whatever the binning
+	plan.readout = hamamatsuCamera->Get_SubArray(left, top, width, height) ? ExcitationSequencer::Get_ReadoutTime(height) : 0;
+	plan.frames = 0;
+	excitationSequencer->Set_Lasers(laser488, laser561);
+	hamamatsuCamera->Set_ChannelSource(excitationSequencer);
+	hamamatsuCamera->AddFrameProcessor(excitationSequencer);
+	if (!excitationSequencer->StartSequence(plan)){
+		hamamatsuCamera->Set_ChannelSource(NULL);
+		hamamatsuCamera->RemoveFrameProcessor(excitationSequencer);
+		hamamatsuExcitationCheck->setChecked(false);
+		stateBox->append("Excitation sequencer: fail to start");
+		return;
+	}
+	hamamatsuSingleChannelButton->setEnabled(false);
+	hamamatsuCompositeChannelsButton->setEnabled(false);
+	hamamatsuImagingChannelsSeqBox->setEnabled(false);
+	hamamatsuAdjustImagingChannel->setEnabled(false);
+
+	ExcitationTiming timing = ExcitationSequencer::Get_Timing(plan);
+	hamamatsuExcitationLabel->setText(tr("Max rate: ") + PrecisionConvert(timing.frameRate, 1) + " Hz, G "
+		+ PrecisionConvert(timing.gcampRate, 1) + " Hz, R " + PrecisionConvert(timing.rfpRate, 1) + " Hz");
+	stateBox->append("Excitation sequencer: start, period " + PrecisionConvert(timing.period) + " ms, exposure "
+		+ PrecisionConvert(plan.exposure*1.0e3) + " ms, readout " + PrecisionConvert(plan.readout*1.0e3) + " ms");
+}
+
+void ControlPanel::On_ExcitationSequenceFinished(bool success){
+	hamamatsuExcitationCheck->setChecked(false);
+	hamamatsuSingleChannelButton->setEnabled(true);
+	hamamatsuCompositeChannelsButton->setEnabled(true);
+	hamamatsuImagingChannelsSeqBox->setEnabled(hamamatsuCompositeChannelsButton->isChecked());
+	hamamatsuAdjustImagingChannel->setEnabled(true);
+	if (excitationSequencer == NULL){
+		return;
+	}
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->Set_ChannelSource(NULL);
+		hamamatsuCamera->RemoveFrameProcessor(excitationSequencer);
+	}
+
+	ExcitationStatistics statistics = excitationSequencer->Get_Statistics();
+	ExcitationTiming timing = excitationSequencer->Get_RunningTiming();
+	stateBox->append(QString("Stop excitation sequencer") + (success ? "" : " (lasers or controller failed)") + ": "
+		+ QString::number(statistics.triggers) + " triggers, " + QString::number(statistics.frames) + " frames, "
+		+ QString::number(statistics.missedFrames) + " missed, " + QString::number(statistics.unmatchedFrames) + " unmatched, "
+		+ QString::number(statistics.wrongChannels) + " wrong channels, " + QString::number(statistics.lateTriggers) + " late triggers, "
+		+ PrecisionConvert(statistics.frameRate, 1) + "/" + PrecisionConvert(timing.frameRate, 1) + " Hz (achieved/model), controller "
+		+ PrecisionConvert(statistics.commandTime) + " ms, frame delay " + PrecisionConvert(statistics.frameDelay) + " ms");
+}
+
+void ControlPanel::SetRatioRegion(int windowFlag, ImageRegion region){
+	vector<ImageRegion> regions;
+	if (region.width > 0 && region.height > 0){
+		regions.push_back(region);
+	}
+	ratioImagingThread->Set_Regions(regions);
+}
+
+void ControlPanel::ShowRatioValues(unsigned long frame_index, QVector<double> ratios){
+	if (ratios.isEmpty()){
+		return;
+	}
+	hamamatsuRatioValueLabel->setText(tr("Ratio: ") + PrecisionConvert(ratios[0], 3));
+}
+
 void ControlPanel::On_HamamatsuImagingChannelSeqBox(){
 	QString itemText = hamamatsuImagingChannelsSeqBox->currentText();
 	if (itemText == "G1_R1_G1_R1_G1_R1"){
@@ -809,6 +1612,11 @@ void ControlPanel::On_HamamatsuImagingChannelSeqBox(){
 void ControlPanel::On_HamamatsuCaptureModeBox()
 {
 	QString text = hamamatsuCaptureModeBox->currentText();
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected()){
+		return;
+	}
+	//the trigger mode and its polarity reconfigure the stream once, a rejected one restores both
+	hamamatsuCamera->BeginSettings();
 	try{
 		if ( hamamatsuCamera != NULL && hamamatsuCamera->IsConnected() && text.compare("Internal") == 0 ){
 			hamamatsuCamera->Set_TriggerMode("Internal");//DCAM_TRIGMODE_INTERNAL
@@ -816,10 +1624,12 @@ void ControlPanel::On_HamamatsuCaptureModeBox()
 			hamamatsuExternalTriggerNegativeButton->setEnabled(false);
 			EnableHamamatsuExposureTimeGroup(true);
 			Hamamatsu_UpdateExposureTimeRange();
+			EnableHamamatsuFrameRateGroup(true);
 			HAMAMATSU_DISPLAY_INTERVAL = 2;
 		}
 		else if( hamamatsuCamera != NULL && hamamatsuCamera->IsConnected() && text.compare("External Trigger") == 0 ){
 			EnableHamamatsuExposureTimeGroup(false);
+			EnableHamamatsuFrameRateGroup(false);
 			hamamatsuCamera->Set_TriggerMode("External Level");//DCAM_TRIGMODE_LEVEL
 			hamamatsuExternalTriggerPositiveButton->setEnabled(true);
 			hamamatsuExternalTriggerNegativeButton->setEnabled(true);
@@ -829,6 +1639,7 @@ void ControlPanel::On_HamamatsuCaptureModeBox()
 		}
 		else if( hamamatsuCamera != NULL && hamamatsuCamera->IsConnected() && text.compare("Global Reset") == 0 ){
 			EnableHamamatsuExposureTimeGroup(false);
+			EnableHamamatsuFrameRateGroup(false);
 			hamamatsuCamera->Set_TriggerMode("Global Reset");//DCAM_TRIGMODE_LEVEL & 
 			hamamatsuExternalTriggerPositiveButton->setEnabled(true);
 			hamamatsuExternalTriggerNegativeButton->setEnabled(true);
@@ -836,9 +1647,26 @@ void ControlPanel::On_HamamatsuCaptureModeBox()
 			On_HamamatsuExternalTriggerOptionButton();
 			HAMAMATSU_DISPLAY_INTERVAL = 1;
 		}
+		else if( hamamatsuCamera != NULL && hamamatsuCamera->IsConnected() && text.compare("External Edge") == 0 ){
+			hamamatsuCamera->Set_TriggerMode("External Edge");//DCAM_TRIGMODE_EDGE, exposure time set by the camera
+			EnableHamamatsuExposureTimeGroup(true);
+			Hamamatsu_UpdateExposureTimeRange();
+			EnableHamamatsuFrameRateGroup(false);
+			hamamatsuExternalTriggerPositiveButton->setEnabled(true);
+			hamamatsuExternalTriggerNegativeButton->setEnabled(true);
+			hamamatsuExternalTriggerPositiveButton->setChecked(true);
+			On_HamamatsuExternalTriggerOptionButton();
+			HAMAMATSU_DISPLAY_INTERVAL = 1;
+		}
 	} catch(QException e){
 		cout<<e.getMessage()<<endl;
 	}
+	if (!hamamatsuCamera->CommitSettings()){
+		stateBox->append("Trigger mode: fail to set the trigger mode");
+	}
+	if (text.compare("Internal") == 0){
+		Hamamatsu_UpdateFrameRateRange();
+	}
 }
 
 void ControlPanel::On_HamamatsuExternalTriggerOptionButton()
@@ -869,18 +1697,16 @@ void ControlPanel::On_HamamatsuSaveImagesButton()
 void ControlPanel::On_HamamatsuSaveOneImageButton()
 {
 	if (hamamatsuCamera != NULL && hamamatsuCamera->IsConnected()){
-		if (hamamatsuWindowInfo.image_data != NULL){
-			QString fileName = QFileDialog::getSaveFileName(this, tr("Save Image"), "E:\\", tr("Images (*.tif *.tiff)"));
-			if (fileName.isEmpty()){ return; }
-
-			int width = hamamatsuWindowInfo.image_width;
-			int height = hamamatsuWindowInfo.image_height;
-			uchar* data_copy = new uchar[width*height*sizeof(ushort)];
-			CopyData(USHORT_TYPE, (uchar*)hamamatsuWindowInfo.image_data, data_copy, width, height);
-			ImageSaveWidget::SaveOneImage(fileName.toStdString(), data_copy, USHORT_TYPE, width, height);
-
-			delete data_copy;
+		//the frame is snapped at the press into pixels held until it is saved
+		ImageBuffer buffer;
+		vector<ushort> pixels;
+		if (!hamamatsuCamera->Snap(buffer, pixels)){
+			stateBox->append("Hamamatsu Camera: no frame to save");
+			return;
 		}
+		QString fileName = QFileDialog::getSaveFileName(this, tr("Save Image"), "E:\\", tr("Images (*.tif *.tiff)"));
+		if (fileName.isEmpty()){ return; }
+		ImageSaveWidget::SaveOneImage(fileName.toStdString(), buffer.image_data, USHORT_TYPE, buffer.image_width, buffer.image_height);
 	}
 }
 
@@ -889,6 +1715,23 @@ void ControlPanel::CameraConnected(int index)
 	try{
 		if (index == 0){      //Hamamastu camera
 			Hamamatsu_UpdateExposureTimeRange();
+			hamamatsuCamera->Set_PositionSource(z1PositionSampler);
+			if (hamamatsuCamera->Get_SubArray(hamamatsu_imageXOffset, hamamatsu_imageYOffset, hamamatsu_imageWidth, hamamatsu_imageHeight)){
+				UpdateHamamatsuFovSetting();
+			}
+			int binning = 1;
+			hamamatsuCamera->Get_Binning(binning);
+			hamamatsuBinningBox->setCurrentIndex(hamamatsuBinningBox->findData(binning));
+			PixelEncodingType encoding = Mono16;
+			hamamatsuCamera->Get_PixelEncoding(encoding);
+			hamamatsuPixelEncodingBox->setCurrentIndex(std::max(0, hamamatsuPixelEncodingBox->findData((int)encoding)));
+			hamamatsuCamera->Set_DriverFrames(hamamatsuDriverFramesEdit->text().toInt());
+			//a camera just connected runs as fast as it can
+			hamamatsu_frameRate = 0;
+			hamamatsuFrameRateEdit->setText("0");
+			EnableHamamatsuFrameRateGroup(hamamatsuCaptureModeBox->currentText() == "Internal");
+			Hamamatsu_UpdateFrameRateRange();
+			hamamatsuRingTimer->start();
 		}
 		else if(index == 1){//Andor Camera
 		}
@@ -904,28 +1747,95 @@ void ControlPanel::CameraConnected(int index)
 ************************************************************************************************************/
 void ControlPanel::Connect_Controller()
 {
-	try{
-		controller = new Galil("192.168.1.11");
-		controller->timeout_ms = 500;//time out is 500ms
-	}
-	catch (string e){
-		ShowState(e);
-		return;
+	if (controller == NULL){
+		try{
+			ControllerTask(&controller).Execute();
+		}
+		catch (string e){
+			ShowState(e);
+			return;
+		}
 	}
+	//All the stages share one command queue in front of the controller
+	stageQueue = new StageCommandQueue(controller);
+	connect(stageQueue, SIGNAL(CommandFinishedSignal(unsigned long, QString, QString)), this, SLOT(On_StageCommandFinished(unsigned long, QString, QString)), Qt::QueuedConnection );
+	stageQueue->StartThread();
+
 	//Connect the z1 and z3 stages
-	z1_stage = new Z1Stage(controller);
+	z1_stage = new Z1Stage(stageQueue);
 	z1_stage->Connect();
+	z3_stage = new Z3Stage(stageQueue);
+	try{
+		z3_stage->Connect();
+	} catch (QException e){
+		ShowState(e.getMessage());
+	}
+	//focus changes with z3 move both stages in the motion time of the slower one
+	focusMotion = new CoordinatedMotion(stageQueue);
+	focusMotion->AddAxis(z1_stage, 'Y', Z1_POSITIVE, 1.0/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
+	focusMotion->AddAxis(z3_stage, 'X', Z3_POSITIVE, 1.0);
+	z1_WithZ3Check->setEnabled(z3_stage->IsConnected());
 	z1MotionThread = new MotionThread(z1_stage); //create motion thread
 	connect(z1MotionThread, SIGNAL(FinishMotion()), this, SLOT(On_Z1MotionFinish()) );
+	autoFocusThread = new AutoFocusThread(z1_stage);
+	connect(autoFocusThread, SIGNAL(FocusFinishedSignal(bool, double, double)), this, SLOT(On_Z1AutoFocusFinish(bool, double, double)), Qt::QueuedConnection );
+	focusLockThread = new FocusLockThread(z1_stage);
+	connect(focusLockThread, SIGNAL(FocusLockSignal(double, double, double)), this, SLOT(ShowFocusLock(double, double, double)), Qt::QueuedConnection );
+	connect(focusLockThread, SIGNAL(FocusLostSignal()), this, SLOT(On_Z1FocusLost()), Qt::QueuedConnection );
+	zStackThread = new ZStackThread(z1_stage, stageQueue); //the trigger output shares the queue with the stages
+	connect(zStackThread, SIGNAL(ZStackFinishedSignal(bool, int, double)), this, SLOT(On_Z1ZStackFinish(bool, int, double)), Qt::QueuedConnection );
+	excitationSequencer = new ExcitationSequencer(stageQueue); //the gates and the trigger share the queue with the stages
+	connect(excitationSequencer, SIGNAL(SequenceFinishedSignal(bool)), this, SLOT(On_ExcitationSequenceFinished(bool)), Qt::QueuedConnection );
+	volumeImagingThread = new VolumeImagingThread(z1_stage);
+	connect(volumeImagingThread, SIGNAL(VolumeReadySignal(unsigned long, double, double)), this, SLOT(ShowVolume(unsigned long, double, double)), Qt::QueuedConnection );
+	connect(volumeImagingThread, SIGNAL(VolumeFinishedSignal(unsigned long)), this, SLOT(On_Z1VolumeFinish(unsigned long)), Qt::QueuedConnection );
+
+	//stream the z1 position for the frames
+	z1PositionSampler = new StagePositionSampler(stageQueue, 'Y');
+	z1PositionSampler->StartSampling();
+	deviceStatusPoller->Set_PositionSampler(z1PositionSampler);
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->Set_PositionSource(z1PositionSampler);
+	}
 }
 
 //Disconnect the stage controller
 void ControlPanel::Disconect_Controller()
 {
+	if (excitationSequencer != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->Set_ChannelSource(NULL);
+			hamamatsuCamera->RemoveFrameProcessor(excitationSequencer);
+		}
+		delete excitationSequencer;
+		excitationSequencer = NULL;
+	}
+	if (z1PositionSampler != NULL){
+		if (hamamatsuCamera != NULL){
+			hamamatsuCamera->Set_PositionSource(NULL);
+		}
+		if (deviceStatusPoller != NULL){
+			deviceStatusPoller->Set_PositionSampler(NULL);
+		}
+		delete z1PositionSampler;
+		z1PositionSampler = NULL;
+	}
+	if (focusMotion != NULL){
+		delete focusMotion;
+		focusMotion = NULL;
+	}
+	if (z3_stage != NULL){
+		delete z3_stage;
+		z3_stage = NULL;
+	}
 	if (z1_stage != NULL){
 		delete z1_stage;
 		z1_stage = NULL;
 	}
+	if (stageQueue != NULL){
+		delete stageQueue;
+		stageQueue = NULL;
+	}
 	if (controller != NULL){
 		delete controller;
 		controller = NULL;
@@ -935,11 +1845,21 @@ void ControlPanel::Disconect_Controller()
 /********************************** Z1 Axis **********************************/
 void ControlPanel::On_Z1MotionFinish()
 {
+	Z1MotionButtonsEnabled(true);
 	if (z1MotionThread->getMethod() == RETURN_ORIGIN){
-		Sleep(500);//wait for setting current position to be 0
-		z1_stage->Set_CurrentPosition(0);
+		if (!z1MotionThread->getResult()){
+			stateBox->append("Z1 return origin: stopped");
+			return;
+		}
+		HomingStatistics homing = z1_stage->Get_HomingStatistics();
+		QString str = QString("Z1 return origin: finish in %1 ms (fast jog %2 ms)").arg(homing.lastTime, 0, 'f', 0).arg(homing.fastTime, 0, 'f', 0);
+		if (homing.comparisons > 0){
+			str += QString(", origin deviation %1 pulse, rms %2, max %3 over %4 homings").arg(homing.lastDeviation, 0, 'f', 1)
+				.arg(homing.rmsDeviation, 0, 'f', 2).arg(homing.maxDeviation, 0, 'f', 1).arg(homing.comparisons);
+		}
+		stateBox->append(str);
+		return;
 	}
-	Z1MotionButtonsEnabled(true);
 	stateBox->append(z1MotionThread->getDescription());
 }
 
@@ -949,7 +1869,26 @@ void ControlPanel::On_Z1CurrentPositionButton()
 		stateBox->setText(tr("Get current position: z3 stage no connection"));
 		return;
 	}
-	double position = z1_stage->Get_CurrentPosition();
+	//the position sampled for the poller is shown at once, otherwise the query is
+	//answered in On_StageCommandFinished, the GUI does not wait for the controller
+	StageStatusEntry entry;
+	if (deviceStatusPoller->Get_StageStatus(entry) && entry.valid){
+		stateBox->append("Current position: "+QString::number(entry.position*Z1_STAGE::Z1_PRECISION)+"um ("+ QString::number(entry.position) +" pulse)");
+		return;
+	}
+	z1_positionQueryId = stageQueue->Post("MG _TPY");
+}
+
+void ControlPanel::On_StageCommandFinished(unsigned long id, QString response, QString error)
+{
+	if (id != z1_positionQueryId){
+		return;
+	}
+	if (!error.isEmpty()){
+		stateBox->append("Get current position: " + error);
+		return;
+	}
+	double position = response.toDouble();
 	stateBox->append("Current position: "+QString::number(position*Z1_STAGE::Z1_PRECISION)+"um ("+ QString::number(position) +" pulse)");
 }
 
@@ -959,6 +1898,26 @@ void ControlPanel::Z1MotionButtonsEnabled( bool ok)
 	z1_DownButton->setEnabled(ok);
 	//z1_ReturnOrigin->setEnabled(ok);
 	z1_RefPointButton->setEnabled(ok);
+	z1_AutoFocusButton->setEnabled(ok);
+	z1_ZStackButton->setEnabled(ok);
+}
+
+//with z3, both stages follow one coordinated motion, z3 by the same distance in um
+void ControlPanel::StartZ1Motion(double distance, QString description)
+{
+	Z1MotionButtonsEnabled(false);
+	if (z1_WithZ3Check->isChecked() && focusMotion != NULL && z3_stage->IsConnected()){
+		vector<double> distances(2);
+		distances[0] = distance;
+		distances[1] = distance*Z1_STAGE::Z1_PRECISION/Z3_STAGE::Z3_PRECISION;
+		z1MotionThread->setMethod(FOCUS_MOTION);
+		z1MotionThread->setFocusMotion(focusMotion, distances);
+	} else{
+		z1MotionThread->setMethod(MOTION);
+		z1MotionThread->setDistance(distance);
+	}
+	z1MotionThread->setDescription(description);
+	z1MotionThread->start();
 }
 
 void ControlPanel::On_Z1MoveUpButton()
@@ -971,11 +1930,7 @@ void ControlPanel::On_Z1MoveUpButton()
 	try{
 		if (STOP_LIMIT){
 			stateBox->setText("Z1 move up: start");
-			Z1MotionButtonsEnabled(false);
-			z1MotionThread->setMethod(MOTION);
-			z1MotionThread->setDistance(z1_step*Z_POSITIVE);
-			z1MotionThread->setDescription( tr("Z1 move up: finish") );
-			z1MotionThread->start();
+			StartZ1Motion(z1_step*Z_POSITIVE, tr("Z1 move up: finish"));
 		}
 		else{
 			double current_position = z1_stage->Get_CurrentPosition();
@@ -985,11 +1940,7 @@ void ControlPanel::On_Z1MoveUpButton()
 			}
 			else{
 				stateBox->setText("Z1 move up: start");
-				Z1MotionButtonsEnabled(false);
-				z1MotionThread->setMethod(MOTION);
-				z1MotionThread->setDistance(z1_step*Z_POSITIVE);
-				z1MotionThread->setDescription( tr("Z1 move up: finish") );
-				z1MotionThread->start();
+				StartZ1Motion(z1_step*Z_POSITIVE, tr("Z1 move up: finish"));
 				//z1_stage->Move_Openloop_Unrealtime(z1_step*Z_POSITIVE);//Throw some exception from Galil because of limit
 			}
 		}
@@ -1008,11 +1959,7 @@ void ControlPanel::On_Z1MoveDownButton()
 	}
 	try{
 		stateBox->setText("Z1 move down: start");
-		Z1MotionButtonsEnabled(false);
-		z1MotionThread->setMethod(MOTION);
-		z1MotionThread->setDistance(z1_step*(-Z_POSITIVE));
-		z1MotionThread->setDescription( tr("Z1 move down: finish") );
-		z1MotionThread->start();
+		StartZ1Motion(z1_step*(-Z_POSITIVE), tr("Z1 move down: finish"));
 		//z1_stage->Move_Openloop_Unrealtime(z1_step*(-Z_POSITIVE));//Throw some exception from Galil because of limits
 	}
 	catch (QException e){
@@ -1022,9 +1969,30 @@ void ControlPanel::On_Z1MoveDownButton()
 
 void ControlPanel::On_Z1StopButton()
 {
+	if (autoFocusThread != NULL && autoFocusThread->isRunning()){
+		autoFocusThread->StopFocus();
+	}
+	if (zStackThread != NULL && zStackThread->isRunning()){
+		zStackThread->StopStack();
+	}
+	if (z1_VolumeCheck->isChecked()){
+		z1_VolumeCheck->setChecked(false);
+		On_Z1VolumeCheck();
+	}
+	if (z1_FocusLockCheck->isChecked()){
+		z1_FocusLockCheck->setChecked(false);
+		On_Z1FocusLock();
+	}
 	if (z1_stage != NULL && z1_stage->IsConnected()){
 		z1_stage->Stop();
 	}
+	if (z1MotionThread != NULL && z1MotionThread->isRunning() && z1MotionThread->getMethod() == FOCUS_MOTION){
+		try{
+			focusMotion->Stop();
+		} catch (QException e){
+			stateBox->append(QString::fromStdString(e.getMessage()));
+		}
+	}
 }
 
 //z1 axis moves the origin (bottom limit)
@@ -1090,35 +2058,353 @@ void ControlPanel::On_Z1StepChanged()
 	z1_step = step/Z1_STAGE::Z1_PRECISION;//convert to pulse
 }
 
+void ControlPanel::SetFocusRegion(int windowFlag, ImageRegion region)
+{
+	z1_focusRegion = region;
+	UpdateZ1FocusImageRegion();
+	stateBox->append("Focus region: (" + QString::number(region.x_offset) + ", " + QString::number(region.y_offset)
+		+ ") " + QString::number(region.width) + "x" + QString::number(region.height));
+}
+
+void ControlPanel::UpdateZ1FocusImageRegion()
+{
+	if (autoFocusThread != NULL){
+		autoFocusThread->Set_FocusRegion(z1_focusRegion);
+	}
+	if (focusLockThread != NULL){
+		focusLockThread->Set_FocusRegion(z1_focusRegion);
+	}
+}
+
+//The focus sweep is measured on the RFP frames when the two channels are alternated
+void ControlPanel::On_Z1AutoFocusButton()
+{
+	if (z1_stage == NULL || !z1_stage->IsConnected() || autoFocusThread == NULL){
+		stateBox->setText(tr("Auto focus: z1 stage no connection"));
+		return;
+	}
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || hamamatsuWindowInfo.isLive == 0){
+		stateBox->setText(tr("Auto focus: camera is not live"));
+		return;
+	}
+	if (autoFocusThread->isRunning()){
+		return;
+	}
+
+	UpdateZ1FocusImageRegion();
+	autoFocusThread->Set_FocusMetric((FocusMetric)z1_FocusMetricBox->currentIndex());
+	autoFocusThread->Set_FocusChannel(hamamatsuWindowInfo.imagingChannelSeq == SINGLE ? 0 : RFP_CHANNEL);
+	hamamatsuCamera->AddFrameProcessor(autoFocusThread);
+	Z1MotionButtonsEnabled(false);
+	stateBox->setText("Z1 auto focus: start");
+	autoFocusThread->StartFocus();
+}
+
+void ControlPanel::On_Z1AutoFocusFinish(bool success, double position, double time_ms)
+{
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->RemoveFrameProcessor(autoFocusThread);
+	}
+	Z1MotionButtonsEnabled(true);
+	if (success){
+		stateBox->append("Z1 auto focus: finish at " + QString::number(position*Z1_STAGE::Z1_PRECISION) + "um ("
+			+ QString::number(long(position)) + " pulse), " + QString::number(time_ms) + " ms");
+	} else{
+		stateBox->append("Z1 auto focus: failed after " + QString::number(time_ms) + " ms");
+	}
+}
+
+//Focus lock keeps correcting z in the background, the manual motions are disabled meanwhile
+void ControlPanel::On_Z1FocusLock()
+{
+	if (!z1_FocusLockCheck->isChecked()){
+		if (focusLockThread != NULL){
+			focusLockThread->StopLock();
+			if (hamamatsuCamera != NULL){
+				hamamatsuCamera->RemoveFrameProcessor(focusLockThread);
+			}
+		}
+		Z1MotionButtonsEnabled(true);
+		z1_FocusMetricBox->setEnabled(true);
+		stateBox->append("Z1 focus lock: stop");
+		return;
+	}
+
+	if (z1_stage == NULL || !z1_stage->IsConnected() || focusLockThread == NULL){
+		z1_FocusLockCheck->setChecked(false);
+		stateBox->setText(tr("Focus lock: z1 stage no connection"));
+		return;
+	}
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || hamamatsuWindowInfo.isLive == 0){
+		z1_FocusLockCheck->setChecked(false);
+		stateBox->setText(tr("Focus lock: camera is not live"));
+		return;
+	}
+	if (autoFocusThread != NULL && autoFocusThread->isRunning()){
+		z1_FocusLockCheck->setChecked(false);
+		stateBox->setText(tr("Focus lock: auto focus is running"));
+		return;
+	}
+	if (z1_VolumeCheck->isChecked()){
+		z1_FocusLockCheck->setChecked(false);
+		stateBox->setText(tr("Focus lock: volumes are running"));
+		return;
+	}
+
+	UpdateZ1FocusImageRegion();
+	focusLockThread->Set_FocusMetric((FocusMetric)z1_FocusMetricBox->currentIndex());
+	focusLockThread->Set_FocusChannel(hamamatsuWindowInfo.imagingChannelSeq == SINGLE ? 0 : RFP_CHANNEL);
+	hamamatsuCamera->AddFrameProcessor(focusLockThread);
+	Z1MotionButtonsEnabled(false);
+	z1_FocusMetricBox->setEnabled(false);
+	stateBox->append("Z1 focus lock: start");
+	focusLockThread->StartLock();
+}
+
+void ControlPanel::On_Z1FocusLost()
+{
+	z1_FocusLockCheck->setChecked(false);
+	On_Z1FocusLock();
+	QMessageBox::warning(this, "Warning", "Focus lost: the correction exceeds " + QString::number(FOCUS_LOCK::MAX_EXCURSION) + "um");
+}
+
+//The stack is triggered by the controller output when the camera waits for external edges
+void ControlPanel::On_Z1ZStackButton()
+{
+	if (z1_stage == NULL || !z1_stage->IsConnected() || zStackThread == NULL){
+		stateBox->setText(tr("Z stack: z1 stage no connection"));
+		return;
+	}
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || hamamatsuWindowInfo.isLive == 0){
+		stateBox->setText(tr("Z stack: camera is not live"));
+		return;
+	}
+	if (zStackThread->isRunning() || z1_FocusLockCheck->isChecked() || z1_VolumeCheck->isChecked()
+		|| (autoFocusThread != NULL && autoFocusThread->isRunning())){
+		stateBox->setText(tr("Z stack: z1 stage is busy"));
+		return;
+	}
+	double step = z1_ZStackStepEdit->text().toDouble();
+	if (step <= 0 || step > Z1_STAGE::Z1_MAXSTEP){
+		QMessageBox::critical(this, "Error", "Invalid step, max step = "+QString::number(Z1_STAGE::Z1_MAXSTEP) + "um");
+		return;
+	}
+	QString folder = QFileDialog::getExistingDirectory(this, tr("Z Stack Folder"), "E:\\");
+	if (folder.isEmpty()){
+		return;
+	}
+
+	ZStackPlan plan;
+	plan.planes = z1_ZStackPlanesBox->value();
+	plan.step = step;
+	plan.start = -step*(plan.planes-1)/2;
+	plan.triggered = (hamamatsuCaptureModeBox->currentText() == "External Edge");
+	plan.exposure = 0;
+	hamamatsuCamera->Get_ExposureTime(plan.exposure);
+	ImageSize imageSize;
+	imageSize.width = 0;
+	imageSize.height = 0;
+	hamamatsuCamera->Get_ImageSize(imageSize);
+	plan.image_width = imageSize.width;
+	plan.image_height = imageSize.height;
+	hamamatsuCamera->AddFrameProcessor(zStackThread);
+	if (!zStackThread->StartStack(plan, folder, QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"))){
+		hamamatsuCamera->RemoveFrameProcessor(zStackThread);
+		stateBox->setText(tr("Z stack: fail to start"));
+		return;
+	}
+	Z1MotionButtonsEnabled(false);
+	stateBox->setText("Z1 z stack: start, " + QString::number(plan.planes) + " planes" + (plan.triggered ? ", triggered" : ""));
+}
+
+//Volumes sweep z1 continuously, so they exclude the other z1 motions
+void ControlPanel::On_Z1VolumeCheck()
+{
+	if (!z1_VolumeCheck->isChecked()){
+		if (volumeImagingThread != NULL){
+			volumeImagingThread->StopVolumes();
+		}
+		return;
+	}
+
+	if (z1_stage == NULL || !z1_stage->IsConnected() || volumeImagingThread == NULL){
+		z1_VolumeCheck->setChecked(false);
+		stateBox->setText(tr("Volumes: z1 stage no connection"));
+		return;
+	}
+	if (hamamatsuCamera == NULL || !hamamatsuCamera->IsConnected() || hamamatsuWindowInfo.isLive == 0){
+		z1_VolumeCheck->setChecked(false);
+		stateBox->setText(tr("Volumes: camera is not live"));
+		return;
+	}
+	if (z1_FocusLockCheck->isChecked() || (zStackThread != NULL && zStackThread->isRunning())
+		|| (autoFocusThread != NULL && autoFocusThread->isRunning())){
+		z1_VolumeCheck->setChecked(false);
+		stateBox->setText(tr("Volumes: z1 stage is busy"));
+		return;
+	}
+	double step = z1_ZStackStepEdit->text().toDouble();
+	if (step <= 0 || step > Z1_STAGE::Z1_MAXSTEP){
+		z1_VolumeCheck->setChecked(false);
+		QMessageBox::critical(this, "Error", "Invalid step, max step = "+QString::number(Z1_STAGE::Z1_MAXSTEP) + "um");
+		return;
+	}
+
+	hamamatsuCamera->AddFrameProcessor(volumeImagingThread);
+	if (!volumeImagingThread->StartVolumes(z1_ZStackPlanesBox->value(), step)){
+		hamamatsuCamera->RemoveFrameProcessor(volumeImagingThread);
+		z1_VolumeCheck->setChecked(false);
+		stateBox->setText(tr("Volumes: fail to start"));
+		return;
+	}
+	Z1MotionButtonsEnabled(false);
+	z1_ZStackPlanesBox->setEnabled(false);
+	z1_ZStackStepEdit->setEnabled(false);
+	stateBox->append("Z1 volumes: start, " + QString::number(z1_ZStackPlanesBox->value()) + " planes");
+}
+
+void ControlPanel::On_Z1VolumeFinish(unsigned long volumes)
+{
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->RemoveFrameProcessor(volumeImagingThread);
+	}
+	z1_VolumeCheck->setChecked(false);
+	Z1MotionButtonsEnabled(true);
+	z1_ZStackPlanesBox->setEnabled(true);
+	z1_ZStackStepEdit->setEnabled(true);
+	VolumeStatistics statistics = volumeImagingThread->Get_Statistics();
+	stateBox->append("Z1 volumes: stop, " + QString::number(volumes) + " volumes, " + QString::number(statistics.partialVolumes)
+		+ " partial, " + QString::number(statistics.droppedVolumes) + " dropped, " + QString::number(statistics.unplacedFrames)
+		+ " frames without position");
+}
+
+void ControlPanel::On_Z1ZStackFinish(bool success, int planes, double time_ms)
+{
+	if (hamamatsuCamera != NULL){
+		hamamatsuCamera->RemoveFrameProcessor(zStackThread);
+	}
+	Z1MotionButtonsEnabled(true);
+	if (success){
+		stateBox->append("Z1 z stack: finish, " + QString::number(planes) + " planes in " + QString::number(time_ms) + " ms ("
+			+ QString::number(time_ms/planes) + " ms/plane)");
+	} else{
+		stateBox->append("Z1 z stack: failed after " + QString::number(planes) + " planes, " + QString::number(time_ms) + " ms");
+	}
+}
+
+void ControlPanel::ShowFocusLock(double metric, double offset, double correction)
+{
+	z1_FocusLockLabel->setText(tr("Focus: ") + PrecisionConvert(metric, 0) + tr("  Offset: ") + PrecisionConvert(offset, 2)
+		+ tr(" um  Step: ") + PrecisionConvert(correction, 2) + " um");
+}
+
+void ControlPanel::ShowVolume(unsigned long volume, double rate, double jitter)
+{
+	z1_VolumeLabel->setText(tr("Volume: ") + QString::number(volume) + tr("  Rate: ") + PrecisionConvert(rate, 2)
+		+ tr(" vol/s  Jitter: ") + PrecisionConvert(jitter, 3) + " um");
+}
+
 
 /*********************************************** Motion Thread ***********************************************/
 MotionThread::MotionThread(Stage* stage) : stage(stage)
 {
 	method = MOTION;
 	distance = 0;
+	focusMotion = NULL;
+	result = false;
 }
 
 MotionThread::~MotionThread()
 {
 	stage = NULL;
+	focusMotion = NULL;
 }
 
 void MotionThread::run()
 {
+	result = false;
 	try{
 		if (method == MOTION){
 			stage->Move_Openloop_Unrealtime(distance);
+			result = true;
 		}
 		else if (method == RETURN_ORIGIN){
-			stage->ReturnOrigin();
+			result = stage->ReturnOrigin();
+		}
+		else if (method == FOCUS_MOTION){
+			focusMotion->Move_Unrealtime(focusDistances);
+			result = true;
 		}
 	} catch (QException e){
 		cout<<e.getMessage()<<endl;
 	}
-	if ( method == MOTION || (method == RETURN_ORIGIN) )
+	if ( method == MOTION || (method == RETURN_ORIGIN) || (method == FOCUS_MOTION) )
 		emit FinishMotion();
 }
 
+/*********************************************** Device Tasks ***********************************************/
+void ControllerTask::Run()
+{
+#ifdef USE_STAGE_SIMULATOR
+	result = new SimulatedController;
+#else
+	result = new GalilController("192.168.1.11", 500);//time out is 500ms
+#endif
+}
+
+void ControllerTask::Commit()
+{
+	*controller = result;
+	result = NULL;
+}
+
+void LaserTask::Run()
+{
+	if (operation == LASER_CONNECT){
+#ifdef USE_LASER_SIMULATOR
+		laser->Connect(new SimulatedLaser);
+#else
+		laser->Connect();
+#endif
+		//the laser answers once it settled after the port opened
+		QElapsedTimer timer;
+		timer.start();
+		while (!laser->GetSettings(result)){
+			if (IsCancelled() || timer.elapsed() > (qint64)DEVICE_MANAGER::CONNECT_TIMEOUT){
+				laser->Disconnect();
+				throw string("No answer from the laser");
+			}
+			Sleep(DEVICE_MANAGER::READY_INTERVAL);
+		}
+		return;
+	}
+	for (int i=0; i<DEVICE_MANAGER::COMMAND_RETRIES && !IsCancelled(); ++i){
+		if (operation == LASER_START ? laser->Start() : laser->Stop()){
+			return;
+		}
+		Sleep(DEVICE_MANAGER::RETRY_INTERVAL);
+	}
+	throw string(operation == LASER_START ? "Cannot start the laser" : "Cannot stop the laser");
+}
+
+void LaserTask::Commit()
+{
+	if (operation == LASER_CONNECT && settings != NULL){
+		*settings = result;
+	}
+}
+
+//the caller reported a failure, the laser is left as it was
+void LaserTask::Discard()
+{
+	if (operation == LASER_CONNECT){
+		laser->Disconnect();
+	}
+	else if (operation == LASER_START){
+		laser->Stop();
+	}
+}
+
 /**********************************************************************************************************
 	Laser Control
 ************************************************************************************************************/
@@ -1145,72 +2431,96 @@ void ControlPanel::InitLasers()
 	laser561StopButton->setEnabled(false);
 }
 
+/*
+	The stage controller and the lasers are connected at the same time, so the start
+	lasts as long as the slowest of them. The stages and the laser panels are set up
+	in the GUI thread once every connection ended or timed out.
+*/
+void ControlPanel::BringUpDevices()
+{
+	laser488 = new CLaser();
+	laser488->SetPortName(COM_488);
+	laser488->SetBaudRate(115200);
+	laser561 = new CLaser();
+	laser561->SetPortName(COM_561);
+
+	deviceManager->StartTimeline();
+	vector<DeviceFuture> futures;
+	futures.push_back(deviceManager->Submit("Stage controller", "connect", new ControllerTask(&controller), DEVICE_MANAGER::CONNECT_TIMEOUT));
+	futures.push_back(deviceManager->Submit("488nm laser", "connect", new LaserTask(laser488, LASER_CONNECT, &laser488Settings), DEVICE_MANAGER::CONNECT_TIMEOUT));
+	futures.push_back(deviceManager->Submit("561nm laser", "connect", new LaserTask(laser561, LASER_CONNECT, &laser561Settings), DEVICE_MANAGER::CONNECT_TIMEOUT));
+	deviceManager->WaitAll(futures);
+
+	if (futures[0].IsSuccess()){
+		Connect_Controller();
+	}
+	if (futures[1].IsSuccess()){
+		Laser488Connected();
+	}
+	if (futures[2].IsSuccess()){
+		Laser561Connected();
+	}
+	ShowState(deviceManager->Get_TimelineString());
+}
+
 void ControlPanel::On_LaserStartAll()
 {
-	int success = 0;
+	//the lasers are started at the same time
+	vector<DeviceFuture> futures;
+	vector<string> names;
+	deviceManager->StartTimeline();
 	if (laser488 != NULL && laser488->IsConnected() && laser488StatusInfo == LASER_READY){
-		for (int i=0; i<3; ++i){
-			if (laser488->Start()){
-				++success;
-				break;
-			}
-			else{ Sleep(100); }
-		}
-		if (success == 0){
-			stateBox->append("StartAll: Cannot start 488nm laser");
-		}
+		futures.push_back(deviceManager->Submit("488nm laser", "start", new LaserTask(laser488, LASER_START), DEVICE_MANAGER::COMMAND_TIMEOUT));
+		names.push_back("488nm");
 	}
 	if (laser561 != NULL && laser561->IsConnected() && laser561StatusInfo == LASER_READY){
-		success = 0;
-		for (int i=0; i<3; ++i){
-			if (laser561->Start()){
-				++success;
-				break;
+		futures.push_back(deviceManager->Submit("561nm laser", "start", new LaserTask(laser561, LASER_START), DEVICE_MANAGER::COMMAND_TIMEOUT));
+		names.push_back("561nm");
+	}
+	if (!deviceManager->WaitAll(futures)){
+		for (size_t i=0; i<futures.size(); ++i){
+			if (!futures[i].IsSuccess()){
+				stateBox->append(QString::fromStdString("StartAll: Cannot start " + names[i] + " laser"));
 			}
-			else{ Sleep(100); }
-		}
-		if (success == 0){
-			stateBox->append("StartAll: Cannot start 561nm laser");
 		}
 	}
 }
 
 void ControlPanel::On_LaserStopAll()
 {
-	int success = 0;
+	//the lasers are stopped at the same time
+	vector<DeviceFuture> futures;
+	vector<string> names;
+	deviceManager->StartTimeline();
 	if (laser488 != NULL && laser488->IsConnected() && laser488StatusInfo == LASER_EMMISION){
-		for (int i=0; i<3; ++i){
-			if (laser488->Stop()){
-				++success;
-				break;
-			}
-			else{ Sleep(100); }
-		}
-		if (success == 0){
-			stateBox->append("StartAll: Cannot stop 488nm laser");
-		}
+		futures.push_back(deviceManager->Submit("488nm laser", "stop", new LaserTask(laser488, LASER_STOP), DEVICE_MANAGER::COMMAND_TIMEOUT));
+		names.push_back("488nm");
 	}
 	if (laser561 != NULL && laser561->IsConnected() && laser561StatusInfo == LASER_EMMISION){
-		success = 0;
-		for (int i=0; i<3; ++i){
-			if (laser561->Stop()){
-				++success;
-				break;
+		futures.push_back(deviceManager->Submit("561nm laser", "stop", new LaserTask(laser561, LASER_STOP), DEVICE_MANAGER::COMMAND_TIMEOUT));
+		names.push_back("561nm");
+	}
+	if (!deviceManager->WaitAll(futures)){
+		for (size_t i=0; i<futures.size(); ++i){
+			if (!futures[i].IsSuccess()){
+				stateBox->append(QString::fromStdString("StopAll: Cannot stop " + names[i] + " laser"));
 			}
-			else{ Sleep(100); }
-		}
-		if (success == 0){
-			stateBox->append("StartAll: Cannot stop 561nm laser");
 		}
 	}
 }
 
 //Laser 488 Control
+//the status is read from the poller, the GUI thread does not query the laser
 void ControlPanel::On_Laser488RefreshStatus()
 {
 	if (laser488!=NULL && laser488->IsConnected()){
-		LaserStatus status;
-		string state = laser488->GetCurrentState(status);
+		LaserStatusEntry entry;
+		if (!deviceStatusPoller->Get_LaserStatus(STATUS_LASER_488, entry)){
+			laser488Timer->start();
+			return;
+		}
+		LaserStatus status = entry.status;
+		string state = entry.state;
 		laser488StatusInfo = status;
 
 		switch (status){
@@ -1244,21 +2554,19 @@ void ControlPanel::On_Laser488RefreshStatus()
 
 		//cout<<"Laser488 current status: "<<state<<endl;
 		laser488Status->setText(QString::fromStdString(state));
-		laser488Timer->setInterval(2000);
 		laser488Timer->start();
 	}
 }
 
 void ControlPanel::On_Laser488Connect() //toggle button
-{  
-	static bool work = false;
-	if (work){
+{
+	if (laser488 != NULL && laser488->IsConnected()){
 		laser488ConnectButton->setText("Connect");
+		deviceStatusPoller->Set_Laser(STATUS_LASER_488, NULL);
 		laser488->Disconnect();
 		laser488StartButton->setEnabled(false);
 		laser488StopButton->setEnabled(false);
 		EnableLaser488Group(false);
-		work = false;
 
 		//update status
 		laser488Status->setStyleSheet("color:red");
@@ -1274,42 +2582,47 @@ void ControlPanel::On_Laser488Connect() //toggle button
 		}
 		laser488->SetPortName(COM_488);
 		laser488->SetBaudRate(115200);
-		try{
-			laser488->Connect();
-			Sleep(500); //wait for 500ms
-
-			work = true;
-			EnableLaser488Group(true);
-			laser488ConnectButton->setText("Disconnect");
-			laser488->GetNomialPower(laser488NomialPower);
-			laser488->GetMinPower(laser488MinPower);
-			laser488->GetMaxPower(laser488MaxPower);
-			laser488->GetCurrentPower(laser488Power);
-			laser488NomialPowerLabel->setText("Nomial Power: " + QString::number(laser488NomialPower*1.0e3) + "mW");
-			laser488PowerEdit->setText( QString::number(laser488Power*1.0e3) );
-
-			//set laser488 power slider
-			int value = int(1.0e2*laser488Power/laser488NomialPower);
-			laser488PowerSlider->setValue(value);
-
-			//get laser mode
-			laser488->GetMode(laser488Mode);
-			laser488ModeBox->setCurrentIndex((int)laser488Mode); //CWP: 0, DIGITAL: 1
-
-			laser488StartButton->setEnabled(true);
-			laser488StopButton->setEnabled(true);
-
-			//start timer
-			laser488Timer->setInterval(2000);//2 seconds
-			connect( laser488Timer, SIGNAL(timeout()), this, SLOT(On_Laser488RefreshStatus()) );
-			laser488Timer->start();
+		//through the manager, so a connection still running from the start is not doubled
+		deviceManager->StartTimeline();
+		vector<DeviceFuture> futures(1, deviceManager->Submit("488nm laser", "connect", new LaserTask(laser488, LASER_CONNECT, &laser488Settings), DEVICE_MANAGER::CONNECT_TIMEOUT));
+		if (deviceManager->WaitAll(futures)){
+			Laser488Connected();
 		}
-		catch (QException e){
-			stateBox->setText(QString::fromStdString(e.getMessage()));
+		else{
+			stateBox->setText(QString::fromStdString(futures[0].Get_Error()));
 		}
 	}
 }
 
+void ControlPanel::Laser488Connected()
+{
+	EnableLaser488Group(true);
+	laser488ConnectButton->setText("Disconnect");
+	laser488NomialPower = laser488Settings.nomialPower;
+	laser488MinPower = laser488Settings.minPower;
+	laser488MaxPower = laser488Settings.maxPower;
+	laser488Power = laser488Settings.currentPower;
+	laser488Mode = laser488Settings.mode;
+	laser488NomialPowerLabel->setText("Nomial Power: " + QString::number(laser488NomialPower*1.0e3) + "mW");
+	laser488PowerEdit->setText( QString::number(laser488Power*1.0e3) );
+
+	//set laser488 power slider
+	int value = int(1.0e2*laser488Power/laser488NomialPower);
+	laser488PowerSlider->setValue(value);
+
+	//laser mode
+	laser488ModeBox->setCurrentIndex((int)laser488Mode); //CWP: 0, DIGITAL: 1
+
+	laser488StartButton->setEnabled(true);
+	laser488StopButton->setEnabled(true);
+
+	//start timer, the poller queries the laser
+	deviceStatusPoller->Set_Laser(STATUS_LASER_488, laser488);
+	laser488Timer->setInterval(DEVICE_STATUS::DISPLAY_PERIOD);
+	connect( laser488Timer, SIGNAL(timeout()), this, SLOT(On_Laser488RefreshStatus()) );
+	laser488Timer->start();
+}
+
 void ControlPanel::On_Laser488Start()
 {
 	if (laser488 != NULL && laser488->IsConnected()){
@@ -1409,11 +2722,17 @@ void ControlPanel::On_Laser488PowerSlider()
 }
 
 //Laser 561 Control
+//the status is read from the poller, the GUI thread does not query the laser
 void ControlPanel::On_Laser561RefreshStatus()
 {  
 	if (laser561!=NULL && laser561->IsConnected()){
-		LaserStatus status;
-		string state = laser561->GetCurrentState(status);
+		LaserStatusEntry entry;
+		if (!deviceStatusPoller->Get_LaserStatus(STATUS_LASER_561, entry)){
+			laser561Timer->start();
+			return;
+		}
+		LaserStatus status = entry.status;
+		string state = entry.state;
 		laser561StatusInfo = status;
 
 		switch (status){
@@ -1446,21 +2765,19 @@ void ControlPanel::On_Laser561RefreshStatus()
 		}
 		//cout<<"Laser561 current status: "<<state<<endl;
 		laser561Status->setText(QString::fromStdString(state));
-		laser561Timer->setInterval(2000);
 		laser561Timer->start();
 	}
 }
 
 void ControlPanel::On_Laser561Connect() //toggle button
 {
-	static bool work = false;
-	if (work){
+	if (laser561 != NULL && laser561->IsConnected()){
 		laser561ConnectButton->setText("Connect");
+		deviceStatusPoller->Set_Laser(STATUS_LASER_561, NULL);
 		laser561->Disconnect();
 		laser561StartButton->setEnabled(false);
 		laser561StopButton->setEnabled(false);
 		EnableLaser561Group(false);
-		work = false;
 
 		//update status
 		laser561Status->setStyleSheet("color:red");
@@ -1475,42 +2792,47 @@ void ControlPanel::On_Laser561Connect() //toggle button
 			laser561 = new CLaser();
 		}
 		laser561->SetPortName(COM_561);
-		try{
-			laser561->Connect();
-			Sleep(500); //wait for 500ms
-			
-			work = true;
-			EnableLaser561Group(true);
-			laser561ConnectButton->setText("Disconnect");
-			laser561->GetNomialPower(laser561NomialPower);
-			laser561->GetMinPower(laser561MinPower);
-			laser561->GetMaxPower(laser561MaxPower);
-			laser561->GetCurrentPower(laser561Power);
-			laser561NomialPowerLabel->setText("Nomial Power: " + QString::number(laser561NomialPower*1.0e3) + "mW");
-			laser561PowerEdit->setText( QString::number(laser561Power*1.0e3) );
-
-			//set laser488 power slider
-			int value = int(1.0e2*laser561Power/laser561NomialPower);
-			laser561PowerSlider->setValue(value);
-
-			//get laser mode
-			laser561->GetMode(laser561Mode);
-			laser561ModeBox->setCurrentIndex((int)laser561Mode); //CWP: 0, DIGITAL: 1
-
-			laser561StartButton->setEnabled(true);
-			laser561StopButton->setEnabled(true);
-
-			//start laser561 timer
-			laser561Timer->setInterval(2000);//2 seconds
-			connect( laser561Timer, SIGNAL(timeout()), this, SLOT(On_Laser561RefreshStatus()) );
-			laser561Timer->start();
+		//through the manager, so a connection still running from the start is not doubled
+		deviceManager->StartTimeline();
+		vector<DeviceFuture> futures(1, deviceManager->Submit("561nm laser", "connect", new LaserTask(laser561, LASER_CONNECT, &laser561Settings), DEVICE_MANAGER::CONNECT_TIMEOUT));
+		if (deviceManager->WaitAll(futures)){
+			Laser561Connected();
 		}
-		catch (QException e){
-			stateBox->setText(QString::fromStdString(e.getMessage()));
+		else{
+			stateBox->setText(QString::fromStdString(futures[0].Get_Error()));
 		}
 	}
 }
 
+void ControlPanel::Laser561Connected()
+{
+	EnableLaser561Group(true);
+	laser561ConnectButton->setText("Disconnect");
+	laser561NomialPower = laser561Settings.nomialPower;
+	laser561MinPower = laser561Settings.minPower;
+	laser561MaxPower = laser561Settings.maxPower;
+	laser561Power = laser561Settings.currentPower;
+	laser561Mode = laser561Settings.mode;
+	laser561NomialPowerLabel->setText("Nomial Power: " + QString::number(laser561NomialPower*1.0e3) + "mW");
+	laser561PowerEdit->setText( QString::number(laser561Power*1.0e3) );
+
+	//set laser488 power slider
+	int value = int(1.0e2*laser561Power/laser561NomialPower);
+	laser561PowerSlider->setValue(value);
+
+	//laser mode
+	laser561ModeBox->setCurrentIndex((int)laser561Mode); //CWP: 0, DIGITAL: 1
+
+	laser561StartButton->setEnabled(true);
+	laser561StopButton->setEnabled(true);
+
+	//start laser561 timer, the poller queries the laser
+	deviceStatusPoller->Set_Laser(STATUS_LASER_561, laser561);
+	laser561Timer->setInterval(DEVICE_STATUS::DISPLAY_PERIOD);
+	connect( laser561Timer, SIGNAL(timeout()), this, SLOT(On_Laser561RefreshStatus()) );
+	laser561Timer->start();
+}
+
 void ControlPanel::On_Laser561Start()
 {
 	if (laser561 != NULL && laser561->IsConnected()){
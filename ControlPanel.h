@@ -5,8 +5,23 @@ ControlPanel : The control panel in Tracking Window
 #define _CONTROL_PANEL_H_
 
 #include "Z1Stage.h"
+#include "Z3Stage.h"
+#include "CoordinatedMotion.h"
+#include "StageCommandQueue.h"
+#include "StagePositionSampler.h"
+#include "SimulatedController.h"
 #include "Laser.h"
+#include "SimulatedLaser.h"
+#include "DeviceManager.h"
+#include "DeviceStatusPoller.h"
 #include "ImageSaveWidget.h"
+#include "RatioImagingThread.h"
+#include "MotionCorrectionThread.h"
+#include "ObjectTrackingThread.h"
+#include "ExcitationSequencer.h"
+#include "FocusLockThread.h"
+#include "ZStackThread.h"
+#include "VolumeImagingThread.h"
 #include <sstream>
 #include <iomanip>
 #include <QtWidgets/QGroupBox>
@@ -30,7 +45,7 @@ ControlPanel : The control panel in Tracking Window
 #define COM_561 "\\\\.\\COM11"
 
 #define IMAGE_MAX 32
-enum MOTION_METHOD{ MOTION, RETURN_ORIGIN};
+enum MOTION_METHOD{ MOTION, RETURN_ORIGIN, FOCUS_MOTION};
 
 class MotionThread: public QThread
 {
@@ -41,9 +56,11 @@ public:
 
 	inline void setMethod( MOTION_METHOD m){ method = m; }
 	inline void setDistance(double d){ distance = d; }
+	inline void setFocusMotion(CoordinatedMotion* m, const vector<double>& d){ focusMotion = m; focusDistances = d; }
 	inline void setDescription(QString& str){ description  = str; }
 	inline QString& getDescription() { return description; }
 	inline MOTION_METHOD getMethod(){ return method; }
+	inline bool getResult(){ return result; }
 
 signals:
 	void FinishMotion();
@@ -55,7 +72,41 @@ private:
 	Stage* stage;
 	MOTION_METHOD method;
 	double distance;
+	CoordinatedMotion* focusMotion;
+	vector<double> focusDistances;
 	QString description;
+	bool result;        //false when the motion failed or was stopped
+};
+
+//device operations run concurrently by the device manager
+class ControllerTask : public DeviceTask
+{
+public:
+	explicit ControllerTask(StageController** controller) : controller(controller), result(NULL){}
+	~ControllerTask(){ delete result; } //a controller which was not committed
+	void Run();
+	void Commit();
+
+private:
+	StageController** controller;
+	StageController* result;
+};
+
+enum LASER_OPERATION{ LASER_CONNECT, LASER_START, LASER_STOP };
+class LaserTask : public DeviceTask
+{
+public:
+	LaserTask(CLaser* laser, LASER_OPERATION operation, LaserSettings* settings = NULL)
+		: laser(laser), operation(operation), settings(settings){}
+	void Run();
+	void Commit();
+	void Discard();
+
+private:
+	CLaser* laser;
+	LASER_OPERATION operation;
+	LaserSettings* settings;   //read on connection
+	LaserSettings result;
 };
 
 class ControlPanel : public QWidget
@@ -73,10 +124,14 @@ public:
 	void UpdateObjectiveLensContents(ObjectiveLens lens);
 
 	void Hamamatsu_UpdateExposureTimeRange();
+	void Hamamatsu_UpdateFrameRateRange();
 	void EnableHamamatsuGroup(bool ok);
+	inline RatioImagingThread* Get_RatioImagingThread(){ return ratioImagingThread; }
+	inline DeviceStatusPoller* Get_DeviceStatusPoller(){ return deviceStatusPoller; }
 
 signals:
 	void Hamamatsu_UpdateDisplayWindow();
+	void Hamamatsu_ImageSizeChanged(int, int);
 	void StopDisplayImagesSignal(int);
 
 public slots:
@@ -84,15 +139,27 @@ public slots:
 	void On_Z1MotionFinish();
 	void StartSaveImage(int);
 	void FinishSaveImage(int);
+	void SetRatioRegion(int, ImageRegion);
+	void ShowRatioValues(unsigned long, QVector<double>);
+	void ShowMotionShift(double, double, double);
+	void ShowTracking(double, double, double);
+	void On_ExcitationSequenceFinished(bool);
+	void SetFocusRegion(int, ImageRegion);
+	void ShowFocusLock(double, double, double);
+	void ShowVolume(unsigned long, double, double);
+
+	void On_StageCommandFinished(unsigned long, QString, QString);
 
 protected:
 	void InitCamera(); 
 	void InitZ1Stage();
 	void InitLasers();
+	void BringUpDevices();
 	void CreateLayout();
 	QGroupBox* Create_LaserSetting_Layout();
 	QGroupBox* Create_Z1Setting_Layout();
 	void Z1MotionButtonsEnabled( bool ok); 
+	void StartZ1Motion(double distance, QString description);
 	void UpdateZ1FocusImageRegion();
 
 	void EnableHamamatsuFrameRateGroup(bool ok);
@@ -102,14 +169,19 @@ protected:
 	void FillHamamatsuDataMapBox();
 	void FillHamamatsuCaptureModeBox();
 	void FillHamamatsuImageSizeBox();
+	void FillHamamatsuBinningBox();
+	void FillHamamatsuPixelEncodingBox();
 	void FillHamamatsuImageChannelsSeqBox();
 	void UpdateHamamatsuFovSetting();
+	void AttachRatioImaging(bool attach);
 
 	void EnableLaser488Group(bool ok);
 	void EnableLaser488ModeBox(bool ok);
 	void EnableLaser561Group(bool ok);
 	void EnableLaser561ModeBox(bool ok);
 	void FillLaserModeBox(QComboBox* box);
+	void Laser488Connected();
+	void Laser561Connected();
 	QString PrecisionConvert(double data, int precision=2);
 
 protected slots:
@@ -120,19 +192,39 @@ protected slots:
 	void On_Z1RefPointButton();
 	void On_Z1MoveUpButton();
 	void On_Z1MoveDownButton();
+	void On_Z1AutoFocusButton();
+	void On_Z1AutoFocusFinish(bool, double, double);
+	void On_Z1FocusLock();
+	void On_Z1FocusLost();
+	void On_Z1ZStackButton();
+	void On_Z1ZStackFinish(bool, int, double);
+	void On_Z1VolumeCheck();
+	void On_Z1VolumeFinish(unsigned long);
 
 	void On_HamamatsuExposureTimeEdit();
+	void On_HamamatsuFrameRateEdit();
 	void On_HamamatsuOrientationBox();
 	void On_HamamatsuDataMapBox();
 	void On_HamamatsuCaptureModeBox();
 	void On_HamamatsuExternalTriggerOptionButton();
 	void On_HamamatsuImageSizeBox();
 	void On_HamamatsuFovChanged();
+	void On_HamamatsuFocusRegionFov();
+	void On_HamamatsuBinningBox();
+	void On_HamamatsuPixelEncodingBox();
+	void On_HamamatsuDriverFramesEdit();
+	void On_HamamatsuRefreshRingStatus();
 	void On_HamamatsuSaveImagesButton();
 	void On_HamamatsuSaveOneImageButton();
 	void On_HamamatsuImagingChannelSeqBox();
 	void On_HamamatsuAdjustImagingChannel();
 	void On_HamamatsuImagingChannelChanged();
+	void On_HamamatsuRatioImaging();
+	void On_HamamatsuRatioBackgroundEdit();
+	void On_HamamatsuRatioRecordButton();
+	void On_HamamatsuMotionCorrection();
+	void On_HamamatsuTracking();
+	void On_HamamatsuExcitationSequencer();
 
 	void On_LaserStartAll();
 	void On_LaserStopAll();
@@ -159,12 +251,22 @@ private:
 	QLineEdit* z1_StepEdit;
 	QPushButton* z1_UpButton;
 	QPushButton* z1_DownButton;
+	QCheckBox* z1_WithZ3Check;
 	QPushButton* z1_StopButton;
 	QPushButton* z1_ReturnOrigin;
 	QPushButton* z1_RefPointButton;
 	QPushButton* z1_SetUpPointButton;
 	QPushButton* z1_SetDownPointButton;
 	QPushButton* z1_CurrentPositionButton;
+	QPushButton* z1_AutoFocusButton;
+	QComboBox* z1_FocusMetricBox;
+	QCheckBox* z1_FocusLockCheck;
+	QLabel* z1_FocusLockLabel;
+	QPushButton* z1_ZStackButton;
+	QSpinBox* z1_ZStackPlanesBox;
+	QLineEdit* z1_ZStackStepEdit;
+	QCheckBox* z1_VolumeCheck;
+	QLabel* z1_VolumeLabel;
 
 	/***** camera control** ***/
 	//hamamastu camera
@@ -173,6 +275,10 @@ private:
 	QLabel* hamamatsuExposureTimeRangeLabel;
 	QLineEdit* hamamatsuFrameRateEdit;
 	QLabel* hamamatsuFrameRateRangeLabel;
+	QLineEdit* hamamatsuDriverFramesEdit;   //0 sizes the ring of the driver from the frame rate
+	QLabel* hamamatsuDriverRingLabel;
+	QLabel* hamamatsuLiveRateLabel;         //achieved frame rate and the one the acquiring thread keeps up with
+	QTimer* hamamatsuRingTimer;
 	
 	QComboBox* hamamatsuOrientationBox;
 	QComboBox* hamamatsuDataMapBox;
@@ -181,6 +287,9 @@ private:
 	QRadioButton* hamamatsuExternalTriggerNegativeButton;
 	QComboBox* hamamatsuImageSizeBox;
 	QPushButton* hamamatsuImageSizeApplyButton;
+	QPushButton* hamamatsuFocusRegionFovButton; //reads out the focus region only
+	QComboBox* hamamatsuBinningBox;
+	QComboBox* hamamatsuPixelEncodingBox;
 	QLineEdit* hamamatsuFovWidth;
 	QLineEdit* hamamatsuFovHeight;
 	QLineEdit* hamamatsuFovXOffset;
@@ -190,14 +299,33 @@ private:
 	QRadioButton* hamamatsuCompositeChannelsButton;
 	QComboBox* hamamatsuImagingChannelsSeqBox;
 	QPushButton* hamamatsuAdjustImagingChannel;
+	QCheckBox* hamamatsuExcitationCheck;
+	QLabel* hamamatsuExcitationLabel;
+	ExcitationSequencer* excitationSequencer; //created with the controller, which drives the gates and the trigger
+	QCheckBox* hamamatsuRatioImagingCheck;
+	QLineEdit* hamamatsuGCaMPBackgroundEdit;
+	QLineEdit* hamamatsuRFPBackgroundEdit;
+	QPushButton* hamamatsuRatioRecordButton;
+	QLabel* hamamatsuRatioValueLabel;
+	RatioImagingThread* ratioImagingThread;
+	QCheckBox* hamamatsuMotionCorrectionCheck;
+	QLabel* hamamatsuMotionShiftLabel;
+	MotionCorrectionThread* motionCorrectionThread;
+	QCheckBox* hamamatsuTrackingCheck;
+	QLabel* hamamatsuTrackingLabel;
+	ObjectTrackingThread* objectTrackingThread;
 
 	QPushButton* hamamatsuSaveImagesButton;
 	QPushButton* hamamatsuSaveOneImageButton;
 	ImageSaveWidget* hamamatsuImageSaveWidget;
 
 	/***** Laser control ** ***/
+	DeviceManager* deviceManager;
+	DeviceStatusPoller* deviceStatusPoller; //the only thread querying the status of the devices
 	CLaser* laser488;
 	CLaser* laser561;
+	LaserSettings laser488Settings;  //written by the connection in a worker thread
+	LaserSettings laser561Settings;
 	QPushButton* laserStartAllButton;
 	QPushButton* laserStopAllButton;
 	QIcon laserStartIcon;
@@ -227,17 +355,32 @@ private:
 
 	/***** others ** ***/
 	QTextEdit* stateBox;//The textbox for show the states of all devices
-	Galil* controller;
+	StageController* controller;
+	StageCommandQueue* stageQueue;
 	Z1Stage* z1_stage;
+	Z3Stage* z3_stage;
+	CoordinatedMotion* focusMotion; //z1 and z3 moved together
+	StagePositionSampler* z1PositionSampler; //stamps the frames with the z1 position
 	
 	//private variables
 	double z1_step;
 	double z1_ref_point; 
+	unsigned long z1_positionQueryId;
+
 	MotionThread* z1MotionThread;
+	AutoFocusThread* autoFocusThread;
+	FocusLockThread* focusLockThread;
+	ZStackThread* zStackThread;
+	VolumeImagingThread* volumeImagingThread;
+
+	ImageRegion z1_focusRegion;
 
 	double hamamatsu_maxExposureTime;
 	double hamamatsu_minExposureTime;
 	double hamamatsu_exposureTime;
+	double hamamatsu_maxFrameRate;
+	double hamamatsu_minFrameRate;
+	double hamamatsu_frameRate;   //0 runs as fast as the exposure and the readout allow
 	int hamamatsu_imageWidth;
 	int hamamatsu_imageHeight;
 	int hamamatsu_imageXOffset;
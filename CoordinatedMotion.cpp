@@ -0,0 +1,201 @@
+
+#include "CoordinatedMotion.h"
+#include <QtCore/QElapsedTimer>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+string CoordinatedMotion::OBJECT_NAME = "CoordinatedMotion";
+
+CoordinatedMotion::CoordinatedMotion(StageController* controller) : controller(controller), profileMutex(QMutex::Recursive)
+{
+}
+
+CoordinatedMotion::~CoordinatedMotion()
+{
+	controller = NULL;
+}
+
+int CoordinatedMotion::AddAxis(Stage* stage, char axis, int direction, double motor_scale)
+{
+	MotionAxis motionAxis;
+	motionAxis.stage = stage;
+	motionAxis.axis = axis;
+	motionAxis.direction = (direction < 0) ? -1 : 1;
+	motionAxis.motorScale = motor_scale;
+	axes.push_back(motionAxis);
+	return (int)axes.size()-1;
+}
+
+//the speed, acceleration and deceleration of all axes in one round trip
+void CoordinatedMotion::ReadLimits()
+{
+	std::ostringstream message;
+	message<<"MG ";
+	for (size_t i=0; i<axes.size(); ++i){
+		message<<(i == 0 ? "" : ", ")<<"_SP"<<axes[i].axis<<", _AC"<<axes[i].axis<<", _DC"<<axes[i].axis;
+	}
+	std::istringstream values(controller->command(message.str()));
+	limits.assign(axes.size(), AxisProfile());
+	for (size_t i=0; i<axes.size(); ++i){
+		limits[i].distance = 0;
+		if (!(values>>limits[i].speed>>limits[i].acc>>limits[i].dec)){
+			throw string("Invalid profile of axis ") + axes[i].axis;
+		}
+	}
+}
+
+/*
+	The move is planned as a trapezoid of the normalized path from 0 to 1 whose speed,
+	acceleration and deceleration are the lowest limits of the axes divided by their
+	distances. Scaled back by the distance, no axis exceeds its limits and all of them
+	follow the straight line between the start and the end in the virtual coordinates.
+*/
+double CoordinatedMotion::Plan(const vector<double>& distances, vector<AxisProfile>& profiles)
+{
+	if (controller == NULL){
+		throw QException(OBJECT_NAME, "Plan", "No Stage Connection");
+	}
+	if (distances.size() != axes.size()){
+		throw QException(OBJECT_NAME, "Plan", "One distance is required for each axis");
+	}
+	QMutexLocker locker(&profileMutex);
+	//the limits are only read while the controller holds the profiles of the stages,
+	//back-to-back moves would read the scaled profiles of the former move instead
+	if (movingAxes.empty() || limits.size() != axes.size()){
+		try{
+			ReadLimits();
+		} catch (string e){
+			throw QException(OBJECT_NAME, "Plan", e);
+		}
+	}
+
+	profiles.assign(axes.size(), AxisProfile());
+	double speed = -1, acc = -1, dec = -1;   //path fraction/s and /s^2
+	for (size_t i=0; i<axes.size(); ++i){
+		long step = long(distances[i]*axes[i].direction*axes[i].motorScale);
+		profiles[i].distance = step;
+		if (step == 0){
+			continue;
+		}
+		double length = fabs((double)step);
+		if (speed < 0 || limits[i].speed/length < speed){ speed = limits[i].speed/length; }
+		if (acc < 0 || limits[i].acc/length < acc){ acc = limits[i].acc/length; }
+		if (dec < 0 || limits[i].dec/length < dec){ dec = limits[i].dec/length; }
+	}
+	if (speed <= 0){
+		return 0;
+	}
+
+	for (size_t i=0; i<axes.size(); ++i){
+		double length = fabs((double)profiles[i].distance);
+		profiles[i].speed = max(1.0, floor(speed*length));
+		profiles[i].acc = max(COORDINATED_MOTION::MIN_ACC, floor(acc*length));
+		profiles[i].dec = max(COORDINATED_MOTION::MIN_ACC, floor(dec*length));
+	}
+	return Get_ProfileTime(speed, acc, dec, 1.0);
+}
+
+double CoordinatedMotion::Move(const vector<double>& distances)
+{
+	QMutexLocker locker(&profileMutex);
+	vector<AxisProfile> profiles;
+	double motionTime = Plan(distances, profiles);
+
+	std::ostringstream instruction;
+	string begin;
+	for (size_t i=0; i<axes.size(); ++i){
+		if (profiles[i].distance == 0){
+			continue;
+		}
+		char axis = axes[i].axis;
+		instruction<<"SP"<<axis<<"="<<long(profiles[i].speed)<<";AC"<<axis<<"="<<long(profiles[i].acc)
+			<<";DC"<<axis<<"="<<long(profiles[i].dec)<<";PR"<<axis<<"="<<profiles[i].distance<<";";
+		begin += axis;
+	}
+	if (begin.empty()){
+		return 0;
+	}
+	try{
+		controller->command(instruction.str() + "BG" + begin);
+		for (size_t i=0; i<begin.size(); ++i){
+			if (std::find(movingAxes.begin(), movingAxes.end(), begin[i]) == movingAxes.end()){
+				movingAxes.push_back(begin[i]);
+			}
+		}
+	} catch (string e){
+		throw QException(OBJECT_NAME, "Move", e);
+	}
+	return motionTime;
+}
+
+void CoordinatedMotion::Move_Unrealtime(const vector<double>& distances)
+{
+	double motionTime = Move(distances);
+	if (!WaitMotionComplete(motionTime, long(motionTime)+COORDINATED_MOTION::MOTION_TIMEOUT)){
+		throw QException(OBJECT_NAME, "Move_Unrealtime", "Motion timeout");
+	}
+}
+
+//all axes end together: sleep through the profile once, then settle them one after the other
+bool CoordinatedMotion::WaitMotionComplete(double motion_time, long timeout_ms)
+{
+	QElapsedTimer timer;
+	timer.start();
+	bool success = true;
+	for (size_t i=0; i<axes.size() && success; ++i){
+		double remain = motion_time - (double)timer.elapsed();
+		success = axes[i].stage->WaitMotionComplete(remain > 0 ? remain : 0, timeout_ms - (long)timer.elapsed());
+	}
+	if (success){
+		RestoreProfiles();
+	}
+	return success;
+}
+
+void CoordinatedMotion::Stop()
+{
+	if (controller == NULL){
+		throw QException(OBJECT_NAME, "Stop", "No Stage Connection");
+	}
+	string axesList;
+	for (size_t i=0; i<axes.size(); ++i){
+		axesList += axes[i].axis;
+	}
+	try{
+		controller->write("ST" + axesList + "\r");
+	} catch (string e){
+		throw QException(OBJECT_NAME, "Stop", e);
+	}
+	//the axes decelerate with the scaled profiles, which are kept until they stand still
+	for (size_t i=0; i<axes.size(); ++i){
+		if (!axes[i].stage->WaitMotionComplete(0, COORDINATED_MOTION::MOTION_TIMEOUT)){
+			throw QException(OBJECT_NAME, "Stop", string("Axis ") + axes[i].axis + " is still moving");
+		}
+	}
+	RestoreProfiles();
+}
+
+//the stages predict their own motions with the profiles they set
+void CoordinatedMotion::RestoreProfiles()
+{
+	QMutexLocker locker(&profileMutex);
+	if (movingAxes.empty()){
+		return;
+	}
+	std::ostringstream instruction;
+	for (size_t i=0; i<axes.size(); ++i){
+		if (std::find(movingAxes.begin(), movingAxes.end(), axes[i].axis) == movingAxes.end()){
+			continue;
+		}
+		char axis = axes[i].axis;
+		instruction<<(instruction.tellp() > 0 ? ";" : "")<<"SP"<<axis<<"="<<long(limits[i].speed)
+			<<";AC"<<axis<<"="<<long(limits[i].acc)<<";DC"<<axis<<"="<<long(limits[i].dec);
+	}
+	movingAxes.clear();
+	try{
+		controller->command(instruction.str());
+	} catch (string e){
+		throw QException(OBJECT_NAME, "RestoreProfiles", e);
+	}
+}
@@ -0,0 +1,67 @@
+/*****************************************************************
+CoordinatedMotion : Simultaneous moves of several stage axes. The
+                    distances are given in the virtual coordinates
+                    and mapped onto the controller axes, every axis
+                    follows the same trapezoid scaled to its distance
+                    so that all of them start and stop together and
+                    the move lasts the time of the slowest axis
+                    instead of the sum. The profiles and the begin
+                    of all axes go in one controller round trip.
+                    The moves may be sent, waited for and stopped
+                    from different threads.
+******************************************************************/
+#ifndef _COORDINATED_MOTION_H_
+#define _COORDINATED_MOTION_H_
+
+#include "StageController.h"
+#include "Stage.h"
+#include "Stage_Params.h"
+#include "VirtualCoordinates.h"
+#include <QtCore/QMutex>
+#include <vector>
+
+struct MotionAxis{
+	Stage* stage;        //settles the axis after a move
+	char axis;           //controller axis
+	int direction;       //positive direction of the device in the virtual coordinates, e.g. Z1_POSITIVE
+	double motorScale;   //motor pulses per encoder pulse
+};
+
+struct AxisProfile{
+	long distance;       //motor pulse, 0 when the axis does not move
+	double speed;        //motor pulse/s
+	double acc;          //motor pulse/s^2
+	double dec;
+};
+
+class CoordinatedMotion
+{
+public:
+	static string OBJECT_NAME;
+
+	explicit CoordinatedMotion(StageController* controller);
+	~CoordinatedMotion();
+
+	int AddAxis(Stage* stage, char axis, int direction, double motor_scale); //returns the index of the axis
+	int Get_AxisNum(){ return (int)axes.size(); }
+
+	//distances are encoder pulses along the virtual positive direction, one per added axis
+	double Plan(const vector<double>& distances, vector<AxisProfile>& profiles); //returns the motion time, ms
+	double Move(const vector<double>& distances);    //starts the move and returns the motion time, ms
+	void Move_Unrealtime(const vector<double>& distances);
+	bool WaitMotionComplete(double motion_time, long timeout_ms); //also restores the profiles of the axes
+	void Stop(); //returns once the axes stopped and their profiles are restored
+
+protected:
+	void ReadLimits();
+	void RestoreProfiles();
+
+private:
+	StageController* controller;
+	QMutex profileMutex;           //limits and moving axes
+	vector<MotionAxis> axes;
+	vector<AxisProfile> limits;    //profiles of the stages, restored after a move
+	vector<char> movingAxes;       //axes whose profile is changed by the running move
+};
+
+#endif //_COORDINATED_MOTION_H_
@@ -0,0 +1,231 @@
+
+#include "DeviceManager.h"
+#include "QException.h"
+#include <sstream>
+#include <iomanip>
+
+string DeviceManager::OBJECT_NAME = "DeviceManager";
+
+/********************************** Device Future **********************************/
+bool DeviceFuture::IsFinished() const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->isFinished;
+}
+
+bool DeviceFuture::IsSuccess() const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->isFinished && state->success;
+}
+
+string DeviceFuture::Get_Error() const
+{
+	if (state.isNull()){
+		return DeviceManager::OBJECT_NAME + ": invalid device future";
+	}
+	QMutexLocker locker(&state->mutex);
+	if (!state->isFinished){
+		return DeviceManager::OBJECT_NAME + ": timeout";
+	}
+	return state->error;
+}
+
+/********************************** Device Operation **********************************/
+void DeviceOperation::run()
+{
+	manager->Started(state);
+	task->cancelled = &state->isCancelled;
+	string error;
+	try{
+		task->Run();
+	} catch (QException e){
+		error = e.getMessage();
+	} catch (string e){
+		error = e;
+	}
+	manager->Finish(state, task, error.empty(), error);
+}
+
+/********************************** Device Manager **********************************/
+DeviceManager::DeviceManager()
+{
+	workers.setMaxThreadCount(DEVICE_MANAGER::MAX_THREADS);
+	clock.start();
+	timelineStart = 0.0;
+	generation = 0;
+}
+
+DeviceManager::~DeviceManager()
+{
+	workers.waitForDone();
+}
+
+void DeviceManager::StartTimeline()
+{
+	QMutexLocker locker(&timelineMutex);
+	timeline.clear();
+	timelineStart = clock.nsecsElapsed()/1.0e6;
+	++generation;
+}
+
+DeviceFuture DeviceManager::Submit(const string& device, const string& operation, DeviceTask* task, unsigned long timeout_ms)
+{
+	QSharedPointer<DeviceOperationState> state(new DeviceOperationState);
+	state->isFinished = false;
+	state->isCancelled = false;
+	state->success = false;
+	state->deadline = clock.elapsed() + timeout_ms;
+	state->device = device;
+
+	timelineMutex.lock();
+	bool busy = (busyDevices.count(device) != 0);
+	DeviceTiming timing;
+	timing.device = device;
+	timing.operation = operation;
+	timing.startTime = clock.nsecsElapsed()/1.0e6 - timelineStart;
+	timing.endTime = -1;
+	timing.success = false;
+	timing.timeout = false;
+	timeline.push_back(timing);
+	state->index = (int)timeline.size()-1;
+	state->generation = generation;
+	if (busy){
+		timeline.back().endTime = timing.startTime;
+		timeline.back().error = "device busy";
+	} else{
+		busyDevices.insert(device);
+	}
+	timelineMutex.unlock();
+
+	DeviceFuture future;
+	future.state = state;
+	if (busy){
+		delete task;
+		state->isFinished = true;
+		state->error = OBJECT_NAME + ": " + device + " still runs a former operation";
+		return future;
+	}
+	workers.start(new DeviceOperation(this, task, state));
+	return future;
+}
+
+//an operation waiting for a free worker starts later than its submission
+void DeviceManager::Started(const QSharedPointer<DeviceOperationState>& state)
+{
+	QMutexLocker locker(&timelineMutex);
+	if (state->generation == generation){
+		timeline[state->index].startTime = clock.nsecsElapsed()/1.0e6 - timelineStart;
+	}
+}
+
+//the result is committed under the lock of the state, so it either reaches the caller
+//before its deadline or is discarded
+void DeviceManager::Finish(const QSharedPointer<DeviceOperationState>& state, DeviceTask* task, bool success, const string& error)
+{
+	state->mutex.lock();
+	bool cancelled = state->isCancelled;
+	if (!cancelled){
+		if (success){
+			task->Commit();
+		}
+		state->success = success;
+		state->error = error;
+		state->isFinished = true;
+		state->finished.wakeAll();
+	}
+	state->mutex.unlock();
+
+	if (cancelled && success){
+		try{
+			task->Discard();
+		} catch (QException e){
+			cout<<e.getMessage()<<endl;
+		} catch (string e){
+			cout<<GetErrorString(OBJECT_NAME, "Finish()", e)<<endl;
+		}
+	}
+
+	QMutexLocker locker(&timelineMutex);
+	busyDevices.erase(state->device);
+	if (state->generation == generation){
+		DeviceTiming& timing = timeline[state->index];
+		timing.endTime = clock.nsecsElapsed()/1.0e6 - timelineStart;
+		timing.success = success && !cancelled;
+		timing.error = error;
+	}
+}
+
+//the deadlines run together, so the wait lasts the longest timeout at most
+bool DeviceManager::WaitAll(const vector<DeviceFuture>& futures)
+{
+	bool success = true;
+	for (size_t i=0; i<futures.size(); ++i){
+		if (!futures[i].IsValid()){
+			success = false;
+			continue;
+		}
+		QSharedPointer<DeviceOperationState> state = futures[i].state;
+		state->mutex.lock();
+		while (!state->isFinished){
+			long long remain = state->deadline - clock.elapsed();
+			if (remain <= 0){
+				break;
+			}
+			state->finished.wait(&state->mutex, (unsigned long)remain);
+		}
+		bool finished = state->isFinished;
+		success = success && finished && state->success;
+		if (!finished){
+			state->isCancelled = true;
+		}
+		state->mutex.unlock();
+
+		if (!finished){
+			QMutexLocker locker(&timelineMutex);
+			if (state->generation == generation){
+				timeline[state->index].timeout = true;
+			}
+		}
+	}
+	return success;
+}
+
+vector<DeviceTiming> DeviceManager::Get_Timeline()
+{
+	QMutexLocker locker(&timelineMutex);
+	return timeline;
+}
+
+string DeviceManager::Get_TimelineString()
+{
+	vector<DeviceTiming> timings = Get_Timeline();
+	double total = 0.0, sum = 0.0;
+	std::ostringstream lines;
+	lines<<std::fixed<<std::setprecision(0);
+	for (size_t i=0; i<timings.size(); ++i){
+		const DeviceTiming& timing = timings[i];
+		lines<<"\n  "<<timing.device<<" "<<timing.operation<<": "<<timing.startTime<<" - ";
+		if (timing.endTime < 0){
+			lines<<"running";
+		} else{
+			lines<<timing.endTime<<" ms";
+			total = max(total, timing.endTime);
+			sum += timing.endTime - timing.startTime;
+		}
+		if (timing.timeout){
+			lines<<", timeout";
+		} else if (timing.endTime >= 0 && !timing.success){
+			lines<<", "<<timing.error;
+		}
+	}
+	std::ostringstream text;
+	text<<std::fixed<<std::setprecision(0)<<"Device timeline: "<<total<<" ms, operations "<<sum<<" ms"<<lines.str();
+	return text.str();
+}
@@ -0,0 +1,136 @@
+/****************************************************************************
+	DeviceManager: runs the operations of independent devices (connection,
+	start, stop) concurrently on a thread pool, so that a bring-up or a
+	command sent to all the lasers lasts as long as the slowest device
+	instead of the sum. Every operation has its own timeout and its start
+	and end go into a timeline. An operation the caller stopped waiting for
+	is cancelled: it returns at its next check, its result is discarded and
+	its device takes no other operation until it returned.
+****************************************************************************/
+
+#ifndef _DEVICE_MANAGER_H_
+#define _DEVICE_MANAGER_H_
+
+#include "Util.h"
+#include <QtCore/QThreadPool>
+#include <QtCore/QRunnable>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSharedPointer>
+#include <vector>
+#include <set>
+
+namespace DEVICE_MANAGER{
+	const int MAX_THREADS = 8;                        //operations running at the same time
+	const unsigned long CONNECT_TIMEOUT = 10000;      //ms
+	const unsigned long COMMAND_TIMEOUT = 2000;       //ms
+	const int COMMAND_RETRIES = 3;                    //attempts of a device command before it fails
+	const unsigned long RETRY_INTERVAL = 100;         //ms
+	const unsigned long READY_INTERVAL = 20;          //ms between the readiness queries of a device
+}
+
+//one operation on one device, run in a worker thread
+class DeviceTask
+{
+public:
+	DeviceTask():cancelled(NULL){}
+	virtual ~DeviceTask(){}
+	virtual void Run() = 0;  //throws QException or string on failure
+	virtual void Commit(){}  //hands the result to the caller, only while the caller still waits for it
+	virtual void Discard(){} //undoes a successful run the caller gave up on
+	inline void Execute(){ Run(); Commit(); } //runs the task in the calling thread
+
+protected:
+	//long operations return at the next check once the caller gave up
+	inline bool IsCancelled() const { return cancelled != NULL && *cancelled; }
+
+private:
+	friend class DeviceOperation;
+	const volatile bool* cancelled;
+};
+
+struct DeviceOperationState{
+	QMutex mutex;
+	QWaitCondition finished;
+	bool isFinished;
+	volatile bool isCancelled;//the caller stopped waiting, read by the task without the mutex
+	bool success;
+	string error;
+	int index;               //entry of the timeline
+	unsigned long generation;//timeline the entry belongs to
+	long long deadline;      //ms on the clock of the manager
+	string device;
+};
+
+struct DeviceTiming{
+	string device;
+	string operation;
+	double startTime;        //ms from the start of the timeline
+	double endTime;          //ms, -1 while the operation runs
+	bool success;
+	bool timeout;            //the caller stopped waiting, the operation was cancelled
+	string error;
+};
+
+class DeviceFuture
+{
+public:
+	bool IsValid() const { return !state.isNull(); }
+	bool IsFinished() const;
+	bool IsSuccess() const;  //finished without error
+	string Get_Error() const;
+
+private:
+	friend class DeviceManager;
+	QSharedPointer<DeviceOperationState> state;
+};
+
+class DeviceManager;
+class DeviceOperation : public QRunnable
+{
+public:
+	DeviceOperation(DeviceManager* manager, DeviceTask* task, QSharedPointer<DeviceOperationState> state)
+		: manager(manager), task(task), state(state){}
+	~DeviceOperation(){ delete task; }
+	void run();
+
+private:
+	DeviceManager* manager;
+	DeviceTask* task;
+	QSharedPointer<DeviceOperationState> state;
+};
+
+class DeviceManager
+{
+	friend class DeviceOperation;
+public:
+	static string OBJECT_NAME;
+
+	DeviceManager();
+	~DeviceManager();  //waits for the operations still running in the drivers
+
+	void StartTimeline(); //clears the timeline, its times count from now
+	//the manager takes the task, the timeout counts from the submission.
+	//the operation fails at once while the device still runs an earlier one.
+	DeviceFuture Submit(const string& device, const string& operation, DeviceTask* task, unsigned long timeout_ms);
+	//waits for all the operations, each until its own deadline; true when all of them succeeded
+	bool WaitAll(const vector<DeviceFuture>& futures);
+	vector<DeviceTiming> Get_Timeline();
+	string Get_TimelineString();
+
+protected:
+	void Started(const QSharedPointer<DeviceOperationState>& state);
+	void Finish(const QSharedPointer<DeviceOperationState>& state, DeviceTask* task, bool success, const string& error);
+
+private:
+	QThreadPool workers;
+	QMutex timelineMutex;
+	QElapsedTimer clock;
+	double timelineStart;    //ms on the clock
+	unsigned long generation;
+	vector<DeviceTiming> timeline;
+	set<string> busyDevices; //devices with an operation in a worker, guarded by timelineMutex
+};
+
+#endif
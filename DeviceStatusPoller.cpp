@@ -0,0 +1,193 @@
+
+#include "DeviceStatusPoller.h"
+#include <string.h>
+
+string DeviceStatusPoller::OBJECT_NAME = "DeviceStatusPoller";
+
+DeviceStatusPoller::DeviceStatusPoller(QObject* parent)
+	: QThread(parent)
+{
+	isStopPolling = true;
+	lasers[0] = NULL;
+	lasers[1] = NULL;
+	camera = NULL;
+	sampler = NULL;
+	basePeriods[STATUS_LASER_488] = DEVICE_STATUS::LASER_PERIOD;
+	basePeriods[STATUS_LASER_561] = DEVICE_STATUS::LASER_PERIOD;
+	basePeriods[STATUS_CAMERA] = DEVICE_STATUS::TEMPERATURE_PERIOD;
+	basePeriods[STATUS_STAGE] = DEVICE_STATUS::STAGE_PERIOD;
+	for (int i=0; i<STATUS_DEVICES; ++i){
+		periods[i] = basePeriods[i];
+		nextPolls[i] = 0;
+		failures[i] = 0;
+	}
+}
+
+DeviceStatusPoller::~DeviceStatusPoller()
+{
+	StopPolling();
+	lasers[0] = NULL;
+	lasers[1] = NULL;
+	camera = NULL;
+	sampler = NULL;
+}
+
+void DeviceStatusPoller::StartPolling()
+{
+	if (isRunning()){
+		return;
+	}
+	isStopPolling = false;
+	start();
+}
+
+void DeviceStatusPoller::StopPolling()
+{
+	deviceMutex.lock();
+	isStopPolling = true;
+	deviceChanged.wakeAll();
+	deviceMutex.unlock();
+	wait();
+}
+
+void DeviceStatusPoller::Set_Laser(STATUS_DEVICE laser, CLaser* device)
+{
+	QMutexLocker locker(&deviceMutex);
+	int index = (laser == STATUS_LASER_561) ? 1 : 0;
+	lasers[index] = device;
+	periods[laser] = basePeriods[laser];
+	nextPolls[laser] = 0;
+	failures[laser] = 0;
+	if (device == NULL){
+		LaserStatusEntry entry;
+		entry.status = LASER_NO_CONNECTION;
+		strcpy(entry.state, "No Connection");
+		entry.failures = 0;
+		entry.time = Get_HostTime();
+		laserCells[index].Publish(entry);
+	}
+	deviceChanged.wakeAll();
+}
+
+void DeviceStatusPoller::Set_Camera(Camera* device)
+{
+	QMutexLocker locker(&deviceMutex);
+	camera = device;
+	periods[STATUS_CAMERA] = basePeriods[STATUS_CAMERA];
+	nextPolls[STATUS_CAMERA] = 0;
+	failures[STATUS_CAMERA] = 0;
+	if (device == NULL){
+		CameraStatusEntry entry;
+		entry.valid = false;
+		entry.temperature = 0;
+		entry.failures = 0;
+		entry.time = Get_HostTime();
+		cameraCell.Publish(entry);
+	}
+	deviceChanged.wakeAll();
+}
+
+void DeviceStatusPoller::Set_PositionSampler(StagePositionSampler* position_sampler)
+{
+	QMutexLocker locker(&deviceMutex);
+	sampler = position_sampler;
+	periods[STATUS_STAGE] = basePeriods[STATUS_STAGE];
+	nextPolls[STATUS_STAGE] = 0;
+	failures[STATUS_STAGE] = 0;
+	if (position_sampler == NULL){
+		StageStatusEntry entry;
+		entry.valid = false;
+		entry.position = 0;
+		entry.failures = 0;
+		entry.time = Get_HostTime();
+		stageCell.Publish(entry);
+	}
+	deviceChanged.wakeAll();
+}
+
+bool DeviceStatusPoller::Get_LaserStatus(STATUS_DEVICE laser, LaserStatusEntry& entry) const
+{
+	return laserCells[(laser == STATUS_LASER_561) ? 1 : 0].Get(entry);
+}
+
+/*
+	The devices due are polled in turn, then the thread sleeps until the next one is due
+	or a device is changed. A change waits for the poll in progress only.
+*/
+void DeviceStatusPoller::run()
+{
+	deviceMutex.lock();
+	while (!isStopPolling){
+		long long now = Get_HostTime()/1000;
+		long long wake = now + DEVICE_STATUS::MAX_PERIOD;
+		for (int i=0; i<STATUS_DEVICES && !isStopPolling; ++i){
+			STATUS_DEVICE device = (STATUS_DEVICE)i;
+			bool present = (device == STATUS_CAMERA) ? (camera != NULL) :
+				(device == STATUS_STAGE) ? (sampler != NULL) : (lasers[(device == STATUS_LASER_561) ? 1 : 0] != NULL);
+			if (!present){
+				continue;
+			}
+			if (nextPolls[i] <= now){
+				bool success = (device == STATUS_CAMERA) ? PollCamera() : (device == STATUS_STAGE) ? PollStage() : PollLaser(device);
+				Schedule(device, success, Get_HostTime()/1000);
+			}
+			wake = min(wake, nextPolls[i]);
+		}
+		long long remain = wake - Get_HostTime()/1000;
+		if (remain > 0 && !isStopPolling){
+			deviceChanged.wait(&deviceMutex, (unsigned long)remain);
+		}
+	}
+	deviceMutex.unlock();
+}
+
+//a failing device is polled less and less often, down to MAX_PERIOD
+void DeviceStatusPoller::Schedule(STATUS_DEVICE device, bool success, long long now)
+{
+	if (success){
+		failures[device] = 0;
+		periods[device] = basePeriods[device];
+	} else{
+		++failures[device];
+		periods[device] = min(periods[device]*DEVICE_STATUS::BACKOFF, DEVICE_STATUS::MAX_PERIOD);
+	}
+	nextPolls[device] = now + periods[device];
+}
+
+bool DeviceStatusPoller::PollLaser(STATUS_DEVICE laser)
+{
+	int index = (laser == STATUS_LASER_561) ? 1 : 0;
+	LaserStatusEntry entry;
+	string state = lasers[index]->GetCurrentState(entry.status);
+	strncpy(entry.state, state.c_str(), sizeof(entry.state)-1);
+	entry.state[sizeof(entry.state)-1] = '\0';
+	bool success = (entry.status != LASER_NO_CONNECTION && entry.status != LASER_FAULT);
+	entry.failures = success ? 0 : failures[laser]+1;
+	entry.time = Get_HostTime();
+	laserCells[index].Publish(entry);
+	return success;
+}
+
+bool DeviceStatusPoller::PollCamera()
+{
+	CameraStatusEntry entry;
+	entry.temperature = 0;
+	entry.valid = camera->IsConnected() && camera->Get_CurrentTemperature(entry.temperature);
+	entry.failures = entry.valid ? 0 : failures[STATUS_CAMERA]+1;
+	entry.time = Get_HostTime();
+	cameraCell.Publish(entry);
+	return entry.valid;
+}
+
+//the sampler streams the encoder already, the poller only checks that its samples are fresh
+bool DeviceStatusPoller::PollStage()
+{
+	PositionSample sample;
+	StageStatusEntry entry;
+	entry.valid = sampler->Get_LatestSample(sample) && (Get_HostTime()-sample.time < DEVICE_STATUS::MAX_SAMPLE_AGE*1000);
+	entry.position = entry.valid ? sample.position : 0;
+	entry.failures = entry.valid ? 0 : failures[STATUS_STAGE]+1;
+	entry.time = entry.valid ? sample.time : Get_HostTime();
+	stageCell.Publish(entry);
+	return entry.valid;
+}
@@ -0,0 +1,127 @@
+/****************************************************************************
+	DeviceStatusPoller: polls the status of the lasers, the temperature of
+	the camera and the position of the stage in its own thread, each on its
+	own period which backs off while the device fails. The results go to
+	single writer cells which the GUI reads without locking, so the GUI
+	never waits for a device to refresh its status.
+****************************************************************************/
+
+#ifndef _DEVICE_STATUS_POLLER_H_
+#define _DEVICE_STATUS_POLLER_H_
+
+#include "Laser.h"
+#include "Camera.h"
+#include "StagePositionSampler.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+
+namespace DEVICE_STATUS{
+	const unsigned long LASER_PERIOD = 1000;          //ms
+	const unsigned long TEMPERATURE_PERIOD = 5000;    //ms
+	const unsigned long STAGE_PERIOD = 100;           //ms
+	const unsigned long MAX_PERIOD = 30000;           //longest period of a failing device, ms
+	const int BACKOFF = 2;                            //period factor after each failure
+	const long long MAX_SAMPLE_AGE = 1000;            //stage sample regarded as stale, ms
+	const int DISPLAY_PERIOD = 500;                   //refresh of the GUI from the cells, ms
+	const int CELL_SIZE = 4;                          //values kept in a cell, power of 2
+}
+
+enum STATUS_DEVICE{STATUS_LASER_488, STATUS_LASER_561, STATUS_CAMERA, STATUS_STAGE, STATUS_DEVICES};
+
+struct LaserStatusEntry{
+	LaserStatus status;
+	char state[32];     //text of the status
+	int failures;       //polls in a row answered with no connection or a fault
+	long long time;     //host time of the poll, us
+};
+
+struct CameraStatusEntry{
+	bool valid;
+	double temperature; //Celsius degree
+	int failures;
+	long long time;
+};
+
+struct StageStatusEntry{
+	bool valid;
+	double position;    //encoder, pulse
+	int failures;
+	long long time;     //host time of the sample
+};
+
+//single writer cell, a value is published by the release store of the count
+template<typename T>
+class StatusCell
+{
+public:
+	StatusCell(){ count = 0; }
+
+	void Publish(const T& value){
+		int n = count.loadAcquire();
+		values[n & (DEVICE_STATUS::CELL_SIZE-1)] = value;
+		count.storeRelease(n+1);
+	}
+	//the writer only reuses the slot read after CELL_SIZE-1 further polls
+	bool Get(T& value) const{
+		int n = count.loadAcquire();
+		if (n == 0){
+			return false;
+		}
+		value = values[(n-1) & (DEVICE_STATUS::CELL_SIZE-1)];
+		return true;
+	}
+
+private:
+	T values[DEVICE_STATUS::CELL_SIZE];
+	QAtomicInt count;
+};
+
+class DeviceStatusPoller : public QThread
+{
+public:
+	static string OBJECT_NAME;
+
+	explicit DeviceStatusPoller(QObject* parent = 0);
+	~DeviceStatusPoller();
+
+	void StartPolling();
+	void StopPolling();
+
+	//the poller stops using the former device before these return, so it may be disconnected then
+	void Set_Laser(STATUS_DEVICE laser, CLaser* device);
+	void Set_Camera(Camera* device);
+	void Set_PositionSampler(StagePositionSampler* sampler);
+
+	bool Get_LaserStatus(STATUS_DEVICE laser, LaserStatusEntry& entry) const;
+	bool Get_CameraStatus(CameraStatusEntry& entry) const { return cameraCell.Get(entry); }
+	bool Get_StageStatus(StageStatusEntry& entry) const { return stageCell.Get(entry); }
+
+protected:
+	virtual void run();
+	bool PollLaser(STATUS_DEVICE laser);
+	bool PollCamera();
+	bool PollStage();
+	void Schedule(STATUS_DEVICE device, bool success, long long now);
+
+private:
+	volatile bool isStopPolling;
+	QMutex deviceMutex;           //held while a device is polled
+	QWaitCondition deviceChanged;
+	CLaser* lasers[2];
+	Camera* camera;
+	StagePositionSampler* sampler;
+
+	//schedule, only used with deviceMutex locked
+	unsigned long basePeriods[STATUS_DEVICES];
+	unsigned long periods[STATUS_DEVICES];
+	long long nextPolls[STATUS_DEVICES];  //ms, 0 polls at once
+	int failures[STATUS_DEVICES];
+
+	StatusCell<LaserStatusEntry> laserCells[2];
+	StatusCell<CameraStatusEntry> cameraCell;
+	StatusCell<StageStatusEntry> stageCell;
+};
+
+#endif
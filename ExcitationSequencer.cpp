@@ -0,0 +1,377 @@
+
+#include "ExcitationSequencer.h"
+#include <stdio.h>
+#include <string.h>
+
+string ExcitationSequencer::OBJECT_NAME = "ExcitationSequencer";
+
+ExcitationSequencer::ExcitationSequencer(StageController* controller, QObject* parent)
+	: QThread(parent), controller(controller)
+{
+	laser488 = NULL;
+	laser561 = NULL;
+	mode488 = CWP;
+	mode561 = CWP;
+	modeChanged488 = false;
+	modeChanged561 = false;
+	isStopSequence = true;
+	plan.sequence = SINGLE;
+	plan.exposure = 0;
+	plan.readout = 0;
+	plan.frames = 0;
+	timing = Get_Timing(plan);
+	memset(&statistics, 0, sizeof(statistics));
+	frameDelay = 0;
+	firstFrame = 0;
+	lastFrame = 0;
+	firstTrigger = 0;
+	firstFrameIndex = 0;
+}
+
+ExcitationSequencer::~ExcitationSequencer()
+{
+	StopSequence();
+	controller = NULL;
+	laser488 = NULL;
+	laser561 = NULL;
+}
+
+void ExcitationSequencer::Set_Lasers(CLaser* laser_488, CLaser* laser_561)
+{
+	if (isRunning()){
+		return;
+	}
+	laser488 = laser_488;
+	laser561 = laser_561;
+}
+
+/*
+	The camera takes a trigger once the former frame is read out, so a frame lasts
+	the exposure and the readout. The gate of the laser opens in the command of the
+	trigger and has to be on before the exposure starts; the host schedule adds its
+	jitter. A period shorter than the round trip of the controller cannot be sent.
+*/
+ExcitationTiming ExcitationSequencer::Get_Timing(const ExcitationPlan& plan, double command_time)
+{
+	ExcitationTiming result;
+	double frame = plan.exposure + plan.readout + EXCITATION_SEQUENCER::LASER_SWITCH_TIME + EXCITATION_SEQUENCER::SCHEDULE_MARGIN;
+	result.period = max(frame*1.0e3, command_time);
+	result.frameRate = 1.0e3/result.period;
+	result.dutyCycle = plan.exposure*1.0e3/result.period;
+
+	char pattern[IMAGING_CHANNEL_LEN];
+	int length = 0;
+	ConvertImagingChannelSeqToArray(plan.sequence, pattern, length);
+	int gcampFrames = 0, rfpFrames = 0;
+	for (int i=0; i<length; ++i){
+		gcampFrames += (pattern[i] == GCAMP_CHANNEL) ? 1 : 0;
+		rfpFrames += (pattern[i] == RFP_CHANNEL) ? 1 : 0;
+	}
+	result.gcampRate = (length > 0) ? result.frameRate*gcampFrames/length : 0;
+	result.rfpRate = (length > 0) ? result.frameRate*rfpFrames/length : 0;
+	return result;
+}
+
+double ExcitationSequencer::Get_ReadoutTime(int image_height)
+{
+	return ((image_height+1)/2)*EXCITATION_SEQUENCER::LINE_TIME;
+}
+
+bool ExcitationSequencer::StartSequence(const ExcitationPlan& sequence_plan)
+{
+	if (isRunning()){
+		return false;
+	}
+	if (controller == NULL || laser488 == NULL || laser561 == NULL || !laser488->IsConnected() || !laser561->IsConnected()){
+		cout<<GetErrorString(OBJECT_NAME, "StartSequence()", "The controller and both lasers are required");
+		return false;
+	}
+	if (sequence_plan.sequence == SINGLE || sequence_plan.exposure <= 0 || sequence_plan.readout < 0){
+		cout<<GetErrorString(OBJECT_NAME, "StartSequence()", "Invalid excitation plan");
+		return false;
+	}
+	plan = sequence_plan;
+	mode488 = CWP;
+	mode561 = CWP;
+
+	triggerMutex.lock();
+	triggers.clear();
+	timing = Get_Timing(plan);
+	memset(&statistics, 0, sizeof(statistics));
+	frameDelay = 0;
+	firstFrame = 0;
+	lastFrame = 0;
+	firstTrigger = 0;
+	firstFrameIndex = 0;
+	triggerMutex.unlock();
+
+	isStopSequence = false;
+	start();
+	return true;
+}
+
+void ExcitationSequencer::StopSequence()
+{
+	isStopSequence = true;
+	wait();
+}
+
+ExcitationTiming ExcitationSequencer::Get_RunningTiming()
+{
+	QMutexLocker locker(&triggerMutex);
+	return timing;
+}
+
+ExcitationStatistics ExcitationSequencer::Get_Statistics()
+{
+	QMutexLocker locker(&triggerMutex);
+	return statistics;
+}
+
+/*
+	The frames come in the order of the triggers. The first one belongs to the first
+	trigger, the next ones to the trigger nearest to their exposure less the mean delay
+	of the camera, which covers its readout and transfer.
+*/
+int ExcitationSequencer::FindTrigger(long long time)
+{
+	if (triggers.empty()){
+		return -1;
+	}
+	long long halfExposure = (long long)(plan.exposure*0.5e6);
+	long long halfPeriod = (long long)(timing.period*500);
+	if (statistics.frames == 0){
+		long long maxDelay = (long long)(plan.readout*1.0e6) + EXCITATION_SEQUENCER::FRAME_DELAY*1000;
+		for (int i=0; i<(int)triggers.size(); ++i){
+			long long delay = time - (triggers[i].time + halfExposure);
+			if (delay < -halfPeriod){
+				break;
+			}
+			if (delay <= maxDelay){
+				return i;
+			}
+		}
+		return -1;
+	}
+	long long edge = time - halfExposure - (long long)frameDelay;
+	for (int i=(int)triggers.size()-1; i>=0; --i){
+		long long error = edge - triggers[i].time;
+		if (error < -halfPeriod){
+			continue;
+		}
+		return (error <= halfPeriod) ? i : -1;
+	}
+	return -1;
+}
+
+bool ExcitationSequencer::Get_Channel(long long time, char& channel)
+{
+	QMutexLocker locker(&triggerMutex);
+	int index = FindTrigger(time);
+	if (index < 0){
+		return false;
+	}
+	channel = triggers[index].channel;
+	return true;
+}
+
+/*
+	The frames are matched with the triggers by time, the triggers skipped by a frame are
+	missed. The match is checked against the count of the camera, which is independent of
+	the times: from the first matched frame on, a frame belongs to the trigger as many
+	places later as the camera counted frames. A trigger the camera ignored or a frame
+	lost without being counted breaks the order and is seen as a wrong channel, the
+	order is then taken up again from that frame.
+*/
+void ExcitationSequencer::ProcessFrame(const uchar*, const FrameInfo& info)
+{
+	QMutexLocker locker(&triggerMutex);
+	if (triggers.empty()){
+		return;
+	}
+	int index = FindTrigger(info.exposure_time);
+	if (index < 0 || triggers[index].received){
+		++statistics.unmatchedFrames;
+		return;
+	}
+	for (int i=0; i<index; ++i){
+		if (!triggers[i].received){
+			triggers[i].received = true;
+			++statistics.missedFrames;
+		}
+	}
+	ExcitationTrigger& trigger = triggers[index];
+	trigger.received = true;
+	++statistics.frames;
+	if (statistics.frames == 1){
+		firstTrigger = trigger.number;
+		firstFrameIndex = info.frame_index;
+	}
+	char pattern[IMAGING_CHANNEL_LEN];
+	int length = 0;
+	ConvertImagingChannelSeqToArray(plan.sequence, pattern, length);
+	unsigned long order = firstTrigger + (info.frame_index - firstFrameIndex);
+	if (length > 0 && pattern[order%length] != trigger.channel){
+		++statistics.wrongChannels;
+		firstTrigger = trigger.number;
+		firstFrameIndex = info.frame_index;
+	}
+
+	double delay = (double)(info.exposure_time - trigger.time) - plan.exposure*0.5e6;
+	if (statistics.frames == 1){
+		frameDelay = delay;
+		firstFrame = info.exposure_time;
+	} else{
+		frameDelay += EXCITATION_SEQUENCER::DELAY_FILTER*(delay-frameDelay);
+	}
+	lastFrame = info.exposure_time;
+}
+
+void ExcitationSequencer::run()
+{
+	bool success = false;
+	char strCommand[64];
+	try{
+		SetLaserModes(true);
+		double commandTime = MeasureCommandTime();
+		triggerMutex.lock();
+		timing = Get_Timing(plan, commandTime);
+		statistics.commandTime = commandTime;
+		triggerMutex.unlock();
+
+		char pattern[IMAGING_CHANNEL_LEN];
+		int length = 0;
+		ConvertImagingChannelSeqToArray(plan.sequence, pattern, length);
+		long long period = (long long)(timing.period*1.0e3);
+		long long margin = (long long)(EXCITATION_SEQUENCER::SCHEDULE_MARGIN*1.0e6);
+		long long next = Get_HostTime();
+		for (unsigned long k=0; !isStopSequence && (plan.frames == 0 || k < plan.frames); ++k){
+			WaitUntil(next);
+			ExcitationTrigger trigger;
+			trigger.channel = pattern[k%length];
+			trigger.number = k;
+			trigger.received = false;
+			int gate = (trigger.channel == GCAMP_CHANNEL) ? EXCITATION_SEQUENCER::GATE_OUTPUT_488 : EXCITATION_SEQUENCER::GATE_OUTPUT_561;
+			int other = (trigger.channel == GCAMP_CHANNEL) ? EXCITATION_SEQUENCER::GATE_OUTPUT_561 : EXCITATION_SEQUENCER::GATE_OUTPUT_488;
+
+			//the controller runs the instructions in order, so the gate leads the edge
+			sprintf(strCommand, "CB%d;SB%d;SB%d;CB%d", other, gate, CAMERA_TRIGGER::CONTROLLER_OUTPUT, CAMERA_TRIGGER::CONTROLLER_OUTPUT);
+			long long sent = Get_HostTime();
+			controller->command(string(strCommand));
+			trigger.time = (sent + Get_HostTime())/2;
+
+			triggerMutex.lock();
+			++statistics.triggers;
+			if (sent - next > margin){
+				++statistics.lateTriggers;
+			}
+			triggers.push_back(trigger);
+			while ((int)triggers.size() > EXCITATION_SEQUENCER::HISTORY_SIZE){
+				if (!triggers.front().received){
+					++statistics.missedFrames;
+				}
+				triggers.pop_front();
+			}
+			triggerMutex.unlock();
+
+			//a late edge delays the next ones, so the camera is never triggered during the readout
+			next = max(next + period, sent + period);
+		}
+		//the last frames are exposed and read out
+		msleep(long((plan.exposure+plan.readout)*1.0e3) + EXCITATION_SEQUENCER::FRAME_DELAY);
+		success = true;
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	} catch (string e){
+		cout<<GetErrorString(OBJECT_NAME, "run()", e);
+	}
+
+	try{
+		sprintf(strCommand, "CB%d;CB%d", EXCITATION_SEQUENCER::GATE_OUTPUT_488, EXCITATION_SEQUENCER::GATE_OUTPUT_561);
+		controller->command(string(strCommand));
+	} catch (string e){
+		cout<<GetErrorString(OBJECT_NAME, "run()", e);
+		success = false;
+	}
+	//the lasers are restored even when the controller failed
+	try{
+		SetLaserModes(false);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+		success = false;
+	} catch (string e){
+		cout<<GetErrorString(OBJECT_NAME, "run()", e);
+		success = false;
+	}
+
+	triggerMutex.lock();
+	for (size_t i=0; i<triggers.size(); ++i){
+		if (!triggers[i].received){
+			triggers[i].received = true;
+			++statistics.missedFrames;
+		}
+	}
+	statistics.frameDelay = frameDelay/1.0e3;
+	statistics.frameRate = (statistics.frames > 1 && lastFrame > firstFrame) ? (statistics.frames-1)*1.0e6/(lastFrame-firstFrame) : 0;
+	triggerMutex.unlock();
+	emit SequenceFinishedSignal(success);
+}
+
+//the digital modulation is checked by reading it back, the former modes are restored at the end.
+//only the lasers whose mode was read and then set are restored, each one even if another fails.
+void ExcitationSequencer::SetLaserModes(bool digital)
+{
+	CLaser* lasers[2] = {laser488, laser561};
+	LaserMode* modes[2] = {&mode488, &mode561};
+	bool* changed[2] = {&modeChanged488, &modeChanged561};
+	const char* names[2] = {"488", "561"};
+	string error;
+	for (int i=0; i<2; ++i){
+		if (!digital){
+			if (*changed[i]){
+				*changed[i] = false;
+				if (!lasers[i]->SetMode(*modes[i]) && error.empty()){
+					error = string("cannot restore the mode of the ") + names[i] + " laser";
+				}
+			}
+			continue;
+		}
+		if (!lasers[i]->GetMode(*modes[i])){
+			throw string("cannot read the mode of the ") + names[i] + " laser";
+		}
+		//a failed set may still have reached the laser
+		*changed[i] = true;
+		LaserMode mode;
+		if (!lasers[i]->SetMode(DIGITAL) || !lasers[i]->GetMode(mode) || mode != DIGITAL){
+			throw string("cannot set the digital modulation of the ") + names[i] + " laser";
+		}
+	}
+	if (!error.empty()){
+		throw error;
+	}
+}
+
+//the gates and the trigger are cleared by the commands measuring the round trip
+double ExcitationSequencer::MeasureCommandTime()
+{
+	char strCommand[64];
+	sprintf(strCommand, "CB%d;CB%d;CB%d", EXCITATION_SEQUENCER::GATE_OUTPUT_488, EXCITATION_SEQUENCER::GATE_OUTPUT_561,
+		CAMERA_TRIGGER::CONTROLLER_OUTPUT);
+	long long start = Get_HostTime();
+	for (int i=0; i<EXCITATION_SEQUENCER::TIMING_COMMANDS; ++i){
+		controller->command(string(strCommand));
+	}
+	return (Get_HostTime()-start)/1.0e3/EXCITATION_SEQUENCER::TIMING_COMMANDS;
+}
+
+//sleeps to the last ms, then yields to the edge time
+void ExcitationSequencer::WaitUntil(long long time)
+{
+	long long remain = time - Get_HostTime();
+	if (remain > 2000){
+		msleep((unsigned long)(remain/1000 - 1));
+	}
+	while (Get_HostTime() < time){
+		yieldCurrentThread();
+	}
+}
@@ -0,0 +1,112 @@
+/*****************************************************************
+ExcitationSequencer : alternates the 488 and 561 lasers with the
+                      camera frames. The lasers run in the digital
+                      modulation mode, gated by controller outputs,
+                      and every frame is started by the trigger
+                      output in the same command which opens its
+                      gate, so the channel of a frame is known from
+                      its trigger instead of inferred from the
+                      channel offset. The frames are checked against
+                      the triggers while the sequence runs.
+******************************************************************/
+#ifndef _EXCITATION_SEQUENCER_H_
+#define _EXCITATION_SEQUENCER_H_
+
+#include "FrameProcessor.h"
+#include "StageController.h"
+#include "Laser.h"
+#include "Camera_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <deque>
+
+struct ExcitationPlan{
+	ImagingChannelsSeq sequence;  //composite sequences only
+	double exposure;              //exposure time of the camera, s
+	double readout;               //readout of the camera at the current image size, s
+	unsigned long frames;         //0 runs until StopSequence
+};
+
+struct ExcitationTiming{
+	double period;      //frame period, ms
+	double frameRate;   //interleaved frames, Hz
+	double gcampRate;   //frames of each channel, Hz
+	double rfpRate;
+	double dutyCycle;   //fraction of the period the camera exposes
+};
+
+struct ExcitationStatistics{
+	unsigned long triggers;
+	unsigned long frames;          //frames matched with their trigger
+	unsigned long unmatchedFrames; //frames no trigger accounts for
+	unsigned long missedFrames;    //triggers without a frame
+	unsigned long wrongChannels;   //frames whose trigger breaks the order counted by the camera
+	unsigned long lateTriggers;    //triggers sent later than the schedule by more than the margin
+	double frameDelay;             //mean delay of the frames after the middle of their exposure, ms
+	double frameRate;              //achieved, Hz
+	double commandTime;            //round trip of the controller, ms
+};
+
+struct ExcitationTrigger{
+	long long time;   //host time of the edge, us
+	char channel;
+	unsigned long number;  //place in the sequence
+	bool received;
+};
+
+class ExcitationSequencer : public QThread, public FrameProcessor, public ChannelSource
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	//the gates and the trigger are outputs of controller
+	explicit ExcitationSequencer(StageController* controller, QObject* parent = 0);
+	~ExcitationSequencer();
+
+	void Set_Lasers(CLaser* laser488, CLaser* laser561);
+	//timing model of the interleaved frames for a controller round trip of command_time ms
+	static ExcitationTiming Get_Timing(const ExcitationPlan& plan, double command_time = 0);
+	static double Get_ReadoutTime(int image_height); //rolling shutter read from the center, s
+
+	bool StartSequence(const ExcitationPlan& plan);
+	void StopSequence();
+	ExcitationTiming Get_RunningTiming(); //timing with the measured round trip of the controller
+	ExcitationStatistics Get_Statistics();
+
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+	virtual bool Get_Channel(long long time, char& channel);
+
+signals:
+	void SequenceFinishedSignal(bool); //false when the lasers or the controller failed
+
+protected:
+	virtual void run();
+	void SetLaserModes(bool digital);
+	double MeasureCommandTime(); //ms
+	void WaitUntil(long long time);
+	int FindTrigger(long long time); //index of the trigger of the frame, -1 if none, called with triggerMutex locked
+
+private:
+	StageController* controller;
+	CLaser* laser488;
+	CLaser* laser561;
+	LaserMode mode488;  //modes restored at the end of the sequence
+	LaserMode mode561;
+	bool modeChanged488;//set to digital by the sequence, restored at its end
+	bool modeChanged561;
+	volatile bool isStopSequence;
+	ExcitationPlan plan;
+
+	QMutex triggerMutex;
+	std::deque<ExcitationTrigger> triggers;
+	ExcitationTiming timing;
+	ExcitationStatistics statistics;
+	double frameDelay;        //mean delay of the camera, us
+	long long firstFrame;     //exposure of the first matched frame, us
+	long long lastFrame;
+	unsigned long firstTrigger;    //trigger and camera index of the first matched frame
+	unsigned long firstFrameIndex;
+};
+
+#endif //_EXCITATION_SEQUENCER_H_
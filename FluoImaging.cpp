@@ -15,8 +15,9 @@ TrackingWindow::TrackingWindow(QWidget* parent) : QMainWindow(parent)
 	hamamatsuCamera = NULL;
 	statusBarContents.ready = false;
 
-	timerInterval = 10000;//10s
+	timerInterval = DEVICE_STATUS::DISPLAY_PERIOD;//the temperature is read from the status poller
 	tempTimer.setSingleShot(true);//for hamamastu camera
+	connect(&tempTimer, SIGNAL(timeout()), this, SLOT(UpdateHamamatsuTemperature()));
 
 	hamamatsuStopDisplayThread = new StopDisplayThread(HAMAMATSU_WINDOW);
 	connect(hamamatsuStopDisplayThread, SIGNAL(HasStopDisplaySignal(int)), this, SLOT(HasStopDisplaySlot()));
@@ -49,7 +50,7 @@ void TrackingWindow::closeEvent(QCloseEvent*  event)
 }
 
 void TrackingWindow::resizeEvent(QResizeEvent * event){
-	if (displayTabs != NULL && Hamamatsu_GCaMPFrame != NULL && Hamamatsu_RFPFrame != NULL){
+	if (displayTabs != NULL && Hamamatsu_GCaMPFrame != NULL && Hamamatsu_RFPFrame != NULL && Hamamatsu_RatioFrame != NULL){
 		//adjust the windows sizes
 		int displayWindowWidth = (displayTabs->geometry()).width();
 		int displayWindowHeight = (displayTabs->geometry()).height();
@@ -72,6 +73,11 @@ void TrackingWindow::resizeEvent(QResizeEvent * event){
 		Hamamatsu_RFPFrame->resize(displayWindowWidth, displayWindowHeight);
 		Hamamatsu_RFPFrame->setContentsMargins(x_offset, y_offset, x_offset, y_offset);
 		Hamamatsu_RFPWindow->resize(displayWindowWidth-2*x_offset, displayWindowHeight-2*y_offset);
+
+		// Hamamatsu G/R Ratio Window
+		Hamamatsu_RatioFrame->resize(displayWindowWidth, displayWindowHeight);
+		Hamamatsu_RatioFrame->setContentsMargins(x_offset, y_offset, x_offset, y_offset);
+		Hamamatsu_RatioWindow->resize(displayWindowWidth-2*x_offset, displayWindowHeight-2*y_offset);
 	}
 }
 
@@ -88,9 +94,12 @@ void TrackingWindow::CreateLayout()
 	Hamamatsu_GCaMPFrame->setStyleSheet(frameStyle);
 	Hamamatsu_RFPFrame = new QFrame;
 	Hamamatsu_RFPFrame->setStyleSheet(frameStyle);
+	Hamamatsu_RatioFrame = new QFrame;
+	Hamamatsu_RatioFrame->setStyleSheet(frameStyle);
 
 	Hamamatsu_GCaMPWindow = new MyGLWidget(hamamatsuWindowInfo);
 	Hamamatsu_RFPWindow = new MyGLWidget(hamamatsuWindowInfo);
+	Hamamatsu_RatioWindow = new MyGLWidget(hamamatsuWindowInfo);
 
 	//add Hamamatsu_Window, Andor_Window and IO_Window into related frames, respectively.
 	QHBoxLayout* hamamatsuGCaMPLayout = new QHBoxLayout;
@@ -105,6 +114,12 @@ void TrackingWindow::CreateLayout()
 	hamamatsuRFPLayout->setSpacing(0);
 	Hamamatsu_RFPFrame->setLayout(hamamatsuRFPLayout);
 
+	QHBoxLayout* hamamatsuRatioLayout = new QHBoxLayout;
+	hamamatsuRatioLayout->addWidget(Hamamatsu_RatioWindow);
+	hamamatsuRatioLayout->setMargin(0);
+	hamamatsuRatioLayout->setSpacing(0);
+	Hamamatsu_RatioFrame->setLayout(hamamatsuRatioLayout);
+
 	//connect the signals to the relative slots
 	connect(saveAction, SIGNAL(triggered()), this, SLOT(OnFileSaveAction()));
 	connect(saveAsAction, SIGNAL(triggered()), this, SLOT(OnFileSaveAction()));
@@ -120,10 +135,17 @@ void TrackingWindow::CreateLayout()
 
 	connect( controlPanel, SIGNAL(Hamamatsu_UpdateDisplayWindow()), Hamamatsu_GCaMPWindow, SLOT(update()) );
 	connect( controlPanel, SIGNAL(Hamamatsu_UpdateDisplayWindow()), Hamamatsu_RFPWindow, SLOT(update()) );
+	connect( controlPanel, SIGNAL(Hamamatsu_UpdateDisplayWindow()), Hamamatsu_RatioWindow, SLOT(update()) );
 	connect( controlPanel, SIGNAL(StopDisplayImagesSignal(int)), this, SLOT(StopDisplayImageSlot(int)) );
+	connect( controlPanel, SIGNAL(Hamamatsu_ImageSizeChanged(int, int)), this, SLOT(UpdateHamamatsuImageSize(int, int)) );
+	connect( controlPanel->Get_RatioImagingThread(), SIGNAL(RatioImageSignal(int)), this, SLOT(DisplayRatioImageSlot(int)), Qt::QueuedConnection );
+	connect( Hamamatsu_RatioWindow, SIGNAL(UpdateFocusRegionSignal(int, ImageRegion)), controlPanel, SLOT(SetRatioRegion(int, ImageRegion)) );
+	connect( Hamamatsu_GCaMPWindow, SIGNAL(UpdateFocusRegionSignal(int, ImageRegion)), controlPanel, SLOT(SetFocusRegion(int, ImageRegion)) );
+	connect( Hamamatsu_RFPWindow, SIGNAL(UpdateFocusRegionSignal(int, ImageRegion)), controlPanel, SLOT(SetFocusRegion(int, ImageRegion)) );
 
 	connect(Hamamatsu_GCaMPWindow, SIGNAL(UpdatePositionStatus()), this, SLOT(ShowCurrentPositionAndValue()));
 	connect(Hamamatsu_RFPWindow, SIGNAL(UpdatePositionStatus()), this, SLOT(ShowCurrentPositionAndValue()));	
+	connect(Hamamatsu_RatioWindow, SIGNAL(UpdatePositionStatus()), this, SLOT(ShowCurrentPositionAndValue()));
 	
 	setCentralWidget(displayTabs);
 	setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Preferred);
@@ -132,6 +154,7 @@ void TrackingWindow::CreateLayout()
 	this->resize(800,800);
 	displayTabs->addTab(Hamamatsu_GCaMPFrame, tr("Channel 1"));
 	displayTabs->addTab(Hamamatsu_RFPFrame, tr("Channel 2"));
+	displayTabs->addTab(Hamamatsu_RatioFrame, tr("G/R Ratio"));
 
 	//adjust the windows sizes
 	int displayWindowWidth = (displayTabs->geometry()).width();
@@ -155,6 +178,11 @@ void TrackingWindow::CreateLayout()
 	Hamamatsu_RFPFrame->resize(displayWindowWidth, displayWindowHeight);
 	Hamamatsu_RFPFrame->setContentsMargins(x_offset, y_offset, x_offset, y_offset);
 	Hamamatsu_RFPWindow->resize(displayWindowWidth-2*x_offset, displayWindowHeight-2*y_offset);
+
+	// Hamamatsu G/R Ratio Window
+	Hamamatsu_RatioFrame->resize(displayWindowWidth, displayWindowHeight);
+	Hamamatsu_RatioFrame->setContentsMargins(x_offset, y_offset, x_offset, y_offset);
+	Hamamatsu_RatioWindow->resize(displayWindowWidth-2*x_offset, displayWindowHeight-2*y_offset);
 }
 
 void TrackingWindow::DockFocusPanel()
@@ -381,6 +409,9 @@ void TrackingWindow::OnTabChanged(int index)
 void TrackingWindow::ClearHamamatsuCamera()
 {
 	if (hamamatsuCamera != NULL){
+		if (controlPanel != NULL){
+			controlPanel->Get_DeviceStatusPoller()->Set_Camera(NULL);
+		}
 		hamamatsuCamera->Disconnect();
 		delete hamamatsuCamera;
 		hamamatsuCamera = NULL;
@@ -423,6 +454,7 @@ void TrackingWindow::ConnectHamamatsuCamera(bool state)
 
 			//Enable Hamamatsu camera settings
 			controlPanel->EnableHamamatsuGroup(true);
+			controlPanel->Get_DeviceStatusPoller()->Set_Camera(hamamatsuCamera);
 
 		} catch (QException e){
 			ClearHamamatsuCamera();
@@ -432,6 +464,7 @@ void TrackingWindow::ConnectHamamatsuCamera(bool state)
 	}
 	else {
 		disconnect( hamamatsuCamera, SIGNAL(DisplayImageSignal(int)), this, SLOT(DisplayImageSlot(int)));
+		controlPanel->Get_DeviceStatusPoller()->Set_Camera(NULL);
 		hamamatsuCamera->Disconnect();
 
 		//Update toolbar and statusbar
@@ -479,7 +512,8 @@ void TrackingWindow::OnLiveAction()
 		hamamatsuCamera->Live();
 		toolBarContents.isLive = true;
 		hamamatsuWindowInfo.isLive = 1;
-		connect( hamamatsuCamera->acquireImageThread, SIGNAL(FinishSaveImageSignal(int)), controlPanel, SLOT(FinishSaveImage(int)) );
+		//the acquiring thread outlives a live, so it is not connected twice
+		connect( hamamatsuCamera->acquireImageThread, SIGNAL(FinishSaveImageSignal(int)), controlPanel, SLOT(FinishSaveImage(int)), Qt::UniqueConnection );
 
 		liveAction->setEnabled(false);
 		stopLiveAction->setEnabled(true);
@@ -508,22 +542,25 @@ void TrackingWindow::OnStopLiveAction()
 
 void TrackingWindow::DisplayImageSlot(int windowFlag)
 {
-	char channelArray[IMAGING_CHANNEL_LEN];
-	int channel_len = 0;
-	int offset = hamamatsuWindowInfo.channelOffset;
-	ConvertImagingChannelSeqToArray(hamamatsuWindowInfo.imagingChannelSeq, channelArray, channel_len);
+	char channel = hamamatsuWindowInfo.image_channel;
 
-	if (hamamatsuWindowInfo.imagingChannelSeq == SINGLE || channelArray[(hamamatsuWindowInfo.image_num+offset)%channel_len] == GCAMP_CHANNEL){
+	if (hamamatsuWindowInfo.imagingChannelSeq == SINGLE || channel == GCAMP_CHANNEL){
 		// Show GCaMP image
 		Hamamatsu_GCaMPWindow->ShowImage(hamamatsuWindowInfo.image_data, hamamatsuWindowInfo.image_width, hamamatsuWindowInfo.image_height,
 				hamamatsuWindowInfo.data_type);
-	} else if (channelArray[(hamamatsuWindowInfo.image_num+offset)%channel_len] == RFP_CHANNEL){
+	} else if (channel == RFP_CHANNEL){
 		// Show RFP image
 		Hamamatsu_RFPWindow->ShowImage(hamamatsuWindowInfo.image_data, hamamatsuWindowInfo.image_width, hamamatsuWindowInfo.image_height,
 				hamamatsuWindowInfo.data_type);
 	}
 }
 
+void TrackingWindow::DisplayRatioImageSlot(int index)
+{
+	ImageBuffer ratioImage = controlPanel->Get_RatioImagingThread()->Get_RatioImage(index);
+	Hamamatsu_RatioWindow->ShowImage(ratioImage.image_data, ratioImage.image_width, ratioImage.image_height, ratioImage.data_type);
+}
+
 void TrackingWindow::StopDisplayImageSlot(int window_flag)
 {
 	if (window_flag == (int)HAMAMATSU_WINDOW){
@@ -546,11 +583,38 @@ void TrackingWindow::OnResetAction()
 	if (windowFlag == (int)HAMAMATSU_WINDOW){
 		Hamamatsu_GCaMPWindow->Reset();
 		Hamamatsu_RFPWindow->Reset();
+		Hamamatsu_RatioWindow->Reset();
 	}
 }
 
+//the poller of the control panel queries the camera, the GUI only reads its cell
 void TrackingWindow::UpdateHamamatsuTemperature()
 {
+	CameraStatusEntry entry;
+	if (controlPanel != NULL && controlPanel->Get_DeviceStatusPoller()->Get_CameraStatus(entry) && entry.valid){
+		statusBarContents.temperature = entry.temperature;
+		stateLabel->setText(tr("Ready, ") + QString::number(entry.temperature, 'f', 1) + QString::fromLocal8Bit(" "));
+	}
+	if (statusBarContents.ready){
+		tempTimer.start(timerInterval);
+	}
+}
+
+//the windows keep the aspect of the new subarray, the former zoom and focus region are dropped
+void TrackingWindow::UpdateHamamatsuImageSize(int width, int height)
+{
+	statusBarContents.imageWidth = width;
+	statusBarContents.imageHeight = height;
+	imageSizeLabel->setText(QString::number(width) + tr("x") + QString::number(height));
+
+	hamamatsuWindowInfo.image_width = width;
+	hamamatsuWindowInfo.image_height = height;
+	resizeEvent(NULL);
+	Hamamatsu_GCaMPWindow->StopShowFocusRegion(HAMAMATSU_WINDOW);
+	Hamamatsu_RFPWindow->StopShowFocusRegion(HAMAMATSU_WINDOW);
+	Hamamatsu_GCaMPWindow->Reset();
+	Hamamatsu_RFPWindow->Reset();
+	Hamamatsu_RatioWindow->Reset();
 }
 
 //0: x10
@@ -55,6 +55,7 @@ public:
 	
 public slots:
 	void DisplayImageSlot(int);
+	void DisplayRatioImageSlot(int);
 	void StopDisplayImageSlot(int);
 	void HasStopDisplaySlot();
 	void ShowCurrentPositionAndValue();
@@ -75,6 +76,7 @@ protected:
 
 protected slots:
 	void UpdateHamamatsuTemperature();
+	void UpdateHamamatsuImageSize(int width, int height);
 	void OnFileSaveAction();
 	void OnTabChanged(int index);
 	void OnConnectAction();
@@ -126,8 +128,11 @@ private:
 	QTabWidget* displayTabs;
 	QFrame* Hamamatsu_GCaMPFrame;
 	QFrame* Hamamatsu_RFPFrame;
+	QFrame* Hamamatsu_RatioFrame;
 	MyGLWidget* Hamamatsu_GCaMPWindow;
 	MyGLWidget* Hamamatsu_RFPWindow;
+	MyGLWidget* Hamamatsu_RatioWindow;
+
 	//DisplayWindowFlag currentWindow; //current displaying content
 
 	//StatusBar
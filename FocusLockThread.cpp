@@ -0,0 +1,227 @@
+#include "FocusLockThread.h"
+#include <cmath>
+#include <string.h>
+
+string FocusLockThread::OBJECT_NAME = "FocusLockThread";
+
+FocusLockThread::FocusLockThread(Stage* stage, QObject* parent) : QThread(parent), stage(stage)
+{
+	isStopLock = true;
+	isRecording = false;
+	focusMetric = BRENNER_GRADIENT;
+	focusRegion.x_offset = 0;
+	focusRegion.y_offset = 0;
+	focusRegion.width = 0;
+	focusRegion.height = 0;
+	focusChannel = 0;
+	frameCount = 0;
+	hasSample = false;
+	lockPosition = 0;
+	referenceMetric = 0;
+	hasReference = false;
+	direction = 1;
+	step = FOCUS_LOCK::MAX_STEP;
+	settling = false;
+	metricSum = 0;
+	metricCount = 0;
+}
+
+FocusLockThread::~FocusLockThread()
+{
+	StopLock();
+	StopRecording();
+	stage = NULL;
+}
+
+void FocusLockThread::StartLock()
+{
+	if (isRunning() || stage == NULL){
+		return;
+	}
+	sampleMutex.lock();
+	frameCount = 0;
+	hasSample = false;
+	sampleMutex.unlock();
+
+	hasReference = false;
+	direction = 1;
+	step = FOCUS_LOCK::MAX_STEP;
+	settling = false;
+	metricSum = 0;
+	metricCount = 0;
+	moveTimer.invalidate();
+	isStopLock = false;
+	start();
+}
+
+void FocusLockThread::StopLock()
+{
+	isStopLock = true;
+	sampleReady.wakeAll();
+	wait();
+}
+
+void FocusLockThread::Set_FocusRegion(ImageRegion region)
+{
+	QMutexLocker locker(&sampleMutex);
+	focusRegion = region;
+}
+
+void FocusLockThread::Set_FocusChannel(char channel)
+{
+	QMutexLocker locker(&sampleMutex);
+	focusChannel = channel;
+}
+
+bool FocusLockThread::StartRecording(QString folder, QString prefix)
+{
+	StopRecording();
+
+	QMutexLocker locker(&recordMutex);
+	traceFile.setFileName(folder + "\\" + prefix + "_focus.txt");
+	if (!traceFile.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+traceFile.fileName().toStdString());
+		return false;
+	}
+	traceStream.setDevice(&traceFile);
+	traceStream<<"frame\ttimestamp\tposition(um)\tmetric\tcorrection(um)\n";
+	isRecording = true;
+	return true;
+}
+
+void FocusLockThread::StopRecording()
+{
+	QMutexLocker locker(&recordMutex);
+	if (!isRecording){
+		return;
+	}
+	isRecording = false;
+	traceStream.flush();
+	traceFile.close();
+}
+
+/*
+	Called in the acquisition thread: every SAMPLE_INTERVAL frames of the focus
+	channel the focus region is copied, unless the lock thread is still busy
+	with the former sample
+*/
+void FocusLockThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopLock || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+
+	QMutexLocker locker(&sampleMutex);
+	if (focusChannel != 0 && (info.channel == GCAMP_CHANNEL || info.channel == RFP_CHANNEL)
+		&& info.channel != focusChannel){
+		return;
+	}
+	if ((frameCount++)%FOCUS_LOCK::SAMPLE_INTERVAL != 0 || hasSample){
+		return;
+	}
+
+	ImageRegion region = Get_ValidFocusRegion(focusRegion, info.image_width, info.image_height);
+	sampleBuffer.resize((size_t)region.width*region.height);
+	for (int row=0; row<region.height; ++row){
+		const uchar* src = data + (size_t)(region.y_offset+row)*info.row_bytes + region.x_offset*sizeof(ushort);
+		memcpy(&sampleBuffer[(size_t)row*region.width], src, region.width*sizeof(ushort));
+	}
+	sample.frame_index = info.frame_index;
+	sample.timestamp = info.timestamp;
+	sample.width = region.width;
+	sample.height = region.height;
+	hasSample = true;
+	sampleReady.wakeAll();
+}
+
+void FocusLockThread::run()
+{
+	try{
+		lockPosition = stage->Get_CurrentPosition();
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+		isStopLock = true;
+		return;
+	}
+
+	while (!isStopLock){
+		sampleMutex.lock();
+		if (!hasSample){
+			sampleReady.wait(&sampleMutex, 100);
+		}
+		if (!hasSample){
+			sampleMutex.unlock();
+			continue;
+		}
+		FocusSample current = sample;
+		workBuffer.swap(sampleBuffer);
+		hasSample = false;
+		sampleMutex.unlock();
+
+		try{
+			//samples are skipped until the correction finished and the rate limit elapsed,
+			//the first sample after that may still be exposed during the motion
+			if (settling){
+				if (stage->IsMoving() || moveTimer.elapsed() < step/FOCUS_LOCK::MAX_RATE*1000){
+					continue;
+				}
+				settling = false;
+				continue;
+			}
+
+			metricSum += Get_FocusMeasure(focusMetric, &workBuffer[0], current.width, current.height);
+			if (++metricCount < FOCUS_LOCK::AVERAGE_SAMPLES){
+				continue;
+			}
+			double metric = metricSum/metricCount;
+			metricSum = 0;
+			metricCount = 0;
+
+			double position = stage->Get_CurrentPosition();
+			double correction = Correct(metric, position);
+
+			recordMutex.lock();
+			if (isRecording){
+				traceStream<<current.frame_index<<"\t"<<current.timestamp<<"\t"<<position*Z1_STAGE::Z1_PRECISION
+					<<"\t"<<metric<<"\t"<<correction<<"\n";
+			}
+			recordMutex.unlock();
+
+			emit FocusLockSignal(metric, (position-lockPosition)*Z1_STAGE::Z1_PRECISION, correction);
+		} catch (QException e){
+			cout<<e.getMessage()<<endl;
+		}
+	}
+}
+
+/*
+	Hill climbing: keep the direction while the metric does not drop by more than
+	the deadband, otherwise reverse and halve the step. Returns the correction (um).
+*/
+double FocusLockThread::Correct(double metric, double position)
+{
+	if (hasReference && referenceMetric > 0){
+		double change = (metric-referenceMetric)/referenceMetric;
+		if (change < -FOCUS_LOCK::DEADBAND){
+			direction = -direction;
+			step = max(step/2, FOCUS_LOCK::MIN_STEP);
+		} else if (change > FOCUS_LOCK::DEADBAND){
+			step = min(step*2, FOCUS_LOCK::MAX_STEP);
+		}
+	}
+	referenceMetric = metric;
+	hasReference = true;
+
+	double correction = direction*step;
+	if (fabs((position-lockPosition)*Z1_STAGE::Z1_PRECISION + correction) > FOCUS_LOCK::MAX_EXCURSION){
+		cout<<OBJECT_NAME<<": focus lost, correction exceeds "<<FOCUS_LOCK::MAX_EXCURSION<<"um"<<endl;
+		isStopLock = true;
+		emit FocusLostSignal();
+		return 0;
+	}
+
+	stage->Move_Closeloop_Realtime(correction/Z1_STAGE::Z1_PRECISION);
+	moveTimer.restart();
+	settling = true;
+	return correction;
+}
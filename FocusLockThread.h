@@ -0,0 +1,82 @@
+/*****************************************************************
+FocusLockThread : Keep the sample in focus during long recordings
+                  by hill climbing the focus metric of the streaming
+                  frames with small closed loop z corrections
+******************************************************************/
+#ifndef _FOCUS_LOCK_THREAD_H_
+#define _FOCUS_LOCK_THREAD_H_
+
+#include "AutoFocusThread.h"
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QElapsedTimer>
+
+struct FocusSample{
+	unsigned long frame_index;
+	long long timestamp;
+	int width;
+	int height;
+};
+
+class FocusLockThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit FocusLockThread(Stage* stage, QObject* parent = 0);
+	~FocusLockThread();
+
+	void StartLock();
+	void StopLock();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	void Set_FocusRegion(ImageRegion region);
+	void Set_FocusMetric(FocusMetric metric){ focusMetric = metric; }
+	void Set_FocusChannel(char channel);
+	bool StartRecording(QString folder, QString prefix);
+	void StopRecording();
+
+signals:
+	void FocusLockSignal(double, double, double); //metric, offset from locked position and correction (um)
+	void FocusLostSignal();                       //correction exceeds the max excursion
+
+protected:
+	virtual void run();
+	double Correct(double metric, double position);
+
+private:
+	Stage* stage;
+	volatile bool isStopLock;
+	FocusMetric focusMetric;
+
+	//sample exchange with the acquisition thread
+	QMutex sampleMutex;
+	QWaitCondition sampleReady;
+	ImageRegion focusRegion;
+	char focusChannel;
+	unsigned long frameCount;
+	bool hasSample;
+	FocusSample sample;
+	vector<ushort> sampleBuffer;
+	vector<ushort> workBuffer;
+
+	//hill climbing state, only used in the lock thread
+	double lockPosition;
+	double referenceMetric;
+	bool hasReference;
+	int direction;
+	double step;
+	bool settling;
+	double metricSum;
+	int metricCount;
+	QElapsedTimer moveTimer;
+
+	//recording
+	QMutex recordMutex;
+	bool isRecording;
+	QFile traceFile;
+	QTextStream traceStream;
+};
+
+#endif //_FOCUS_LOCK_THREAD_H_
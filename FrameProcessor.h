@@ -0,0 +1,101 @@
+/*****************************************************************
+FrameProcessor : Interface of the consumers which get every frame
+                 acquired by a camera
+FrameDispatcher : Frame source which hands its frames to the
+                  registered frame processors
+PositionSource : Stage position at a host time, joined with the
+                 frames at their exposure time
+ChannelSource : Excitation channel of the exposure at a host time,
+                known when the lasers are sequenced with the frames
+******************************************************************/
+#ifndef _FRAME_PROCESSOR_H_
+#define _FRAME_PROCESSOR_H_
+
+#include "Util.h"
+#include <QtCore/QMutex>
+#include <vector>
+#include <algorithm>
+
+class FrameProcessor
+{
+public:
+	virtual ~FrameProcessor(){}
+
+	//Called in the thread of the frame source while its buffer is valid.
+	//Implementations copy what they need and return as soon as possible.
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info) = 0;
+};
+
+class PositionSource
+{
+public:
+	virtual ~PositionSource(){}
+
+	//position at the host time (us, Get_HostTime), false if it is not covered by the samples
+	virtual bool Get_Position(long long time, double& position) = 0;
+};
+
+class ChannelSource
+{
+public:
+	virtual ~ChannelSource(){}
+
+	//channel of the frame exposed around the host time (us, Get_HostTime), false if no excitation is known
+	virtual bool Get_Channel(long long time, char& channel) = 0;
+};
+
+class FrameDispatcher
+{
+public:
+	FrameDispatcher() : positionSource(NULL), channelSource(NULL){}
+	virtual ~FrameDispatcher(){}
+
+	void AddFrameProcessor(FrameProcessor* processor){
+		QMutexLocker locker(&processorMutex);
+		if (std::find(frameProcessors.begin(), frameProcessors.end(), processor) == frameProcessors.end()){
+			frameProcessors.push_back(processor);
+		}
+	}
+	//the processor is not called any more once it returns
+	void RemoveFrameProcessor(FrameProcessor* processor){
+		QMutexLocker locker(&processorMutex);
+		frameProcessors.erase(std::remove(frameProcessors.begin(), frameProcessors.end(), processor), frameProcessors.end());
+	}
+	bool HasFrameProcessors(){
+		QMutexLocker locker(&processorMutex);
+		return !frameProcessors.empty();
+	}
+	void DispatchFrame(const uchar* data, const FrameInfo& info){
+		QMutexLocker locker(&processorMutex);
+		for (size_t i=0; i<frameProcessors.size(); ++i){
+			frameProcessors[i]->ProcessFrame(data, info);
+		}
+	}
+
+	void Set_PositionSource(PositionSource* source){
+		QMutexLocker locker(&processorMutex);
+		positionSource = source;
+	}
+	bool Get_FramePosition(long long time, double& position){
+		QMutexLocker locker(&processorMutex);
+		return (positionSource != NULL) && positionSource->Get_Position(time, position);
+	}
+
+	//the frames take the channel of the source instead of the one inferred from the channel offset
+	void Set_ChannelSource(ChannelSource* source){
+		QMutexLocker locker(&processorMutex);
+		channelSource = source;
+	}
+	bool Get_FrameChannel(long long time, char& channel){
+		QMutexLocker locker(&processorMutex);
+		return (channelSource != NULL) && channelSource->Get_Channel(time, channel);
+	}
+
+protected:
+	QMutex processorMutex;
+	std::vector<FrameProcessor*> frameProcessors;
+	PositionSource* positionSource;
+	ChannelSource* channelSource;
+};
+
+#endif //_FRAME_PROCESSOR_H_
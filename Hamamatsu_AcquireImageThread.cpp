@@ -1,8 +1,10 @@
 
 #include "Hamamatsu_AcquireImageThread.h"
 #include "DevicePackage.h"
+#include "ImageKernels.h"
 
 #include <QtCore\QDateTime>
+#include <stdio.h>
 
 string Hamamatsu_AcquireImageThread::OBJECT_NAME = "Hamamatsu_AcquireImageThread";
 Hamamatsu_AcquireImageThread::Hamamatsu_AcquireImageThread(Hamamatsu_Camera* camera):Camera(camera)
@@ -12,6 +14,37 @@ Hamamatsu_AcquireImageThread::Hamamatsu_AcquireImageThread(Hamamatsu_Camera* cam
 	Buffer_Index = 0;
 	SaveImage_Index = 0;
 	ImageCount = 0;
+	exposureTime = 0;
+	bufferBytes = 0;
+	packedFrames = false;
+	unpackBuffer = NULL;
+	unpackBytes = 0;
+	binBuffer = NULL;
+	image_width = 0;
+	image_height = 0;
+	data_width = 0;
+	data_height = 0;
+	softwareBinning = 1;
+	isStreaming = false;
+	isCapturing = false;
+	isReconfigure = false;
+	reconfigureSuccess = false;
+	settings.changes = 0;
+	isSnap = false;
+	snapSuccess = false;
+	snapRequest = 0;
+	memset(&snapImage, 0, sizeof(snapImage));
+	snapPixels = NULL;
+	ringFrames = 0;
+	lastFrameCount = 0;
+	lastWaitTime = 0;
+	lastWaitCount = 0;
+	framePeriod = 0;
+	processTime = 0;
+	backlog = 0;
+	maxBacklog = 0;
+	lostFrames = 0;
+	UpdateFrameGeometry();
 	CreateBuffers();
 }
 
@@ -26,7 +59,10 @@ Hamamatsu_AcquireImageThread::~Hamamatsu_AcquireImageThread()
 
 void Hamamatsu_AcquireImageThread::StopThread()
 {
+	sessionMutex.lock();
 	isStopAcquireImage = true;
+	sessionChanged.wakeAll();
+	sessionMutex.unlock();
 }
 
 void Hamamatsu_AcquireImageThread::StartThread()
@@ -35,41 +71,259 @@ void Hamamatsu_AcquireImageThread::StartThread()
 	start();
 }
 
+bool Hamamatsu_AcquireImageThread::StartStream()
+{
+	QMutexLocker locker(&sessionMutex);
+	isStreaming = true;
+	sessionChanged.wakeAll();
+	while (isStreaming && !isCapturing && isRunning()){
+		sessionChanged.wait(&sessionMutex, 100);
+	}
+	return isCapturing;
+}
+
+void Hamamatsu_AcquireImageThread::StopStream()
+{
+	QMutexLocker locker(&sessionMutex);
+	isStreaming = false;
+	sessionChanged.wakeAll();
+	while (isCapturing && isRunning()){
+		sessionChanged.wait(&sessionMutex, 100);
+	}
+}
+
+/*
+	The session allocates the frames of the driver once, live only starts and idles the
+	capture, so it toggles within a frame. The thread sleeps while the capture is idle
+	and wakes up for a change of the stream or of the settings.
+*/
 void Hamamatsu_AcquireImageThread::run()
 {
-	//allocate capturing buffer
+	HDCAM hdcam = Camera->Get_Handle();
+	if (AllocateFrames()){
+		//get image size
+		UpdateFrameGeometry();
+		double exposure = 0;
+		if (Camera->Get_ExposureTime(exposure)){
+			Set_ExposureTime(exposure);
+		}
+	}
+
+	while (!isStopAcquireImage && hasAllocatedFrames){
+		if (isReconfigure){
+			ReconfigureStream();
+			continue;
+		}
+		if (isStreaming != isCapturing){
+			SwitchCapture();
+			continue;
+		}
+		if (isSnap && !isCapturing){
+			SnapFrame();
+			continue;
+		}
+		if (!isCapturing){
+			sessionMutex.lock();
+			if (!isStopAcquireImage && !isReconfigure && !isStreaming && !isSnap){
+				sessionChanged.wait(&sessionMutex, 100);
+			}
+			sessionMutex.unlock();
+			continue;
+		}
+		AcquireImage();
+	}
+
+	//stop capturing and release the frames of the driver
+	dcam_idle(hdcam);
+	if (hasAllocatedFrames){
+		dcam_freeframe(hdcam);
+		hasAllocatedFrames = false;
+	}
+
+	//a change requested while stopping is not applied
+	sessionMutex.lock();
+	isCapturing = false;
+	isReconfigure = false;
+	sessionChanged.wakeAll();
+	sessionMutex.unlock();
+}
+
+bool Hamamatsu_AcquireImageThread::Reconfigure(const StreamSettings& stream_settings)
+{
+	QMutexLocker locker(&sessionMutex);
+	settings = stream_settings;
+	reconfigureSuccess = false;
+	isReconfigure = true;
+	sessionChanged.wakeAll();
+	while (isReconfigure && isRunning()){
+		sessionChanged.wait(&sessionMutex, 100);
+	}
+	bool success = !isReconfigure && reconfigureSuccess;
+	isReconfigure = false;
+	return success;
+}
+
+bool Hamamatsu_AcquireImageThread::Snap(ImageBuffer& buffer, vector<ushort>& pixels, unsigned long timeout_ms)
+{
+	QMutexLocker locker(&sessionMutex);
+	snapRequest = Get_HostTime();
+	snapSuccess = false;
+	snapPixels = &pixels;
+	isSnap = true;
+	sessionChanged.wakeAll();
+	long long deadline = snapRequest + (long long)timeout_ms*1000;
+	while (isSnap && isRunning() && Get_HostTime() < deadline){
+		sessionChanged.wait(&sessionMutex, 100);
+	}
+	//a frame later than the timeout is not taken
+	isSnap = false;
+	snapPixels = NULL;
+	if (snapSuccess){
+		buffer = snapImage;
+	}
+	return snapSuccess;
+}
+
+DriverRingStatus Hamamatsu_AcquireImageThread::Get_RingStatus()
+{
+	DriverRingStatus status;
+	status.frames = hasAllocatedFrames ? ringFrames : 0;
+	status.backlog = backlog;
+	status.maxBacklog = maxBacklog;
+	status.lostFrames = lostFrames;
+	status.framePeriod = framePeriod;
+	status.processTime = processTime;
+	return status;
+}
+
+//the camera sizes the ring from the frame rate
+bool Hamamatsu_AcquireImageThread::AllocateFrames()
+{
 	char buf[256];
-	if (!dcam_allocframe(Camera->Get_Handle(), 3)){
+	ringFrames = Camera->Get_DriverFrames();
+	if (!dcam_allocframe(Camera->Get_Handle(), ringFrames)){
 		dcam_getlasterror(Camera->Get_Handle(), buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "run(): dcam_allocframe()", string(buf))<<endl<<"exit acquiring image thread ..."<<endl;
-		return;
-	} else{
-		hasAllocatedFrames = true;
+		cout<<GetErrorString(OBJECT_NAME, "AllocateFrames(): dcam_allocframe()", string(buf));
+		return false;
 	}
+	hasAllocatedFrames = true;
+	return true;
+}
 
-	if (!dcam_capture( Camera->Get_Handle())){
+//the frame counts of the driver restart with the capture
+bool Hamamatsu_AcquireImageThread::StartCapture()
+{
+	char buf[256];
+	lastFrameCount = 0;
+	lastWaitTime = 0;
+	lastWaitCount = 0;
+	backlog = 0;
+	if (!dcam_capture(Camera->Get_Handle())){
 		dcam_getlasterror(Camera->Get_Handle(), buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "run(): dcam_allocframe()", string(buf))<<endl<<"exit acquiring image thread ..."<<endl;
-		//release capturing buffer
-		dcam_freeframe(Camera->Get_Handle());
+		cout<<GetErrorString(OBJECT_NAME, "StartCapture(): dcam_capture()", string(buf));
+		return false;
+	}
+	return true;
+}
+
+//a new live restarts the frame count and the channel sequence like a new stream
+void Hamamatsu_AcquireImageThread::SwitchCapture()
+{
+	bool streaming = isStreaming;
+	bool capturing = false;
+	if (streaming){
+		ImageCount = 0;
+		SaveImage_Index = 0;
+		maxBacklog = 0;
+		lostFrames = 0;
+		framePeriod = (double)exposureTime;
+		processTime = 0;
+		capturing = StartCapture();
+	} else{
+		dcam_idle(Camera->Get_Handle());
+	}
+
+	sessionMutex.lock();
+	isCapturing = capturing;
+	if (streaming && !capturing){
+		isStreaming = false;
+	}
+	sessionChanged.wakeAll();
+	sessionMutex.unlock();
+}
+
+//the size of the frames handed on and the part of the binning done here
+void Hamamatsu_AcquireImageThread::UpdateFrameGeometry()
+{
+	ImageSize imageSize, dataSize;
+	if (Camera->Get_DataSize(dataSize) && Camera->Get_ImageSize(imageSize)){
+		data_width = dataSize.width;
+		data_height = dataSize.height;
+		image_width = imageSize.width;
+		image_height = imageSize.height;
+		softwareBinning = Camera->Get_SoftwareBinning();
+	}
+	PixelEncodingType encoding;
+	packedFrames = Camera->Get_PixelEncoding(encoding) && encoding == Mono12Packed;
+}
+
+/*
+	The capture is idled and the settings are applied together, then the capture resumes
+	in this thread, so the stream is not torn down. The frames of the driver are only
+	released for the subarray, the binning, the ring and the pixel encoding, and the
+	buffers are reallocated when the new frame does not fit in them.
+*/
+void Hamamatsu_AcquireImageThread::ReconfigureStream()
+{
+	sessionMutex.lock();
+	StreamSettings changes = settings;
+	sessionMutex.unlock();
+
+	char buf[256];
+	HDCAM hdcam = Camera->Get_Handle();
+	bool wasCapturing = isCapturing;
+	bool geometry = (changes.changes & (STREAM_SUBARRAY | STREAM_BINNING | STREAM_DRIVER_FRAMES | STREAM_PIXEL_ENCODING)) != 0;
+	if (wasCapturing){
+		dcam_idle(hdcam);
+	}
+	if (geometry && hasAllocatedFrames){
+		dcam_freeframe(hdcam);
 		hasAllocatedFrames = false;
-		return;
 	}
-	
-	//get image size
-	ImageSize imageSize;
-	Camera->Get_ImageSize(imageSize);
-	image_width = imageSize.width;
-	image_height = imageSize.height;
 
-	//start capturing images
-	while (true){
-		if (isStopAcquireImage){
-			dcam_idle(Camera->Get_Handle());//stop capturing
-			break;
+	//a rejected setting leaves the former one, the stream resumes anyway
+	bool success = Camera->ApplySettings(changes);
+	double exposure = 0;
+	if ((changes.changes & STREAM_EXPOSURE) && Camera->Get_ExposureTime(exposure)){
+		Set_ExposureTime(exposure);
+	}
+	if (geometry){
+		if (!dcam_precapture(hdcam, DCAM_CAPTUREMODE_SEQUENCE)){
+			dcam_getlasterror(hdcam, buf, sizeof(buf));
+			cout<<GetErrorString(OBJECT_NAME, "ReconfigureStream(): dcam_precapture()", string(buf));
+		}
+		UpdateFrameGeometry();
+		//the session cannot go on without its frames
+		if (!ResizeBuffers() || !AllocateFrames()){
+			success = false;
+			isStopAcquireImage = true;
 		}
-		AcquireImage();
 	}
+	bool capturing = false;
+	if (wasCapturing && !isStopAcquireImage){
+		capturing = StartCapture();
+		success = capturing && success;
+	}
+
+	sessionMutex.lock();
+	isCapturing = capturing;
+	if (wasCapturing && !capturing){
+		isStreaming = false;
+	}
+	reconfigureSuccess = success;
+	isReconfigure = false;
+	sessionChanged.wakeAll();
+	sessionMutex.unlock();
 }
 
 void Hamamatsu_AcquireImageThread::CreateBuffers()
@@ -80,6 +334,12 @@ void Hamamatsu_AcquireImageThread::CreateBuffers()
 		dcam_getlasterror(Camera->Get_Handle(), buf, sizeof(buf));
 		throw QException(OBJECT_NAME, "CreateBuffers(): dcam_getdataframebytes()", string(buf));
 	}
+	if (packedFrames){
+		frameByte = frameByte/3*4; //the buffers hold the frames unpacked to 16 bits
+		unpackBuffer = new uchar[frameByte];
+		unpackBytes = frameByte;
+	}
+	frameByte /= softwareBinning*softwareBinning; //the buffers hold the binned frames
 	for (int i=0; i<HAMAMATSU_BUFFER_SIZE; ++i){
 		acqBuffers[i] = NULL;
 		circularBuffers[i] = NULL;
@@ -89,71 +349,300 @@ void Hamamatsu_AcquireImageThread::CreateBuffers()
 		acqBuffers[i] = new uchar[frameByte];
 		circularBuffers[i] = acqBuffers[i];
 	}
+	binBuffer = new uchar[frameByte];
+	bufferBytes = frameByte;
+}
+
+//a smaller subarray or a larger binning reuses the buffers
+bool Hamamatsu_AcquireImageThread::ResizeBuffers()
+{
+	_DWORD frameByte;
+	char buf[256];
+	if (!dcam_getdataframebytes( Camera->Get_Handle(), &frameByte)){
+		dcam_getlasterror(Camera->Get_Handle(), buf, sizeof(buf));
+		cout<<GetErrorString(OBJECT_NAME, "ResizeBuffers(): dcam_getdataframebytes()", string(buf));
+		return false;
+	}
+	_DWORD unpackByte = 0;
+	if (packedFrames){
+		frameByte = frameByte/3*4;
+		unpackByte = frameByte;
+	}
+	frameByte /= softwareBinning*softwareBinning;
+	if (frameByte <= bufferBytes && unpackByte <= unpackBytes){
+		return true;
+	}
+	ClearBuffers();
+	if (unpackByte > 0){
+		unpackBuffer = new uchar[unpackByte];
+		unpackBytes = unpackByte;
+	}
+	for (int i=0; i<HAMAMATSU_BUFFER_SIZE; ++i){
+		acqBuffers[i] = new uchar[frameByte];
+		circularBuffers[i] = acqBuffers[i];
+	}
+	binBuffer = new uchar[frameByte];
+	bufferBytes = frameByte;
+	return true;
 }
 
 void Hamamatsu_AcquireImageThread::ClearBuffers()
 {
 	for (int i=0; i<HAMAMATSU_BUFFER_SIZE;++i){
 		if (acqBuffers[i] != NULL){
-			delete acqBuffers[i];
+			delete[] acqBuffers[i];
 			acqBuffers[i] = NULL;
 			circularBuffers[i] = NULL;
 		}
 	}
+	if (unpackBuffer != NULL){
+		delete[] unpackBuffer;
+		unpackBuffer = NULL;
+		unpackBytes = 0;
+	}
+	if (binBuffer != NULL){
+		delete[] binBuffer;
+		binBuffer = NULL;
+	}
 	hamamatsuWindowInfo.image_data = NULL;
 }
 
+/*
+	The driver fills its ring of frames while this thread works. After each wait the
+	frames since the last one read are drained in order, so a stall is caught up as
+	long as the ring holds its frames. The frame being written follows the newest one,
+	a larger backlog is lost; the lost frames are still counted, so the channels of
+	the next frames stay in step.
+*/
 void Hamamatsu_AcquireImageThread::AcquireImage()
 {
 	_DWORD dw = DCAM_EVENT_FRAMEEND;
+	HDCAM hdcam = Camera->Get_Handle();
+	int32 newestIndex, frameCount;
+
+	if (!dcam_wait(hdcam, &dw, 100, NULL) || !dcam_gettransferinfo(hdcam, &newestIndex, &frameCount)){
+		return;
+	}
+	//the frame end event follows the exposure, readout is neglected
+	long long now = Get_HostTime();
+	if (lastWaitTime > 0 && frameCount > lastWaitCount){
+		double period = (double)(now - lastWaitTime)/(frameCount - lastWaitCount);
+		framePeriod += HAMAMATSU_PARAMS::FRAME_PERIOD_FILTER*(period - framePeriod);
+	}
+	lastWaitTime = now;
+	lastWaitCount = frameCount;
+
+	int pending = frameCount - lastFrameCount;
+	backlog = pending;
+	if (pending > maxBacklog){
+		maxBacklog = pending;
+	}
+	if (pending >= ringFrames){
+		int lost = pending - ringFrames + 1;
+		char msg[64];
+		sprintf(msg, "%d frames overwritten in the ring of the driver", lost);
+		cout<<GetErrorString(OBJECT_NAME, "AcquireImage()", string(msg));
+		lostFrames += lost;
+		ImageCount += lost;
+		lastFrameCount += lost;
+	}
+
+	//the older frames ended one period apart before the newest one
+	while (lastFrameCount < frameCount && !isStopAcquireImage){
+		int later = frameCount - lastFrameCount - 1;
+		int32 index = ((newestIndex - later)%ringFrames + ringFrames)%ringFrames;
+		ProcessFrame(index, now - (long long)(later*framePeriod) - exposureTime/2);
+		++lastFrameCount;
+	}
+}
+
+void Hamamatsu_AcquireImageThread::ProcessFrame(int32 index, long long exposureCenter)
+{
 	int32 rowBytes;
 	uchar* pBuf;
 
-	// Test time consumption of AcquireImage
-	qint64 start_time = QDateTime::currentMSecsSinceEpoch();
+	//the pipeline keeps up with the frame rate while a frame is handled within the frame period
+	long long start = Get_HostTime();
+
+	if (dcam_lockdata(Camera->Get_Handle(), (void**) &pBuf, &rowBytes, index)){ //get data and emit display signal
+		//rowBytes will be negetive sometimes
+		if (rowBytes<0){
+			dcam_unlockdata(Camera->Get_Handle());
+			return;
+		}
+		//cout << "AcquireImage: pic "<<Image_Count<<endl;
+		//cout<<"image width: "<<image_width<<", image height: "<<image_height<<", rowBytes: "<<rowBytes<<endl;
+
+		//a packed frame is only unpacked for the ones using its pixels, the recorder may keep it packed
+		const uchar* packed = packedFrames ? pBuf : NULL;
+		bool display = (ImageCount%HAMAMATSU_DISPLAY_INTERVAL == 0);
+		bool save = (HamamatsuImageBuffers != NULL && HamamatsuStartSaveImage);
+		bool savePacked = save && HamamatsuImageBuffers[SaveImage_Index].data_type == MONO12P_TYPE;
+		//the packed frame is recorded as the driver gives it, before the software binning;
+		//a frame whose size changed since the buffers were allocated is not recorded
+		int saveWidth = savePacked ? data_width : image_width;
+		int saveHeight = savePacked ? data_height : image_height;
+		if (save && (saveWidth != HamamatsuImageBuffers[SaveImage_Index].image_width || saveHeight != HamamatsuImageBuffers[SaveImage_Index].image_height)){
+			save = false;
+			savePacked = false;
+		}
+		bool unpack = !packedFrames || display || isSnap || (save && !savePacked) || Camera->HasFrameProcessors();
+		pBuf = unpack ? BinFrame(UnpackFrame(pBuf, rowBytes), rowBytes) : NULL;
+
+		//hand the frame to the frame processors (ratio imaging, ...)
+		FrameInfo frameInfo;
+		frameInfo.frame_index = ImageCount;
+		frameInfo.timestamp = QDateTime::currentMSecsSinceEpoch();
+		frameInfo.image_width = image_width;
+		frameInfo.image_height = image_height;
+		frameInfo.row_bytes = rowBytes;
+		frameInfo.data_type = USHORT_TYPE;
+		frameInfo.channelOffset = hamamatsuWindowInfo.channelOffset;
+		if (!Camera->Get_FrameChannel(exposureCenter, frameInfo.channel)){
+			frameInfo.channel = Get_ImagingChannel(hamamatsuWindowInfo.imagingChannelSeq, frameInfo.channelOffset, ImageCount);
+		}
+		frameInfo.exposure_time = exposureCenter;
+		frameInfo.z_position = 0;
+		frameInfo.has_position = Camera->Get_FramePosition(exposureCenter, frameInfo.z_position);
+		if (pBuf != NULL){
+			Camera->DispatchFrame(pBuf, frameInfo);
+			if (isSnap && exposureCenter + exposureTime/2 >= snapRequest){
+				TakeSnapshot(pBuf, frameInfo);
+			}
+		}
 
-	if( dcam_wait(Camera->Get_Handle(), &dw, 100, NULL) ){
-		if (dcam_lockdata(Camera->Get_Handle(), (void**) &pBuf, &rowBytes, -1)){ //get data and emit display signal
-			//rowBytes will be negetive sometimes
-			if (rowBytes<0){
-				dcam_unlockdata(Camera->Get_Handle());
-				return;
+		//save images
+		const uchar* saveData = savePacked ? packed : pBuf;
+		if (save && saveData != NULL){
+			HamamatsuImageBuffers[SaveImage_Index].timestamp = QDateTime::currentMSecsSinceEpoch();
+			HamamatsuImageBuffers[SaveImage_Index].exposure_time = frameInfo.exposure_time;
+			HamamatsuImageBuffers[SaveImage_Index].has_position = frameInfo.has_position;
+			HamamatsuImageBuffers[SaveImage_Index].z_position = frameInfo.z_position;
+			CopyData(HamamatsuImageBuffers[SaveImage_Index].data_type, (uchar*)saveData, (uchar*)HamamatsuImageBuffers[SaveImage_Index].image_data, saveWidth, saveHeight);
+			++SaveImage_Index;
+			if (SaveImage_Index == HamamatsuSaveImageNum){
+				SaveImage_Index = 0;
+				HamamatsuStartSaveImage = false;
+				emit FinishSaveImageSignal((int)HAMAMATSU_WINDOW);
 			}
+		}
+		//emit signal to hamamastu display window
+		if (display){
 			//cout << "AcquireImage: pic "<<Image_Count<<endl;
 			//cout<<"image width: "<<image_width<<", image height: "<<image_height<<", rowBytes: "<<rowBytes<<endl;
+			hamamatsuWindowInfo.image_width = image_width;
+			hamamatsuWindowInfo.image_height = image_height;
+			hamamatsuWindowInfo.image_stride = rowBytes;
+			hamamatsuWindowInfo.image_num = ImageCount;
+			hamamatsuWindowInfo.image_channel = frameInfo.channel;
 
-			//save images
-			if (HamamatsuImageBuffers!=NULL && HamamatsuStartSaveImage){
-				HamamatsuImageBuffers[SaveImage_Index].timestamp = QDateTime::currentMSecsSinceEpoch();
-				CopyData(USHORT_TYPE, (uchar*)pBuf, (uchar*)HamamatsuImageBuffers[SaveImage_Index].image_data, image_width, image_height);
-				++SaveImage_Index;
-				if (SaveImage_Index == HamamatsuSaveImageNum){
-					SaveImage_Index = 0;
-					HamamatsuStartSaveImage = false;
-					emit FinishSaveImageSignal((int)HAMAMATSU_WINDOW);
-				}
-			}
-			//emit signal to hamamastu display window
-			if (ImageCount%HAMAMATSU_DISPLAY_INTERVAL == 0){
-				//cout << "AcquireImage: pic "<<Image_Count<<endl;
-				//cout<<"image width: "<<image_width<<", image height: "<<image_height<<", rowBytes: "<<rowBytes<<endl;
-				hamamatsuWindowInfo.image_width = image_width;
-				hamamatsuWindowInfo.image_height = image_height;
-				hamamatsuWindowInfo.image_stride = rowBytes;
-				hamamatsuWindowInfo.image_num = ImageCount;
-
-				CopyData(USHORT_TYPE, (uchar*)pBuf, circularBuffers[Buffer_Index], image_width, image_height); // Time comsumption is 2ms
-				hamamatsuWindowInfo.image_data = circularBuffers[Buffer_Index];
-				Buffer_Index = (Buffer_Index+1)%HAMAMATSU_BUFFER_SIZE;
-				Camera->SendDisplayImageSignal(); 
+			CopyData(USHORT_TYPE, (uchar*)pBuf, circularBuffers[Buffer_Index], image_width, image_height); // Time comsumption is 2ms
+			hamamatsuWindowInfo.image_data = circularBuffers[Buffer_Index];
+			Buffer_Index = (Buffer_Index+1)%HAMAMATSU_BUFFER_SIZE;
+			Camera->SendDisplayImageSignal(); 
+		}
+		++ImageCount;
+		dcam_unlockdata(Camera->Get_Handle());
+	}
+
+	double elapsed = (double)(Get_HostTime() - start);
+	processTime = (processTime > 0) ? processTime + HAMAMATSU_PARAMS::FRAME_PERIOD_FILTER*(elapsed - processTime) : elapsed;
+}
+
+uchar* Hamamatsu_AcquireImageThread::UnpackFrame(uchar* data, int32& rowBytes)
+{
+	if (!packedFrames){
+		return data;
+	}
+	UnpackMono12(data, rowBytes, data_width, data_height, (ushort*)unpackBuffer);
+	rowBytes = data_width*sizeof(ushort);
+	return unpackBuffer;
+}
+
+//the binning the sensor cannot do is done before any copy, everything after sees the binned frame
+uchar* Hamamatsu_AcquireImageThread::BinFrame(uchar* data, int32& rowBytes)
+{
+	if (softwareBinning <= 1){
+		return data;
+	}
+	BinImage_SSE2((const ushort*)data, rowBytes/sizeof(ushort), data_width, data_height, softwareBinning, (ushort*)binBuffer);
+	rowBytes = image_width*sizeof(ushort);
+	return binBuffer;
+}
+
+//the driver frame is unlocked after the processing, so it is copied to the caller of the snap.
+//the snap cannot time out during the copy, it waits for sessionMutex to return.
+void Hamamatsu_AcquireImageThread::TakeSnapshot(const uchar* data, const FrameInfo& info)
+{
+	QMutexLocker locker(&sessionMutex);
+	if (!isSnap || snapPixels == NULL){
+		return;
+	}
+	snapPixels->resize((size_t)info.image_width*info.image_height);
+	CopyData(USHORT_TYPE, (uchar*)data, (uchar*)&(*snapPixels)[0], info.image_width, info.image_height);
+	snapImage.timestamp = info.timestamp;
+	snapImage.image_width = info.image_width;
+	snapImage.image_height = info.image_height;
+	snapImage.image_data = &(*snapPixels)[0];
+	snapImage.data_type = USHORT_TYPE;
+	snapImage.exposure_time = info.exposure_time;
+	snapImage.has_position = info.has_position;
+	snapImage.z_position = info.z_position;
+	snapSuccess = true;
+	isSnap = false;
+	sessionChanged.wakeAll();
+}
+
+/*
+	A snap while the stream is paused captures on the frames already allocated, so it
+	costs the exposure and the readout only. The capture is idle again afterwards; the
+	frame is not handed to the frame processors, the displays or the recorder.
+*/
+void Hamamatsu_AcquireImageThread::SnapFrame()
+{
+	_DWORD dw = DCAM_EVENT_FRAMEEND;
+	HDCAM hdcam = Camera->Get_Handle();
+	int32 newestIndex = 0, frameCount = 0;
+	long long request = snapRequest;
+	if (StartCapture()){
+		while (isSnap && !isStopAcquireImage && !isReconfigure && !isStreaming){
+			if (dcam_wait(hdcam, &dw, 100, NULL) && dcam_gettransferinfo(hdcam, &newestIndex, &frameCount) && frameCount > 0){
+				break;
 			}
-			++ImageCount;
-			dcam_unlockdata(Camera->Get_Handle());
 		}
 	}
 
-	qint64 end_time = QDateTime::currentMSecsSinceEpoch();
-	//cout<<"AcquireImage time consumption:  " << (end_time - start_time) << "ms" <<endl;
+	int32 rowBytes;
+	uchar* pBuf;
+	if (frameCount > 0 && dcam_lockdata(hdcam, (void**) &pBuf, &rowBytes, newestIndex)){
+		if (rowBytes >= 0){
+			long long now = Get_HostTime();
+			FrameInfo frameInfo;
+			frameInfo.frame_index = 0;
+			frameInfo.timestamp = QDateTime::currentMSecsSinceEpoch();
+			frameInfo.image_width = image_width;
+			frameInfo.image_height = image_height;
+			frameInfo.data_type = USHORT_TYPE;
+			frameInfo.channelOffset = 0;
+			frameInfo.channel = (char)0xFF;
+			frameInfo.exposure_time = now - exposureTime/2;
+			frameInfo.z_position = 0;
+			frameInfo.has_position = Camera->Get_FramePosition(frameInfo.exposure_time, frameInfo.z_position);
+			pBuf = BinFrame(UnpackFrame(pBuf, rowBytes), rowBytes);
+			frameInfo.row_bytes = rowBytes;
+			TakeSnapshot(pBuf, frameInfo);
+		}
+		dcam_unlockdata(hdcam);
+	}
+	dcam_idle(hdcam);
+
+	//a snap not taken is given up, unless the stream it was left for takes it; a newer snap is kept
+	sessionMutex.lock();
+	if (snapRequest == request && !isStreaming && !isReconfigure){
+		isSnap = false;
+	}
+	sessionChanged.wakeAll();
+	sessionMutex.unlock();
 }
 
 ImageBuffer Hamamatsu_AcquireImageThread::Get_LatestImageBuffer()
@@ -163,6 +652,9 @@ ImageBuffer Hamamatsu_AcquireImageThread::Get_LatestImageBuffer()
 	buffer.image_width = 0;
 	buffer.image_height = 0;
 	buffer.data_type = USHORT_TYPE;
+	buffer.exposure_time = 0;
+	buffer.has_position = false;
+	buffer.z_position = 0;
 
 	if (circularBuffers[Buffer_Index] != NULL){
 		buffer.image_width = image_width;
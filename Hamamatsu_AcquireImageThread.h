@@ -4,6 +4,8 @@
 
 #include "Hamamatsu_Camera.h"
 #include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
 
 #ifndef _DEFINE_HAMAMATSU_BUFFER
 #define _DEFINE_HAMAMATSU_BUFFER
@@ -21,20 +23,43 @@ public:
 	~Hamamatsu_AcquireImageThread();
 	Hamamatsu_Camera* Camera;
 
+	//the thread holds the session: the driver frames and the buffers live until it stops
 	void StopThread();
 	void StartThread();
+	bool StartStream();   //returns once the capture runs
+	void StopStream();    //returns once the capture is idle
+	bool IsStreaming(){ return isCapturing; }
 	void ClearImageCount(){
 		ImageCount = 0;
 	}
 	ImageBuffer Get_LatestImageBuffer();
+	void Set_ExposureTime(double time){ //s
+		exposureTime = (long long)(time*1.0e6);
+	}
+	//the settings are changed between two frames, returns once the stream is resumed
+	bool Reconfigure(const StreamSettings& settings);
+	DriverRingStatus Get_RingStatus();
+	//the next complete frame, copied once into the pixels of the caller, buffer.image_data points to them
+	bool Snap(ImageBuffer& buffer, vector<ushort>& pixels, unsigned long timeout_ms);
 
 signals:
 	void FinishSaveImageSignal(int);
 
 protected:
 	void CreateBuffers();//create cicular buffers with 8 alignment
+	bool ResizeBuffers();
 	void ClearBuffers();
 	void AcquireImage();
+	void ProcessFrame(int32 index, long long exposureCenter); //frame of the ring of the driver
+	uchar* UnpackFrame(uchar* data, int32& rowBytes);
+	uchar* BinFrame(uchar* data, int32& rowBytes);
+	void TakeSnapshot(const uchar* data, const FrameInfo& info);
+	void SnapFrame();
+	bool AllocateFrames();
+	bool StartCapture();
+	void SwitchCapture();
+	void ReconfigureStream();
+	void UpdateFrameGeometry();
 	virtual void run();
 
 private:
@@ -42,11 +67,45 @@ private:
 	volatile bool isStopAcquireImage;
 	int SaveImage_Index;
 	int Buffer_Index;
-	int image_width;
+	int image_width;   //after the software binning
 	int image_height;
+	int data_width;    //frame of the driver
+	int data_height;
+	int softwareBinning;
+	bool packedFrames;    //Mono12Packed frames of the driver, unpacked when their pixels are used
+	uchar* unpackBuffer;  //frame of the driver in 16 bits
+	_DWORD unpackBytes;
+	uchar* binBuffer;  //frame binned in software, handed on instead of the driver frame
 	uchar* acqBuffers[HAMAMATSU_BUFFER_SIZE];
 	uchar* circularBuffers[HAMAMATSU_BUFFER_SIZE];
+	_DWORD bufferBytes; //size of each buffer, may exceed the current binned frame
 	unsigned long ImageCount;
+	volatile long long exposureTime; //us
+
+	//ring of the driver, drained up to the newest frame after each wait
+	int ringFrames;
+	int32 lastFrameCount;    //frames of the driver read or lost since the capture started
+	long long lastWaitTime;  //us
+	int32 lastWaitCount;
+	double framePeriod;      //us, estimated from the frame counts of the driver
+	double processTime;      //us, handling of a frame by this thread, estimated like the frame period
+	volatile int backlog;
+	volatile int maxBacklog;
+	volatile unsigned long lostFrames;
+
+	//requests of the other threads, applied by this one between two frames
+	QMutex sessionMutex;
+	QWaitCondition sessionChanged;
+	volatile bool isStreaming;   //requested state of the capture
+	volatile bool isCapturing;   //state of the capture, only changed by this thread
+	volatile bool isReconfigure;
+	bool reconfigureSuccess;
+	StreamSettings settings;
+	volatile bool isSnap;
+	bool snapSuccess;
+	long long snapRequest;  //us, frames ended before are not taken
+	ImageBuffer snapImage;
+	vector<ushort>* snapPixels; //storage of the caller of the pending snap
 };
 
 #endif //_HAMAMATSU_ACQUIRE_IMAGE_H_
\ No newline at end of file
@@ -8,21 +8,24 @@ string Hamamatsu_Camera::OBJECT_NAME = "Hamamatsu_Camera";
 string Hamamatsu_Camera::DEVICE_NAME = "Hamamatsu Camera";
 
 Hamamatsu_Camera::Hamamatsu_Camera()
+	: propertyMutex(QMutex::Recursive)
 {
 	hdcam = NULL;
 	acquireImageThread = NULL;
-	AcqBuffer = NULL;
+	Binning = 1;
+	SoftwareBinning = 1;
+	DriverFrames = 0;
+	TriggerMode = "Internal";
+	FrameRate = 0;
+	cache.valid = 0;
+	isBatch = false;
+	batch.changes = 0;
 	status = DISCONNECTED;
 }
 
 Hamamatsu_Camera::~Hamamatsu_Camera()
 {
 	Disconnect();
-	if (AcqBuffer != NULL){
-		delete AcqBuffer;
-		AcqBuffer = NULL;
-		hamamatsuWindowInfo.image_data = NULL;
-	}
 }
 
 bool Hamamatsu_Camera::Connect()
@@ -35,6 +38,12 @@ bool Hamamatsu_Camera::Connect()
 		return false;
 	}
 	status = CONNECTED;
+	InvalidateProperties();
+
+	//the sensor keeps its binning between two sessions
+	int32 binning = 1;
+	Binning = dcam_getbinning(hdcam, &binning) ? binning : 1;
+	SoftwareBinning = 1;
 	cout<<"Connect to hamamatsu camera successfully"<<endl;
 	return true;
 }
@@ -66,12 +75,15 @@ HDCAM Hamamatsu_Camera::Init_Open()
 
 void Hamamatsu_Camera::Disconnect()
 {
+	CloseSession();
 	ReleaseData();
 	if (hdcam != NULL){
 		dcam_close( hdcam );     //process camera termination
 		dcam_uninit(NULL, NULL); //terminate the driver
 		hdcam = NULL;
 	}
+	InvalidateProperties();
+	CancelSettings();
 	status = DISCONNECTED;
 }
 
@@ -120,6 +132,12 @@ void Hamamatsu_Camera::Get_CameraInfo()
 bool Hamamatsu_Camera::Get_ExposureTimeRange(Range & range)
 {
 	if (hdcam == NULL){ return false; }
+	QMutexLocker locker(&propertyMutex);
+	if (cache.valid & PROPERTY_EXPOSURE_RANGE){
+		range.min = cache.exposureRange.min;
+		range.max = cache.exposureRange.max;
+		return true;
+	}
 
 	DCAM_PARAM_FEATURE_INQ inq;
 	memset(&inq, 0, sizeof(inq));
@@ -143,45 +161,127 @@ bool Hamamatsu_Camera::Get_ExposureTimeRange(Range & range)
 	} else{
 		if (inq.hdr.oFlag & dcamparam_featureinq_min) range.min = inq.min;
 		if (inq.hdr.oFlag & dcamparam_featureinq_max) range.max = inq.max;
+		cache.exposureRange = range;
+		cache.valid |= PROPERTY_EXPOSURE_RANGE;
 		return true;
 	}
 }
 
+//the acquiring thread changes it between two frames while the session is open
 bool Hamamatsu_Camera::Set_ExposureTime(double time)
 {
 	if (hdcam == NULL){ return false; }
-	if (!dcam_setexposuretime(hdcam, time)){
-		cout<<GetErrorString(OBJECT_NAME, "Set_ExposureTime()", "Fail to set exposure time");
-		return false;
-	}
-	return true;
+	StreamSettings settings;
+	settings.changes = STREAM_EXPOSURE;
+	settings.exposure = time;
+	return ChangeSettings(settings);
 }
 
 bool Hamamatsu_Camera::Get_ExposureTime(double& time)
 {
 	if (hdcam == NULL){ return false; }
+	QMutexLocker locker(&propertyMutex);
 	time = 0;
-	if (!dcam_getexposuretime(hdcam, &time)){
-		char buf[256];
-		dcam_getlasterror(hdcam, buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "Get_ExposureTime()", string(buf));
-		return false;
+	if (!(cache.valid & PROPERTY_EXPOSURE)){
+		if (!dcam_getexposuretime(hdcam, &cache.exposure)){
+			char buf[256];
+			dcam_getlasterror(hdcam, buf, sizeof(buf));
+			cout<<GetErrorString(OBJECT_NAME, "Get_ExposureTime()", string(buf));
+			return false;
+		}
+		cache.valid |= PROPERTY_EXPOSURE;
 	}
+	time = cache.exposure;
 	return true;
 }
 
-bool Hamamatsu_Camera::Get_FrameRateRange(Range &)
+//the fastest rate reads the subarray in the line time, a rate beyond the exposure is not reached
+bool Hamamatsu_Camera::Get_FrameRateRange(Range& range)
 {
-	return true;
+	if (hdcam == NULL){ return false; }
+	double exposure = 0;
+	int left, top, width, height;
+	if (!Get_ExposureTime(exposure) || !Get_SubArray(left, top, width, height)){
+		return false;
+	}
+	range.max = 1.0/max(exposure, ((height+1)/2)*HAMAMATSU_PARAMS::LINE_TIME);
+	range.min = min(HAMAMATSU_PARAMS::MIN_FRAME_RATE, range.max);
+	return Get_FrameRate(range.current);
+}
+
+//the frames of an external trigger follow the trigger, only the internal one has a rate of its own
+bool Hamamatsu_Camera::Set_FrameRate(double rate)
+{
+	if (hdcam == NULL){ return false; }
+	if (TriggerMode != "Internal"){
+		cout<<GetErrorString(OBJECT_NAME, "Set_FrameRate()", "The frame rate follows the external trigger");
+		return false;
+	}
+	Range range;
+	if (rate < 0 || (rate > 0 && (!Get_FrameRateRange(range) || rate < range.min || rate > range.max))){
+		cout<<GetErrorString(OBJECT_NAME, "Set_FrameRate()", "Invalid frame rate");
+		return false;
+	}
+	StreamSettings settings;
+	settings.changes = STREAM_FRAME_RATE;
+	settings.frameRate = rate;
+	return ChangeSettings(settings);
 }
 
-bool Hamamatsu_Camera::Set_FrameRate(double)
+//the rolling shutter exposes while the former frame is read out, the frame interval stretches the period
+bool Hamamatsu_Camera::Get_FrameRate(double& rate)
 {
+	if (hdcam == NULL){ return false; }
+	double exposure = 0, readout = 0;
+	if (!Get_ExposureTime(exposure) || !Get_ReadoutTime(readout)){
+		return false;
+	}
+	double period = max(exposure, readout);
+	if (TriggerMode == "Internal"){
+		QMutexLocker locker(&propertyMutex);
+		if (!(cache.valid & PROPERTY_FRAME_INTERVAL)){
+			if (!dcam_getpropertyvalue(hdcam, DCAM_IDPROP_INTERNAL_FRAMEINTERVAL, &cache.frameInterval)){
+				cache.frameInterval = 0;
+			}
+			cache.valid |= PROPERTY_FRAME_INTERVAL;
+		}
+		period = max(period, cache.frameInterval);
+	}
+	rate = (period > 0) ? 1.0/period : 0;
 	return true;
 }
 
-bool Hamamatsu_Camera::Get_FrameRate(double &)
+/*
+	The slowest readout reaching the rate is taken, it has the lowest read noise, and the
+	frame interval stretches the period to the rate. A rate of 0 or one beyond the exposure
+	takes the fastest readout and the shortest interval. The capture has to be idle.
+*/
+bool Hamamatsu_Camera::SetFrameRateProperties(double rate)
 {
+	if (hdcam == NULL){ return false; }
+	int maxSpeed = 1;
+	double exposure = 0, readout = 0;
+	if (!Get_MaxReadoutRate(maxSpeed) || !Get_ExposureTime(exposure)){
+		return false;
+	}
+	for (int speed = (rate > 0) ? 1 : maxSpeed; ; ++speed){
+		if ((maxSpeed > 1 && !Set_ReadoutRate(speed)) || !Get_ReadoutTime(readout)){
+			return false;
+		}
+		if (speed >= maxSpeed || max(exposure, readout)*rate <= 1.0){
+			break;
+		}
+	}
+	double period = max(exposure, readout);
+	double interval = (rate > 0) ? max(1.0/rate, period) : period;
+	bool success = dcam_setpropertyvalue(hdcam, DCAM_IDPROP_INTERNAL_FRAMEINTERVAL, interval) != 0;
+	InvalidateProperties();
+	if (!success && rate > 0){
+		char buf[256];
+		dcam_getlasterror(hdcam, buf, sizeof(buf));
+		cout<<GetErrorString(OBJECT_NAME, "SetFrameRateProperties(): dcam_setpropertyvalue()", string(buf));
+		return false;
+	}
 	return true;
 }
 
@@ -195,64 +295,65 @@ bool Hamamatsu_Camera::Get_FrameRate(double &)
 bool Hamamatsu_Camera::Set_TriggerMode(string strMode)
 {
 	if (hdcam == NULL){ return false; }
+	StreamSettings settings;
+	settings.changes = STREAM_TRIGGER_MODE;
+	settings.triggerMode = strMode;
+	return ChangeSettings(settings);
+}
 
-	long mode;
+/*
+	The source, the activation and the global exposure of the trigger go together, all
+	three are set or the mode is rejected, and ApplySettings rolls back the former mode.
+	The capture has to be idle.
+*/
+bool Hamamatsu_Camera::SetTriggerModeProperties(string strMode)
+{
+	if (hdcam == NULL){ return false; }
+
+	double source, active, exposure;
 	if (strMode == "Internal"){
-		mode = DCAM_TRIGMODE_INTERNAL;
-		if (!dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERSOURCE,DCAMPROP_TRIGGERSOURCE__INTERNAL) 
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERACTIVE,DCAMPROP_TRIGGERACTIVE__EDGE)
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGER_GLOBALEXPOSURE,DCAMPROP_TRIGGER_GLOBALEXPOSURE__DELAYED)){
-			cout<<GetErrorString(OBJECT_NAME, "set_triggermode()", "fail to set trigger mode");
-			return false;
-		}
-		cout<<"trigger mode : internal"<<endl;
-	}
-	else if (strMode == "External Level"){ // "External Level"
-		mode = DCAM_TRIGMODE_LEVEL;
-		if (!dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERSOURCE,DCAMPROP_TRIGGERSOURCE__EXTERNAL) 
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERACTIVE,DCAMPROP_TRIGGERACTIVE__LEVEL)
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGER_GLOBALEXPOSURE,DCAMPROP_TRIGGER_GLOBALEXPOSURE__DELAYED)){
-			cout<<GetErrorString(OBJECT_NAME, "set_triggermode()", "fail to set trigger mode");
-			return false;
-		}
-		cout<<"trigger mode : external level"<<endl;
-	}
-	else if (strMode == "Global Reset"){ // "External Level"
-		mode = DCAM_TRIGMODE_LEVEL;
-		if (!dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERSOURCE,DCAMPROP_TRIGGERSOURCE__EXTERNAL) 
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGERACTIVE,DCAMPROP_TRIGGERACTIVE__LEVEL)
-			&& !dcam_setpropertyvalue(hdcam,DCAM_IDPROP_TRIGGER_GLOBALEXPOSURE,DCAMPROP_TRIGGER_GLOBALEXPOSURE__GLOBALRESET)){
-			cout<<GetErrorString(OBJECT_NAME, "set_triggermode()", "fail to set trigger mode");
-			return false;
-		}
-		cout<<"Trigger mode : global reset"<<endl;
+		source = DCAMPROP_TRIGGERSOURCE__INTERNAL;
+		active = DCAMPROP_TRIGGERACTIVE__EDGE;
+		exposure = DCAMPROP_TRIGGER_GLOBALEXPOSURE__DELAYED;
+	}
+	else if (strMode == "External Level"){
+		source = DCAMPROP_TRIGGERSOURCE__EXTERNAL;
+		active = DCAMPROP_TRIGGERACTIVE__LEVEL;
+		exposure = DCAMPROP_TRIGGER_GLOBALEXPOSURE__DELAYED;
+	}
+	else if (strMode == "External Edge"){ //every edge starts one exposure of the set exposure time
+		source = DCAMPROP_TRIGGERSOURCE__EXTERNAL;
+		active = DCAMPROP_TRIGGERACTIVE__EDGE;
+		exposure = DCAMPROP_TRIGGER_GLOBALEXPOSURE__DELAYED;
+	}
+	else if (strMode == "Global Reset"){
+		source = DCAMPROP_TRIGGERSOURCE__EXTERNAL;
+		active = DCAMPROP_TRIGGERACTIVE__LEVEL;
+		exposure = DCAMPROP_TRIGGER_GLOBALEXPOSURE__GLOBALRESET;
 	}
 	else{
 		cout<<GetErrorString(OBJECT_NAME, "Set_TriggerMode()", "Invalid trigger mode");
 		return false;
 	}
 
-	//if (!dcam_settriggermode(hdcam, mode)){
-	//	cout<<geterrorstring(object_name, "set_triggermode()", "fail to set trigger mode");
-	//	return false;
-	//}
+	bool success = dcam_setpropertyvalue(hdcam, DCAM_IDPROP_TRIGGERSOURCE, source)
+		&& dcam_setpropertyvalue(hdcam, DCAM_IDPROP_TRIGGERACTIVE, active)
+		&& dcam_setpropertyvalue(hdcam, DCAM_IDPROP_TRIGGER_GLOBALEXPOSURE, exposure);
+	InvalidateProperties();
+	if (!success){
+		cout<<GetErrorString(OBJECT_NAME, "SetTriggerModeProperties()", "Fail to set trigger mode");
+		return false;
+	}
+	TriggerMode = strMode;
+	cout<<"Trigger mode : "<<strMode<<endl;
 	return true;
 }
 
+//the camera is only set through this class, so the last mode set is the one of the driver
 bool Hamamatsu_Camera::Get_TriggerMode(string & strMode)
 {
 	if (hdcam == NULL){ return false; }
-
-	long mode;
-	dcam_gettriggermode(hdcam, &mode);
-
-	if (mode == DCAM_TRIGMODE_INTERNAL){
-		strMode == "Internal";
-	}
-	else if (mode == DCAM_TRIGMODE_LEVEL){
-		strMode == "External Level";
-	}
-
+	strMode = TriggerMode;
 	return true;
 }
 
@@ -262,11 +363,10 @@ bool Hamamatsu_Camera::Set_TriggerPolarity(int32 polarity)
 	if (hdcam == NULL) { return false; }
 
 	if (polarity == DCAM_TRIGPOL_POSITIVE || polarity == DCAM_TRIGPOL_NEGATIVE){
-		if (!dcam_settriggerpolarity(hdcam, polarity)){
-			cout<<GetErrorString(OBJECT_NAME, "Set_TriggerPolarity", "Fail to set trigger polarity");
-			return false;
-		}
-		return true;
+		StreamSettings settings;
+		settings.changes = STREAM_TRIGGER_POLARITY;
+		settings.triggerPolarity = polarity;
+		return ChangeSettings(settings);
 	}
 	else{
 		cout<<GetErrorString(OBJECT_NAME, "Set_TriggerPolarity", "Invalid trigger polarity");
@@ -277,11 +377,15 @@ bool Hamamatsu_Camera::Set_TriggerPolarity(int32 polarity)
 bool Hamamatsu_Camera::Get_TriggerPolarity(int32 &polarity)
 {
 	if (hdcam == NULL){ return false; }
-
-	if (!dcam_gettriggerpolarity(hdcam, &polarity)){
-		cout<<GetErrorString(OBJECT_NAME, "Set_TriggerPolarity", "Fail to get trigger polarity");
-		return false;
+	QMutexLocker locker(&propertyMutex);
+	if (!(cache.valid & PROPERTY_TRIGGER_POLARITY)){
+		if (!dcam_gettriggerpolarity(hdcam, &cache.triggerPolarity)){
+			cout<<GetErrorString(OBJECT_NAME, "Get_TriggerPolarity", "Fail to get trigger polarity");
+			return false;
+		}
+		cache.valid |= PROPERTY_TRIGGER_POLARITY;
 	}
+	polarity = cache.triggerPolarity;
 	return true;
 }
 
@@ -403,35 +507,54 @@ and before LUT settings are entered, to determine the operation mode of the digi
 bool Hamamatsu_Camera::Set_PixelEncoding(PixelEncodingType type)
 {
 	if (hdcam == NULL){ return false; }
-	DCAM_DATATYPE pixelType = DCAM_DATATYPE_UINT16;
-	if (type == Mono8){
-		pixelType = DCAM_DATATYPE_UINT8;
-	}
-	else if (type == Mono16){
-		pixelType = DCAM_DATATYPE_UINT16;
-	}
-	if (!dcam_setdatatype(hdcam, pixelType)){
-		cout<<GetErrorString(OBJECT_NAME, "Set_PixelEncoding()", "Fail to set pixel encoding")<<endl;
+	//the frames are handed on in 16 bits, the acquiring thread unpacks the 12 bits packed ones
+	if (type != Mono12 && type != Mono12Packed && type != Mono16){
+		cout<<GetErrorString(OBJECT_NAME, "Set_PixelEncoding()", "Unsupported pixel encoding");
 		return false;
 	}
-	return true;
+	StreamSettings settings;
+	settings.changes = STREAM_PIXEL_ENCODING;
+	settings.pixelEncoding = type;
+	return ChangeSettings(settings);
 }
 
 bool Hamamatsu_Camera::Get_PixelEncoding(PixelEncodingType& type)
 {
 	if (hdcam == NULL){ return false; }
-	bool result = false;
-	DCAM_DATATYPE pixelType;
-	dcam_getdatatype(hdcam, &pixelType);
-	if (type == DCAM_DATATYPE_UINT8){
-		type = Mono8;
-		result = true;
+	QMutexLocker locker(&propertyMutex);
+	if (!(cache.valid & PROPERTY_PIXEL_ENCODING)){
+		double pixelType = 0;
+		if (!dcam_getpropertyvalue(hdcam, DCAM_IDPROP_IMAGE_PIXELTYPE, &pixelType)){
+			type = InvalidType;
+			return false;
+		}
+		if (pixelType == DCAM_PIXELTYPE_MONO8){
+			cache.pixelEncoding = Mono8;
+		} else if (pixelType == DCAM_PIXELTYPE_MONO12){
+			cache.pixelEncoding = Mono12;
+		} else if (pixelType == DCAM_PIXELTYPE_MONO12P){
+			cache.pixelEncoding = Mono12Packed;
+		} else{
+			cache.pixelEncoding = Mono16;
+		}
+		cache.valid |= PROPERTY_PIXEL_ENCODING;
 	}
-	else if (type == DCAM_DATATYPE_UINT16){
-		type = Mono16;
-		result = true;
+	type = cache.pixelEncoding;
+	return true;
+}
+
+bool Hamamatsu_Camera::SetPixelTypeProperty(PixelEncodingType type)
+{
+	double pixelType = (type == Mono12Packed) ? DCAM_PIXELTYPE_MONO12P : (type == Mono12) ? DCAM_PIXELTYPE_MONO12 : DCAM_PIXELTYPE_MONO16;
+	bool success = dcam_setpropertyvalue(hdcam, DCAM_IDPROP_IMAGE_PIXELTYPE, pixelType) != 0;
+	InvalidateProperties();
+	if (!success){
+		char buf[256];
+		dcam_getlasterror(hdcam, buf, sizeof(buf));
+		cout<<GetErrorString(OBJECT_NAME, "SetPixelTypeProperty(): dcam_setpropertyvalue()", string(buf));
+		return false;
 	}
-	return result;
+	return true;
 }
 
 bool Hamamatsu_Camera::Set_ReadoutRate(int rate)
@@ -444,7 +567,9 @@ bool Hamamatsu_Camera::Set_ReadoutRate(int rate)
 	param.hdr.iFlag = dcamparam_scanmode_speed;
 
 	param.speed = rate;
-	if (!dcam_extended(hdcam, DCAM_IDMSG_SETPARAM, &param, sizeof(param)) || !(param.hdr.oFlag & dcamparam_scanmode_speed) ){
+	bool success = dcam_extended(hdcam, DCAM_IDMSG_SETPARAM, &param, sizeof(param)) && (param.hdr.oFlag & dcamparam_scanmode_speed);
+	InvalidateProperties();
+	if (!success){
 		char buf[256];
 		dcam_getlasterror(hdcam, buf, sizeof(buf));
 		cout<<GetErrorString(OBJECT_NAME, "Set_ReadoutRate()", string(buf));
@@ -456,6 +581,11 @@ bool Hamamatsu_Camera::Set_ReadoutRate(int rate)
 bool Hamamatsu_Camera::Get_ReadoutRate(int& rate)
 {
 	if (hdcam == NULL){ return false; }
+	QMutexLocker locker(&propertyMutex);
+	if (cache.valid & PROPERTY_READOUT_RATE){
+		rate = cache.readoutRate;
+		return true;
+	}
 	DCAM_PARAM_SCANMODE param;
 	memset(&param, 0, sizeof(param));
 	param.hdr.cbSize = sizeof(param);
@@ -470,12 +600,38 @@ bool Hamamatsu_Camera::Get_ReadoutRate(int& rate)
 	} else{
 		rate = param.speed;
 	}
+	cache.readoutRate = rate;
+	cache.valid |= PROPERTY_READOUT_RATE;
+	return true;
+}
+
+//the driver tells the readout of the subarray at the current readout rate, the line time the fastest one
+bool Hamamatsu_Camera::Get_ReadoutTime(double& time)
+{
+	if (hdcam == NULL){ return false; }
+	QMutexLocker locker(&propertyMutex);
+	if (!(cache.valid & PROPERTY_READOUT_TIME)){
+		if (!dcam_getpropertyvalue(hdcam, DCAM_IDPROP_TIMING_READOUTTIME, &cache.readoutTime)){
+			int left, top, width, height;
+			if (!Get_SubArray(left, top, width, height)){
+				return false;
+			}
+			cache.readoutTime = ((height+1)/2)*HAMAMATSU_PARAMS::LINE_TIME;
+		}
+		cache.valid |= PROPERTY_READOUT_TIME;
+	}
+	time = cache.readoutTime;
 	return true;
 }
 
 bool Hamamatsu_Camera::Get_MaxReadoutRate(int& max_rate)
 {
 	if (hdcam == NULL){ return false; }
+	QMutexLocker locker(&propertyMutex);
+	if (cache.valid & PROPERTY_MAX_READOUT_RATE){
+		max_rate = cache.maxReadoutRate;
+		return true;
+	}
 	DCAM_PARAM_SCANMODE_INQ inq;
 	memset( &inq, 0, sizeof(inq));
 	inq.hdr.cbSize = sizeof(inq);
@@ -490,14 +646,287 @@ bool Hamamatsu_Camera::Get_MaxReadoutRate(int& max_rate)
 	} else{
 		max_rate = inq.speedmax;
 	}
+	cache.maxReadoutRate = max_rate;
+	cache.valid |= PROPERTY_MAX_READOUT_RATE;
 	return true;
 }
 
-//Set subarray area of camera
+//Set subarray area of camera, the acquiring thread changes it between two frames while the session is open
 bool Hamamatsu_Camera::Set_ImageSize(int left, int top, int width, int height)
 {
 	if (hdcam == NULL) { return false; }
-	if (!dcamex_setsubarrayrect(left, top, width, height)){
+	StreamSettings settings;
+	settings.changes = STREAM_SUBARRAY;
+	settings.subArray.x_offset = left;
+	settings.subArray.y_offset = top;
+	settings.subArray.width = width;
+	settings.subArray.height = height;
+	return ChangeSettings(settings);
+}
+
+//the subarray stays in sensor pixels whatever the binning
+bool Hamamatsu_Camera::Set_Binning(int binning)
+{
+	if (hdcam == NULL) { return false; }
+	if (binning != 1 && binning != 2 && binning != 4){
+		cout<<GetErrorString(OBJECT_NAME, "Set_Binning()", "Invalid binning");
+		return false;
+	}
+	StreamSettings settings;
+	settings.changes = STREAM_BINNING;
+	settings.binning = binning;
+	return ChangeSettings(settings);
+}
+
+bool Hamamatsu_Camera::Get_Binning(int &binning)
+{
+	binning = Binning;
+	return true;
+}
+
+//the sensor bins when it can, the acquiring thread bins the rest in software
+bool Hamamatsu_Camera::Set_SensorBinning(int binning)
+{
+	if (hdcam == NULL) { return false; }
+	InvalidateProperties();
+	if (dcam_setbinning(hdcam, binning)){
+		Binning = binning;
+		SoftwareBinning = 1;
+		return true;
+	}
+	if (!dcam_setbinning(hdcam, 1)){
+		char buf[256];
+		dcam_getlasterror(hdcam, buf, sizeof(buf));
+		cout<<GetErrorString(OBJECT_NAME, "Set_SensorBinning(): dcam_setbinning()", string(buf));
+		return false;
+	}
+	Binning = binning;
+	SoftwareBinning = binning;
+	return true;
+}
+
+bool Hamamatsu_Camera::Set_DriverFrames(int frames)
+{
+	if (hdcam == NULL) { return false; }
+	if (frames < 0 || frames > HAMAMATSU_PARAMS::MAX_DRIVER_FRAMES){
+		cout<<GetErrorString(OBJECT_NAME, "Set_DriverFrames()", "Invalid number of frames");
+		return false;
+	}
+	StreamSettings settings;
+	settings.changes = STREAM_DRIVER_FRAMES;
+	settings.driverFrames = frames;
+	return ChangeSettings(settings);
+}
+
+/*
+	The ring holds the frames of STALL_TOLERANCE at the frame rate, which is bound by the
+	exposure, the readout of the subarray and the frame interval, within MAX_DRIVER_MEMORY.
+	It is sized when the capture starts, a later change of the exposure does not resize it.
+*/
+int Hamamatsu_Camera::Get_DriverFrames()
+{
+	int frames = DriverFrames;
+	if (frames == 0){
+		double rate = 0;
+		frames = (Get_FrameRate(rate) && rate > 0) ? (int)(HAMAMATSU_PARAMS::STALL_TOLERANCE*rate)+1 : HAMAMATSU_PARAMS::MAX_DRIVER_FRAMES;
+	}
+	QMutexLocker locker(&propertyMutex);
+	if (!(cache.valid & PROPERTY_FRAME_BYTES)){
+		if (!dcam_getdataframebytes(hdcam, &cache.frameBytes)){
+			cache.frameBytes = 0;
+		}
+		cache.valid |= PROPERTY_FRAME_BYTES;
+	}
+	if (cache.frameBytes > 0){
+		frames = min(frames, (int)(HAMAMATSU_PARAMS::MAX_DRIVER_MEMORY/cache.frameBytes));
+	}
+	return max(HAMAMATSU_PARAMS::MIN_DRIVER_FRAMES, min(frames, HAMAMATSU_PARAMS::MAX_DRIVER_FRAMES));
+}
+
+/*
+	The former values of the settings are read first, so a rejected setting rolls all
+	of them back and the stream never resumes with a part of them.
+*/
+bool Hamamatsu_Camera::ApplySettings(const StreamSettings& settings)
+{
+	if (hdcam == NULL) { return false; }
+	StreamSettings former;
+	if (!ReadSettings(settings.changes, former)){
+		cout<<GetErrorString(OBJECT_NAME, "ApplySettings()", "Fail to read the current settings");
+		return false;
+	}
+	if (WriteSettings(settings)){
+		return true;
+	}
+	if (WriteSettings(former)){
+		cout<<GetErrorString(OBJECT_NAME, "ApplySettings()", "A setting is rejected, the former settings are restored");
+	} else{
+		cout<<GetErrorString(OBJECT_NAME, "ApplySettings()", "Fail to restore the former settings");
+	}
+	return false;
+}
+
+//the subarray goes with the binning, the settings kept by the camera are always read
+bool Hamamatsu_Camera::ReadSettings(int changes, StreamSettings& settings)
+{
+	bool success = true;
+	settings.changes = changes;
+	if (changes & (STREAM_SUBARRAY | STREAM_BINNING)){
+		settings.changes |= STREAM_SUBARRAY;
+		ImageRegion& region = settings.subArray;
+		success = Get_SubArray(region.x_offset, region.y_offset, region.width, region.height) && success;
+	}
+	settings.binning = Binning;
+	settings.driverFrames = DriverFrames;
+	if (changes & STREAM_EXPOSURE){
+		success = Get_ExposureTime(settings.exposure) && success;
+	}
+	settings.triggerMode = TriggerMode;
+	if (changes & STREAM_TRIGGER_POLARITY){
+		success = Get_TriggerPolarity(settings.triggerPolarity) && success;
+	}
+	if (changes & STREAM_PIXEL_ENCODING){
+		success = Get_PixelEncoding(settings.pixelEncoding) && success;
+	}
+	settings.frameRate = FrameRate;
+	return success;
+}
+
+/*
+	The settings are written in the order the driver needs them, the subarray is set
+	again after a new binning. A rejected setting does not stop the others, the result
+	tells whether all of them were written.
+*/
+bool Hamamatsu_Camera::WriteSettings(const StreamSettings& settings)
+{
+	bool success = true;
+	if (settings.changes & STREAM_DRIVER_FRAMES){
+		DriverFrames = settings.driverFrames;
+	}
+	if (settings.changes & STREAM_PIXEL_ENCODING){
+		success = SetPixelTypeProperty(settings.pixelEncoding) && success;
+	}
+	if (settings.changes & STREAM_BINNING){
+		success = Set_SensorBinning(settings.binning) && success;
+	}
+	if (settings.changes & (STREAM_SUBARRAY | STREAM_BINNING)){
+		ImageRegion region = settings.subArray;
+		if (!(settings.changes & STREAM_SUBARRAY) && !Get_SubArray(region.x_offset, region.y_offset, region.width, region.height)){
+			success = false;
+		} else{
+			success = Set_SubArray(region.x_offset, region.y_offset, region.width, region.height) && success;
+		}
+	}
+	if (settings.changes & STREAM_EXPOSURE){
+		bool exposure = dcam_setexposuretime(hdcam, settings.exposure) != 0;
+		InvalidateProperties();
+		if (!exposure){
+			cout<<GetErrorString(OBJECT_NAME, "WriteSettings(): dcam_setexposuretime()", "Fail to set exposure time");
+			success = false;
+		}
+	}
+	if (settings.changes & STREAM_TRIGGER_MODE){
+		success = SetTriggerModeProperties(settings.triggerMode) && success;
+	}
+	if (settings.changes & STREAM_TRIGGER_POLARITY){
+		bool polarity = dcam_settriggerpolarity(hdcam, settings.triggerPolarity) != 0;
+		InvalidateProperties();
+		if (!polarity){
+			cout<<GetErrorString(OBJECT_NAME, "WriteSettings(): dcam_settriggerpolarity()", "Fail to set trigger polarity");
+			success = false;
+		}
+	}
+	//the readout and the frame interval follow the exposure and the subarray
+	int rateChanges = STREAM_FRAME_RATE | STREAM_EXPOSURE | STREAM_SUBARRAY | STREAM_BINNING | STREAM_TRIGGER_MODE;
+	if ((settings.changes & rateChanges) && TriggerMode == "Internal"){
+		double rate = (settings.changes & STREAM_FRAME_RATE) ? settings.frameRate : FrameRate;
+		if (SetFrameRateProperties(rate)){
+			FrameRate = rate;
+		} else{
+			success = false;
+		}
+	}
+	return success;
+}
+
+//the settings of changes replace the ones of settings, the others are kept
+static void MergeSettings(StreamSettings& settings, const StreamSettings& changes)
+{
+	if (changes.changes & STREAM_SUBARRAY){ settings.subArray = changes.subArray; }
+	if (changes.changes & STREAM_BINNING){ settings.binning = changes.binning; }
+	if (changes.changes & STREAM_DRIVER_FRAMES){ settings.driverFrames = changes.driverFrames; }
+	if (changes.changes & STREAM_EXPOSURE){ settings.exposure = changes.exposure; }
+	if (changes.changes & STREAM_TRIGGER_MODE){ settings.triggerMode = changes.triggerMode; }
+	if (changes.changes & STREAM_TRIGGER_POLARITY){ settings.triggerPolarity = changes.triggerPolarity; }
+	if (changes.changes & STREAM_PIXEL_ENCODING){ settings.pixelEncoding = changes.pixelEncoding; }
+	if (changes.changes & STREAM_FRAME_RATE){ settings.frameRate = changes.frameRate; }
+	settings.changes |= changes.changes;
+}
+
+/*
+	The setters check their values against the current settings, not against the
+	ones gathered before them. The stream is reconfigured once for all of them.
+*/
+void Hamamatsu_Camera::BeginSettings()
+{
+	isBatch = true;
+	batch.changes = 0;
+}
+
+bool Hamamatsu_Camera::CommitSettings()
+{
+	if (!isBatch){
+		return false;
+	}
+	isBatch = false;
+	if (batch.changes == 0){
+		return true;
+	}
+	StreamSettings settings = batch;
+	batch.changes = 0;
+	return ChangeSettings(settings);
+}
+
+void Hamamatsu_Camera::CancelSettings()
+{
+	isBatch = false;
+	batch.changes = 0;
+}
+
+//called after each write to the driver, which may change other properties too
+void Hamamatsu_Camera::InvalidateProperties()
+{
+	QMutexLocker locker(&propertyMutex);
+	cache.valid = 0;
+}
+
+bool Hamamatsu_Camera::ChangeSettings(const StreamSettings& settings)
+{
+	if (isBatch){
+		MergeSettings(batch, settings);
+		return true;
+	}
+	if (acquireImageThread != NULL && acquireImageThread->isRunning()){
+		return acquireImageThread->Reconfigure(settings);
+	}
+	return ApplySettings(settings);
+}
+
+bool Hamamatsu_Camera::Get_DriverRingStatus(DriverRingStatus &ringStatus)
+{
+	if (acquireImageThread == NULL || !acquireImageThread->isRunning()){
+		return false;
+	}
+	ringStatus = acquireImageThread->Get_RingStatus();
+	return true;
+}
+
+bool Hamamatsu_Camera::Set_SubArray(int left, int top, int width, int height)
+{
+	if (hdcam == NULL) { return false; }
+	bool success = dcamex_setsubarrayrect(left, top, width, height) != 0;
+	InvalidateProperties();
+	if (!success){
 		cout<<GetErrorString(OBJECT_NAME, "SetImageSize()", "Fail to set image size");
 		return false;
 	}
@@ -510,21 +939,58 @@ bool Hamamatsu_Camera::Set_ImageSize(int left, int top, int width, int height)
 	}
 }
 
-bool Hamamatsu_Camera::Get_ImageSize(ImageSize &imageSize)
+bool Hamamatsu_Camera::Get_SubArray(int &left, int &top, int &width, int &height)
 {
 	if (hdcam == NULL) { return false; }
+	QMutexLocker locker(&propertyMutex);
+	ImageRegion& region = cache.subArray;
+	if (!(cache.valid & PROPERTY_SUBARRAY)){
+		if (!dcamex_getsubarrayrect(region.x_offset, region.y_offset, region.width, region.height)){
+			cout<<GetErrorString(OBJECT_NAME, "Get_SubArray()", "Fail to get subarray");
+			return false;
+		}
+		cache.valid |= PROPERTY_SUBARRAY;
+	}
+	left = region.x_offset;
+	top = region.y_offset;
+	width = region.width;
+	height = region.height;
+	ImageLeft = left;
+	ImageTop = top;
+	return true;
+}
 
-	SIZE size;
-	if (dcam_getdatasize(hdcam, &size)){
-		ImageWidth = size.cx;
-		ImageHeight = size.cy;
-		imageSize.width = ImageWidth;
-		imageSize.height = ImageHeight;
-		return true;
-	} else{
-		cout<<GetErrorString(OBJECT_NAME, "GetImageSize()", "Fail to get image size");
+bool Hamamatsu_Camera::Get_ImageSize(ImageSize &imageSize)
+{
+	ImageSize dataSize;
+	if (!Get_DataSize(dataSize)){
 		return false;
 	}
+	ImageWidth = dataSize.width/SoftwareBinning;
+	ImageHeight = dataSize.height/SoftwareBinning;
+	imageSize.width = ImageWidth;
+	imageSize.height = ImageHeight;
+	imageSize.stride = ImageWidth;
+	return true;
+}
+
+bool Hamamatsu_Camera::Get_DataSize(ImageSize &dataSize)
+{
+	if (hdcam == NULL) { return false; }
+	QMutexLocker locker(&propertyMutex);
+	if (!(cache.valid & PROPERTY_DATA_SIZE)){
+		SIZE size;
+		if (!dcam_getdatasize(hdcam, &size)){
+			cout<<GetErrorString(OBJECT_NAME, "GetImageSize()", "Fail to get image size");
+			return false;
+		}
+		cache.dataSize.width = size.cx;
+		cache.dataSize.height = size.cy;
+		cache.dataSize.stride = size.cx;
+		cache.valid |= PROPERTY_DATA_SIZE;
+	}
+	dataSize = cache.dataSize;
+	return true;
 }
 
 BOOL Hamamatsu_Camera::dcamex_getfeatureinq(long feature_id, long& cap_flags, 
@@ -712,82 +1178,45 @@ BOOL Hamamatsu_Camera::dcamex_setsubarrayrect(int left, int top, int width, int
 	return dcam_extended( hdcam, DCAM_IDMSG_SETPARAM, &param, sizeof( param ) );
 }
 
-//capture one image
+//capture one image, a live goes on
 void  Hamamatsu_Camera::Capture()
 {
 	if (hdcam == NULL){ return; }
-	char buf[256];
-	ImageSize imageSize;
-
-	if (hamamatsuWindowInfo.image_data != NULL){
-		//delete hamamatsuWindowInfo.image_data;
-		hamamatsuWindowInfo.image_data = NULL;
-	}
-	//pre capturing
-	if (! dcam_precapture(hdcam, DCAM_CAPTUREMODE_SNAP)){
-		dcam_getlasterror(hdcam, buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_precapture()",  string(buf));
+	ImageBuffer buffer;
+	if (!Snap(buffer, capturedImage)){
+		cout<<GetErrorString(OBJECT_NAME, "Capture()", "No frame in time");
+		return;
 	}
-	try{ Get_ImageSize(imageSize); } 
-	catch(QException e){ throw e; }
-
-	//allocate capturing buffer
-	if (!dcam_allocframe(hdcam, 3)){
-		dcam_getlasterror(hdcam, buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_allocframe()", string(buf));
-	}
-
-	//start capturing
-	_DWORD dw = DCAM_EVENT_FRAMEEND;
-	uchar* pBuf;
-	int32 rowBytes;
-	if (!dcam_capture(hdcam)){
-		dcam_getlasterror(hdcam, buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_capture()", string(buf));
+	hamamatsuWindowInfo.image_data = buffer.image_data;
+	hamamatsuWindowInfo.image_width = buffer.image_width;
+	hamamatsuWindowInfo.image_height = buffer.image_height;
+	hamamatsuWindowInfo.image_stride = buffer.image_width*sizeof(ushort);
+	hamamatsuWindowInfo.image_num = 1;
+	hamamatsuWindowInfo.image_channel = (char)0xFF;
+	if (!acquireImageThread->IsStreaming()){
+		hamamatsuWindowInfo.imagingChannelSeq = SINGLE;
 	}
-	else{
-		if (!dcam_wait(hdcam, &dw, 10000, NULL)){
-			dcam_getlasterror(hdcam, buf, sizeof(buf));
-			cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_wait()", string(buf));
-		}
-		else{
-			//read data and display
-			if (!dcam_lockdata(hdcam, (void**) &pBuf, &rowBytes, -1)){
-				dcam_getlasterror(hdcam, buf, sizeof(buf));
-				cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_lockdata()", string(buf));
-			}
-			if (rowBytes < 0){
-				cout<<GetErrorString(OBJECT_NAME, "Capture(): dcam_lockdata()", "Invalid row bytes");
-			}
+	emit DisplayImageSignal(HAMAMATSU_WINDOW); //display image
+}
 
-			int image_width = imageSize.width;
-			int image_height = imageSize.height;
-			if (AcqBuffer == NULL){
-				AcqBuffer = new uchar[image_width*image_height*sizeof(ushort)];
-			}
-			CopyData(USHORT_TYPE, pBuf, AcqBuffer, image_width, image_height);
-			hamamatsuWindowInfo.image_data = (void*)AcqBuffer;
-			hamamatsuWindowInfo.image_width = image_width;
-			hamamatsuWindowInfo.image_height = image_height;
-			hamamatsuWindowInfo.image_stride = rowBytes;
-			hamamatsuWindowInfo.image_num = 1;
-			hamamatsuWindowInfo.imagingChannelSeq = SINGLE;
-			cout<<"image width: "<<image_width<<", image height: "<<image_height<<", rowBytes: "<<rowBytes<<endl;
-
-			dcam_unlockdata(hdcam);
-			emit DisplayImageSignal(HAMAMATSU_WINDOW); //display image
-		}
-		dcam_idle(hdcam); //stop capturing
-	}
-	dcam_freeframe(hdcam);
+/*
+	The frame is taken from the session: the next frame of a live, or a single frame
+	captured on the frames of the driver already allocated. It is copied into pixels,
+	which the caller keeps as long as it uses buffer.
+*/
+bool Hamamatsu_Camera::Snap(ImageBuffer& buffer, vector<ushort>& pixels)
+{
+	if (hdcam == NULL){ return false; }
+	OpenSession();
+	double exposure = 0;
+	Get_ExposureTime(exposure);
+	return acquireImageThread->Snap(buffer, pixels, (unsigned long)(exposure*1000) + HAMAMATSU_PARAMS::SNAP_TIMEOUT);
 }
 
 //capture images continuously
 void Hamamatsu_Camera::Live()
 {
 	if (hdcam == NULL){ return; }
-	char buf[256];
-	ImageSize imageSize;
 
 	//clear resources and make preparation to capture images continuously
 	if (hamamatsuWindowInfo.image_data != NULL){
@@ -795,14 +1224,6 @@ void Hamamatsu_Camera::Live()
 		hamamatsuWindowInfo.image_data = NULL;
 	}
 
-	//pre capturing
-	if (! dcam_precapture(hdcam, DCAM_CAPTUREMODE_SEQUENCE)){
-		dcam_getlasterror(hdcam, buf, sizeof(buf));
-		cout<<GetErrorString(OBJECT_NAME, "Live(): dcam_precapture()",  string(buf));
-	}
-	try{ Get_ImageSize(imageSize); } 
-	catch(QException e){ throw e; }
-
 	//start capturing images
 	StartStreaming();
 }
@@ -813,18 +1234,55 @@ void Hamamatsu_Camera::StopLive()
 	StopStreaming();
 }
 
+/*
+	The acquiring thread holds the session, it keeps the frames of the driver and the
+	buffers between two lives, so live and stop only start and idle the capture.
+*/
 void Hamamatsu_Camera::StartStreaming()
 {
-	if (acquireImageThread == NULL){
-		acquireImageThread = new Hamamatsu_AcquireImageThread(this);
-		acquireImageThread->StartThread();
-		acquireImageThread->setPriority(QThread::HighPriority);
+	OpenSession();
+	if (!acquireImageThread->StartStream()){
+		throw QException(OBJECT_NAME, "StartStreaming()", "Fail to start capturing");
 	}
 }
 
 void Hamamatsu_Camera::StopStreaming()
 {
 	if (acquireImageThread != NULL){
+		acquireImageThread->StopStream();
+	}
+}
+
+void Hamamatsu_Camera::OpenSession()
+{
+	char buf[256];
+	ImageSize imageSize;
+
+	//a session stopped by an error is opened again
+	if (acquireImageThread != NULL && !acquireImageThread->isRunning()){
+		CloseSession();
+	}
+	if (acquireImageThread != NULL){
+		return;
+	}
+	//pre capturing, an open session is already prepared
+	if (! dcam_precapture(hdcam, DCAM_CAPTUREMODE_SEQUENCE)){
+		dcam_getlasterror(hdcam, buf, sizeof(buf));
+		cout<<GetErrorString(OBJECT_NAME, "OpenSession(): dcam_precapture()",  string(buf));
+	}
+	try{ Get_ImageSize(imageSize); } 
+	catch(QException e){ throw e; }
+
+	acquireImageThread = new Hamamatsu_AcquireImageThread(this);
+	acquireImageThread->StartThread();
+	acquireImageThread->setPriority(QThread::HighPriority);
+}
+
+void Hamamatsu_Camera::CloseSession()
+{
+	if (acquireImageThread != NULL){
+		//the displayed frame is in the buffers of the session
+		hamamatsuWindowInfo.image_data = NULL;
 		acquireImageThread->StopThread();
 		acquireImageThread->wait();
 		delete acquireImageThread;
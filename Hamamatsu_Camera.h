@@ -14,6 +14,73 @@
 
 #include "Camera.h"
 #include "QException.h"
+#include <QtCore/QMutex>
+#include <vector>
+
+//declared before the acquiring thread, which includes this header
+struct DriverRingStatus{
+	int frames;               //frames of the ring of the driver
+	int backlog;              //frames waiting in the ring at the last drain
+	int maxBacklog;
+	unsigned long lostFrames; //frames the driver overwrote before they were read
+	double framePeriod;       //us, measured from the frame counts of the driver
+	double processTime;       //us, handling of a frame by the acquiring thread
+};
+
+enum STREAM_SETTING{
+	STREAM_SUBARRAY = 0x01,
+	STREAM_BINNING = 0x02,
+	STREAM_DRIVER_FRAMES = 0x04,
+	STREAM_EXPOSURE = 0x08,
+	STREAM_TRIGGER_MODE = 0x10,
+	STREAM_TRIGGER_POLARITY = 0x20,
+	STREAM_PIXEL_ENCODING = 0x40,
+	STREAM_FRAME_RATE = 0x80
+};
+
+//settings changed together while the capture is idle, the others are left as they are
+struct StreamSettings{
+	int changes;            //STREAM_SETTING flags
+	ImageRegion subArray;   //sensor pixels, the current one is kept for a binning alone
+	int binning;
+	int driverFrames;       //0 sizes the ring of the driver from the frame rate
+	double exposure;        //s
+	string triggerMode;
+	int32 triggerPolarity;
+	PixelEncodingType pixelEncoding;  //Mono12, Mono12Packed or Mono16
+	double frameRate;       //Hz of the internal trigger, 0 runs as fast as the exposure and the readout allow
+};
+
+enum CAMERA_PROPERTY{
+	PROPERTY_EXPOSURE = 0x01,
+	PROPERTY_EXPOSURE_RANGE = 0x02,
+	PROPERTY_SUBARRAY = 0x04,
+	PROPERTY_DATA_SIZE = 0x08,
+	PROPERTY_FRAME_BYTES = 0x10,
+	PROPERTY_PIXEL_ENCODING = 0x20,
+	PROPERTY_TRIGGER_POLARITY = 0x40,
+	PROPERTY_READOUT_RATE = 0x80,
+	PROPERTY_MAX_READOUT_RATE = 0x100,
+	PROPERTY_READOUT_TIME = 0x200,
+	PROPERTY_FRAME_INTERVAL = 0x400
+};
+
+//values read from the driver, kept until the camera writes a setting
+struct PropertyCache{
+	int valid;              //CAMERA_PROPERTY flags
+	double exposure;        //s
+	Range exposureRange;
+	ImageRegion subArray;
+	ImageSize dataSize;
+	_DWORD frameBytes;
+	PixelEncodingType pixelEncoding;
+	int32 triggerPolarity;
+	int readoutRate;
+	int maxReadoutRate;
+	double readoutTime;     //s
+	double frameInterval;   //s, 0 when the driver has none
+};
+
 #include "Hamamatsu_AcquireImageThread.h"
 
 #pragma comment(lib, "D:/SDK/DCAMSDK/lib/win64/dcamapi.lib")
@@ -35,11 +102,27 @@ public:
 	void Disconnect();
 
 	void Capture(); 
+	bool Snap(ImageBuffer& buffer, vector<ushort>& pixels); //the next complete frame into pixels, a live goes on
 	void Live();
 	void StopLive();
 	
-	bool Set_ImageSize(int left, int top, int width, int height);
+	bool Set_ImageSize(int left, int top, int width, int height); //applied in place in a session
 	bool Get_ImageSize(ImageSize &);
+	bool Set_SubArray(int left, int top, int width, int height);  //the capture has to be idle
+	bool Get_SubArray(int &left, int &top, int &width, int &height);
+	bool Set_Binning(int binning);         //applied in place in a session
+	bool Get_Binning(int &binning);
+	bool Set_SensorBinning(int binning);   //the capture has to be idle
+	bool Get_DataSize(ImageSize &);        //frame of the driver, before the software binning
+	inline int Get_SoftwareBinning(){ return SoftwareBinning; }
+	bool Set_DriverFrames(int frames);     //0 sizes the ring from the frame rate, applied in place in a session
+	int Get_DriverFrames();                //frames of the ring of the driver for the next capture
+	bool Get_DriverRingStatus(DriverRingStatus &);
+	bool ApplySettings(const StreamSettings& settings); //the capture has to be idle, a rejected setting rolls all of them back
+	//the setters called in between are applied together by CommitSettings
+	void BeginSettings();
+	bool CommitSettings();
+	void CancelSettings();
 	bool Set_TriggerMode(string);
 	bool Get_TriggerMode(string &);
 	bool Set_TriggerPolarity(int32 polarity);
@@ -51,17 +134,18 @@ public:
 	bool Get_CurrentTemperature(double &);
 	void GrabLatestImageBuffer(ImageBuffer& imageBuffer); //get the latest image buffer
 
-	bool Set_PixelEncoding(PixelEncodingType type);
+	bool Set_PixelEncoding(PixelEncodingType type); //applied in place in a session
 	bool Get_PixelEncoding(PixelEncodingType& type);
 	bool Set_ReadoutRate(int rate);
 	bool Get_ReadoutRate(int& rate);
 	bool Get_MaxReadoutRate(int& max_rate);
+	bool Get_ReadoutTime(double& time);    //readout of the subarray at the current readout rate, s
 
 	bool Get_ExposureTimeRange(Range &);
 	bool Set_ExposureTime(double);
 	bool Get_ExposureTime(double &);
 	bool Get_FrameRateRange(Range &);
-	bool Set_FrameRate(double);
+	bool Set_FrameRate(double);            //internal trigger only, 0 runs as fast as possible
 	bool Get_FrameRate(double &);
 	
 	inline void SendDisplayImageSignal(){
@@ -74,8 +158,17 @@ signals:
 protected:
 	HDCAM Init_Open(); //initialize DCAM-API and get HDCAM camera handle
 	void ReleaseData();
+	void OpenSession();   //the session is prepared and waits for a live or a snap
 	void StartStreaming();
 	void StopStreaming();
+	void CloseSession();  //releases the acquiring thread with its frames and buffers
+	bool ChangeSettings(const StreamSettings& settings); //applied between two frames while the session is open
+	bool ReadSettings(int changes, StreamSettings& settings);
+	bool WriteSettings(const StreamSettings& settings);
+	void InvalidateProperties();
+	bool SetTriggerModeProperties(string);
+	bool SetPixelTypeProperty(PixelEncodingType type);
+	bool SetFrameRateProperties(double rate);
 
 	/*All Features:
 		DCAM_IDFEATURE_INITIALIZE
@@ -130,10 +223,21 @@ private:
 	string moduleVersion;  //Version of DCAM Module
 	string dcamAPIVersion;//Version of DCAM-API the Module supports
 
-	uchar* AcqBuffer;
 	int ImageLeft;
 	int ImageTop;
 	int ImageWidth;
 	int ImageHeight;
+	int Binning;          //binning of the frames
+	int SoftwareBinning;  //part of the binning the sensor cannot do
+	int DriverFrames;     //0 sizes the ring of the driver from the frame rate
+	vector<ushort> capturedImage; //displayed frame of Capture
+	string TriggerMode;   //the last one set
+	double FrameRate;     //requested rate of the internal trigger, Hz, 0 runs as fast as possible
+
+	//the acquiring thread reads the properties while it applies the settings
+	QMutex propertyMutex;
+	PropertyCache cache;
+	bool isBatch;         //the settings are gathered, only used by the thread of the setters
+	StreamSettings batch;
 };
 #endif //_Hamamatsu_Camera_H_
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "ImageKernels.h"
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <string.h>
+
+void RatioImage_SSE2(const ushort* gcamp, const ushort* rfp, float* ratio, int count,
+					 ushort gcamp_background, ushort rfp_background, float min_denominator)
+{
+	if (min_denominator < 1.0f){
+		min_denominator = 1.0f;
+	}
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i gBackground = _mm_set1_epi16((short)gcamp_background);
+	const __m128i rBackground = _mm_set1_epi16((short)rfp_background);
+	const __m128 minDenominator = _mm_set1_ps(min_denominator);
+
+	int i = 0;
+	for (; i+8<=count; i+=8){
+		//saturated subtraction keeps the pixels below background at 0
+		__m128i g = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(gcamp+i)), gBackground);
+		__m128i r = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(rfp+i)), rBackground);
+
+		__m128 g_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(g, zero));
+		__m128 g_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(g, zero));
+		__m128 r_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(r, zero));
+		__m128 r_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(r, zero));
+
+		__m128 valid_lo = _mm_cmpge_ps(r_lo, minDenominator);
+		__m128 valid_hi = _mm_cmpge_ps(r_hi, minDenominator);
+		__m128 ratio_lo = _mm_and_ps(_mm_div_ps(g_lo, _mm_max_ps(r_lo, minDenominator)), valid_lo);
+		__m128 ratio_hi = _mm_and_ps(_mm_div_ps(g_hi, _mm_max_ps(r_hi, minDenominator)), valid_hi);
+
+		_mm_storeu_ps(ratio+i, ratio_lo);
+		_mm_storeu_ps(ratio+i+4, ratio_hi);
+	}
+
+	//the remain pixels
+	for (; i<count; ++i){
+		float g = gcamp[i] > gcamp_background ? (float)(gcamp[i]-gcamp_background) : 0.0f;
+		float r = rfp[i] > rfp_background ? (float)(rfp[i]-rfp_background) : 0.0f;
+		ratio[i] = r >= min_denominator ? g/r : 0.0f;
+	}
+}
+
+/*
+	The values are clamped to 255 before the conversion: beyond the 32 bits range it
+	returns the minimal integer, which the packs turned into 0. The remain pixels go
+	through the same conversion, so all the pixels round to nearest even.
+*/
+void FloatToUChar_SSE2(const float* src, uchar* dst, int count, float scale)
+{
+	const __m128 factor = _mm_set1_ps(scale);
+	const __m128 limit = _mm_set1_ps(255.0f);
+
+	int i = 0;
+	for (; i+16<=count; i+=16){
+		__m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i), factor), limit));
+		__m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i+4), factor), limit));
+		__m128i c = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i+8), factor), limit));
+		__m128i d = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(src+i+12), factor), limit));
+		__m128i ab = _mm_packs_epi32(a, b);
+		__m128i cd = _mm_packs_epi32(c, d);
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(ab, cd));
+	}
+
+	//the remain pixels
+	for (; i<count; ++i){
+		int value = _mm_cvtss_si32(_mm_min_ss(_mm_set_ss(src[i]*scale), limit));
+		dst[i] = (uchar)(value > 0 ? value : 0);
+	}
+}
+
+double RegionSum_SSE2(const ushort* image, int image_width, const ImageRegion& region, ushort background)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bg = _mm_set1_epi16((short)background);
+	unsigned long long sum = 0;
+
+	for (int row=region.y_offset; row<region.y_offset+region.height; ++row){
+		const ushort* p = image + (size_t)row*image_width + region.x_offset;
+
+		//32 bits lanes do not overflow for rows up to 8192 pixels
+		__m128i acc = zero;
+		int j = 0;
+		for (; j+8<=region.width; j+=8){
+			__m128i v = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(p+j)), bg);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+		}
+		unsigned int lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+		//the remain pixels
+		for (; j<region.width; ++j){
+			if (p[j] > background){
+				sum += p[j] - background;
+			}
+		}
+	}
+	return (double)sum;
+}
+
+//accumulate the squares of four 32 bits integers into two double lanes
+static inline __m128d AddSquare_epi32(__m128d acc, __m128i v)
+{
+	__m128d lo = _mm_cvtepi32_pd(v);
+	__m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+	acc = _mm_add_pd(acc, _mm_mul_pd(lo, lo));
+	return _mm_add_pd(acc, _mm_mul_pd(hi, hi));
+}
+
+static inline __m128d AddValue_epi32(__m128d acc, __m128i v)
+{
+	acc = _mm_add_pd(acc, _mm_cvtepi32_pd(v));
+	return _mm_add_pd(acc, _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2))));
+}
+
+static inline double HorizontalSum(__m128d v)
+{
+	double lanes[2];
+	_mm_storeu_pd(lanes, v);
+	return lanes[0] + lanes[1];
+}
+
+double BrennerGradient_SSE2(const ushort* image, int image_width, const ImageRegion& region)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128d acc = _mm_setzero_pd();
+	double sum = 0.0;
+	int count = region.width - 2;
+	if (count <= 0){
+		return 0.0;
+	}
+
+	for (int row=region.y_offset; row<region.y_offset+region.height; ++row){
+		const ushort* p = image + (size_t)row*image_width + region.x_offset;
+
+		int j = 0;
+		for (; j+8<=count; j+=8){
+			__m128i a = _mm_loadu_si128((const __m128i*)(p+j));
+			__m128i b = _mm_loadu_si128((const __m128i*)(p+j+2));
+			__m128i d_lo = _mm_sub_epi32(_mm_unpacklo_epi16(b, zero), _mm_unpacklo_epi16(a, zero));
+			__m128i d_hi = _mm_sub_epi32(_mm_unpackhi_epi16(b, zero), _mm_unpackhi_epi16(a, zero));
+			acc = AddSquare_epi32(acc, d_lo);
+			acc = AddSquare_epi32(acc, d_hi);
+		}
+
+		//the remain pixels
+		for (; j<count; ++j){
+			double d = (double)p[j+2] - (double)p[j];
+			sum += d*d;
+		}
+	}
+	return sum + HorizontalSum(acc);
+}
+
+double LaplacianVariance_SSE2(const ushort* image, int image_width, const ImageRegion& region)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128d accSum = _mm_setzero_pd();
+	__m128d accSquare = _mm_setzero_pd();
+	double sum = 0.0, square = 0.0;
+	int count = region.width - 2;
+	int rows = region.height - 2;
+	if (count <= 0 || rows <= 0){
+		return 0.0;
+	}
+
+	for (int row=region.y_offset+1; row<region.y_offset+region.height-1; ++row){
+		const ushort* p = image + (size_t)row*image_width + region.x_offset + 1;
+		const ushort* up = p - image_width;
+		const ushort* down = p + image_width;
+
+		int j = 0;
+		for (; j+8<=count; j+=8){
+			__m128i c = _mm_loadu_si128((const __m128i*)(p+j));
+			__m128i l = _mm_loadu_si128((const __m128i*)(p+j-1));
+			__m128i r = _mm_loadu_si128((const __m128i*)(p+j+1));
+			__m128i u = _mm_loadu_si128((const __m128i*)(up+j));
+			__m128i d = _mm_loadu_si128((const __m128i*)(down+j));
+
+			//neighbour sums in 32 bits: 4*65535 does not fit in 16 bits
+			__m128i n_lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(l, zero), _mm_unpacklo_epi16(r, zero)),
+										 _mm_add_epi32(_mm_unpacklo_epi16(u, zero), _mm_unpacklo_epi16(d, zero)));
+			__m128i n_hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(l, zero), _mm_unpackhi_epi16(r, zero)),
+										 _mm_add_epi32(_mm_unpackhi_epi16(u, zero), _mm_unpackhi_epi16(d, zero)));
+			__m128i lap_lo = _mm_sub_epi32(_mm_slli_epi32(_mm_unpacklo_epi16(c, zero), 2), n_lo);
+			__m128i lap_hi = _mm_sub_epi32(_mm_slli_epi32(_mm_unpackhi_epi16(c, zero), 2), n_hi);
+
+			accSum = AddValue_epi32(accSum, lap_lo);
+			accSum = AddValue_epi32(accSum, lap_hi);
+			accSquare = AddSquare_epi32(accSquare, lap_lo);
+			accSquare = AddSquare_epi32(accSquare, lap_hi);
+		}
+
+		//the remain pixels
+		for (; j<count; ++j){
+			double lap = 4.0*p[j] - p[j-1] - p[j+1] - up[j] - down[j];
+			sum += lap;
+			square += lap*lap;
+		}
+	}
+
+	double n = (double)count*rows;
+	double mean = (sum + HorizontalSum(accSum))/n;
+	return (square + HorizontalSum(accSquare))/n - mean*mean;
+}
+
+void InterpolateImage_SSE2(const ushort* first, const ushort* second, ushort* dst, int count, float weight)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i offset = _mm_set1_epi32(32768);
+	const __m128 w = _mm_set1_ps(weight);
+
+	int i = 0;
+	for (; i+8<=count; i+=8){
+		__m128i a = _mm_loadu_si128((const __m128i*)(first+i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(second+i));
+		__m128 a_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero));
+		__m128 a_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero));
+		__m128 b_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero));
+		__m128 b_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(b, zero));
+		__m128i lo = _mm_cvtps_epi32(_mm_add_ps(a_lo, _mm_mul_ps(_mm_sub_ps(b_lo, a_lo), w)));
+		__m128i hi = _mm_cvtps_epi32(_mm_add_ps(a_hi, _mm_mul_ps(_mm_sub_ps(b_hi, a_hi), w)));
+
+		//SSE2 has no unsigned pack, shift into the signed range and back
+		lo = _mm_sub_epi32(lo, offset);
+		hi = _mm_sub_epi32(hi, offset);
+		__m128i packed = _mm_packs_epi32(lo, hi);
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+	}
+
+	//the remain pixels, rounded to nearest even as the vector ones
+	for (; i<count; ++i){
+		float a = (float)first[i];
+		dst[i] = (ushort)_mm_cvtss_si32(_mm_set_ss(a + ((float)second[i]-a)*weight));
+	}
+}
+
+void Downsample2x2_SSE2(const ushort* src, int src_stride, int width, int height, ushort* dst)
+{
+	const __m128i offset = _mm_set1_epi32(32768);
+	const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+	const __m128i round = _mm_set1_epi32(2);
+	int dstWidth = width/2;
+	int dstHeight = height/2;
+
+	for (int y=0; y<dstHeight; ++y){
+		const ushort* r0 = src + (size_t)2*y*src_stride;
+		const ushort* r1 = r0 + src_stride;
+		ushort* d = dst + (size_t)y*dstWidth;
+		int x = 0;
+		for (; x+8<=dstWidth; x+=8){
+			__m128i a0 = _mm_loadu_si128((const __m128i*)(r0+2*x));
+			__m128i a1 = _mm_loadu_si128((const __m128i*)(r1+2*x));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(r0+2*x+8));
+			__m128i b1 = _mm_loadu_si128((const __m128i*)(r1+2*x+8));
+
+			//the 4 pixels are summed in 32 bits lanes and rounded once, as the remain pixels
+			__m128i a = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(a0, lowMask), _mm_srli_epi32(a0, 16)),
+									  _mm_add_epi32(_mm_and_si128(a1, lowMask), _mm_srli_epi32(a1, 16)));
+			__m128i b = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(b0, lowMask), _mm_srli_epi32(b0, 16)),
+									  _mm_add_epi32(_mm_and_si128(b1, lowMask), _mm_srli_epi32(b1, 16)));
+			a = _mm_srli_epi32(_mm_add_epi32(a, round), 2);
+			b = _mm_srli_epi32(_mm_add_epi32(b, round), 2);
+			__m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, offset), _mm_sub_epi32(b, offset));
+			_mm_storeu_si128((__m128i*)(d+x), _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+		}
+
+		//the remain pixels
+		for (; x<dstWidth; ++x){
+			d[x] = (ushort)((r0[2*x] + r0[2*x+1] + r1[2*x] + r1[2*x+1] + 2)/4);
+		}
+	}
+}
+
+//a 4x4 bin averages the 2x2 bins again in place
+void BinImage_SSE2(const ushort* src, int src_stride, int width, int height, int binning, ushort* dst)
+{
+	if (binning <= 1){
+		for (int y=0; y<height; ++y){
+			memcpy(dst + (size_t)y*width, src + (size_t)y*src_stride, width*sizeof(ushort));
+		}
+		return;
+	}
+	Downsample2x2_SSE2(src, src_stride, width, height, dst);
+	for (int factor=4; factor<=binning; factor*=2){
+		width /= 2;
+		height /= 2;
+		Downsample2x2_SSE2(dst, width, width, height, dst);
+	}
+}
+
+/*
+	Each pixel gets the 2 bytes holding its bits in a 16 bits lane: the even pixels take
+	bytes 0 and 1 of their triple, the odd ones bytes 1 and 2. The odd ones are then
+	right there after a shift, the even ones need their low nibble moved below.
+*/
+static inline __m128i UnpackMono12Pixels(__m128i bytes)
+{
+	const __m128i order = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	const __m128i evenMask = _mm_set1_epi32(0x0000FFFF);
+	__m128i w = _mm_shuffle_epi8(bytes, order);
+	__m128i even = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(w, 4), _mm_set1_epi16(0x0FF0)), _mm_and_si128(_mm_srli_epi16(w, 8), _mm_set1_epi16(0x000F)));
+	__m128i odd = _mm_srli_epi16(w, 4);
+	return _mm_or_si128(_mm_and_si128(even, evenMask), _mm_andnot_si128(evenMask, odd));
+}
+
+#ifdef __AVX2__
+static inline __m256i UnpackMono12Pixels(__m256i bytes)
+{
+	const __m256i order = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+		0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	__m256i w = _mm256_shuffle_epi8(bytes, order);
+	__m256i even = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(w, 4), _mm256_set1_epi16(0x0FF0)), _mm256_and_si256(_mm256_srli_epi16(w, 8), _mm256_set1_epi16(0x000F)));
+	__m256i odd = _mm256_srli_epi16(w, 4);
+	return _mm256_blend_epi16(odd, even, 0x55);
+}
+#endif
+
+//the last pixels of a row are unpacked one pair at a time
+static inline void UnpackMono12Remain(const uchar* s, ushort* d, int x, int width)
+{
+	for (; x+2<=width; x+=2){
+		const uchar* p = s + x/2*3;
+		d[x] = (ushort)((p[0]<<4) | (p[1] & 0x0F));
+		d[x+1] = (ushort)((p[2]<<4) | (p[1]>>4));
+	}
+}
+
+//the vector loads read 4 bytes past the 12 they unpack, so they stop before the end of the row
+static inline int UnpackMono12Row_SSSE3(const uchar* s, ushort* d, int x, int rowBytes)
+{
+	for (; x/2*3+16<=rowBytes; x+=8){
+		_mm_storeu_si128((__m128i*)(d+x), UnpackMono12Pixels(_mm_loadu_si128((const __m128i*)(s+x/2*3))));
+	}
+	return x;
+}
+
+void UnpackMono12_SSSE3(const uchar* src, int src_stride, int width, int height, ushort* dst)
+{
+	int rowBytes = width/2*3;
+	for (int y=0; y<height; ++y){
+		const uchar* s = src + (size_t)y*src_stride;
+		ushort* d = dst + (size_t)y*width;
+		UnpackMono12Remain(s, d, UnpackMono12Row_SSSE3(s, d, 0, rowBytes), width);
+	}
+}
+
+#ifdef __AVX2__
+void UnpackMono12_AVX2(const uchar* src, int src_stride, int width, int height, ushort* dst)
+{
+	int rowBytes = width/2*3;
+	for (int y=0; y<height; ++y){
+		const uchar* s = src + (size_t)y*src_stride;
+		ushort* d = dst + (size_t)y*width;
+		int x = 0;
+		for (; x/2*3+28<=rowBytes; x+=16){
+			__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(s+x/2*3))),
+				_mm_loadu_si128((const __m128i*)(s+x/2*3+12)), 1);
+			_mm256_storeu_si256((__m256i*)(d+x), UnpackMono12Pixels(bytes));
+		}
+		UnpackMono12Remain(s, d, UnpackMono12Row_SSSE3(s, d, x, rowBytes), width);
+	}
+}
+#endif
+
+void UnpackMono12(const uchar* src, int src_stride, int width, int height, ushort* dst)
+{
+#ifdef __AVX2__
+	UnpackMono12_AVX2(src, src_stride, width, height, dst);
+#else
+	UnpackMono12_SSSE3(src, src_stride, width, height, dst);
+#endif
+}
+
+ushort MaxPixel_SSE2(const ushort* src, int count)
+{
+	//SSE2 only compares signed words, the sign bit is flipped around the comparison
+	const __m128i sign = _mm_set1_epi16((short)0x8000);
+	__m128i accMax = _mm_set1_epi16((short)0x8000);
+
+	int i = 0;
+	for (; i+8<=count; i+=8){
+		accMax = _mm_max_epi16(accMax, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src+i)), sign));
+	}
+	accMax = _mm_xor_si128(accMax, sign);
+	ushort lanes[8];
+	_mm_storeu_si128((__m128i*)lanes, accMax);
+	ushort result = 0;
+	for (int k=0; k<8; ++k){
+		result = max(result, lanes[k]);
+	}
+
+	//the remain pixels
+	for (; i<count; ++i){
+		result = max(result, src[i]);
+	}
+	return result;
+}
+
+void ThresholdImage_SSE2(const ushort* src, uchar* mask, int count, ushort threshold)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8((char)0xFF);
+	const __m128i t = _mm_set1_epi16((short)threshold);
+
+	int i = 0;
+	for (; i+16<=count; i+=16){
+		//the saturated difference is 0 for the pixels not above threshold
+		__m128i a = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)(src+i)), t), zero);
+		__m128i b = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)(src+i+8)), t), zero);
+		_mm_storeu_si128((__m128i*)(mask+i), _mm_xor_si128(_mm_packs_epi16(a, b), ones));
+	}
+
+	//the remain pixels
+	for (; i<count; ++i){
+		mask[i] = (src[i] > threshold) ? 255 : 0;
+	}
+}
@@ -0,0 +1,50 @@
+/*****************************************************************
+ImageKernels : SSE2 pixel kernels used by the image processing threads
+******************************************************************/
+#ifndef _IMAGE_KERNELS_H_
+#define _IMAGE_KERNELS_H_
+
+#include "Util.h"
+
+//ratio = (gcamp-gcamp_background)/(rfp-rfp_background)
+//pixels whose background subtracted rfp value is below min_denominator are set to 0
+void RatioImage_SSE2(const ushort* gcamp, const ushort* rfp, float* ratio, int count,
+					 ushort gcamp_background, ushort rfp_background, float min_denominator);
+
+//dst = saturate(round(src*scale)), used to map float images onto the 8 bits display
+void FloatToUChar_SSE2(const float* src, uchar* dst, int count, float scale);
+
+//sum of the background subtracted pixels inside region, the region must lie in the image
+double RegionSum_SSE2(const ushort* image, int image_width, const ImageRegion& region, ushort background);
+
+//Brenner focus measure: sum of (I(x+2,y)-I(x,y))^2 inside region, region must be at least 3 pixels wide
+double BrennerGradient_SSE2(const ushort* image, int image_width, const ImageRegion& region);
+
+//variance of the 4-neighbour laplacian over the interior of region
+double LaplacianVariance_SSE2(const ushort* image, int image_width, const ImageRegion& region);
+
+//dst = round(first + (second-first)*weight), weight in [0, 1], rounded to nearest even
+void InterpolateImage_SSE2(const ushort* first, const ushort* second, ushort* dst, int count, float weight);
+
+//2x2 binning by average into a (width/2)x(height/2) image, src_stride in pixels.
+//dst may be src since every output row is written behind the rows it is read from.
+void Downsample2x2_SSE2(const ushort* src, int src_stride, int width, int height, ushort* dst);
+
+//binning by average into a (width/binning)x(height/binning) image, binning is 1, 2 or 4
+void BinImage_SSE2(const ushort* src, int src_stride, int width, int height, int binning, ushort* dst);
+
+//Mono12Packed rows (pixel pairs in 3 bytes: p0 bits 11-4, p1 bits 3-0 | p0 bits 3-0, p1 bits 11-4)
+//to 16 bits pixels, width is even and src_stride in bytes. AVX2 when compiled for it, SSSE3 otherwise.
+void UnpackMono12(const uchar* src, int src_stride, int width, int height, ushort* dst);
+//the two paths of UnpackMono12, the AVX2 one only exists when compiled for it
+void UnpackMono12_SSSE3(const uchar* src, int src_stride, int width, int height, ushort* dst);
+#ifdef __AVX2__
+void UnpackMono12_AVX2(const uchar* src, int src_stride, int width, int height, ushort* dst);
+#endif
+
+ushort MaxPixel_SSE2(const ushort* src, int count);
+
+//mask = 255 where src > threshold, 0 elsewhere
+void ThresholdImage_SSE2(const ushort* src, uchar* mask, int count, ushort threshold);
+
+#endif //_IMAGE_KERNELS_H_
@@ -5,6 +5,8 @@
 #include <QtWidgets/QHBoxLayout>
 #include <QtWidgets/QVBoxLayout>
 #include <QtWidgets/QMessageBox>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -29,6 +31,8 @@ void ImageSaveWidget::CreateLayout()
 	imageNumEdit = new QLineEdit;
 	tiffFormatButton = new QRadioButton("Tiff");
 	rawFormatButton = new QRadioButton("Raw");
+	packedCheck = new QCheckBox("Keep 12 Bits Packed");
+	packedCheck->setToolTip("Record the Mono12Packed frames without unpacking them, they are unpacked when saved in tiff");
 	imageFolderButton = new QPushButton("...");
 	okButton = new QPushButton("OK");
 	cancelButton = new QPushButton("Cancel");
@@ -42,6 +46,7 @@ void ImageSaveWidget::CreateLayout()
 		
 	QObject::connect( imageNumEdit, SIGNAL( editingFinished() ), this, SLOT( OnImageNumChanged() ));
 	QObject::connect( imageFolderButton, SIGNAL( clicked() ), this, SLOT( OnImageFolderButton() ));
+	QObject::connect( tiffFormatButton, SIGNAL( toggled(bool) ), this, SLOT( OnImageFormatChanged() ));
 	QObject::connect( okButton, SIGNAL( clicked() ), this, SLOT( OnOkButton() ));
 	QObject::connect( cancelButton, SIGNAL( clicked() ), this, SLOT( OnCancelButton() ));
 	
@@ -62,6 +67,9 @@ void ImageSaveWidget::CreateLayout()
 	imageSettingLayout->addWidget( new QLabel("Image Num") );
 	imageSettingLayout->addWidget( imageNumEdit );
 	
+	QHBoxLayout* packedLayout = new QHBoxLayout;
+	packedLayout->addWidget( packedCheck );
+
 	QHBoxLayout* buttonsLayout = new QHBoxLayout;
 	buttonsLayout->addWidget( okButton );
 	buttonsLayout->addWidget( cancelButton );
@@ -71,6 +79,7 @@ void ImageSaveWidget::CreateLayout()
 	mainLayout->addLayout(fileFolderLayout);
 	mainLayout->addLayout(imageNamePrefixLayout);
 	mainLayout->addLayout(imageSettingLayout);
+	mainLayout->addLayout(packedLayout);
 	mainLayout->addLayout( buttonsLayout );
 	
 	progressDialog = new QProgressDialog();
@@ -211,12 +220,19 @@ ImageBuffer* ImageSaveWidget::Allocate(ImageSize imageSize, DATATYPE type)
 		buffers[i].image_width = imageSize.width;
 		buffers[i].image_height = imageSize.height;
 		buffers[i].data_type = type;
+		buffers[i].timestamp = 0;
+		buffers[i].exposure_time = 0;
+		buffers[i].has_position = false;
+		buffers[i].z_position = 0;
 		if (type == USHORT_TYPE){
 			buffers[i].image_data = (void*)new ushort[imageSize.width*imageSize.height];
 		}
 		else if (type == UCHAR_TYPE){
 			buffers[i].image_data = (void*)new uchar[imageSize.width*imageSize.height];
 		}
+		else if (type == MONO12P_TYPE){
+			buffers[i].image_data = (void*)new uchar[Get_ImageBytes(type, imageSize.width, imageSize.height)];
+		}
 	}
 	return buffers;
 }
@@ -272,7 +288,7 @@ void ImageSaveWidget::SaveImages()
 
 	if (buffers == NULL){ return; }
 	prefix = fileNamePrefixEdit->text();
-	imageFormat = "tiff";
+	SavePositionLog(buffers);
 
 	unsigned int sliceCountQuot = ImageNum / IMAGE_SAVE_THREADS;
 	unsigned int sliceCountRem = ImageNum - sliceCountQuot * IMAGE_SAVE_THREADS;
@@ -288,6 +304,35 @@ void ImageSaveWidget::SaveImages()
 	for (int i = 0; i < IMAGE_SAVE_THREADS; i++) threads[i]->start();
 }
 
+//stage positions of the images stamped at their exposure time, one line per image file
+void ImageSaveWidget::SavePositionLog(ImageBuffer* buffers)
+{
+	bool hasPosition = false;
+	for (int i=0; i<ImageNum; ++i){
+		hasPosition = hasPosition || buffers[i].has_position;
+	}
+	if (!hasPosition){
+		return;
+	}
+
+	QFile file(imageFolder+"\\"+prefix+"_positions.txt");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "SavePositionLog()", "Fail to create the position log");
+		return;
+	}
+	QTextStream stream(&file);
+	stream<<"image\texposure_time(us)\tz1_position(pulse)\n";
+	for (int i=0; i<ImageNum; ++i){
+		stream<<prefix<<"_"<<buffers[i].timestamp<<"."<<imageFormat<<"\t"<<buffers[i].exposure_time<<"\t";
+		if (buffers[i].has_position){
+			stream<<QString::number(buffers[i].z_position, 'f', 1)<<"\n";
+		} else{
+			stream<<"nan\n";
+		}
+	}
+	file.close();
+}
+
  void ImageSaveWidget::SaveOneImage(const string& filename, void* image_data, DATATYPE data_type, int width, int height)
  {
 	 if (data_type == USHORT_TYPE){
@@ -6,6 +6,7 @@
 #include <QtWidgets/QLineEdit>
 #include <QtWidgets/QDialog>
 #include <QtWidgets/QRadioButton>
+#include <QtWidgets/QCheckBox>
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QGroupBox>
 #include <QtWidgets/QProgressBar>
@@ -27,12 +28,14 @@ public:
 	void SaveImages();
 	static void SaveOneImage(const string& filename, void* image_data, DATATYPE dataType, int width, int height);
 	inline int Get_ImageNum(){ return ImageNum; }
+	inline bool Get_KeepPacked(){ return packedCheck->isChecked(); } //12 bits packed frames are recorded as they are
 
 signals:
 	void StartSaveImageSignal(int);
 
 protected:
 	void CreateLayout();
+	void SavePositionLog(ImageBuffer* buffers);
 
 protected slots:
 	void OnImageNumChanged();
@@ -48,6 +51,7 @@ private:
 	QLineEdit* imageNumEdit;
 	QRadioButton* tiffFormatButton;
 	QRadioButton* rawFormatButton;
+	QCheckBox* packedCheck;
 	QPushButton* imageFolderButton;
 	QPushButton* okButton;
 	QPushButton* cancelButton;
@@ -1,4 +1,3 @@
-
 #include "Laser.h"
 #include <stdlib.h>
 
@@ -8,27 +7,48 @@ std::string CLaser::DEVICE_NAME = "Laser";
 CLaser::CLaser()
 {
 	baudRate = 9600;
-	serialPort = NULL;
+	endpoint = NULL;
+	commandQueue = NULL;
 	serialState = SERIAL_CLOSED;
 	laserMode = CWP;
 }
 
+CLaser::~CLaser()
+{
+	Disconnect();
+}
+
 void CLaser::Connect()
 {
-	serialPort = new CSerialPort();
+	CSerialPort* serialPort = new CSerialPort();
 	if (serialPort->Init_Com(portName, baudRate) != SERIAL_CONNECTION_SUCCESS){
+		delete serialPort;
 		//cout<<GetErrorString(OBJECT_NAME, "InitCom()", "Fail to conect laser")<<endl;
 		throw QException(OBJECT_NAME, "InitCom()", "Fail to conect laser");
 	}
+	Connect(serialPort);
+}
+
+//the commands go through the I/O thread of the queue, which answers them as soon as the laser does
+void CLaser::Connect(SerialEndpoint* serial_endpoint)
+{
+	Disconnect();
+	endpoint = serial_endpoint;
+	commandQueue = new SerialCommandQueue(endpoint, "OK", "ERR");
+	commandQueue->StartThread();
 	serialState = SERIAL_OPENED;
 }
 
 void CLaser::Disconnect()
 {
-	if (serialPort != NULL){
-		serialPort->ClosePort();
-		delete serialPort;
-		serialPort = NULL;
+	if (commandQueue != NULL){
+		commandQueue->StopThread();
+		delete commandQueue;
+		commandQueue = NULL;
+	}
+	if (endpoint != NULL){
+		delete endpoint;
+		endpoint = NULL;
 	}
 	serialState = SERIAL_CLOSED;
 }
@@ -38,150 +58,120 @@ void CLaser::SetPortName(char* port)
 	strncpy(portName, port, 16);
 }
 
-//Send broadcast message for all devices to start
-bool CLaser::StartAll()
+SerialQueueStatistics CLaser::GetQueueStatistics()
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce255:AM:STATe ON\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
+	if (commandQueue == NULL){
+		SerialQueueStatistics statistics;
+		memset(&statistics, 0, sizeof(statistics));
+		return statistics;
+	}
+	return commandQueue->Get_Statistics();
+}
 
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
+bool CLaser::Query(const string& command, string& value)
+{
+	if (commandQueue == NULL || !IsConnected()){
+		return false;
 	}
-	return false;
+	try{
+		value = commandQueue->command(command + "\n\r");
+	} catch (string e){
+		return false;
+	}
+	return true;
+}
+
+bool CLaser::Query(const string& command)
+{
+	string value;
+	return Query(command, value);
+}
+
+//Send broadcast message for all devices to start
+bool CLaser::StartAll()
+{
+	return Query("SOURce255:AM:STATe ON");
 }
 
 //Send broadcast message for all devices to stop
 bool CLaser::StopAll()
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce255:AM:STATe OFF\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
-	}
-	return false;
+	return Query("SOURce255:AM:STATe OFF");
 }
 	
 bool CLaser::Start()
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:AM:STATe ON\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
-	}
-	return false;
+	return Query("SOURce:AM:STATe ON");
 }
 
 bool CLaser::Stop()
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:AM:STATe OFF\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
-	}
-	return false;
+	return Query("SOURce:AM:STATe OFF");
 }
 
 bool CLaser::SetMode(LaserMode mode)
 {
 	if (mode != CWP && mode != DIGITAL){ return false; }
-	if (serialPort != NULL && IsConnected()){
-		if (mode == CWP){
-			serialPort->Write_Data("SOURce:AM:INTernal CWP\n\r");
-		} else{
-			serialPort->Write_Data("SOURce:AM:EXTernal DIGital\n\r");
-		}
-		Sleep(SERIAL_QUERY_DELAY);
-
-		//receive the returned message
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		bool success = AnalyseData(serialPort->readBuffer, numBytes);
-		if (success){
-			laserMode = mode;
-		}
-		return success;
+	bool success = Query(mode == CWP ? "SOURce:AM:INTernal CWP" : "SOURce:AM:EXTernal DIGital");
+	if (success){
+		laserMode = mode;
 	}
-	return false;
+	return success;
 }
 
 bool CLaser::GetMode(LaserMode &mode)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:AM:SOURce?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		bool success = false;
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			if (strncmp(LaserValue, "CWP", 3) == 0){
-				mode = CWP;     //constant power
-				laserMode = mode;
-				success = true;
-			}
-			else if (strncmp(LaserValue, "DIGITAL", 6) == 0){
-				mode = DIGITAL; //Digital modulation
-				laserMode = mode;
-				success = true;
-			}
-			return success;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SOURce:AM:SOURce?", value)){
+		return false;
 	}
-	return false;
+	if (value.compare(0, 3, "CWP") == 0){
+		mode = CWP;     //constant power
+	}
+	else if (value.compare(0, 6, "DIGITA") == 0){
+		mode = DIGITAL; //Digital modulation
+	}
+	else { return false; }
+	laserMode = mode;
+	return true;
 }
 
 string CLaser::GetCurrentState(LaserStatus &status)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SYSTem:STATus?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			//generally, the size of status code is 8
-			if (strlen(LaserValue) < 8){
-				status = LASER_FAULT;
-				return "Invalid Status Code";
-			}
-			long statusCode = strtol(LaserValue+4, NULL, 16);
-			if (statusCode & 0x1){ 
-				status = LASER_FAULT;
-				return "Fault"; 
-			}
-			else if (statusCode & 0x2){ 
-				status = LASER_EMMISION;
-				return "Emission"; 
-			}
-			else if ((statusCode & 0x4) || (statusCode & 0x1000 && statusCode & 0x08)){ 
-				status = LASER_READY;
-				return "Ready";
-			}
-			else if (statusCode & 0x8){ 
-				status = LASER_STANDBY;
-				return "Key Switch Standby";
-			}
-			else if (statusCode & 0x100){ 
-				status = LASER_WARMUP;
-				return "Warm Up"; 
-			}
-		}
-		else { 
-			status = LASER_FAULT;
-			return "No Returned Status"; 
-		}
+	if (commandQueue == NULL || !IsConnected()){
+		status = LASER_NO_CONNECTION;
+		return "No Connection";
+	}
+	string value;
+	if (!Query("SYSTem:STATus?", value)){
+		status = LASER_FAULT;
+		return "No Returned Status";
+	}
+	//generally, the size of status code is 8
+	if (value.size() < 8){
+		status = LASER_FAULT;
+		return "Invalid Status Code";
+	}
+	long statusCode = strtol(value.c_str()+4, NULL, 16);
+	if (statusCode & 0x1){ 
+		status = LASER_FAULT;
+		return "Fault"; 
+	}
+	else if (statusCode & 0x2){ 
+		status = LASER_EMMISION;
+		return "Emission"; 
+	}
+	else if ((statusCode & 0x4) || (statusCode & 0x1000 && statusCode & 0x08)){ 
+		status = LASER_READY;
+		return "Ready";
+	}
+	else if (statusCode & 0x8){ 
+		status = LASER_STANDBY;
+		return "Key Switch Standby";
+	}
+	else if (statusCode & 0x100){ 
+		status = LASER_WARMUP;
+		return "Warm Up"; 
 	}
 	status = LASER_NO_CONNECTION;
 	return "No Connection";
@@ -189,27 +179,18 @@ string CLaser::GetCurrentState(LaserStatus &status)
 
 string CLaser::GetFaultInfo()
 {
-	if (serialPort != NULL && IsConnected()){
+	if (commandQueue != NULL && IsConnected()){
 	}
 	return "No Connection";
 }
 
 bool CLaser::SetCDRHDelay(int state)
 {
-	if (serialPort != NULL && IsConnected()){
-		if (state == 1){
-			serialPort->Write_Data("SYSTem:CDRH ON\n\r");
-		}
-		else if (state == 0){
-			serialPort->Write_Data("SYSTem:CDRH OFF\n\r");
-		}
-		else {return false;}
-		Sleep(SERIAL_QUERY_DELAY);
-
-		//receive the returned message
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
+	if (state == 1){
+		return Query("SYSTem:CDRH ON");
+	}
+	else if (state == 0){
+		return Query("SYSTem:CDRH OFF");
 	}
 	return false;
 }
@@ -217,25 +198,17 @@ bool CLaser::SetCDRHDelay(int state)
 //state=1: ON, state=0: OFF
 bool CLaser::GetCDRHDelayState(int state)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SYSTem:CDRH?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		bool success = false;
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			if (strncmp(LaserValue, "ON", 2) == 0){
-				state = 1; // ON
-				success = true;
-			}
-			else if (strncmp(LaserValue, "OFF", 3) == 0){
-				state = 0; //OFF
-				success = true;
-			}
-			return success;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SYSTem:CDRH?", value)){
+		return false;
+	}
+	if (value.compare(0, 2, "ON") == 0){
+		state = 1; // ON
+		return true;
+	}
+	else if (value.compare(0, 3, "OFF") == 0){
+		state = 0; //OFF
+		return true;
 	}
 	return false;
 }
@@ -243,150 +216,109 @@ bool CLaser::GetCDRHDelayState(int state)
 //state=1: ON, state=0: OFF
 bool CLaser::SetAutoStartState(int state)
 {
-	if (serialPort != NULL && IsConnected()){
-		if (state == 1){
-			serialPort->Write_Data("SYSTem:AUTostart ON\n\r");
-		}
-		else if (state == 0){
-			serialPort->Write_Data("SYSTem:AUTostart OFF\n\r");
-		}
-		else{ return false; }
-		Sleep(SERIAL_QUERY_DELAY);
-
-		//receive the returned message
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
+	if (state == 1){
+		return Query("SYSTem:AUTostart ON");
+	}
+	else if (state == 0){
+		return Query("SYSTem:AUTostart OFF");
 	}
 	return false;
 }
 
 bool CLaser::GetAutoStartState(int state)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SYSTem:AuTostart?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		bool success = false;
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			if (strncmp(LaserValue, "ON", 2) == 0){
-				state = 1; // ON
-				success = true;
-			}
-			else if (strncmp(LaserValue, "OFF", 3) == 0){
-				state = 0; //OFF
-				success = true;
-			}
-			return success;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SYSTem:AuTostart?", value)){
+		return false;
+	}
+	if (value.compare(0, 2, "ON") == 0){
+		state = 1; // ON
+		return true;
+	}
+	else if (value.compare(0, 3, "OFF") == 0){
+		state = 0; //OFF
+		return true;
 	}
 	return false;
 }
 
 bool CLaser::GetMaxPower(double &max_power)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:POWer:LIMit:HIGH?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			maxPower = atof(LaserValue);
-			max_power = maxPower;
-			return true;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SOURce:POWer:LIMit:HIGH?", value)){
+		return false;
 	}
-	return false;
+	maxPower = atof(value.c_str());
+	max_power = maxPower;
+	return true;
 }
 
 bool CLaser::GetMinPower(double &min_power)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:POWer:LIMit:LOW?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			minPower = atof(LaserValue);
-			min_power = minPower;
-			return true;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SOURce:POWer:LIMit:LOW?", value)){
+		return false;
 	}
-	return false;
+	minPower = atof(value.c_str());
+	min_power = minPower;
+	return true;
 }
 
 bool CLaser::GetNomialPower(double &nomial_power)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:POWer:NOMinal?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			nomialPower = atof(LaserValue);
-			nomial_power = nomialPower;
-			return true;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SOURce:POWer:NOMinal?", value)){
+		return false;
 	}
-	return false;
+	nomialPower = atof(value.c_str());
+	nomial_power = nomialPower;
+	return true;
 }
 
 bool CLaser::SetCurrentPower(double power)
 {
-	if (serialPort != NULL && IsConnected()){
-		sprintf(LaserValue, "SOURce:POWer:LEVel:IMMediate:AMPLitude %f\n\r", power);
-		serialPort->Write_Data(LaserValue);
-		Sleep(SERIAL_QUERY_DELAY);
-
-		//receive the returned message
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		return AnalyseData(serialPort->readBuffer, numBytes);
-	}
-	return false;
+	char command[128];
+	sprintf(command, "SOURce:POWer:LEVel:IMMediate:AMPLitude %f", power);
+	return Query(command);
 }
 
 bool CLaser::GetCurrentPower(double &power)
 {
-	if (serialPort != NULL && IsConnected()){
-		serialPort->Write_Data("SOURce:POWer:LEVel:IMMediate:AMPLitude?\n\r");
-		Sleep(SERIAL_QUERY_DELAY);
-
-		serialPort->ClearReadBuffer();
-		int numBytes = serialPort->Receive_Data();
-		if (AnalyseData(serialPort->readBuffer, numBytes)){
-			currentPower = atof(LaserValue);
-			power = currentPower;
-			return true;
-		}
-		else { return false; }
+	string value;
+	if (!Query("SOURce:POWer:LEVel:IMMediate:AMPLitude?", value)){
+		return false;
 	}
-	return false;
+	currentPower = atof(value.c_str());
+	power = currentPower;
+	return true;
 }
 
-bool CLaser::AnalyseData(char* data, int num)
+//the laser answers the queries in order, so they are all sent before the first answer
+bool CLaser::GetSettings(LaserSettings &settings)
 {
-	bool success = false;
-	int index = 0;
-	memset(LaserValue, 0, sizeof(LaserValue));
-	for (int i=0; i<num-3; ++i){
-		if (strncmp(data+i, "OK\r\n", 4) == 0){
-			success = true;
-			LaserValue[index] = '\0';
-			break;
-		}
-		else if (data[i] != ' '){
-			LaserValue[index++] = data[i];
-		}
+	if (commandQueue == NULL || !IsConnected()){
+		return false;
 	}
-	return success;
-}
\ No newline at end of file
+	vector<string> queries;
+	queries.push_back("SOURce:POWer:NOMinal?\n\r");
+	queries.push_back("SOURce:POWer:LIMit:LOW?\n\r");
+	queries.push_back("SOURce:POWer:LIMit:HIGH?\n\r");
+	queries.push_back("SOURce:POWer:LEVel:IMMediate:AMPLitude?\n\r");
+	queries.push_back("SOURce:AM:SOURce?\n\r");
+	vector<SerialFuture> answers = commandQueue->Submit(queries);
+	try{
+		nomialPower = atof(answers[0].Get_Response().c_str());
+		minPower = atof(answers[1].Get_Response().c_str());
+		maxPower = atof(answers[2].Get_Response().c_str());
+		currentPower = atof(answers[3].Get_Response().c_str());
+		laserMode = (answers[4].Get_Response().compare(0, 3, "CWP") == 0) ? CWP : DIGITAL;
+	} catch (string e){
+		return false;
+	}
+	settings.nomialPower = nomialPower;
+	settings.minPower = minPower;
+	settings.maxPower = maxPower;
+	settings.currentPower = currentPower;
+	settings.mode = laserMode;
+	return true;
+}
@@ -3,12 +3,21 @@
 #define _LASER_H_
 
 #include "serial.h"
+#include "SerialCommandQueue.h"
 #include "Util.h"
 #include "QException.h"
 
 enum LaserMode{CWP, DIGITAL};
 enum LaserStatus{LASER_NO_CONNECTION, LASER_FAULT, LASER_EMMISION, LASER_READY, LASER_STANDBY, LASER_WARMUP};
 
+struct LaserSettings{
+	double nomialPower;   //W
+	double minPower;
+	double maxPower;
+	double currentPower;
+	LaserMode mode;
+};
+
 class CLaser
 {
 public:
@@ -16,18 +25,20 @@ public:
 	static std::string DEVICE_NAME;
 
 	CLaser();
+	~CLaser();
 	inline bool IsConnected(){ return serialState == SERIAL_OPENED; }
 	inline void SetLaserDescription(string description){ laserDescription = description; }
 	void SetPortName(char* port);
 	inline void SetBaudRate(long rate = 9600) { baudRate = rate; }
 
 	void Connect();
+	void Connect(SerialEndpoint* endpoint); //the laser owns the endpoint, e.g. a SimulatedLaser
 	void Disconnect();
 	bool StartAll();
 	bool StopAll();
 	bool Start();
 	bool Stop();
-	CSerialPort* GetCurrentSerialPort(){ return serialPort; } // Only available for Start All or Stop All
+	SerialQueueStatistics GetQueueStatistics();
 
 	string GetCurrentState(LaserStatus &status);
 	string GetFaultInfo();
@@ -43,18 +54,20 @@ public:
 	bool GetMaxPower(double &max_power);
 	bool GetMinPower(double &min_power);
 	bool GetNomialPower(double &nomial_power);
+	bool GetSettings(LaserSettings &settings); //the queries are pipelined in one round trip
 
 protected:
-	bool AnalyseData(char* data, int num);
+	bool Query(const string& command, string& value);
+	bool Query(const string& command);
 
 private:
 	SerialStatus serialState;
 	long baudRate;
 	char portName[16];
 	string laserDescription;
-	CSerialPort* serialPort;
+	SerialEndpoint* endpoint;
+	SerialCommandQueue* commandQueue;
 
-	char LaserValue[256];
 	double maxPower;
 	double minPower;
 	double nomialPower;
@@ -0,0 +1,408 @@
+#include "MotionCorrectionThread.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <QtCore/QDateTime>
+#include <cmath>
+
+string MotionCorrectionThread::OBJECT_NAME = "MotionCorrectionThread";
+
+void RegistrationTask::run()
+{
+	owner->RegisterFrame(frameSlot);
+}
+
+MotionCorrectionThread::MotionCorrectionThread(QObject* parent) : QThread(parent)
+{
+	isStopMotionCorrection = true;
+	correctFrames = false;
+	isRecording = false;
+	resetTemplates = false;
+	submitSequence = 0;
+	finishSequence = 0;
+	lastTimestamp = 0;
+	totalProcessTime = 0.0;
+	totalLatency = 0.0;
+	for (int i=0; i<MOTION_CORRECTION::FRAME_POOL_SIZE; ++i){
+		framePool[i].capacity = 0;
+		framePool[i].image_data = NULL;
+		framePool[i].corrected_data = NULL;
+	}
+	for (int i=0; i<MOTION_TEMPLATE_NUM; ++i){
+		templateUpdateCount[i] = 0;
+	}
+	//keep one core for the acquisition and display
+	workers.setMaxThreadCount(std::max(1, QThread::idealThreadCount()-1));
+	statistics.workers = workers.maxThreadCount();
+}
+
+MotionCorrectionThread::~MotionCorrectionThread()
+{
+	StopThread();
+	StopRecording();
+	ClearBuffers();
+}
+
+void MotionCorrectionThread::ClearBuffers()
+{
+	for (int i=0; i<MOTION_CORRECTION::FRAME_POOL_SIZE; ++i){
+		if (framePool[i].image_data != NULL){
+			delete [] framePool[i].image_data;
+			framePool[i].image_data = NULL;
+		}
+		if (framePool[i].corrected_data != NULL){
+			delete [] framePool[i].corrected_data;
+			framePool[i].corrected_data = NULL;
+		}
+		framePool[i].capacity = 0;
+		framePool[i].patch.release();
+	}
+}
+
+void MotionCorrectionThread::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	poolMutex.lock();
+	freeSlots.clear();
+	finishedSlots.clear();
+	for (int i=0; i<MOTION_CORRECTION::FRAME_POOL_SIZE; ++i){
+		freeSlots.push_back(i);
+	}
+	submitSequence = 0;
+	finishSequence = 0;
+	poolMutex.unlock();
+
+	ResetTemplate();
+	statistics.frames = 0;
+	statistics.droppedFrames = 0;
+	statistics.workers = workers.maxThreadCount();
+	statistics.averageProcessTime = 0.0;
+	statistics.averageLatency = 0.0;
+	statistics.maxLatency = 0.0;
+	statistics.framePeriod = 0.0;
+	totalProcessTime = 0.0;
+	totalLatency = 0.0;
+	lastTimestamp = 0;
+	displayTimer.start();
+
+	isStopMotionCorrection = false;
+	start();
+}
+
+void MotionCorrectionThread::StopThread()
+{
+	isStopMotionCorrection = true;
+	resultReady.wakeAll();
+	wait();
+	workers.waitForDone();
+}
+
+void MotionCorrectionThread::ResetTemplate()
+{
+	resetTemplates = true;
+}
+
+/*
+	Called in the acquisition thread: copy the frame and queue its registration
+	in the thread pool. The frame is dropped when all slots are in flight.
+*/
+void MotionCorrectionThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopMotionCorrection || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+
+	int slot = -1;
+	poolMutex.lock();
+	if (!freeSlots.empty()){
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	} else{
+		++statistics.droppedFrames;
+	}
+	poolMutex.unlock();
+	if (slot < 0){
+		return;
+	}
+
+	MotionFrame& frame = framePool[slot];
+	int pixels = info.image_width*info.image_height;
+	if (frame.capacity < pixels){
+		delete [] frame.image_data;
+		delete [] frame.corrected_data;
+		frame.image_data = new ushort[pixels];
+		frame.corrected_data = new ushort[pixels];
+		frame.capacity = pixels;
+	}
+	frame.info = info;
+	CopyData(USHORT_TYPE, (uchar*)data, (uchar*)frame.image_data, info.image_width, info.image_height);
+
+	poolMutex.lock();
+	frame.sequence = submitSequence++;
+	poolMutex.unlock();
+	workers.start(new RegistrationTask(this, slot));
+}
+
+cv::Rect MotionCorrectionThread::RegistrationRect(int width, int height)
+{
+	int size = std::min(MOTION_CORRECTION::REGISTRATION_SIZE, std::min(width, height));
+	size = size & ~1;
+	return cv::Rect((width-size)/2, (height-size)/2, size, size);
+}
+
+cv::Mat MotionCorrectionThread::Get_Window(cv::Size size)
+{
+	QMutexLocker locker(&templateMutex);
+	if (window.size() != size){
+		cv::createHanningWindow(window, size, CV_32F);
+	}
+	return window;
+}
+
+int MotionCorrectionThread::TemplateIndex(char channel)
+{
+	if (channel == GCAMP_CHANNEL){
+		return 0;
+	} else if (channel == RFP_CHANNEL){
+		return 1;
+	}
+	return 2;
+}
+
+/*
+	Normalised cross power spectrum, its inverse transform peaks at the shift
+	of the frame against the template. The peak is refined by the centroid of
+	its 3x3 neighbourhood.
+*/
+void MotionCorrectionThread::PhaseCorrelation(const cv::Mat& spectrum, const cv::Mat& templateSpectrum, double& dx, double& dy, double& peak)
+{
+	cv::Mat crossPower;
+	cv::mulSpectrums(spectrum, templateSpectrum, crossPower, 0, true);
+	for (int row=0; row<crossPower.rows; ++row){
+		cv::Vec2f* p = crossPower.ptr<cv::Vec2f>(row);
+		for (int col=0; col<crossPower.cols; ++col){
+			float magnitude = std::sqrt(p[col][0]*p[col][0] + p[col][1]*p[col][1]);
+			if (magnitude > 1.0e-6f){
+				p[col][0] /= magnitude;
+				p[col][1] /= magnitude;
+			} else{
+				p[col][0] = 0.0f;
+				p[col][1] = 0.0f;
+			}
+		}
+	}
+
+	cv::Mat correlation;
+	cv::idft(crossPower, correlation, cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+	double maxValue = 0.0;
+	cv::Point maxLocation;
+	cv::minMaxLoc(correlation, NULL, &maxValue, NULL, &maxLocation);
+
+	int width = correlation.cols;
+	int height = correlation.rows;
+	double sumX = 0.0, sumY = 0.0, sumWeight = 0.0;
+	for (int j=-1; j<=1; ++j){
+		for (int i=-1; i<=1; ++i){
+			int x = (maxLocation.x+i+width)%width;
+			int y = (maxLocation.y+j+height)%height;
+			float value = correlation.at<float>(y, x);
+			if (value > 0.0f){
+				sumX += value*(maxLocation.x+i);
+				sumY += value*(maxLocation.y+j);
+				sumWeight += value;
+			}
+		}
+	}
+	double x = sumWeight > 0.0 ? sumX/sumWeight : maxLocation.x;
+	double y = sumWeight > 0.0 ? sumY/sumWeight : maxLocation.y;
+	if (x > width/2){
+		x -= width;
+	}
+	if (y > height/2){
+		y -= height;
+	}
+	dx = x;
+	dy = y;
+	peak = maxValue;
+}
+
+//run in the thread pool
+void MotionCorrectionThread::RegisterFrame(int slot)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	MotionFrame& frame = framePool[slot];
+	int width = frame.info.image_width;
+	int height = frame.info.image_height;
+	cv::Mat image(height, width, CV_16UC1, frame.image_data);
+	cv::Rect rect = RegistrationRect(width, height);
+	image(rect).convertTo(frame.patch, CV_32F);
+
+	cv::Mat windowed = frame.patch - cv::mean(frame.patch)[0];
+	cv::multiply(windowed, Get_Window(rect.size()), windowed);
+	cv::Mat spectrum;
+	cv::dft(windowed, spectrum, cv::DFT_COMPLEX_OUTPUT);
+
+	templateMutex.lock();
+	cv::Mat templateSpectrum = templateSpectrums[TemplateIndex(frame.info.channel)];
+	templateMutex.unlock();
+
+	frame.dx = 0.0;
+	frame.dy = 0.0;
+	frame.peak = 0.0;
+	if (!templateSpectrum.empty() && templateSpectrum.size() == spectrum.size()){
+		PhaseCorrelation(spectrum, templateSpectrum, frame.dx, frame.dy, frame.peak);
+	}
+
+	frame.corrected = correctFrames;
+	if (frame.corrected){
+		cv::Mat corrected(height, width, CV_16UC1, frame.corrected_data);
+		cv::Mat shift = (cv::Mat_<double>(2, 3) << 1.0, 0.0, -frame.dx, 0.0, 1.0, -frame.dy);
+		cv::warpAffine(image, corrected, shift, image.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+	}
+	frame.processTime = timer.nsecsElapsed()/1.0e6;
+
+	poolMutex.lock();
+	finishedSlots[frame.sequence] = slot;
+	poolMutex.unlock();
+	resultReady.wakeOne();
+}
+
+//results are handled in the order of acquisition although the workers finish out of order
+void MotionCorrectionThread::run()
+{
+	while (!isStopMotionCorrection){
+		poolMutex.lock();
+		std::map<unsigned long, int>::iterator it = finishedSlots.find(finishSequence);
+		if (it == finishedSlots.end()){
+			resultReady.wait(&poolMutex, 100);
+			it = finishedSlots.find(finishSequence);
+		}
+		if (it == finishedSlots.end()){
+			poolMutex.unlock();
+			continue;
+		}
+		int slot = it->second;
+		finishedSlots.erase(it);
+		++finishSequence;
+		poolMutex.unlock();
+
+		FinishFrame(slot);
+	}
+}
+
+void MotionCorrectionThread::FinishFrame(int slot)
+{
+	MotionFrame& frame = framePool[slot];
+	double latency = (double)(QDateTime::currentMSecsSinceEpoch() - frame.info.timestamp);
+
+	if (resetTemplates){
+		resetTemplates = false;
+		QMutexLocker locker(&templateMutex);
+		for (int i=0; i<MOTION_TEMPLATE_NUM; ++i){
+			templates[i].release();
+			templateSpectrums[i].release();
+			templateUpdateCount[i] = 0;
+		}
+	}
+	UpdateTemplate(TemplateIndex(frame.info.channel), frame);
+
+	if (frame.corrected){
+		DispatchFrame((const uchar*)frame.corrected_data, frame.info);
+	}
+
+	recordMutex.lock();
+	if (isRecording){
+		shiftStream<<frame.info.frame_index<<"\t"<<frame.info.timestamp<<"\t"<<frame.dx<<"\t"<<frame.dy<<"\t"<<frame.peak<<"\n";
+	}
+	recordMutex.unlock();
+
+	//statistics
+	++statistics.frames;
+	totalProcessTime += frame.processTime;
+	totalLatency += latency;
+	statistics.averageProcessTime = totalProcessTime/statistics.frames;
+	statistics.averageLatency = totalLatency/statistics.frames;
+	statistics.maxLatency = std::max(statistics.maxLatency, latency);
+	if (lastTimestamp > 0 && frame.info.timestamp > lastTimestamp){
+		double period = (double)(frame.info.timestamp - lastTimestamp);
+		statistics.framePeriod = statistics.framePeriod > 0.0 ? 0.9*statistics.framePeriod + 0.1*period : period;
+	}
+	lastTimestamp = frame.info.timestamp;
+
+	if (displayTimer.elapsed() >= MOTION_CORRECTION::DISPLAY_PERIOD){
+		displayTimer.restart();
+		emit ShiftSignal(frame.dx, frame.dy, latency);
+	}
+	ReleaseSlot(slot);
+}
+
+/*
+	The template is a running average of the registered patches shifted back
+	onto the template, its spectrum is refreshed every TEMPLATE_UPDATE_INTERVAL frames
+*/
+void MotionCorrectionThread::UpdateTemplate(int index, const MotionFrame& frame)
+{
+	bool firstFrame = templates[index].empty() || templates[index].size() != frame.patch.size();
+	if (firstFrame){
+		templates[index] = frame.patch.clone();
+		templateUpdateCount[index] = MOTION_CORRECTION::TEMPLATE_UPDATE_INTERVAL;
+	} else if (frame.peak >= MOTION_CORRECTION::MIN_PEAK){
+		cv::Mat shifted;
+		cv::Mat shift = (cv::Mat_<double>(2, 3) << 1.0, 0.0, -frame.dx, 0.0, 1.0, -frame.dy);
+		cv::warpAffine(frame.patch, shifted, shift, frame.patch.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		cv::addWeighted(templates[index], 1.0-MOTION_CORRECTION::TEMPLATE_ALPHA, shifted, MOTION_CORRECTION::TEMPLATE_ALPHA, 0.0, templates[index]);
+		++templateUpdateCount[index];
+	}
+
+	if (templateUpdateCount[index] >= MOTION_CORRECTION::TEMPLATE_UPDATE_INTERVAL){
+		templateUpdateCount[index] = 0;
+		cv::Mat windowed = templates[index] - cv::mean(templates[index])[0];
+		cv::multiply(windowed, Get_Window(windowed.size()), windowed);
+		cv::Mat spectrum;
+		cv::dft(windowed, spectrum, cv::DFT_COMPLEX_OUTPUT);
+
+		QMutexLocker locker(&templateMutex);
+		templateSpectrums[index] = spectrum;
+	}
+}
+
+void MotionCorrectionThread::ReleaseSlot(int slot)
+{
+	QMutexLocker locker(&poolMutex);
+	freeSlots.push_back(slot);
+}
+
+//shifts are written into prefix_shift.txt: frame index, timestamp(ms), dx, dy, correlation peak
+bool MotionCorrectionThread::StartRecording(QString folder, QString prefix)
+{
+	StopRecording();
+
+	QMutexLocker locker(&recordMutex);
+	shiftFile.setFileName(folder + "\\" + prefix + "_shift.txt");
+	if (!shiftFile.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+shiftFile.fileName().toStdString());
+		return false;
+	}
+	shiftStream.setDevice(&shiftFile);
+	shiftStream<<"frame\ttimestamp\tdx\tdy\tpeak\n";
+	isRecording = true;
+	return true;
+}
+
+void MotionCorrectionThread::StopRecording()
+{
+	QMutexLocker locker(&recordMutex);
+	if (!isRecording){
+		return;
+	}
+	isRecording = false;
+	shiftStream.flush();
+	shiftFile.close();
+}
+
+MotionStatistics MotionCorrectionThread::Get_Statistics()
+{
+	return statistics;
+}
@@ -0,0 +1,131 @@
+/*****************************************************************
+MotionCorrectionThread : Rigid registration of the streamed frames
+                         against a running template by FFT phase
+                         correlation on a thread pool
+******************************************************************/
+#ifndef _MOTION_CORRECTION_THREAD_H_
+#define _MOTION_CORRECTION_THREAD_H_
+
+#include "FrameProcessor.h"
+#include <opencv2/core/core.hpp>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QRunnable>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QElapsedTimer>
+#include <vector>
+#include <map>
+
+#define MOTION_TEMPLATE_NUM 3 //GCaMP, RFP and single channel frames are registered against their own templates
+
+struct MotionFrame{
+	FrameInfo info;
+	unsigned long sequence;  //submission order
+	int capacity;            //pixels allocated in the buffers
+	ushort* image_data;
+	ushort* corrected_data;
+	cv::Mat patch;           //registration patch, float
+	double dx;               //shift of the frame against the template, pixel
+	double dy;
+	double peak;             //phase correlation peak, 1 for a perfect match
+	double processTime;      //ms spent in the worker
+	bool corrected;          //corrected_data holds the shifted frame
+};
+
+struct MotionStatistics{
+	unsigned long frames;
+	unsigned long droppedFrames;
+	int workers;
+	double averageProcessTime;  //ms per frame in a worker
+	double averageLatency;      //ms from acquisition to the result
+	double maxLatency;
+	double framePeriod;         //ms, measured from the frame timestamps
+};
+
+class MotionCorrectionThread;
+class RegistrationTask : public QRunnable
+{
+public:
+	RegistrationTask(MotionCorrectionThread* thread, int slot) : owner(thread), frameSlot(slot){}
+	void run();
+
+private:
+	MotionCorrectionThread* owner;
+	int frameSlot;
+};
+
+class MotionCorrectionThread : public QThread, public FrameProcessor, public FrameDispatcher
+{
+	Q_OBJECT
+	friend class RegistrationTask;
+public:
+	static string OBJECT_NAME;
+
+	explicit MotionCorrectionThread(QObject* parent = 0);
+	~MotionCorrectionThread();
+
+	void StartThread();
+	void StopThread();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	//corrected frames are handed to the frame processors of this thread
+	void Set_CorrectFrames(bool correct){ correctFrames = correct; }
+	void ResetTemplate();
+	bool StartRecording(QString folder, QString prefix);
+	void StopRecording();
+	MotionStatistics Get_Statistics();
+
+signals:
+	void ShiftSignal(double, double, double); //dx, dy, latency(ms)
+
+protected:
+	virtual void run();
+	void RegisterFrame(int slot);
+	void FinishFrame(int slot);
+	void UpdateTemplate(int index, const MotionFrame& frame);
+	void ReleaseSlot(int slot);
+	void ClearBuffers();
+	cv::Rect RegistrationRect(int width, int height);
+	cv::Mat Get_Window(cv::Size size);
+	static int TemplateIndex(char channel);
+	static void PhaseCorrelation(const cv::Mat& spectrum, const cv::Mat& templateSpectrum, double& dx, double& dy, double& peak);
+
+private:
+	volatile bool isStopMotionCorrection;
+	volatile bool correctFrames;
+	QThreadPool workers;
+
+	//frame pool shared with the acquisition thread and the workers
+	QMutex poolMutex;
+	QWaitCondition resultReady;
+	MotionFrame framePool[MOTION_CORRECTION::FRAME_POOL_SIZE];
+	vector<int> freeSlots;
+	std::map<unsigned long, int> finishedSlots; //sequence -> slot
+	unsigned long submitSequence;
+	unsigned long finishSequence;
+
+	//running templates, updated in frame order by this thread
+	QMutex templateMutex;
+	cv::Mat templates[MOTION_TEMPLATE_NUM];
+	cv::Mat templateSpectrums[MOTION_TEMPLATE_NUM];
+	int templateUpdateCount[MOTION_TEMPLATE_NUM];
+	volatile bool resetTemplates;
+	cv::Mat window;
+
+	//recording
+	QMutex recordMutex;
+	bool isRecording;
+	QFile shiftFile;
+	QTextStream shiftStream;
+
+	QElapsedTimer displayTimer;
+	MotionStatistics statistics;
+	double totalProcessTime;
+	double totalLatency;
+	long long lastTimestamp;
+};
+
+#endif //_MOTION_CORRECTION_THREAD_H_
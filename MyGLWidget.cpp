@@ -287,12 +287,12 @@ void MyGLWidget::ShowImage(void* image_data, int width, int height, DATATYPE dat
 		positionStatus.currentCol = currentCol;
 		positionStatus.currentRow = currentRow;
 
-		if (windowFlag == HAMAMATSU_WINDOW || windowFlag == ANDOR_WINDOW){
+		if (data_type == USHORT_TYPE){
 			ushort* data = (ushort*)image_data;
 			positionStatus.value = data[currentRow*width + currentCol];
 			emit UpdatePositionStatus(); //update current position and value in status bar
 		}
-		else if (windowFlag == IO_WINDOW){
+		else if (data_type == UCHAR_TYPE){
 			uchar* data = (uchar*)image_data;
 			positionStatus.value = data[currentRow*width + currentCol];
 			emit UpdatePositionStatus(); //update current position and value in status bar
@@ -478,6 +478,23 @@ void MyGLWidget::mouseReleaseEvent(QMouseEvent * event)
 			bShowCurrentPosition = true;
 			return;
 		}
+
+		//Ctrl + drag selects the focus region instead of zooming
+		if (event->modifiers() & Qt::ControlModifier){
+			ImageRegion region;
+			region.x_offset = startDisplayImageCol + int(1.0 * xMin * displayImageWidth/windowWidth);
+			region.y_offset = startDisplayImageRow + int(1.0 * yMin * displayImageHeight/windowHeight);
+			region.width = int(1.0 * (xMax-xMin) * displayImageWidth/windowWidth);
+			region.height = int(1.0 * (yMax-yMin) * displayImageHeight/windowHeight);
+			startImageRegion = region;
+			currentImageRegion = region;
+			bSetFocusRegion = true;
+			bShowFocusRegion = true;
+			bShowCurrentPosition = true;
+			emit UpdateFocusRegionSignal(windowFlag, region);
+			return;
+		}
+
 		double x_scale = 1.0*windowWidth/(xMax - xMin);
 		double y_scale = 1.0*windowHeight/(yMax - yMin);
 		if (x_scale < y_scale){
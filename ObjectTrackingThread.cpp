@@ -0,0 +1,339 @@
+
+#include "ObjectTrackingThread.h"
+#include "ImageKernels.h"
+#include <cmath>
+#include <string.h>
+
+string ObjectTrackingThread::OBJECT_NAME = "ObjectTrackingThread";
+
+ObjectTrackingThread::ObjectTrackingThread(QObject* parent) : QThread(parent)
+{
+	isStopTracking = true;
+	hasSample = false;
+	sampleWidth = 0;
+	sampleHeight = 0;
+	sampleFactor = 1;
+	motion = NULL;
+	pulsePerPixelX = 0;
+	pulsePerPixelY = 0;
+	motionTime = 0;
+	memset(&statistics, 0, sizeof(statistics));
+	totalProcessTime = 0.0;
+	totalLatency = 0.0;
+	receivedFrames = 0;
+	firstExposureTime = 0;
+}
+
+ObjectTrackingThread::~ObjectTrackingThread()
+{
+	StopThread();
+	motion = NULL;
+}
+
+void ObjectTrackingThread::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	sampleMutex.lock();
+	hasSample = false;
+	memset(&statistics, 0, sizeof(statistics));
+	totalProcessTime = 0.0;
+	totalLatency = 0.0;
+	receivedFrames = 0;
+	firstExposureTime = 0;
+	sampleMutex.unlock();
+
+	motionMutex.lock();
+	moveTimer.invalidate();
+	motionTime = 0;
+	motionMutex.unlock();
+	displayTimer.start();
+
+	isStopTracking = false;
+	start();
+}
+
+void ObjectTrackingThread::StopThread()
+{
+	isStopTracking = true;
+	sampleReady.wakeAll();
+	wait();
+}
+
+void ObjectTrackingThread::Set_StageMotion(CoordinatedMotion* stage_motion, double pulse_per_pixel_x, double pulse_per_pixel_y)
+{
+	QMutexLocker locker(&motionMutex);
+	if (stage_motion != NULL && stage_motion->Get_AxisNum() < 2){
+		cout<<GetErrorString(OBJECT_NAME, "Set_StageMotion()", "Two axes are required for tracking");
+		return;
+	}
+	motion = stage_motion;
+	pulsePerPixelX = pulse_per_pixel_x;
+	pulsePerPixelY = pulse_per_pixel_y;
+	moveTimer.invalidate();
+}
+
+TrackingStatistics ObjectTrackingThread::Get_Statistics()
+{
+	QMutexLocker locker(&sampleMutex);
+	return statistics;
+}
+
+/*
+	Called in the acquisition thread: the frame is binned while it is read, which
+	is faster than copying it whole. A sample the tracking thread did not take yet
+	is replaced, so the tracking always works on the newest frame.
+*/
+void ObjectTrackingThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopTracking || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+	int factor = OBJECT_TRACKING::DOWNSAMPLE;
+	if (info.image_width < factor || info.image_height < factor){
+		return;
+	}
+	int width = info.image_width/2;
+	int height = info.image_height/2;
+
+	QMutexLocker locker(&sampleMutex);
+	if (firstExposureTime == 0){
+		firstExposureTime = info.exposure_time;
+	} else{
+		statistics.framePeriod = (info.exposure_time-firstExposureTime)/1.0e3/receivedFrames;
+	}
+	++receivedFrames;
+	if (hasSample){
+		++statistics.droppedFrames;
+	}
+
+	sampleBuffer.resize((size_t)width*height);
+	Downsample2x2_SSE2((const ushort*)data, info.row_bytes/sizeof(ushort), info.image_width, info.image_height, &sampleBuffer[0]);
+	for (int f=4; f<=factor; f*=2){
+		Downsample2x2_SSE2(&sampleBuffer[0], width, width, height, &sampleBuffer[0]);
+		width /= 2;
+		height /= 2;
+	}
+	sample = info;
+	sampleWidth = width;
+	sampleHeight = height;
+	sampleFactor = factor;
+	hasSample = true;
+	sampleReady.wakeAll();
+}
+
+void ObjectTrackingThread::run()
+{
+	bool moved = false;
+	while (!isStopTracking){
+		sampleMutex.lock();
+		if (!hasSample){
+			sampleReady.wait(&sampleMutex, 100);
+		}
+		if (!hasSample){
+			sampleMutex.unlock();
+			continue;
+		}
+		FrameInfo current = sample;
+		int width = sampleWidth;
+		int height = sampleHeight;
+		int factor = sampleFactor;
+		workBuffer.swap(sampleBuffer);
+		hasSample = false;
+		sampleMutex.unlock();
+
+		QElapsedTimer timer;
+		timer.start();
+		TrackingTarget target = FindTarget(&workBuffer[0], width, height, factor);
+		bool isMoved = target.found && Correct(target);
+		moved = moved || isMoved;
+		double processTime = timer.nsecsElapsed()/1.0e6;
+		double latency = (Get_HostTime()-current.exposure_time)/1.0e3;
+
+		sampleMutex.lock();
+		++statistics.frames;
+		if (!target.found){
+			++statistics.lostFrames;
+		}
+		if (isMoved){
+			++statistics.moves;
+		}
+		totalProcessTime += processTime;
+		totalLatency += latency;
+		statistics.averageProcessTime = totalProcessTime/statistics.frames;
+		statistics.averageLatency = totalLatency/statistics.frames;
+		statistics.maxLatency = max(statistics.maxLatency, latency);
+		if (statistics.framePeriod > 0 && latency > statistics.framePeriod){
+			++statistics.lateFrames;
+		}
+		sampleMutex.unlock();
+
+		if (displayTimer.elapsed() >= OBJECT_TRACKING::DISPLAY_PERIOD){
+			displayTimer.restart();
+			emit TrackingSignal(target.dx, target.dy, latency);
+		}
+	}
+
+	//the stages get their own profiles back once the last move ended
+	QMutexLocker locker(&motionMutex);
+	if (moved && motion != NULL){
+		try{
+			double remain = moveTimer.isValid() ? motionTime - moveTimer.elapsed() : 0;
+			motion->WaitMotionComplete(remain > 0 ? remain : 0, long(remain)+COORDINATED_MOTION::MOTION_TIMEOUT);
+		} catch (QException e){
+			cout<<e.getMessage()<<endl;
+		}
+	}
+}
+
+/*
+	A new move is sent once the former one ended, it corrects GAIN of the error
+	so that the noise of the centroid is not followed at full amplitude
+*/
+bool ObjectTrackingThread::Correct(const TrackingTarget& target)
+{
+	QMutexLocker locker(&motionMutex);
+	if (motion == NULL){
+		return false;
+	}
+	if (fabs(target.dx) < OBJECT_TRACKING::DEADBAND && fabs(target.dy) < OBJECT_TRACKING::DEADBAND){
+		return false;
+	}
+	if (moveTimer.isValid() && moveTimer.elapsed() < motionTime){
+		return false;
+	}
+	vector<double> distances(motion->Get_AxisNum(), 0.0);
+	distances[0] = OBJECT_TRACKING::GAIN*target.dx*pulsePerPixelX;
+	distances[1] = OBJECT_TRACKING::GAIN*target.dy*pulsePerPixelY;
+	try{
+		motionTime = motion->Move(distances);
+		moveTimer.start();
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+		return false;
+	}
+	return true;
+}
+
+int ObjectTrackingThread::FindRoot(int label)
+{
+	while (parents[label] != label){
+		parents[label] = parents[parents[label]];
+		label = parents[label];
+	}
+	return label;
+}
+
+/*
+	The binned image is thresholded between its mean and its max, the objects are
+	labelled in one raster pass with 8-connectivity whose label equivalences are
+	merged in a union-find, and the intensity weighted centroids are summed per
+	object in a second pass
+*/
+TrackingTarget ObjectTrackingThread::FindTarget(const ushort* image, int width, int height, int factor)
+{
+	TrackingTarget target;
+	memset(&target, 0, sizeof(target));
+	int count = width*height;
+	ImageRegion region;
+	region.x_offset = 0;
+	region.y_offset = 0;
+	region.width = width;
+	region.height = height;
+	double mean = RegionSum_SSE2(image, width, region, 0)/count;
+	ushort peak = MaxPixel_SSE2(image, count);
+	if (peak - mean < OBJECT_TRACKING::MIN_CONTRAST){
+		return target;
+	}
+	ushort threshold = (ushort)(mean + (peak-mean)*OBJECT_TRACKING::THRESHOLD_RATIO);
+	mask.resize(count);
+	ThresholdImage_SSE2(image, &mask[0], count, threshold);
+
+	labels.resize(count);
+	parents.clear();
+	for (int y=0; y<height; ++y){
+		const uchar* m = &mask[(size_t)y*width];
+		int* l = &labels[(size_t)y*width];
+		const int* up = (y > 0) ? l - width : NULL;
+		for (int x=0; x<width; ++x){
+			if (m[x] == 0){
+				l[x] = -1;
+				continue;
+			}
+			int label = -1;
+			int neighbours[4] = {-1, -1, -1, -1};
+			if (x > 0){
+				neighbours[0] = l[x-1];
+			}
+			if (y > 0){
+				neighbours[1] = up[x];
+				if (x > 0){
+					neighbours[2] = up[x-1];
+				}
+				if (x+1 < width){
+					neighbours[3] = up[x+1];
+				}
+			}
+			for (int k=0; k<4; ++k){
+				if (neighbours[k] < 0){
+					continue;
+				}
+				int root = FindRoot(neighbours[k]);
+				if (label < 0){
+					label = root;
+				} else if (root != label){
+					//the smaller label is kept as the root
+					parents[max(root, label)] = min(root, label);
+					label = min(root, label);
+				}
+			}
+			if (label < 0){
+				label = (int)parents.size();
+				parents.push_back(label);
+			}
+			l[x] = label;
+		}
+	}
+
+	size_t blobs = parents.size();
+	blobArea.assign(blobs, 0.0);
+	blobSum.assign(blobs, 0.0);
+	blobX.assign(blobs, 0.0);
+	blobY.assign(blobs, 0.0);
+	for (int y=0; y<height; ++y){
+		const ushort* p = image + (size_t)y*width;
+		const int* l = &labels[(size_t)y*width];
+		for (int x=0; x<width; ++x){
+			if (l[x] < 0){
+				continue;
+			}
+			int root = FindRoot(l[x]);
+			double weight = p[x] - threshold;
+			blobArea[root] += 1;
+			blobSum[root] += weight;
+			blobX[root] += weight*x;
+			blobY[root] += weight*y;
+		}
+	}
+
+	int best = -1;
+	for (size_t k=0; k<blobs; ++k){
+		if (blobArea[k] >= OBJECT_TRACKING::MIN_AREA && (best < 0 || blobSum[k] > blobSum[best])){
+			best = (int)k;
+		}
+	}
+	if (best < 0 || blobSum[best] <= 0){
+		return target;
+	}
+
+	//a binned pixel covers factor pixels of the frame
+	target.found = true;
+	target.x = (blobX[best]/blobSum[best] + 0.5)*factor - 0.5;
+	target.y = (blobY[best]/blobSum[best] + 0.5)*factor - 0.5;
+	target.dx = target.x - (width*factor-1)*0.5;
+	target.dy = target.y - (height*factor-1)*0.5;
+	target.area = (int)blobArea[best];
+	target.intensity = blobSum[best];
+	return target;
+}
@@ -0,0 +1,112 @@
+/*****************************************************************
+ObjectTrackingThread : Keep a moving bright object in the center
+                       of the field of view. Every frame is binned
+                       in the acquisition thread, the tracking thread
+                       thresholds it, labels the connected objects
+                       and moves the stages by the position error of
+                       the brightest one. Only the newest frame is
+                       processed so the latency stays below a frame.
+******************************************************************/
+#ifndef _OBJECT_TRACKING_THREAD_H_
+#define _OBJECT_TRACKING_THREAD_H_
+
+#include "FrameProcessor.h"
+#include "CoordinatedMotion.h"
+#include "Camera_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QElapsedTimer>
+#include <vector>
+
+struct TrackingTarget{
+	bool found;
+	double x;          //centroid in the full frame, pixel
+	double y;
+	double dx;         //error from the frame center, pixel
+	double dy;
+	int area;          //binned pixels
+	double intensity;  //sum above the threshold
+};
+
+struct TrackingStatistics{
+	unsigned long frames;         //frames tracked
+	unsigned long droppedFrames;  //frames replaced by a newer one before tracking
+	unsigned long lostFrames;     //frames without a target
+	unsigned long moves;          //stage moves sent
+	double averageProcessTime;    //ms per frame in the tracking thread
+	double averageLatency;        //ms from the middle of the exposure to the motion command
+	double maxLatency;
+	unsigned long lateFrames;     //frames whose latency exceeds the frame period
+	double framePeriod;           //ms, measured from the exposure times
+};
+
+class ObjectTrackingThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit ObjectTrackingThread(QObject* parent = 0);
+	~ObjectTrackingThread();
+
+	void StartThread();
+	void StopThread();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	//axis 0 of motion follows the image columns and axis 1 the rows, pulse_per_pixel carries the
+	//orientation of the camera on the stages. Without motion the error is only measured.
+	void Set_StageMotion(CoordinatedMotion* motion, double pulse_per_pixel_x, double pulse_per_pixel_y);
+	TrackingStatistics Get_Statistics();
+
+	//the brightest connected object of the binned image, public for the offline analysis
+	TrackingTarget FindTarget(const ushort* image, int width, int height, int factor);
+
+signals:
+	void TrackingSignal(double, double, double); //error from the center (pixel) and latency (ms)
+
+protected:
+	virtual void run();
+	bool Correct(const TrackingTarget& target); //true when a move is sent
+	int FindRoot(int label);
+
+private:
+	volatile bool isStopTracking;
+
+	//sample exchange with the acquisition thread
+	QMutex sampleMutex;
+	QWaitCondition sampleReady;
+	bool hasSample;
+	FrameInfo sample;
+	int sampleWidth;             //binned size
+	int sampleHeight;
+	int sampleFactor;
+	vector<ushort> sampleBuffer;
+	vector<ushort> workBuffer;
+
+	//detection buffers, only used in the tracking thread
+	vector<uchar> mask;
+	vector<int> labels;
+	vector<int> parents;
+	vector<double> blobArea;
+	vector<double> blobSum;
+	vector<double> blobX;
+	vector<double> blobY;
+
+	//stage feedback
+	QMutex motionMutex;
+	CoordinatedMotion* motion;
+	double pulsePerPixelX;
+	double pulsePerPixelY;
+	double motionTime;           //ms, predicted duration of the last move
+	QElapsedTimer moveTimer;
+
+	TrackingStatistics statistics;
+	double totalProcessTime;
+	double totalLatency;
+	unsigned long receivedFrames;
+	long long firstExposureTime;  //us
+	QElapsedTimer displayTimer;
+};
+
+#endif //_OBJECT_TRACKING_THREAD_H_
@@ -0,0 +1,370 @@
+#include "RatioImagingThread.h"
+#include "ImageKernels.h"
+
+string RatioImagingThread::OBJECT_NAME = "RatioImagingThread";
+
+RatioImagingThread::RatioImagingThread(QObject* parent) : QThread(parent)
+{
+	isStopRatioImaging = true;
+	isRecording = false;
+	recordImages = false;
+	maxPixels = HAMAMATSU_PARAMS::FULLIMAGE_WIDTH*HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT;
+	gcampBackground = 0;
+	rfpBackground = 0;
+	pendingSlot = -1;
+	displayIndex = 0;
+	totalProcessTime = 0.0;
+	ratioBuffer = NULL;
+	for (int i=0; i<RATIO_IMAGING::FRAME_POOL_SIZE; ++i){
+		framePool[i].image_data = NULL;
+	}
+	for (int i=0; i<RATIO_IMAGING::DISPLAY_BUFFER_SIZE; ++i){
+		displayBuffers[i] = NULL;
+		displayWidth[i] = 0;
+		displayHeight[i] = 0;
+	}
+	statistics.pairs = 0;
+	statistics.droppedFrames = 0;
+	statistics.unpairedFrames = 0;
+	statistics.resyncs = 0;
+	statistics.averageProcessTime = 0.0;
+}
+
+RatioImagingThread::~RatioImagingThread()
+{
+	StopThread();
+	StopRecording();
+	ClearBuffers();
+}
+
+/*
+	Buffers are allocated for the full sensor once, so that changing
+	the camera subarray does not need to reallocate them
+*/
+void RatioImagingThread::CreateBuffers()
+{
+	if (ratioBuffer != NULL){
+		return;
+	}
+	for (int i=0; i<RATIO_IMAGING::FRAME_POOL_SIZE; ++i){
+		framePool[i].image_data = new ushort[maxPixels];
+	}
+	ratioBuffer = new float[maxPixels];
+	for (int i=0; i<RATIO_IMAGING::DISPLAY_BUFFER_SIZE; ++i){
+		displayBuffers[i] = new uchar[maxPixels];
+	}
+}
+
+void RatioImagingThread::ClearBuffers()
+{
+	for (int i=0; i<RATIO_IMAGING::FRAME_POOL_SIZE; ++i){
+		if (framePool[i].image_data != NULL){
+			delete [] framePool[i].image_data;
+			framePool[i].image_data = NULL;
+		}
+	}
+	if (ratioBuffer != NULL){
+		delete [] ratioBuffer;
+		ratioBuffer = NULL;
+	}
+	for (int i=0; i<RATIO_IMAGING::DISPLAY_BUFFER_SIZE; ++i){
+		if (displayBuffers[i] != NULL){
+			delete [] displayBuffers[i];
+			displayBuffers[i] = NULL;
+		}
+	}
+}
+
+void RatioImagingThread::ResetPairing()
+{
+	QMutexLocker locker(&poolMutex);
+	freeSlots.clear();
+	readySlots.clear();
+	for (int i=0; i<RATIO_IMAGING::FRAME_POOL_SIZE; ++i){
+		freeSlots.push_back(i);
+	}
+	pendingSlot = -1;
+}
+
+void RatioImagingThread::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	CreateBuffers();
+	ResetPairing();
+	statistics.pairs = 0;
+	statistics.droppedFrames = 0;
+	statistics.unpairedFrames = 0;
+	statistics.resyncs = 0;
+	statistics.averageProcessTime = 0.0;
+	totalProcessTime = 0.0;
+	displayTimer.start();
+	isStopRatioImaging = false;
+	start();
+}
+
+void RatioImagingThread::StopThread()
+{
+	isStopRatioImaging = true;
+	frameReady.wakeAll();
+	wait();
+}
+
+/*
+	Called in the acquisition thread: copy the frame into a free slot of the pool
+	and wake up the ratio thread. The frame is dropped instead of blocking the
+	acquisition when the ratio thread falls behind.
+*/
+void RatioImagingThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopRatioImaging || data == NULL){
+		return;
+	}
+	if (info.channel != GCAMP_CHANNEL && info.channel != RFP_CHANNEL){
+		return; //single channel imaging, nothing to pair
+	}
+	if (info.data_type != USHORT_TYPE || info.image_width*info.image_height > maxPixels){
+		return;
+	}
+
+	int slot = -1;
+	poolMutex.lock();
+	if (!freeSlots.empty()){
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	} else{
+		++statistics.droppedFrames;
+	}
+	poolMutex.unlock();
+	if (slot < 0){
+		return;
+	}
+
+	RatioFrame& frame = framePool[slot];
+	frame.frame_index = info.frame_index;
+	frame.timestamp = info.timestamp;
+	frame.image_width = info.image_width;
+	frame.image_height = info.image_height;
+	frame.channelOffset = info.channelOffset;
+	frame.channel = info.channel;
+	CopyData(USHORT_TYPE, (uchar*)data, (uchar*)frame.image_data, info.image_width, info.image_height);
+
+	poolMutex.lock();
+	readySlots.push_back(slot);
+	poolMutex.unlock();
+	frameReady.wakeOne();
+}
+
+void RatioImagingThread::run()
+{
+	while (!isStopRatioImaging){
+		poolMutex.lock();
+		if (readySlots.empty()){
+			frameReady.wait(&poolMutex, 100);
+		}
+		if (readySlots.empty()){
+			poolMutex.unlock();
+			continue;
+		}
+		int slot = readySlots.front();
+		readySlots.pop_front();
+		poolMutex.unlock();
+
+		PairFrame(slot);
+	}
+}
+
+void RatioImagingThread::ReleaseSlot(int slot)
+{
+	QMutexLocker locker(&poolMutex);
+	freeSlots.push_back(slot);
+}
+
+/*
+	A GCaMP frame waits for the next frame. They are paired only if the next one is
+	the RFP frame with the following frame index and both were labelled with the same
+	channel offset; otherwise the pending frame is discarded, so that frames labelled
+	before and after adjusting the channel offset are never mixed.
+*/
+void RatioImagingThread::PairFrame(int slot)
+{
+	const RatioFrame& frame = framePool[slot];
+
+	if (pendingSlot >= 0){
+		const RatioFrame& pending = framePool[pendingSlot];
+		bool sameOffset = (frame.channelOffset == pending.channelOffset);
+		if (sameOffset && frame.frame_index == pending.frame_index+1
+			&& pending.channel == GCAMP_CHANNEL && frame.channel == RFP_CHANNEL
+			&& frame.image_width == pending.image_width && frame.image_height == pending.image_height){
+			ComputeRatio(pending, frame);
+			ReleaseSlot(pendingSlot);
+			ReleaseSlot(slot);
+			pendingSlot = -1;
+			return;
+		}
+		if (!sameOffset){
+			++statistics.resyncs;
+		} else{
+			++statistics.unpairedFrames;
+		}
+		ReleaseSlot(pendingSlot);
+		pendingSlot = -1;
+	}
+
+	if (frame.channel == GCAMP_CHANNEL){
+		pendingSlot = slot;
+	} else{
+		++statistics.unpairedFrames;
+		ReleaseSlot(slot);
+	}
+}
+
+void RatioImagingThread::ComputeRatio(const RatioFrame& gcamp, const RatioFrame& rfp)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	int width = gcamp.image_width;
+	int height = gcamp.image_height;
+	int count = width*height;
+
+	settingMutex.lock();
+	ushort gBackground = gcampBackground;
+	ushort rBackground = rfpBackground;
+	vector<ImageRegion> regions = ratioRegions;
+	settingMutex.unlock();
+
+	//ratio image
+	RatioImage_SSE2(gcamp.image_data, rfp.image_data, ratioBuffer, count, gBackground, rBackground, RATIO_IMAGING::MIN_DENOMINATOR);
+
+	//ratio of regions, the sums are taken before dividing to keep the dim pixels from dominating
+	if (regions.empty()){
+		ImageRegion fullImage = {0, 0, width, height};
+		regions.push_back(fullImage);
+	}
+	QVector<double> ratios;
+	for (size_t i=0; i<regions.size(); ++i){
+		ImageRegion region = regions[i];
+		if (region.x_offset < 0 || region.y_offset < 0 || region.width <= 0 || region.height <= 0
+			|| region.x_offset+region.width > width || region.y_offset+region.height > height){
+			ratios.append(0.0);
+			continue;
+		}
+		double gSum = RegionSum_SSE2(gcamp.image_data, width, region, gBackground);
+		double rSum = RegionSum_SSE2(rfp.image_data, width, region, rBackground);
+		ratios.append(rSum > 0.0 ? gSum/rSum : 0.0);
+	}
+
+	//recording
+	recordMutex.lock();
+	if (isRecording){
+		ratioValueStream<<gcamp.frame_index<<"\t"<<gcamp.timestamp<<"\t"<<width<<"\t"<<height;
+		for (int i=0; i<ratios.size(); ++i){
+			ratioValueStream<<"\t"<<ratios[i];
+		}
+		ratioValueStream<<"\n";
+		if (recordImages){
+			ratioImageFile.write((const char*)ratioBuffer, (qint64)count*sizeof(float));
+		}
+	}
+	recordMutex.unlock();
+
+	//display
+	if (displayTimer.elapsed() >= RATIO_IMAGING::DISPLAY_PERIOD){
+		displayTimer.restart();
+		FloatToUChar_SSE2(ratioBuffer, displayBuffers[displayIndex], count, RATIO_IMAGING::DISPLAY_SCALE);
+		displayWidth[displayIndex] = width;
+		displayHeight[displayIndex] = height;
+		emit RatioImageSignal(displayIndex);
+		emit RatioValuesSignal(gcamp.frame_index, ratios);
+		displayIndex = (displayIndex+1)%RATIO_IMAGING::DISPLAY_BUFFER_SIZE;
+	}
+
+	++statistics.pairs;
+	totalProcessTime += timer.nsecsElapsed()/1.0e6;
+	statistics.averageProcessTime = totalProcessTime/statistics.pairs;
+}
+
+void RatioImagingThread::Set_Background(ushort gcamp_background, ushort rfp_background)
+{
+	QMutexLocker locker(&settingMutex);
+	gcampBackground = gcamp_background;
+	rfpBackground = rfp_background;
+}
+
+void RatioImagingThread::Set_Regions(const vector<ImageRegion>& regions)
+{
+	QMutexLocker locker(&settingMutex);
+	ratioRegions = regions;
+}
+
+/*
+	Ratios of regions are written into prefix_ratio.txt, one line per pair:
+	gcamp frame index, timestamp(ms), width, height, ratio of each region.
+	Ratio images are appended to prefix_ratio.raw as float32 if save_images is set.
+*/
+bool RatioImagingThread::StartRecording(QString folder, QString prefix, bool save_images)
+{
+	StopRecording();
+
+	QMutexLocker locker(&recordMutex);
+	ratioValueFile.setFileName(folder + "\\" + prefix + "_ratio.txt");
+	if (!ratioValueFile.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+ratioValueFile.fileName().toStdString());
+		return false;
+	}
+	if (save_images){
+		ratioImageFile.setFileName(folder + "\\" + prefix + "_ratio.raw");
+		if (!ratioImageFile.open(QIODevice::WriteOnly)){
+			cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+ratioImageFile.fileName().toStdString());
+			ratioValueFile.close();
+			return false;
+		}
+	}
+	ratioValueStream.setDevice(&ratioValueFile);
+	ratioValueStream<<"frame\ttimestamp\twidth\theight\tratio\n";
+	recordImages = save_images;
+	isRecording = true;
+	return true;
+}
+
+void RatioImagingThread::StopRecording()
+{
+	QMutexLocker locker(&recordMutex);
+	if (!isRecording){
+		return;
+	}
+	isRecording = false;
+	ratioValueStream.flush();
+	ratioValueFile.close();
+	if (recordImages){
+		ratioImageFile.close();
+	}
+	recordImages = false;
+}
+
+ImageBuffer RatioImagingThread::Get_RatioImage(int index)
+{
+	ImageBuffer buffer;
+	buffer.timestamp = 0;
+	buffer.image_data = NULL;
+	buffer.image_width = 0;
+	buffer.image_height = 0;
+	buffer.data_type = UCHAR_TYPE;
+	buffer.exposure_time = 0;
+	buffer.has_position = false;
+	buffer.z_position = 0;
+
+	if (index >= 0 && index < RATIO_IMAGING::DISPLAY_BUFFER_SIZE && displayBuffers[index] != NULL){
+		buffer.image_data = displayBuffers[index];
+		buffer.image_width = displayWidth[index];
+		buffer.image_height = displayHeight[index];
+	}
+	return buffer;
+}
+
+RatioStatistics RatioImagingThread::Get_Statistics()
+{
+	return statistics;
+}
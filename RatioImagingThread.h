@@ -0,0 +1,108 @@
+/*****************************************************************
+RatioImagingThread : Pair adjacent GCaMP and RFP frames and compute
+                     the background subtracted G/R ratio online
+******************************************************************/
+#ifndef _RATIO_IMAGING_THREAD_H_
+#define _RATIO_IMAGING_THREAD_H_
+
+#include "FrameProcessor.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QVector>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QElapsedTimer>
+#include <vector>
+#include <deque>
+
+struct RatioFrame{
+	unsigned long frame_index;
+	long long timestamp;
+	int image_width;
+	int image_height;
+	int channelOffset;
+	char channel;
+	ushort* image_data;
+};
+
+struct RatioStatistics{
+	unsigned long pairs;          //computed ratio images
+	unsigned long droppedFrames;  //frames dropped because the pool was full
+	unsigned long unpairedFrames; //frames without an adjacent partner
+	unsigned long resyncs;        //pending frames discarded after channel offset changed
+	double averageProcessTime;    //ms per pair
+};
+
+class RatioImagingThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit RatioImagingThread(QObject* parent = 0);
+	~RatioImagingThread();
+
+	void StartThread();
+	void StopThread();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	void Set_Background(ushort gcamp_background, ushort rfp_background);
+	void Set_Regions(const vector<ImageRegion>& regions); //empty regions means the whole image
+	bool StartRecording(QString folder, QString prefix, bool save_images);
+	void StopRecording();
+	ImageBuffer Get_RatioImage(int index);
+	RatioStatistics Get_Statistics();
+
+signals:
+	void RatioImageSignal(int);                         //index of the display buffer
+	void RatioValuesSignal(unsigned long, QVector<double>); //gcamp frame index and ratios of regions
+
+protected:
+	virtual void run();
+	void CreateBuffers();
+	void ClearBuffers();
+	void ResetPairing();
+	void PairFrame(int slot);
+	void ComputeRatio(const RatioFrame& gcamp, const RatioFrame& rfp);
+	void ReleaseSlot(int slot);
+
+private:
+	volatile bool isStopRatioImaging;
+	int maxPixels;
+
+	//frame pool shared with the acquisition thread
+	QMutex poolMutex;
+	QWaitCondition frameReady;
+	RatioFrame framePool[RATIO_IMAGING::FRAME_POOL_SIZE];
+	vector<int> freeSlots;
+	std::deque<int> readySlots;
+	int pendingSlot;
+
+	//settings
+	QMutex settingMutex;
+	ushort gcampBackground;
+	ushort rfpBackground;
+	vector<ImageRegion> ratioRegions;
+
+	//results
+	float* ratioBuffer;
+	uchar* displayBuffers[RATIO_IMAGING::DISPLAY_BUFFER_SIZE];
+	int displayIndex;
+	int displayWidth[RATIO_IMAGING::DISPLAY_BUFFER_SIZE];
+	int displayHeight[RATIO_IMAGING::DISPLAY_BUFFER_SIZE];
+	QElapsedTimer displayTimer;
+
+	//recording
+	QMutex recordMutex;
+	bool isRecording;
+	bool recordImages;
+	QFile ratioValueFile;
+	QFile ratioImageFile;
+	QTextStream ratioValueStream;
+
+	RatioStatistics statistics;
+	double totalProcessTime;
+};
+
+#endif //_RATIO_IMAGING_THREAD_H_
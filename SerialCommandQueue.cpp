@@ -0,0 +1,252 @@
+
+#include "SerialCommandQueue.h"
+#include <QtCore/QElapsedTimer>
+
+string SerialCommandQueue::OBJECT_NAME = "SerialCommandQueue";
+
+//the command without its line end, for the error messages
+static string CommandName(const string& command)
+{
+	size_t end = command.find_last_not_of("\r\n");
+	return (end == string::npos) ? "" : command.substr(0, end+1);
+}
+
+/********************************** Serial Future **********************************/
+bool SerialFuture::IsFinished() const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->isFinished;
+}
+
+bool SerialFuture::Wait(unsigned long time_ms) const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QElapsedTimer timer;
+	timer.start();
+	QMutexLocker locker(&state->mutex);
+	while (!state->isFinished){
+		long long remain = (long long)time_ms - timer.elapsed();
+		if (remain <= 0){
+			return false;
+		}
+		state->finished.wait(&state->mutex, (unsigned long)remain);
+	}
+	return true;
+}
+
+string SerialFuture::Get_Response() const
+{
+	if (state.isNull()){
+		throw string(SerialCommandQueue::OBJECT_NAME + ": invalid command future");
+	}
+	//the I/O thread answers every command within its deadlines, this only guards against a stopped thread
+	if (!Wait(SERIAL_RESPONSE_TIMEOUT*(SERIAL_PIPELINE_DEPTH+1))){
+		throw string(SerialCommandQueue::OBJECT_NAME + ": timeout, " + CommandName(state->command));
+	}
+	QMutexLocker locker(&state->mutex);
+	if (!state->error.empty()){
+		throw state->error;
+	}
+	return state->response;
+}
+
+/********************************** Command Queue **********************************/
+SerialCommandQueue::SerialCommandQueue(SerialEndpoint* endpoint, const string& ack, const string& error_prefix, QObject* parent)
+	: QThread(parent), endpoint(endpoint), ack(ack), errorPrefix(error_prefix)
+{
+	isStopQueue = true;
+	statistics.commands = 0;
+	statistics.batches = 0;
+	statistics.timeouts = 0;
+	statistics.averageRoundTrip = 0.0;
+	totalRoundTrip = 0.0;
+}
+
+SerialCommandQueue::~SerialCommandQueue()
+{
+	StopThread();
+	endpoint = NULL;
+}
+
+void SerialCommandQueue::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	received.clear();
+	isStopQueue = false;
+	start();
+}
+
+//the commands left in the queue are answered with an error
+void SerialCommandQueue::StopThread()
+{
+	isStopQueue = true;
+	commandReady.wakeAll();
+	wait();
+
+	queueMutex.lock();
+	std::deque<QSharedPointer<SerialCommandState> > remains;
+	remains.swap(commands);
+	queueMutex.unlock();
+	for (size_t i=0; i<remains.size(); ++i){
+		Finish(remains[i], "", OBJECT_NAME + ": queue stopped");
+	}
+}
+
+SerialFuture SerialCommandQueue::Submit(const string& command)
+{
+	return Submit(vector<string>(1, command))[0];
+}
+
+vector<SerialFuture> SerialCommandQueue::Submit(const vector<string>& commands)
+{
+	vector<SerialFuture> futures(commands.size());
+	for (size_t i=0; i<commands.size(); ++i){
+		futures[i].state = QSharedPointer<SerialCommandState>(new SerialCommandState);
+		futures[i].state->isFinished = false;
+		futures[i].state->command = commands[i];
+	}
+
+	QMutexLocker locker(&queueMutex);
+	if (isStopQueue){
+		locker.unlock();
+		for (size_t i=0; i<futures.size(); ++i){
+			Finish(futures[i].state, "", OBJECT_NAME + ": queue stopped");
+		}
+		return futures;
+	}
+	for (size_t i=0; i<futures.size(); ++i){
+		this->commands.push_back(futures[i].state);
+	}
+	commandReady.wakeOne();
+	return futures;
+}
+
+string SerialCommandQueue::command(const string& command)
+{
+	return Submit(command).Get_Response();
+}
+
+SerialQueueStatistics SerialCommandQueue::Get_Statistics()
+{
+	QMutexLocker locker(&queueMutex);
+	return statistics;
+}
+
+void SerialCommandQueue::run()
+{
+	char buffer[MAX_BUFFER_SIZE];
+	while (!isStopQueue){
+		queueMutex.lock();
+		if (commands.empty()){
+			commandReady.wait(&queueMutex, 100);
+		}
+		if (commands.empty()){
+			queueMutex.unlock();
+			continue;
+		}
+		vector<QSharedPointer<SerialCommandState> > batch;
+		while (!commands.empty() && batch.size() < SERIAL_PIPELINE_DEPTH){
+			batch.push_back(commands.front());
+			commands.pop_front();
+		}
+		queueMutex.unlock();
+
+		//the device answers the commands in order, so they are sent without waiting for each other
+		string bytes;
+		for (size_t i=0; i<batch.size(); ++i){
+			bytes += batch[i]->command;
+		}
+		long long sentTime = Get_HostTime();
+		if (!endpoint->Write(bytes.data(), (int)bytes.size())){
+			for (size_t i=0; i<batch.size(); ++i){
+				Finish(batch[i], "", OBJECT_NAME + ": write failed, " + CommandName(batch[i]->command));
+			}
+			continue;
+		}
+
+		size_t answered = 0;
+		double roundTrip = 0.0;
+		QElapsedTimer deadline;
+		deadline.start();
+		while (answered < batch.size()){
+			string response, error;
+			if (ParseResponse(response, error)){
+				roundTrip += (Get_HostTime()-sentTime)/1.0e3;
+				Finish(batch[answered++], response, error);
+				deadline.restart();
+				continue;
+			}
+			long long remain = SERIAL_RESPONSE_TIMEOUT - deadline.elapsed();
+			int size = (remain > 0) ? endpoint->Read(buffer, sizeof(buffer), (unsigned long)remain) : -1;
+			if (size < 0 || (size == 0 && deadline.elapsed() >= SERIAL_RESPONSE_TIMEOUT)){
+				break;
+			}
+			received.append(buffer, size);
+		}
+
+		//a late response would be taken for the one of the next command
+		if (answered < batch.size()){
+			for (size_t i=answered; i<batch.size(); ++i){
+				Finish(batch[i], "", OBJECT_NAME + ": timeout, " + CommandName(batch[i]->command));
+			}
+			endpoint->Flush();
+			received.clear();
+		}
+
+		queueMutex.lock();
+		++statistics.batches;
+		statistics.commands += (unsigned long)answered;
+		statistics.timeouts += (unsigned long)(batch.size()-answered);
+		totalRoundTrip += roundTrip;
+		if (statistics.commands > 0){
+			statistics.averageRoundTrip = totalRoundTrip/statistics.commands;
+		}
+		queueMutex.unlock();
+	}
+}
+
+/*
+	A response is made of lines ended by "\r\n": the value lines, if any, and the
+	ack line. A line starting with the error prefix ends the response as an error.
+*/
+bool SerialCommandQueue::ParseResponse(string& response, string& error)
+{
+	string value;
+	size_t start = 0;
+	while (true){
+		size_t end = received.find("\r\n", start);
+		if (end == string::npos){
+			return false;
+		}
+		size_t first = received.find_first_not_of("\r\n", start);
+		string line = (first < end) ? received.substr(first, end-first) : "";
+		start = end + 2;
+		if (line == ack || line.compare(0, errorPrefix.size(), errorPrefix) == 0){
+			response = value;
+			if (line != ack){
+				error = line;
+			}
+			received.erase(0, start);
+			return true;
+		}
+		if (!line.empty()){
+			value += (value.empty() ? "" : " ") + line;
+		}
+	}
+}
+
+void SerialCommandQueue::Finish(const QSharedPointer<SerialCommandState>& state, const string& response, const string& error)
+{
+	QMutexLocker locker(&state->mutex);
+	state->response = response;
+	state->error = error;
+	state->isFinished = true;
+	state->finished.wakeAll();
+}
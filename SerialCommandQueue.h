@@ -0,0 +1,88 @@
+/****************************************************************************
+	SerialCommandQueue: I/O thread which owns a serial endpoint. Commands of
+	any thread are queued and answered through futures. The thread writes
+	the pending commands together (up to SERIAL_PIPELINE_DEPTH) and reads
+	their responses in order, each as soon as its last line arrives, with a
+	deadline per response instead of a fixed delay before reading.
+****************************************************************************/
+
+#ifndef _SERIAL_COMMAND_QUEUE_H_
+#define _SERIAL_COMMAND_QUEUE_H_
+
+#include "serial.h"
+#include "Util.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QSharedPointer>
+#include <deque>
+#include <vector>
+
+struct SerialCommandState{
+	QMutex mutex;
+	QWaitCondition finished;
+	bool isFinished;
+	string command;
+	string response;
+	string error;
+};
+
+class SerialFuture
+{
+public:
+	bool IsValid() const { return !state.isNull(); }
+	bool IsFinished() const;
+	bool Wait(unsigned long time_ms) const;
+	string Get_Response() const;   //waits for the command and throws the error string of the device
+
+private:
+	friend class SerialCommandQueue;
+	QSharedPointer<SerialCommandState> state;
+};
+
+struct SerialQueueStatistics{
+	unsigned long commands;       //commands answered by the device
+	unsigned long batches;        //writes carrying one or more commands
+	unsigned long timeouts;
+	double averageRoundTrip;      //ms from the write to the response
+};
+
+class SerialCommandQueue : public QThread
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	//a response is the lines ended by the ack line, or by a line starting with error_prefix
+	SerialCommandQueue(SerialEndpoint* endpoint, const string& ack, const string& error_prefix, QObject* parent = 0);
+	~SerialCommandQueue();
+
+	void StartThread();
+	void StopThread();
+
+	SerialFuture Submit(const string& command);
+	vector<SerialFuture> Submit(const vector<string>& commands); //queued together, so they share one write
+	string command(const string& command); //blocks the calling thread only
+	SerialQueueStatistics Get_Statistics();
+
+protected:
+	virtual void run();
+	bool ParseResponse(string& response, string& error); //takes one response out of the received bytes
+	void Finish(const QSharedPointer<SerialCommandState>& state, const string& response, const string& error);
+
+private:
+	SerialEndpoint* endpoint;
+	string ack;
+	string errorPrefix;
+	volatile bool isStopQueue;
+
+	QMutex queueMutex;
+	QWaitCondition commandReady;
+	std::deque<QSharedPointer<SerialCommandState> > commands;
+	string received;              //bytes not parsed yet, only used in the I/O thread
+
+	SerialQueueStatistics statistics;
+	double totalRoundTrip;
+};
+
+#endif
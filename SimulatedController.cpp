@@ -0,0 +1,393 @@
+
+#include "SimulatedController.h"
+#include <QtCore/QThread>
+#include <cmath>
+#include <cstdlib>
+
+string SimulatedController::OBJECT_NAME = "SimulatedController";
+
+SimulatedController::SimulatedController(long latency_ms)
+{
+	latency = latency_ms;
+	for (int i=0; i<SIMULATED_AXIS_NUM; ++i){
+		axes[i].servo = false;
+		axes[i].speed = STAGE_SIMULATION::DEFAULT_SPEED;
+		axes[i].acc = STAGE_SIMULATION::DEFAULT_ACC;
+		axes[i].dec = STAGE_SIMULATION::DEFAULT_DEC;
+		axes[i].startPosition = STAGE_SIMULATION::INITIAL_POSITION;
+		axes[i].distance = 0;
+		axes[i].startTime = 0;
+		axes[i].moving = false;
+		axes[i].ringing = false;
+		axes[i].settleStart = 0;
+		axes[i].pendingValue = 0;
+		axes[i].pendingAbsolute = false;
+		axes[i].jogMode = false;
+		axes[i].jogSpeed = 0;
+		axes[i].runSpeed = STAGE_SIMULATION::DEFAULT_SPEED;
+		axes[i].encoderScale = 1;
+	}
+	//the encoder of the z1 stage measures the vertical travel of the wedge
+	axes[AxisIndex('Y')].encoderScale = Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL;
+	for (int i=0; i<=SIMULATED_OUTPUT_NUM; ++i){
+		outputs[i] = false;
+	}
+	outputListener = NULL;
+	clock.start();
+}
+
+string SimulatedController::command(const string& command, const string& terminator, const string& ack, bool trim)
+{
+	if (latency > 0){
+		QThread::msleep(latency);
+	}
+
+	QMutexLocker locker(&controllerMutex);
+	string response;
+	size_t start = 0;
+	while (start <= command.size()){
+		size_t end = command.find(';', start);
+		if (end == string::npos){
+			end = command.size();
+		}
+		string instruction;
+		for (size_t i=start; i<end; ++i){
+			if (command[i] != '\r' && command[i] != '\n'){
+				instruction += command[i];
+			}
+		}
+		if (!instruction.empty()){
+			string result = Execute(instruction);
+			if (!result.empty()){
+				response += (response.empty() ? "" : " ") + result;
+			}
+		}
+		start = end + 1;
+	}
+	return response;
+}
+
+double SimulatedController::commandValue(const string& command)
+{
+	return atof(this->command(command).c_str());
+}
+
+void SimulatedController::write(const string& bytes)
+{
+	command(bytes);
+}
+
+void SimulatedController::Set_OutputListener(SimulatedOutputListener* listener)
+{
+	QMutexLocker locker(&controllerMutex);
+	outputListener = listener;
+}
+
+/*
+	Supported instructions: SH MO BG ST with an axes list, SP AC DC IP PR PA JG DE
+	DP with one "axis=value" assignment, SB CB with an output number and MG with
+	comma separated operands
+
+*/
+string SimulatedController::Execute(const string& instruction)
+{
+	if (instruction.size() < 2){
+		throw string(OBJECT_NAME + ": unsupported command " + instruction);
+	}
+	string op = instruction.substr(0, 2);
+	string rest = instruction.substr(2);
+	while (!rest.empty() && rest[0] == ' '){
+		rest.erase(0, 1);
+	}
+
+	if (op == "MG"){
+		return Message(rest);
+	}
+
+	if (op == "SB" || op == "CB"){
+		int output = atoi(rest.c_str());
+		if (output < 1 || output > SIMULATED_OUTPUT_NUM){
+			throw string(OBJECT_NAME + ": invalid output in " + instruction);
+		}
+		bool level = (op == "SB");
+		if (outputs[output] != level){
+			outputs[output] = level;
+			if (outputListener != NULL){
+				outputListener->OutputChanged(output, level);
+			}
+		}
+		return "";
+	}
+
+	if (op == "SH" || op == "MO" || op == "BG" || op == "ST"){
+		string axesList = rest.empty() ? string("ABCDEFGH") : rest;
+		for (size_t i=0; i<axesList.size(); ++i){
+			int axis = AxisIndex(axesList[i]);
+			if (axis < 0){
+				throw string(OBJECT_NAME + ": invalid axis in " + instruction);
+			}
+			UpdateAxis(axis);
+			SimulatedAxis& a = axes[axis];
+			a.ringing = false;
+			if (op == "SH"){
+				a.servo = true;
+			} else if (op == "MO"){
+				a.startPosition = Get_Position(axis);
+				a.moving = false;
+				a.servo = false;
+			} else if (op == "ST"){
+				//the deceleration distance is neglected: the axis stops where it is
+				a.startPosition = Get_Position(axis);
+				a.moving = false;
+			} else{
+				if (a.moving){
+					throw string(OBJECT_NAME + ": axis is already moving, " + instruction);
+				}
+				if (a.jogMode){
+					//a jog is a profile long enough to run into a limit switch
+					double travel = STAGE_SIMULATION::FORWARD_LIMIT - STAGE_SIMULATION::REVERSE_LIMIT;
+					StartProfile(axis, (a.jogSpeed < 0 ? -4 : 4)*travel, fabs(a.jogSpeed));
+				} else{
+					double distance = a.pendingAbsolute ? a.pendingValue - a.startPosition : a.pendingValue;
+					StartProfile(axis, distance, a.speed);
+				}
+			}
+		}
+		return "";
+	}
+
+	//assignments "axis=value"
+	if (rest.size() < 3 || rest[1] != '='){
+		throw string(OBJECT_NAME + ": unsupported command " + instruction);
+	}
+	int axis = AxisIndex(rest[0]);
+	if (axis < 0){
+		throw string(OBJECT_NAME + ": invalid axis in " + instruction);
+	}
+	double value = atof(rest.substr(2).c_str());
+	UpdateAxis(axis);
+	SimulatedAxis& a = axes[axis];
+	if (op == "DE" || op == "DP" || op == "IP"){
+		a.ringing = false;
+	}
+
+	if (op == "SP"){
+		a.speed = fabs(value);
+	} else if (op == "AC"){
+		a.acc = fabs(value);
+	} else if (op == "DC"){
+		a.dec = fabs(value);
+	} else if (op == "PR"){
+		a.pendingValue = value;
+		a.pendingAbsolute = false;
+		a.jogMode = false;
+	} else if (op == "PA"){
+		a.pendingValue = value;
+		a.pendingAbsolute = true;
+		a.jogMode = false;
+	} else if (op == "JG"){
+		a.jogSpeed = value;
+		a.jogMode = true;
+	} else if (op == "DE" || op == "DP"){
+		if (a.moving){
+			a.startPosition = Get_Position(axis);
+			a.moving = false;
+		}
+		a.startPosition = (op == "DE") ? value/a.encoderScale : value;
+	} else if (op == "IP"){
+		//an increment during motion extends the running target
+		double remain = a.moving ? a.startPosition + a.distance - Get_Position(axis) : 0;
+		if (a.moving){
+			a.startPosition = Get_Position(axis);
+		}
+		a.moving = false;
+		StartProfile(axis, remain + value, a.speed);
+	} else{
+		throw string(OBJECT_NAME + ": unsupported command " + instruction);
+	}
+	return "";
+}
+
+string SimulatedController::Message(const string& operands)
+{
+	string response;
+	size_t start = 0;
+	while (start <= operands.size()){
+		size_t end = operands.find(',', start);
+		if (end == string::npos){
+			end = operands.size();
+		}
+		string operand;
+		for (size_t i=start; i<end; ++i){
+			if (operands[i] != ' '){
+				operand += operands[i];
+			}
+		}
+		start = end + 1;
+		if (operand.empty()){
+			continue;
+		}
+
+		double value = 0;
+		if (operand == "TIME"){
+			value = Get_Time()/1000.0;
+		} else if (operand.size() == 4 && operand[0] == '_' && AxisIndex(operand[3]) >= 0){
+			int axis = AxisIndex(operand[3]);
+			UpdateAxis(axis);
+			string name = operand.substr(1, 2);
+			double position = Get_Position(axis);
+			if (name == "TP"){
+				value = floor(position*axes[axis].encoderScale + 0.5);
+			} else if (name == "TD"){
+				value = position;
+			} else if (name == "RP"){
+				value = axes[axis].moving ? axes[axis].startPosition + axes[axis].distance : position;
+			} else if (name == "BG"){
+				value = axes[axis].moving ? 1 : 0;
+			} else if (name == "SP"){
+				value = axes[axis].speed;
+			} else if (name == "AC"){
+				value = axes[axis].acc;
+			} else if (name == "DC"){
+				value = axes[axis].dec;
+			} else if (name == "MO"){
+				value = axes[axis].servo ? 0 : 1;
+			} else if (name == "LR"){
+				value = (position <= STAGE_SIMULATION::REVERSE_LIMIT) ? 0 : 1; //limit switches are active low
+			} else if (name == "LF"){
+				value = (position >= STAGE_SIMULATION::FORWARD_LIMIT) ? 0 : 1;
+			} else{
+				throw string(OBJECT_NAME + ": unsupported operand " + operand);
+			}
+		} else{
+			throw string(OBJECT_NAME + ": unsupported operand " + operand);
+		}
+
+		char strValue[32];
+		sprintf(strValue, "%.4f", value);
+		response += (response.empty() ? "" : " ") + string(strValue);
+	}
+	return response;
+}
+
+void SimulatedController::StartProfile(int axis, double distance, double speed)
+{
+	SimulatedAxis& a = axes[axis];
+	if (!a.servo || distance == 0){
+		return;
+	}
+	a.runSpeed = speed;
+	a.distance = distance;
+	a.startTime = Get_Time();
+	a.moving = true;
+}
+
+//finish the profile when it is completed or the axis runs into a limit switch
+void SimulatedController::UpdateAxis(int axis)
+{
+	SimulatedAxis& a = axes[axis];
+	if (!a.moving){
+		return;
+	}
+	bool done = false;
+	double t = (Get_Time()-a.startTime)/1.0e6;
+	double s = ProfileDistance(fabs(a.distance), a.runSpeed, a.acc, a.dec, t, done);
+	double position = a.startPosition + (a.distance < 0 ? -s : s);
+
+	if (a.distance < 0 && position <= STAGE_SIMULATION::REVERSE_LIMIT){
+		StopOnLimit(axis, STAGE_SIMULATION::REVERSE_LIMIT);
+	} else if (a.distance > 0 && position >= STAGE_SIMULATION::FORWARD_LIMIT){
+		StopOnLimit(axis, STAGE_SIMULATION::FORWARD_LIMIT);
+	} else if (done){
+		a.startPosition += a.distance;
+		a.moving = false;
+		a.ringing = true;
+		a.settleStart = a.startTime + (long long)(1.0e3*Get_ProfileTime(a.runSpeed, a.acc, a.dec, a.distance));
+	}
+}
+
+/*
+	The switch is seen up to LIMIT_DELAY after it is reached, so the axis overruns it by
+	a distance growing with the speed, which makes slow approaches repeatable
+*/
+void SimulatedController::StopOnLimit(int axis, double limit)
+{
+	SimulatedAxis& a = axes[axis];
+	double delay = STAGE_SIMULATION::LIMIT_DELAY*1.0e-3*rand()/RAND_MAX;
+	double overrun = min(a.runSpeed, sqrt(2*a.acc*fabs(limit-a.startPosition)))*delay;
+	a.startPosition = limit + (a.distance < 0 ? -overrun : overrun);
+	a.moving = false;
+}
+
+double SimulatedController::Get_Position(int axis)
+{
+	const SimulatedAxis& a = axes[axis];
+	if (!a.moving){
+		//decaying oscillation of the encoder once the profiler stopped
+		double t = (Get_Time()-a.settleStart)/1.0e3; //ms
+		if (!a.ringing || t > 10*STAGE_SIMULATION::RINGING_DECAY){
+			return a.startPosition;
+		}
+		double ringing = STAGE_SIMULATION::RINGING_AMPLITUDE*exp(-t/STAGE_SIMULATION::RINGING_DECAY)
+			*cos(2*3.14159265358979*STAGE_SIMULATION::RINGING_FREQUENCY*t/1.0e3);
+		return floor(a.startPosition + ringing + 0.5);
+	}
+
+	bool done = false;
+	double t = (Get_Time()-a.startTime)/1.0e6;
+	double s = ProfileDistance(fabs(a.distance), a.runSpeed, a.acc, a.dec, t, done);
+	return floor(a.startPosition + (a.distance < 0 ? -s : s) + 0.5);
+}
+
+long long SimulatedController::Get_Time()
+{
+	return clock.nsecsElapsed()/1000;
+}
+
+int SimulatedController::AxisIndex(char axis)
+{
+	switch (axis){
+		case 'X': return 0;
+		case 'Y': return 1;
+		case 'Z': return 2;
+		case 'W': return 3;
+	}
+	if (axis >= 'A' && axis < 'A'+SIMULATED_AXIS_NUM){
+		return axis - 'A';
+	}
+	return -1;
+}
+
+//travelled distance of a trapezoidal (or triangular) velocity profile at time t (s)
+double SimulatedController::ProfileDistance(double distance, double speed, double acc, double dec, double t, bool& done)
+{
+	done = false;
+	if (distance <= 0 || speed <= 0 || acc <= 0 || dec <= 0){
+		done = true;
+		return distance;
+	}
+	double peak = speed;
+	double accDistance = peak*peak/(2*acc);
+	double decDistance = peak*peak/(2*dec);
+	if (accDistance + decDistance > distance){
+		peak = sqrt(2*distance*acc*dec/(acc+dec));
+		accDistance = peak*peak/(2*acc);
+		decDistance = peak*peak/(2*dec);
+	}
+	double accTime = peak/acc;
+	double cruiseTime = (distance-accDistance-decDistance)/peak;
+	double decTime = peak/dec;
+
+	if (t <= 0){
+		return 0;
+	} else if (t < accTime){
+		return 0.5*acc*t*t;
+	} else if (t < accTime+cruiseTime){
+		return accDistance + peak*(t-accTime);
+	} else if (t < accTime+cruiseTime+decTime){
+		double tau = t-accTime-cruiseTime;
+		return accDistance + peak*cruiseTime + peak*tau - 0.5*dec*tau*tau;
+	}
+	done = true;
+	return distance;
+}
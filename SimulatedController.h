@@ -0,0 +1,82 @@
+/****************************************************************************
+	SimulatedController: offline stand-in of the Galil controller which
+	answers the DMC commands used by the stages and moves its axes along
+	trapezoidal profiles or jogs in real time, stopping them on the limit
+	switches after a detection delay. Its digital outputs can drive a
+	simulated device such as the trigger input of the simulated camera.
+	Defining USE_STAGE_SIMULATOR makes the control panel connect to it
+	instead of the controller.
+****************************************************************************/
+
+#ifndef _SIMULATED_CONTROLLER_H_
+#define _SIMULATED_CONTROLLER_H_
+
+#include "StageController.h"
+#include "Stage_Params.h"
+#include <QtCore/QMutex>
+#include <QtCore/QElapsedTimer>
+
+#define SIMULATED_AXIS_NUM 8
+#define SIMULATED_OUTPUT_NUM 8
+
+//device wired to the digital outputs of the simulated controller, e.g. a camera trigger input
+class SimulatedOutputListener
+{
+public:
+	virtual ~SimulatedOutputListener(){}
+	virtual void OutputChanged(int output, bool level) = 0; //called in the thread sending SB/CB
+};
+
+struct SimulatedAxis{
+	bool servo;
+	double speed;
+	double acc;
+	double dec;
+	double startPosition;   //position where the current profile starts
+	double distance;        //signed distance of the current profile
+	long long startTime;    //us
+	bool moving;
+	bool ringing;           //encoder rings around the target after a completed profile
+	long long settleStart;  //us
+	double pendingValue;    //PR/PA value waiting for BG
+	bool pendingAbsolute;
+	bool jogMode;           //BG starts a jog at jogSpeed after JG, a PR/PA motion otherwise
+	double jogSpeed;        //signed
+	double runSpeed;        //slew speed of the current profile
+	double encoderScale;    //encoder pulses (TP) per motor pulse (TD)
+};
+
+class SimulatedController : public StageController
+{
+public:
+	static string OBJECT_NAME;
+
+	explicit SimulatedController(long latency_ms = STAGE_SIMULATION::COMMAND_LATENCY);
+
+	string command(const string& command, const string& terminator = "\r", const string& ack = ":", bool trim = true);
+	double commandValue(const string& command);
+	void write(const string& bytes);
+
+	void Set_OutputListener(SimulatedOutputListener* listener);
+
+protected:
+	string Execute(const string& instruction);
+	string Message(const string& operands);
+	void StartProfile(int axis, double distance, double speed);
+	void StopOnLimit(int axis, double limit);
+	void UpdateAxis(int axis);
+	double Get_Position(int axis);
+	long long Get_Time();
+	static int AxisIndex(char axis);
+	static double ProfileDistance(double distance, double speed, double acc, double dec, double t, bool& done);
+
+private:
+	QMutex controllerMutex;
+	QElapsedTimer clock;
+	long latency;
+	SimulatedAxis axes[SIMULATED_AXIS_NUM];
+	bool outputs[SIMULATED_OUTPUT_NUM+1];  //outputs 1..SIMULATED_OUTPUT_NUM
+	SimulatedOutputListener* outputListener;
+};
+
+#endif
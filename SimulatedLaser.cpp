@@ -0,0 +1,147 @@
+
+#include "SimulatedLaser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+string SimulatedLaser::OBJECT_NAME = "SimulatedLaser";
+
+SimulatedLaser::SimulatedLaser(long latency_ms, long baud_rate)
+{
+	latency = latency_ms;
+	byteTime = 1.0e7/baud_rate;  //10 bits per byte
+	busyTime = 0;
+	emission = false;
+	digitalMode = false;
+	cdrh = true;
+	autoStart = false;
+	power = LASER_SIMULATION_NOMIAL_POWER/2;
+	clock.start();
+}
+
+long long SimulatedLaser::Get_Time()
+{
+	return clock.nsecsElapsed()/1000;
+}
+
+//every received line is answered after the bytes of the command, the commands before it and the processing
+bool SimulatedLaser::Write(const char* data, int size)
+{
+	QMutexLocker locker(&laserMutex);
+	long long now = Get_Time();
+	for (int i=0; i<size; ++i){
+		if (data[i] != '\r' && data[i] != '\n'){
+			line += data[i];
+			continue;
+		}
+		if (line.empty()){
+			continue;
+		}
+		SimulatedResponse response;
+		response.bytes = Execute(line);
+		long long received = now + (long long)((i+1)*byteTime);
+		response.readyTime = max(received, busyTime) + latency*1000 + (long long)(response.bytes.size()*byteTime);
+		busyTime = response.readyTime;
+		responses.push_back(response);
+		line.clear();
+	}
+	responseReady.wakeAll();
+	return true;
+}
+
+int SimulatedLaser::Read(char* buffer, int size, unsigned long timeout_ms)
+{
+	QMutexLocker locker(&laserMutex);
+	long long deadline = Get_Time() + timeout_ms*1000LL;
+	while (true){
+		long long now = Get_Time();
+		int count = 0;
+		while (!responses.empty() && responses.front().readyTime <= now && count < size){
+			string& bytes = responses.front().bytes;
+			int length = min(size-count, (int)bytes.size());
+			memcpy(buffer+count, bytes.data(), length);
+			count += length;
+			bytes.erase(0, length);
+			if (bytes.empty()){
+				responses.pop_front();
+			}
+		}
+		if (count > 0){
+			return count;
+		}
+		if (now >= deadline){
+			return 0;
+		}
+		long long wake = responses.empty() ? deadline : min(deadline, responses.front().readyTime);
+		responseReady.wait(&laserMutex, (unsigned long)((wake-now+999)/1000));
+	}
+}
+
+void SimulatedLaser::Flush()
+{
+	QMutexLocker locker(&laserMutex);
+	responses.clear();
+	line.clear();
+}
+
+string SimulatedLaser::Execute(const string& command)
+{
+	string instruction;
+	for (size_t i=0; i<command.size(); ++i){
+		instruction += (char)toupper(command[i]);
+	}
+	size_t space = instruction.find(' ');
+	string name = instruction.substr(0, space);
+	string value = (space == string::npos) ? "" : instruction.substr(space+1);
+	char text[64];
+
+	if (name == "SOURCE:AM:STATE" || name == "SOURCE255:AM:STATE"){
+		if (value != "ON" && value != "OFF"){ return "ERR-102\r\n"; }
+		emission = (value == "ON");
+	} else if (name == "SOURCE:AM:INTERNAL"){
+		if (value != "CWP"){ return "ERR-102\r\n"; }
+		digitalMode = false;
+	} else if (name == "SOURCE:AM:EXTERNAL"){
+		if (value != "DIGITAL"){ return "ERR-102\r\n"; }
+		digitalMode = true;
+	} else if (name == "SOURCE:AM:SOURCE?"){
+		return string(digitalMode ? "DIGITAL" : "CWP") + "\r\nOK\r\n";
+	} else if (name == "SYSTEM:STATUS?"){
+		//bit 0x2: emission, bit 0x4: ready
+		sprintf(text, "0x%08X\r\nOK\r\n", emission ? 0x2 : 0x4);
+		return text;
+	} else if (name == "SYSTEM:CDRH" || name == "SYSTEM:AUTOSTART"){
+		if (value != "ON" && value != "OFF"){ return "ERR-102\r\n"; }
+		if (name == "SYSTEM:CDRH"){
+			cdrh = (value == "ON");
+		} else{
+			autoStart = (value == "ON");
+		}
+	} else if (name == "SYSTEM:CDRH?"){
+		return string(cdrh ? "ON" : "OFF") + "\r\nOK\r\n";
+	} else if (name == "SYSTEM:AUTOSTART?"){
+		return string(autoStart ? "ON" : "OFF") + "\r\nOK\r\n";
+	} else if (name == "SOURCE:POWER:LIMIT:HIGH?" || name == "SOURCE:POWER:LIMIT:LOW?" ||
+			   name == "SOURCE:POWER:NOMINAL?" || name == "SOURCE:POWER:LEVEL:IMMEDIATE:AMPLITUDE?"){
+		double result = power;
+		if (name == "SOURCE:POWER:LIMIT:HIGH?"){
+			result = LASER_SIMULATION_MAX_POWER;
+		} else if (name == "SOURCE:POWER:LIMIT:LOW?"){
+			result = LASER_SIMULATION_MIN_POWER;
+		} else if (name == "SOURCE:POWER:NOMINAL?"){
+			result = LASER_SIMULATION_NOMIAL_POWER;
+		}
+		sprintf(text, "%.5f\r\nOK\r\n", result);
+		return text;
+	} else if (name == "SOURCE:POWER:LEVEL:IMMEDIATE:AMPLITUDE"){
+		double level = atof(value.c_str());
+		if (value.empty() || level < LASER_SIMULATION_MIN_POWER || level > LASER_SIMULATION_MAX_POWER){
+			return "ERR-102\r\n";
+		}
+		power = level;
+	} else{
+		return "ERR-100\r\n";
+	}
+	return "OK\r\n";
+}
@@ -0,0 +1,62 @@
+/****************************************************************************
+	SimulatedLaser: offline stand-in of the serial port of a laser which
+	answers the commands of CLaser one after the other, each after the
+	transmission of its bytes and a processing delay, so that the command
+	queue runs on it as on the device. Defining USE_LASER_SIMULATOR makes
+	the control panel connect the lasers to it instead of the serial ports.
+****************************************************************************/
+
+#ifndef _SIMULATED_LASER_H_
+#define _SIMULATED_LASER_H_
+
+#include "serial.h"
+#include "Util.h"
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QElapsedTimer>
+#include <deque>
+
+#define LASER_SIMULATION_LATENCY 2          //processing of one command, ms
+#define LASER_SIMULATION_BAUD_RATE 115200
+#define LASER_SIMULATION_NOMIAL_POWER 0.05  //W
+#define LASER_SIMULATION_MAX_POWER 0.055    //W
+#define LASER_SIMULATION_MIN_POWER 0.0005   //W
+
+struct SimulatedResponse{
+	string bytes;
+	long long readyTime;   //us, when the last byte is received
+};
+
+class SimulatedLaser : public SerialEndpoint
+{
+public:
+	static string OBJECT_NAME;
+
+	explicit SimulatedLaser(long latency_ms = LASER_SIMULATION_LATENCY, long baud_rate = LASER_SIMULATION_BAUD_RATE);
+
+	bool Write(const char* data, int size);
+	int Read(char* buffer, int size, unsigned long timeout_ms);
+	void Flush();
+
+protected:
+	string Execute(const string& command);  //returns the response lines
+	long long Get_Time();
+
+private:
+	QMutex laserMutex;
+	QWaitCondition responseReady;
+	QElapsedTimer clock;
+	long latency;
+	double byteTime;       //us per byte on the line
+	string line;           //command being received
+	std::deque<SimulatedResponse> responses;
+	long long busyTime;    //us, when the device ends the commands it received
+
+	bool emission;
+	bool digitalMode;
+	bool cdrh;
+	bool autoStart;
+	double power;          //W
+};
+
+#endif
@@ -0,0 +1,369 @@
+
+#include "Simulated_Camera.h"
+#include "ImageKernels.h"
+#include <QtCore/QDateTime>
+#include <cmath>
+
+string Simulated_Camera::OBJECT_NAME = "Simulated_Camera";
+string Simulated_Camera::DEVICE_NAME = "Simulated Camera";
+
+void Simulated_AcquireImageThread::run()
+{
+	camera->AcquireImages();
+}
+
+Simulated_Camera::Simulated_Camera(StageController* specimen) : specimen(specimen)
+{
+	status = DISCONNECTED;
+	acquireImageThread = NULL;
+	isStopLive = true;
+	isSingleCapture = false;
+	isExternalTrigger = false;
+	isBusy = false;
+	pendingTriggers = 0;
+	missedTriggers = 0;
+	imageWidth = SIMULATED_CAMERA::IMAGE_WIDTH;
+	imageHeight = SIMULATED_CAMERA::IMAGE_HEIGHT;
+	pendingWidth = 0;
+	pendingHeight = 0;
+	binning = 1;
+	pendingBinning = 0;
+	exposureTime = SIMULATED_CAMERA::EXPOSURE_TIME;
+	frameCount = 0;
+}
+
+Simulated_Camera::~Simulated_Camera()
+{
+	Disconnect();
+	specimen = NULL;
+}
+
+bool Simulated_Camera::Connect()
+{
+	status = CONNECTED;
+	cout<<"Connect to simulated camera successfully"<<endl;
+	return true;
+}
+
+bool Simulated_Camera::IsConnected()
+{
+	return (status == CONNECTED);
+}
+
+void Simulated_Camera::Disconnect()
+{
+	StopLive();
+	status = DISCONNECTED;
+}
+
+void Simulated_Camera::Capture()
+{
+	StartThread(true);
+}
+
+void Simulated_Camera::Live()
+{
+	StartThread(false);
+}
+
+void Simulated_Camera::StopLive()
+{
+	if (acquireImageThread == NULL){
+		return;
+	}
+	isStopLive = true;
+	triggerReady.wakeAll();
+	acquireImageThread->wait();
+	delete acquireImageThread;
+	acquireImageThread = NULL;
+}
+
+void Simulated_Camera::StartThread(bool single)
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "StartThread()", "No camera connection");
+	}
+	StopLive();
+	isSingleCapture = single;
+	isStopLive = false;
+	triggerMutex.lock();
+	pendingTriggers = 0;
+	triggerMutex.unlock();
+	acquireImageThread = new Simulated_AcquireImageThread(this);
+	acquireImageThread->start();
+}
+
+void Simulated_Camera::Get_CameraInfo()
+{
+	cout<<DEVICE_NAME<<": "<<imageWidth<<"x"<<imageHeight<<", exposure "<<exposureTime<<"s, readout "
+		<<Get_ReadoutTime()<<"s"<<endl;
+}
+
+//the subarray offset does not matter for the uniform sample, while live the size is changed before the next frame
+bool Simulated_Camera::Set_ImageSize(int left, int top, int width, int height)
+{
+	if (left < 0 || top < 0 || width <= 0 || height <= 0
+		|| left+width > SIMULATED_CAMERA::IMAGE_WIDTH || top+height > SIMULATED_CAMERA::IMAGE_HEIGHT){
+		cout<<GetErrorString(OBJECT_NAME, "Set_ImageSize()", "Invalid image size");
+		return false;
+	}
+	QMutexLocker locker(&sizeMutex);
+	if (acquireImageThread != NULL){
+		pendingWidth = width;
+		pendingHeight = height;
+	} else{
+		imageWidth = width;
+		imageHeight = height;
+	}
+	return true;
+}
+
+bool Simulated_Camera::Get_ImageSize(ImageSize& size)
+{
+	QMutexLocker locker(&sizeMutex);
+	int frameBinning = (pendingBinning > 0) ? pendingBinning : binning;
+	size.width = ((pendingWidth > 0) ? pendingWidth : imageWidth)/frameBinning;
+	size.height = ((pendingHeight > 0) ? pendingHeight : imageHeight)/frameBinning;
+	size.stride = size.width;
+	return true;
+}
+
+bool Simulated_Camera::Set_Binning(int frame_binning)
+{
+	if (frame_binning != 1 && frame_binning != 2 && frame_binning != 4){
+		cout<<GetErrorString(OBJECT_NAME, "Set_Binning()", "Invalid binning");
+		return false;
+	}
+	QMutexLocker locker(&sizeMutex);
+	if (acquireImageThread != NULL){
+		pendingBinning = frame_binning;
+	} else{
+		binning = frame_binning;
+	}
+	return true;
+}
+
+bool Simulated_Camera::Get_Binning(int& frame_binning)
+{
+	QMutexLocker locker(&sizeMutex);
+	frame_binning = (pendingBinning > 0) ? pendingBinning : binning;
+	return true;
+}
+
+//all the rows of the subarray are read out whatever the binning
+double Simulated_Camera::Get_ReadoutTime()
+{
+	QMutexLocker locker(&sizeMutex);
+	int height = (pendingHeight > 0) ? pendingHeight : imageHeight;
+	return SIMULATED_CAMERA::READOUT_TIME*height/SIMULATED_CAMERA::IMAGE_HEIGHT;
+}
+
+bool Simulated_Camera::Set_TriggerMode(string mode)
+{
+	QMutexLocker locker(&triggerMutex);
+	if (mode == "Internal"){
+		isExternalTrigger = false;
+	} else if (mode == "External Edge"){
+		isExternalTrigger = true;
+		pendingTriggers = 0;
+	} else{
+		cout<<GetErrorString(OBJECT_NAME, "Set_TriggerMode()", "Invalid trigger mode");
+		return false;
+	}
+	triggerReady.wakeAll();
+	return true;
+}
+
+bool Simulated_Camera::Get_TriggerMode(string& mode)
+{
+	QMutexLocker locker(&triggerMutex);
+	mode = isExternalTrigger ? "External Edge" : "Internal";
+	return true;
+}
+
+bool Simulated_Camera::Get_ExposureTimeRange(Range& range)
+{
+	range.min = SIMULATED_CAMERA::MIN_EXPOSURE_TIME;
+	range.max = SIMULATED_CAMERA::MAX_EXPOSURE_TIME;
+	range.current = exposureTime;
+	return true;
+}
+
+bool Simulated_Camera::Set_ExposureTime(double time)
+{
+	if (time < SIMULATED_CAMERA::MIN_EXPOSURE_TIME || time > SIMULATED_CAMERA::MAX_EXPOSURE_TIME){
+		cout<<GetErrorString(OBJECT_NAME, "Set_ExposureTime()", "Fail to set exposure time");
+		return false;
+	}
+	exposureTime = time;
+	return true;
+}
+
+bool Simulated_Camera::Get_ExposureTime(double& time)
+{
+	time = exposureTime;
+	return true;
+}
+
+bool Simulated_Camera::Get_FrameRateRange(Range& range)
+{
+	double readout = Get_ReadoutTime();
+	range.min = 1.0/(SIMULATED_CAMERA::MAX_EXPOSURE_TIME+readout);
+	range.max = 1.0/(SIMULATED_CAMERA::MIN_EXPOSURE_TIME+readout);
+	range.current = 1.0/(exposureTime+readout);
+	return true;
+}
+
+//the internal frame rate follows the exposure and the readout
+bool Simulated_Camera::Set_FrameRate(double)
+{
+	return false;
+}
+
+bool Simulated_Camera::Get_FrameRate(double& rate)
+{
+	rate = 1.0/(exposureTime+Get_ReadoutTime());
+	return true;
+}
+
+bool Simulated_Camera::Get_CurrentTemperature(double& temperature)
+{
+	if (status != CONNECTED){
+		return false;
+	}
+	temperature = SIMULATED_CAMERA::SENSOR_TEMPERATURE;
+	return true;
+}
+
+//an edge starts an exposure unless the sensor is still busy with the former frame
+void Simulated_Camera::OutputChanged(int output, bool level)
+{
+	if (output != CAMERA_TRIGGER::CONTROLLER_OUTPUT || !level){
+		return;
+	}
+	QMutexLocker locker(&triggerMutex);
+	if (!isExternalTrigger){
+		return;
+	}
+	if (isBusy || pendingTriggers > 0){
+		++missedTriggers;
+		return;
+	}
+	pendingTriggers = 1;
+	triggerReady.wakeAll();
+}
+
+bool Simulated_Camera::WaitTrigger()
+{
+	QMutexLocker locker(&triggerMutex);
+	if (!isExternalTrigger){
+		isBusy = true;
+		return true;
+	}
+	if (pendingTriggers == 0){
+		triggerReady.wait(&triggerMutex, 100);
+	}
+	if (pendingTriggers == 0){
+		return false;
+	}
+	pendingTriggers = 0;
+	isBusy = true;
+	return true;
+}
+
+void Simulated_Camera::AcquireImages()
+{
+	image.resize(imageWidth*imageHeight);
+	while (!isStopLive){
+		sizeMutex.lock();
+		if (pendingWidth > 0){
+			imageWidth = pendingWidth;
+			imageHeight = pendingHeight;
+			pendingWidth = 0;
+			pendingHeight = 0;
+			image.resize(imageWidth*imageHeight);
+		}
+		if (pendingBinning > 0){
+			binning = pendingBinning;
+			pendingBinning = 0;
+		}
+		int frameBinning = binning;
+		sizeMutex.unlock();
+		if (!WaitTrigger()){
+			continue;
+		}
+		long exposure_ms = long(exposureTime*1.0e3 + 0.5);
+		long long exposureStart = Get_HostTime();
+
+		//the sample is seen at the position of the middle of the exposure
+		QThread::msleep(exposure_ms/2);
+		double z = SIMULATED_CAMERA::FOCUS_POSITION;
+		if (specimen != NULL){
+			try{
+				z = specimen->commandValue("MG _TPY");
+			} catch (string e){
+				cout<<GetErrorString(OBJECT_NAME, "AcquireImages()", e);
+			}
+		}
+		QThread::msleep(exposure_ms - exposure_ms/2);
+		RenderImage(z);
+		if (frameBinning > 1){
+			BinImage_SSE2(&image[0], imageWidth, imageWidth, imageHeight, frameBinning, &image[0]);
+		}
+		QThread::msleep(long(Get_ReadoutTime()*1.0e3 + 0.5));
+
+		FrameInfo frameInfo;
+		frameInfo.frame_index = frameCount;
+		frameInfo.timestamp = QDateTime::currentMSecsSinceEpoch();
+		frameInfo.image_width = imageWidth/frameBinning;
+		frameInfo.image_height = imageHeight/frameBinning;
+		frameInfo.row_bytes = frameInfo.image_width*sizeof(ushort);
+		frameInfo.data_type = USHORT_TYPE;
+		frameInfo.channelOffset = 0;
+		frameInfo.exposure_time = exposureStart + exposure_ms*500;
+		if (!Get_FrameChannel(frameInfo.exposure_time, frameInfo.channel)){
+			frameInfo.channel = (char)0xFF;
+		}
+		frameInfo.z_position = 0;
+		frameInfo.has_position = Get_FramePosition(frameInfo.exposure_time, frameInfo.z_position);
+		DispatchFrame((const uchar*)&image[0], frameInfo);
+		++frameCount;
+
+		triggerMutex.lock();
+		isBusy = false;
+		triggerMutex.unlock();
+		if (isSingleCapture){
+			break;
+		}
+	}
+}
+
+/*
+	Beads on a square grid, rendered as separable gaussians whose width grows with the
+	defocus while their integrated intensity is kept
+*/
+void Simulated_Camera::RenderImage(double z_position)
+{
+	double defocus = fabs(z_position-SIMULATED_CAMERA::FOCUS_POSITION)*Z1_STAGE::Z1_PRECISION; //um
+	double sigma = SIMULATED_CAMERA::SPOT_SIGMA + SIMULATED_CAMERA::DEFOCUS_BLUR*defocus;
+	double peak = SIMULATED_CAMERA::SPOT_INTENSITY*Square(SIMULATED_CAMERA::SPOT_SIGMA/sigma);
+	const int spacing = SIMULATED_CAMERA::SPOT_SPACING;
+
+	profileX.resize(imageWidth);
+	profileY.resize(imageHeight);
+	for (int x=0; x<imageWidth; ++x){
+		double dx = (x%spacing) - spacing/2;
+		profileX[x] = exp(-dx*dx/(2*sigma*sigma));
+	}
+	for (int y=0; y<imageHeight; ++y){
+		double dy = (y%spacing) - spacing/2;
+		profileY[y] = peak*exp(-dy*dy/(2*sigma*sigma));
+	}
+	for (int y=0; y<imageHeight; ++y){
+		ushort* row = &image[y*imageWidth];
+		for (int x=0; x<imageWidth; ++x){
+			double value = SIMULATED_CAMERA::BACKGROUND + profileY[y]*profileX[x];
+			row[x] = (ushort)(value > 65535 ? 65535 : value);
+		}
+	}
+}
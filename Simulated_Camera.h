@@ -0,0 +1,105 @@
+/***********************************************************************************
+	Simulated Camera: offline camera which renders a bead sample blurred by the
+	defocus of the z1 stage. It exposes continuously in the internal mode or on
+	the rising edges of a simulated controller output in the external edge mode,
+	and hands its frames to the frame processors like the Hamamatsu camera.
+***********************************************************************************/
+#ifndef _SIMULATED_CAMERA_H_
+#define _SIMULATED_CAMERA_H_
+
+#include "Camera.h"
+#include "QException.h"
+#include "SimulatedController.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <vector>
+
+class Simulated_Camera;
+class Simulated_AcquireImageThread : public QThread
+{
+public:
+	explicit Simulated_AcquireImageThread(Simulated_Camera* camera) : camera(camera){}
+
+protected:
+	virtual void run();
+
+private:
+	Simulated_Camera* camera;
+};
+
+class Simulated_Camera : public Camera, public SimulatedOutputListener
+{
+public:
+	static string OBJECT_NAME;
+	static string DEVICE_NAME;
+
+	//the focus of the sample follows the z1 encoder of the controller
+	explicit Simulated_Camera(StageController* specimen = NULL);
+	~Simulated_Camera();
+
+	bool Connect();
+	bool IsConnected();
+	void Disconnect();
+
+	void Capture();
+	void Live();
+	void StopLive();
+
+	void Get_CameraInfo();
+	bool Set_ImageSize(int left, int top, int width, int height);
+	bool Get_ImageSize(ImageSize &);
+	bool Set_Binning(int binning);
+	bool Get_Binning(int &);
+	bool Set_TriggerMode(string mode);  //"Internal" or "External Edge"
+	bool Get_TriggerMode(string &);
+
+	bool Get_ExposureTimeRange(Range &);
+	bool Set_ExposureTime(double);
+	bool Get_ExposureTime(double &);
+	bool Get_FrameRateRange(Range &);
+	bool Set_FrameRate(double);
+	bool Get_FrameRate(double &);
+	bool Get_CurrentTemperature(double &);
+
+	void OutputChanged(int output, bool level);
+	unsigned long Get_FrameCount(){ return frameCount; }
+	unsigned long Get_MissedTriggers(){ return missedTriggers; } //edges received while exposing or reading out
+	double Get_ReadoutTime(); //the rows of the subarray are read out, s
+
+protected:
+	friend class Simulated_AcquireImageThread;
+	void AcquireImages();
+	bool WaitTrigger();
+	void RenderImage(double z_position);
+	void StartThread(bool single);
+
+private:
+	DeviceStatus status;
+	StageController* specimen;
+	Simulated_AcquireImageThread* acquireImageThread;
+	volatile bool isStopLive;
+	bool isSingleCapture;
+
+	QMutex triggerMutex;
+	QWaitCondition triggerReady;
+	bool isExternalTrigger;
+	bool isBusy;
+	int pendingTriggers;
+	volatile unsigned long missedTriggers;
+
+	QMutex sizeMutex;
+	int imageWidth;
+	int imageHeight;
+	int pendingWidth;   //taken between two frames while live, 0 if none
+	int pendingHeight;
+	int binning;        //in software, the sensor is read out whole
+	int pendingBinning;
+	volatile double exposureTime;  //s
+	volatile unsigned long frameCount;
+	std::vector<ushort> image;
+	std::vector<double> profileX;
+	std::vector<double> profileY;
+};
+
+#endif //_SIMULATED_CAMERA_H_
@@ -0,0 +1,47 @@
+
+#include "Stage.h"
+#include <Windows.h>
+#include <QtCore/QElapsedTimer>
+#include <cmath>
+
+/*
+	Sleep through the predicted profile, then sample the profiler state and the
+	encoder of the axis in one round trip until the profiler stopped and the
+	encoder stays within the settle tolerance for the settle time
+*/
+bool Stage::WaitAxisSettled(StageController* controller, char axis, double motion_time, long margin, long timeout_ms)
+{
+	QElapsedTimer timer;
+	timer.start();
+	long sleepTime = long(motion_time) - margin;
+	if (sleepTime > 0){
+		Sleep(sleepTime);
+	}
+
+	char strCommand[32];
+	sprintf(strCommand, "MG _BG%c, _TP%c", axis, axis);
+	bool hasLastPosition = false;
+	double lastPosition = 0;
+	long long stableStart = -1;
+	while (true){
+		double moving = 1, position = 0;
+		sscanf(controller->command(strCommand).c_str(), "%lf %lf", &moving, &position);
+		if (moving == 0 && hasLastPosition && fabs(position-lastPosition) <= settleCriterion.tolerance){
+			if (stableStart < 0){
+				stableStart = timer.elapsed();
+			}
+			if (timer.elapsed()-stableStart >= settleCriterion.settle_time){
+				return true;
+			}
+		} else{
+			stableStart = -1;
+		}
+		hasLastPosition = true;
+		lastPosition = position;
+
+		if (timer.elapsed() > timeout_ms){
+			return false;
+		}
+		Sleep(settleCriterion.poll_interval);
+	}
+}
@@ -7,10 +7,23 @@
 
 #include "Util.h"
 #include "QException.h"
+#include "StageController.h"
+
+//a motion is complete when the profiler stopped and the encoder stays within
+//tolerance (pulse) for settle_time (ms), sampled every poll_interval (ms)
+struct SettleCriterion{
+	double tolerance;
+	long settle_time;
+	long poll_interval;
+};
 
 class Stage{
 public:
-	Stage():state(DISCONNECTED){}
+	Stage():state(DISCONNECTED){
+		settleCriterion.tolerance = 1;
+		settleCriterion.settle_time = 0;
+		settleCriterion.poll_interval = 1;
+	}
 
 	//General control
 	virtual bool Connect() = 0;
@@ -25,6 +38,11 @@ public:
 	virtual void Move_Closeloop_Unrealtime(double distance) = 0;
 	virtual void Stop() = 0;
 	virtual bool ReturnOrigin() = 0;
+	virtual bool IsMoving() = 0; //whether a motion instruction is still being executed
+	//block until the running motion completes, motion_time (ms) is the predicted profile duration
+	virtual bool WaitMotionComplete(double motion_time, long timeout_ms) = 0;
+	inline void Set_SettleCriterion(const SettleCriterion& criterion){ settleCriterion = criterion; }
+	inline SettleCriterion Get_SettleCriterion(){ return settleCriterion; }
 
 	//Position acquisition
 	virtual double Get_CurrentPosition() = 0;
@@ -38,6 +56,13 @@ public:
 	virtual double Get_ACCSpeed() = 0;
 	virtual double Get_DECSpeed() = 0;
 
+protected:
+	//wait of an axis on the controller, margin (ms) is woken early before the end of the profile,
+	//throws the error string of the controller
+	bool WaitAxisSettled(StageController* controller, char axis, double motion_time, long margin, long timeout_ms);
+
+	SettleCriterion settleCriterion;
+
 private:
 	DeviceStatus state;
 };
@@ -0,0 +1,333 @@
+
+#include "StageCommandQueue.h"
+#include <QtCore/QElapsedTimer>
+#include <sstream>
+#include <ctype.h>
+
+string StageCommandQueue::OBJECT_NAME = "StageCommandQueue";
+
+/********************************** Command Future **********************************/
+bool CommandFuture::IsFinished() const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QMutexLocker locker(&state->mutex);
+	return state->isFinished;
+}
+
+bool CommandFuture::Wait(unsigned long time_ms) const
+{
+	if (state.isNull()){
+		return false;
+	}
+	QElapsedTimer timer;
+	timer.start();
+	QMutexLocker locker(&state->mutex);
+	while (!state->isFinished){
+		long long remain = (long long)time_ms - timer.elapsed();
+		if (remain <= 0){
+			return false;
+		}
+		state->finished.wait(&state->mutex, (unsigned long)remain);
+	}
+	return true;
+}
+
+string CommandFuture::Get_Response() const
+{
+	if (state.isNull()){
+		throw string(StageCommandQueue::OBJECT_NAME + ": invalid command future");
+	}
+	if (!Wait()){
+		//a command still queued is dropped, a move given up on must not start later
+		QMutexLocker locker(&state->mutex);
+		if (!state->isFinished){
+			state->isCancelled = true;
+			throw string(StageCommandQueue::OBJECT_NAME + ": timeout, " + state->command);
+		}
+	}
+	QMutexLocker locker(&state->mutex);
+	if (!state->error.empty()){
+		throw state->error;
+	}
+	return state->response;
+}
+
+double CommandFuture::Get_Value() const
+{
+	return atof(Get_Response().c_str());
+}
+
+void CommandFuture::Get_RoundTrip(long long& sent_time, long long& answered_time) const
+{
+	Get_Response();
+	QMutexLocker locker(&state->mutex);
+	sent_time = state->sentTime;
+	answered_time = state->answeredTime;
+}
+
+vector<double> CommandFuture::Get_Values() const
+{
+	vector<double> values;
+	std::istringstream stream(Get_Response());
+	double value;
+	while (stream>>value){
+		values.push_back(value);
+	}
+	return values;
+}
+
+/********************************** Command Queue **********************************/
+StageCommandQueue::StageCommandQueue(StageController* controller, QObject* parent) : QThread(parent), controller(controller)
+{
+	isStopQueue = true;
+	nextId = 0;
+	statistics.commands = 0;
+	statistics.sharedQueries = 0;
+	statistics.maxQueueLength = 0;
+	statistics.averageRoundTrip = 0.0;
+	totalRoundTrip = 0.0;
+}
+
+StageCommandQueue::~StageCommandQueue()
+{
+	StopThread();
+	controller = NULL;
+}
+
+void StageCommandQueue::StartThread()
+{
+	if (isRunning()){
+		return;
+	}
+	isStopQueue = false;
+	start();
+}
+
+//the commands left in the queue are answered with an error
+void StageCommandQueue::StopThread()
+{
+	isStopQueue = true;
+	commandReady.wakeAll();
+	wait();
+
+	queueMutex.lock();
+	std::deque<QueuedCommand> remains;
+	remains.swap(commands);
+	queueMutex.unlock();
+	for (size_t i=0; i<remains.size(); ++i){
+		Finish(remains[i], "", OBJECT_NAME + ": queue stopped");
+	}
+}
+
+CommandFuture StageCommandQueue::Submit(const string& command)
+{
+	return Enqueue(command, "\r", ":", true, false, 0);
+}
+
+CommandFuture StageCommandQueue::SubmitWrite(const string& bytes)
+{
+	return Enqueue(bytes, "", "", false, true, 0);
+}
+
+unsigned long StageCommandQueue::Post(const string& command)
+{
+	queueMutex.lock();
+	unsigned long id = ++nextId;
+	queueMutex.unlock();
+	Enqueue(command, "\r", ":", true, false, id);
+	return id;
+}
+
+CommandFuture StageCommandQueue::QueryPositions(const string& axes)
+{
+	string command = "MG ";
+	for (size_t i=0; i<axes.size(); ++i){
+		command += (i==0 ? "_TP" : ", _TP") + string(1, axes[i]);
+	}
+	return Submit(command);
+}
+
+QueueStatistics StageCommandQueue::Get_Statistics()
+{
+	QMutexLocker locker(&queueMutex);
+	return statistics;
+}
+
+string StageCommandQueue::command(const string& command, const string& terminator, const string& ack, bool trim)
+{
+	return Enqueue(command, terminator, ack, trim, false, 0).Get_Response();
+}
+
+double StageCommandQueue::commandValue(const string& command)
+{
+	return atof(this->command(command).c_str());
+}
+
+void StageCommandQueue::write(const string& bytes)
+{
+	SubmitWrite(bytes).Get_Response();
+}
+
+CommandFuture StageCommandQueue::Enqueue(const string& command, const string& terminator, const string& ack, bool trim,
+										 bool is_write, unsigned long id)
+{
+	QueuedCommand entry;
+	entry.command = command;
+	entry.terminator = terminator;
+	entry.ack = ack;
+	entry.trim = trim;
+	entry.isWrite = is_write;
+	entry.id = id;
+	entry.state = QSharedPointer<CommandState>(new CommandState);
+	entry.state->isFinished = false;
+	entry.state->isCancelled = false;
+	entry.state->command = command;
+	entry.state->sentTime = 0;
+	entry.state->answeredTime = 0;
+
+	CommandFuture future;
+	future.state = entry.state;
+
+	queueMutex.lock();
+	if (isStopQueue){
+		queueMutex.unlock();
+		Finish(entry, "", OBJECT_NAME + ": queue stopped");
+		return future;
+	}
+	//a stop is urgent and goes before the pending commands, the moves it stops are not sent
+	//after it; other writes keep their order
+	std::deque<QueuedCommand> stopped;
+	if (is_write && command.compare(0, 2, "ST") == 0){
+		TakeMoves(command, stopped);
+		commands.push_front(entry);
+	} else{
+		commands.push_back(entry);
+	}
+	if (commands.size() > statistics.maxQueueLength){
+		statistics.maxQueueLength = (unsigned long)commands.size();
+	}
+	commandReady.wakeOne();
+	queueMutex.unlock();
+
+	for (size_t i=0; i<stopped.size(); ++i){
+		Finish(stopped[i], "", OBJECT_NAME + ": stopped, " + stopped[i].command);
+	}
+	return future;
+}
+
+//"ST" stops all the axes, "STXY" the axes X and Y. A move instruction names its axis after
+//the opcode ("PRY=100"), the comma form ("PR 100,200") moves several axes and is taken for any stop.
+void StageCommandQueue::TakeMoves(const string& stop, std::deque<QueuedCommand>& moves)
+{
+	string axes;
+	for (size_t i=2; i<stop.size() && isalpha((unsigned char)stop[i]); ++i){
+		axes += stop[i];
+	}
+	std::deque<QueuedCommand> remains;
+	for (size_t i=0; i<commands.size(); ++i){
+		const string& command = commands[i].command;
+		bool isMove = false;
+		size_t start = 0;
+		while (start < command.size() && !isMove){
+			size_t end = command.find(';', start);
+			if (end == string::npos){
+				end = command.size();
+			}
+			string op = command.substr(start, 2);
+			if (op == "IP" || op == "PR" || op == "PA" || op == "BG" || op == "JG"){
+				char axis = (start+2 < end) ? command[start+2] : ' ';
+				isMove = axes.empty() || !isalpha((unsigned char)axis) || axes.find(axis) != string::npos;
+			}
+			start = end+1;
+		}
+		if (isMove){
+			moves.push_back(commands[i]);
+		} else{
+			remains.push_back(commands[i]);
+		}
+	}
+	commands.swap(remains);
+}
+
+void StageCommandQueue::run()
+{
+	while (!isStopQueue){
+		queueMutex.lock();
+		if (commands.empty()){
+			commandReady.wait(&queueMutex, 100);
+		}
+		if (commands.empty()){
+			queueMutex.unlock();
+			continue;
+		}
+		QueuedCommand entry = commands.front();
+		commands.pop_front();
+
+		//the caller gave up on it
+		entry.state->mutex.lock();
+		bool cancelled = entry.state->isCancelled;
+		entry.state->mutex.unlock();
+		if (cancelled){
+			queueMutex.unlock();
+			Finish(entry, "", OBJECT_NAME + ": cancelled after timeout, " + entry.command);
+			continue;
+		}
+
+		//identical queries following the front are answered by the same round trip,
+		//a query queued after any other command must see its effect
+		vector<QueuedCommand> shared;
+		if (!entry.isWrite && entry.command.compare(0, 3, "MG ") == 0){
+			while (!commands.empty() && !commands.front().isWrite && commands.front().command == entry.command){
+				shared.push_back(commands.front());
+				commands.pop_front();
+			}
+		}
+		queueMutex.unlock();
+
+		long long sentTime = Get_HostTime();
+		string response, error;
+		try{
+			if (entry.isWrite){
+				controller->write(entry.command);
+			} else{
+				response = controller->command(entry.command, entry.terminator, entry.ack, entry.trim);
+			}
+		} catch (string e){
+			error = e;
+		}
+		long long answeredTime = Get_HostTime();
+		double roundTrip = (answeredTime-sentTime)/1.0e3;
+
+		queueMutex.lock();
+		++statistics.commands;
+		statistics.sharedQueries += (unsigned long)shared.size();
+		totalRoundTrip += roundTrip;
+		statistics.averageRoundTrip = totalRoundTrip/statistics.commands;
+		queueMutex.unlock();
+
+		Finish(entry, response, error, sentTime, answeredTime);
+		for (size_t i=0; i<shared.size(); ++i){
+			Finish(shared[i], response, error, sentTime, answeredTime);
+		}
+	}
+}
+
+//slots connected to CommandFinishedSignal must be queued, they are emitted in the queue thread
+void StageCommandQueue::Finish(const QueuedCommand& entry, const string& response, const string& error,
+							   long long sent_time, long long answered_time)
+{
+	entry.state->mutex.lock();
+	entry.state->response = response;
+	entry.state->error = error;
+	entry.state->sentTime = sent_time;
+	entry.state->answeredTime = answered_time;
+	entry.state->isFinished = true;
+	entry.state->finished.wakeAll();
+	entry.state->mutex.unlock();
+
+	if (entry.id != 0){
+		emit CommandFinishedSignal(entry.id, QString::fromStdString(response), QString::fromStdString(error));
+	}
+}
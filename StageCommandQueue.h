@@ -0,0 +1,119 @@
+/****************************************************************************
+	StageCommandQueue: single thread which owns the round trips to a stage
+	controller. Commands of any thread are queued and answered through
+	futures or signals; identical consecutive queries share one round trip
+	and a stop jumps the queue, failing the moves of its axes still queued.
+	A command whose caller timed out is not sent. The queue is itself a
+	StageController, so the stages run on it unchanged and never interleave
+	their commands.
+****************************************************************************/
+
+#ifndef _STAGE_COMMAND_QUEUE_H_
+#define _STAGE_COMMAND_QUEUE_H_
+
+#include "StageController.h"
+#include "Stage_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <deque>
+#include <vector>
+
+struct CommandState{
+	QMutex mutex;
+	QWaitCondition finished;
+	bool isFinished;
+	bool isCancelled;        //the caller timed out, the command is not sent any more
+	string command;
+	string response;
+	string error;
+	long long sentTime;      //host time (us) of the round trip to the controller
+	long long answeredTime;
+};
+
+class CommandFuture
+{
+public:
+	bool IsValid() const { return !state.isNull(); }
+	bool IsFinished() const;
+	bool Wait(unsigned long time_ms = STAGE_QUEUE::COMMAND_TIMEOUT) const;
+	string Get_Response() const;   //waits for the command and throws the error string of the controller, cancels it on timeout
+	double Get_Value() const;
+	vector<double> Get_Values() const; //values of a batched MG query
+	void Get_RoundTrip(long long& sent_time, long long& answered_time) const; //waits for the command
+
+private:
+	friend class StageCommandQueue;
+	QSharedPointer<CommandState> state;
+};
+
+struct QueuedCommand{
+	string command;
+	string terminator;
+	string ack;
+	bool trim;
+	bool isWrite;
+	unsigned long id;  //0 for commands answered through futures only
+	QSharedPointer<CommandState> state;
+};
+
+struct QueueStatistics{
+	unsigned long commands;       //round trips to the controller
+	unsigned long sharedQueries;  //queries answered by the round trip of an identical one
+	unsigned long maxQueueLength;
+	double averageRoundTrip;      //ms
+};
+
+class StageCommandQueue : public QThread, public StageController
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit StageCommandQueue(StageController* controller, QObject* parent = 0);
+	~StageCommandQueue();
+
+	void StartThread();
+	void StopThread();
+
+	CommandFuture Submit(const string& command);
+	CommandFuture SubmitWrite(const string& bytes);
+	//answered by CommandFinishedSignal, the returned id identifies the answer
+	unsigned long Post(const string& command);
+	//positions of several axes in one round trip, e.g. axes = "YX"
+	CommandFuture QueryPositions(const string& axes);
+	QueueStatistics Get_Statistics();
+
+	//StageController, blocking the calling thread only
+	string command(const string& command, const string& terminator = "\r", const string& ack = ":", bool trim = true);
+	double commandValue(const string& command);
+	void write(const string& bytes);
+
+signals:
+	void CommandFinishedSignal(unsigned long, QString, QString); //id, response and error
+
+protected:
+	virtual void run();
+	CommandFuture Enqueue(const string& command, const string& terminator, const string& ack, bool trim,
+						  bool is_write, unsigned long id);
+	void Finish(const QueuedCommand& entry, const string& response, const string& error,
+				long long sent_time = 0, long long answered_time = 0);
+	//moves queued for the axes of a stop command, taken out of the queue, called with queueMutex locked
+	void TakeMoves(const string& stop, std::deque<QueuedCommand>& moves);
+
+private:
+	StageController* controller;
+	volatile bool isStopQueue;
+
+	QMutex queueMutex;
+	QWaitCondition commandReady;
+	std::deque<QueuedCommand> commands;
+	unsigned long nextId;
+
+	QueueStatistics statistics;
+	double totalRoundTrip;
+};
+
+#endif
@@ -0,0 +1,30 @@
+
+#include "StageController.h"
+#include "Galil.h"
+
+GalilController::GalilController(const string& address, int timeout_ms)
+{
+	galil = new Galil(address);
+	galil->timeout_ms = timeout_ms;
+}
+
+GalilController::~GalilController()
+{
+	delete galil;
+	galil = NULL;
+}
+
+string GalilController::command(const string& command, const string& terminator, const string& ack, bool trim)
+{
+	return galil->command(command, terminator, ack, trim);
+}
+
+double GalilController::commandValue(const string& command)
+{
+	return galil->commandValue(command);
+}
+
+void GalilController::write(const string& bytes)
+{
+	galil->write(bytes);
+}
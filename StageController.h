@@ -0,0 +1,39 @@
+/****************************************************************************
+	StageController: motion controller with the call surface of Galil, so
+	that the stages run unchanged on the Galil controller, on the command
+	queue in front of it or on the simulator
+****************************************************************************/
+
+#ifndef _STAGE_CONTROLLER_H_
+#define _STAGE_CONTROLLER_H_
+
+#include "Util.h"
+
+class Galil;
+
+class StageController
+{
+public:
+	virtual ~StageController(){}
+
+	//errors are thrown as string like Galil does
+	virtual string command(const string& command, const string& terminator = "\r", const string& ack = ":", bool trim = true) = 0;
+	virtual double commandValue(const string& command) = 0;
+	virtual void write(const string& bytes) = 0;
+};
+
+class GalilController : public StageController
+{
+public:
+	explicit GalilController(const string& address, int timeout_ms);
+	~GalilController();
+
+	string command(const string& command, const string& terminator = "\r", const string& ack = ":", bool trim = true);
+	double commandValue(const string& command);
+	void write(const string& bytes);
+
+private:
+	Galil* galil;
+};
+
+#endif
@@ -0,0 +1,168 @@
+
+#include "StagePositionSampler.h"
+
+string StagePositionSampler::OBJECT_NAME = "StagePositionSampler";
+
+StagePositionSampler::StagePositionSampler(StageCommandQueue* queue, char axis, QObject* parent)
+	: QThread(parent), queue(queue), axis(axis)
+{
+	isStopSampling = true;
+	sampleCount = 0;
+	lastRead = -1;
+	isIdle = false;
+}
+
+StagePositionSampler::~StagePositionSampler()
+{
+	StopSampling();
+	queue = NULL;
+}
+
+void StagePositionSampler::StartSampling()
+{
+	if (isRunning()){
+		return;
+	}
+	isStopSampling = false;
+	start();
+}
+
+void StagePositionSampler::StopSampling()
+{
+	isStopSampling = true;
+	idleMutex.lock();
+	readCondition.wakeAll();
+	idleMutex.unlock();
+	wait();
+}
+
+/*
+	While the positions are read, the next query is submitted before the former one is
+	awaited, so the queue sends it as soon as the round trip in progress returns. When both
+	are still pending the queue answers them with one round trip, which is then appended
+	only once. Without readers a single query is sent every idle interval, which keeps the
+	latest sample fresh for the status poll.
+*/
+void StagePositionSampler::run()
+{
+	string command = "MG _TP" + string(1, axis);
+	CommandFuture pending = queue->Submit(command);
+	long long lastAnswered = -1;
+	while (!isStopSampling){
+		bool isRead = IsRead();
+		CommandFuture next;
+		if (isRead){
+			next = queue->Submit(command);
+		}
+		try{
+			PositionSample sample;
+			long long sent, answered;
+			sample.position = pending.Get_Value();
+			pending.Get_RoundTrip(sent, answered);
+			sample.time = (sent+answered)/2;
+			if (answered != lastAnswered){
+				Append(sample);
+				lastAnswered = answered;
+			}
+		} catch (string e){
+			cout<<GetErrorString(OBJECT_NAME, "run()", e);
+			msleep(POSITION_SAMPLER::ERROR_WAITING);
+		}
+		if (isRead){
+			if (POSITION_SAMPLER::SAMPLE_INTERVAL > 0){
+				msleep(POSITION_SAMPLER::SAMPLE_INTERVAL);
+			}
+		} else{
+			idleMutex.lock();
+			isIdle = true;
+			if (!isStopSampling && !IsRead()){
+				readCondition.wait(&idleMutex, POSITION_SAMPLER::IDLE_INTERVAL);
+			}
+			isIdle = false;
+			idleMutex.unlock();
+			next = queue->Submit(command);
+		}
+		pending = next;
+	}
+	pending.Wait();
+}
+
+bool StagePositionSampler::IsRead()
+{
+	long long time = lastRead;
+	return (time >= 0) && (Get_HostTime()-time < POSITION_SAMPLER::READ_TIMEOUT);
+}
+
+void StagePositionSampler::Append(const PositionSample& sample)
+{
+	int count = sampleCount.loadAcquire();
+	samples[count & (POSITION_SAMPLER::HISTORY_SIZE-1)] = sample;
+	sampleCount.storeRelease(count+1);
+}
+
+bool StagePositionSampler::Get_LatestSample(PositionSample& sample)
+{
+	int count = sampleCount.loadAcquire();
+	if (count == 0){
+		return false;
+	}
+	sample = samples[(count-1) & (POSITION_SAMPLER::HISTORY_SIZE-1)];
+	return true;
+}
+
+bool StagePositionSampler::Get_Position(long long time, double& position)
+{
+	lastRead = Get_HostTime();
+	if (isIdle){
+		idleMutex.lock();
+		readCondition.wakeAll();
+		idleMutex.unlock();
+	}
+
+	const int mask = POSITION_SAMPLER::HISTORY_SIZE-1;
+	int count = sampleCount.loadAcquire();
+	int oldest = count - (POSITION_SAMPLER::HISTORY_SIZE-POSITION_SAMPLER::GUARD_SIZE);
+	if (oldest < 0){
+		oldest = 0;
+	}
+	if (count == 0){
+		return false;
+	}
+
+	//newest sample taken at or before time
+	int index = count-1;
+	PositionSample after = samples[index & mask];
+	PositionSample before = after;
+	while (index >= oldest){
+		before = samples[index & mask];
+		if (before.time <= time){
+			break;
+		}
+		after = before;
+		--index;
+	}
+	if (index < oldest){
+		return false;
+	}
+
+	if (index == count-1){
+		//later than the newest sample: extrapolate along the last two samples
+		if (time-before.time > POSITION_SAMPLER::MAX_EXTRAPOLATION){
+			return false;
+		}
+		if (index-1 < oldest){
+			position = before.position;
+		} else{
+			PositionSample former = samples[(index-1) & mask];
+			position = (before.time == former.time) ? before.position :
+				before.position + (before.position-former.position)*(time-before.time)/double(before.time-former.time);
+		}
+	} else if (after.time == before.time){
+		position = before.position;
+	} else{
+		position = before.position + (after.position-before.position)*(time-before.time)/double(after.time-before.time);
+	}
+
+	//the samples read may have been overwritten when the writer lapped the guard
+	return (sampleCount.loadAcquire()-oldest < POSITION_SAMPLER::HISTORY_SIZE);
+}
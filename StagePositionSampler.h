@@ -0,0 +1,63 @@
+/****************************************************************************
+	StagePositionSampler: samples the encoder of one axis as fast as the
+	command queue answers while the positions are read, keeping one query
+	pipelined behind the round trip in progress, and slowly otherwise so
+	that the other stage commands are not delayed. The samples are stamped
+	with the host time of their round trip and kept in a ring which one
+	writer fills and any thread reads without locking, so the acquisition
+	thread can interpolate the position at the exposure time of every frame.
+****************************************************************************/
+
+#ifndef _STAGE_POSITION_SAMPLER_H_
+#define _STAGE_POSITION_SAMPLER_H_
+
+#include "StageCommandQueue.h"
+#include "FrameProcessor.h"
+#include <QtCore/QThread>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+struct PositionSample{
+	long long time;   //host time (us) in the middle of the round trip
+	double position;  //encoder pulse
+};
+
+class StagePositionSampler : public QThread, public PositionSource
+{
+public:
+	static string OBJECT_NAME;
+
+	StagePositionSampler(StageCommandQueue* queue, char axis, QObject* parent = 0);
+	~StagePositionSampler();
+
+	void StartSampling();
+	void StopSampling();
+
+	//linear interpolation between the samples around time, extrapolation shortly after the newest one
+	bool Get_Position(long long time, double& position);
+	bool Get_LatestSample(PositionSample& sample);
+	unsigned long Get_SampleCount(){ return (unsigned long)sampleCount.loadAcquire(); }
+
+protected:
+	virtual void run();
+	void Append(const PositionSample& sample);
+	bool IsRead(); //whether the positions were read lately
+
+private:
+	StageCommandQueue* queue;
+	char axis;
+	volatile bool isStopSampling;
+
+	//host time (us) of the latest Get_Position, an idle sampler is woken by the next one
+	volatile long long lastRead;
+	volatile bool isIdle;
+	QMutex idleMutex;
+	QWaitCondition readCondition;
+
+	//single writer ring, a sample is published by the release store of the count
+	PositionSample samples[POSITION_SAMPLER::HISTORY_SIZE];
+	QAtomicInt sampleCount;
+};
+
+#endif
@@ -12,6 +12,8 @@ namespace Z1_STAGE{
 	const double Z1_PRECISION = 0.05;                    //光栅尺精度：0.05um/pulse
 	const double Z1_VERTICAL_TO_HORIZONTAL = 0.57; //Z1轴竖直与水平之间的比例
 	const long Z1_TOL = 3;
+	const long MOTION_MARGIN = 5;                        //polling starts before the predicted end of a motion, ms
+	const long MOTION_TIMEOUT = 3000;                    //extra time allowed over the predicted motion time, ms
 	
 	const long Z1_UPLIMIT = 158000;                          //Z1轴上限位, pulse
 	const long Z1_INITIAL_REF_POSITION = 140000;  //Z1轴成像参考位置, pulse
@@ -24,6 +26,87 @@ namespace Z1_STAGE{
 	const int Z1_FINEFOCUS_STEP = 1;                     //精对焦步长, um
 }
 
+namespace HOMING{
+	const long FAST_SPEED = 20000;                    //jog toward the reverse limit, motor pulse/s
+	const long SLOW_SPEED = 1000;                     //final approach of the limit, motor pulse/s
+	const long BACKOFF = 1000;                        //distance out of the limit before the approach, beyond the stopping distance of the fast jog, motor pulse
+	const long POLL_INTERVAL = 5;                     //polling of the jog state, ms
+	const long TIMEOUT = 30000;                       //max time of one homing phase, ms
+}
+
+namespace AUTOFOCUS{
+	const long SWEEP_SPEED = 20000;                   //Z1 speed during focus sweep, pulse/s
+	const long MOTION_WAITING = 1;                    //polling interval of motion state, ms
+	const long MOTION_TIMEOUT = 2000;                 //max time for one focus step, ms
+	const long FRAME_TIMEOUT = 1000;                  //max time waiting for a settled frame, ms
+	const int SETTLE_FRAMES = 2;                      //frames skipped after motion completion
+	const int MAX_COARSE_RETRY = 2;                   //recentering times when the peak is at the sweep edge
+	const int DEFAULT_REGION_SIZE = 256;              //focus region used when none is selected, pixel
+}
+
+namespace FOCUS_LOCK{
+	const int SAMPLE_INTERVAL = 5;                    //frames between two focus samples
+	const int AVERAGE_SAMPLES = 3;                    //samples averaged for one decision
+	const double MAX_STEP = 0.5;                      //correction step, um
+	const double MIN_STEP = 0.1;                      //step after reversals, um
+	const double MAX_RATE = 2.0;                      //max correction rate, um/s
+	const double MAX_EXCURSION = 20.0;                //max distance from the locked position, um
+	const double DEADBAND = 0.01;                     //relative metric change regarded as noise
+}
+
+namespace STAGE_SIMULATION{
+	const long COMMAND_LATENCY = 1;                   //round trip of one command, ms
+	const double DEFAULT_SPEED = 25000;               //pulse/s
+	const double DEFAULT_ACC = 256000;                //pulse/s^2
+	const double DEFAULT_DEC = 256000;                //pulse/s^2
+	const double REVERSE_LIMIT = 0;                   //reverse limit switch position, pulse
+	const double FORWARD_LIMIT = 200000;              //forward limit switch position, pulse
+	const double INITIAL_POSITION = 50000;            //pulse
+	const double RINGING_AMPLITUDE = 8;               //encoder ringing after a profile completes, pulse
+	const double RINGING_DECAY = 3;                   //ms
+	const double RINGING_FREQUENCY = 150;             //Hz
+	const double LIMIT_DELAY = 1.0;                   //max delay detecting a limit switch, ms
+}
+
+namespace STAGE_QUEUE{
+	const unsigned long COMMAND_TIMEOUT = 5000;       //max time waiting for a queued command, ms
+}
+
+namespace CLOSELOOP{
+	const int MAX_CORRECTIONS = 10;                   //corrections of a realtime closed loop motion before it fails
+}
+
+namespace POSITION_SAMPLER{
+	const int HISTORY_SIZE = 4096;                    //samples kept in the ring, power of 2
+	const int GUARD_SIZE = 64;                        //oldest samples not read as the writer may overwrite them
+	const long SAMPLE_INTERVAL = 1;                   //pause between two queries while the positions are read, ms
+	const long IDLE_INTERVAL = 200;                   //pause between two queries while no position is read, ms
+	const long long READ_TIMEOUT = 500000;            //the sampling slows down when no position was read for this time, us
+	const long long MAX_EXTRAPOLATION = 5000;         //extrapolation beyond the newest sample, us
+	const long ERROR_WAITING = 100;                   //pause after a failed query, ms
+}
+
+namespace COORDINATED_MOTION{
+	const double MIN_ACC = 1024;                      //resolution of the AC and DC of the controller, pulse/s^2
+	const long MOTION_TIMEOUT = 3000;                 //extra time allowed over the predicted motion time, ms
+}
+
+namespace ZSTACK{
+	const int MAX_PLANES = 1000;
+	const double MAX_STACK_SIZE = 2048;               //memory of the stack held until it is saved, MB
+	const long FRAME_TIMEOUT = 1000;                  //max wait of a plane's frame beyond its exposure, ms
+	const long TRIGGER_MARGIN = 1;                    //delay of the exposure after the trigger edge allowed to the camera, ms
+}
+
+namespace VOLUME_IMAGING{
+	const int RING_SIZE = 4;                          //volumes buffered for the volume processors
+	const double FRAMES_PER_PLANE = 1.0;              //frames exposed while the sweep crosses one plane step
+	const double SWEEP_MARGIN = 2.0;                  //sweep beyond the outer planes so they are crossed at speed, um
+	const double MIN_MOTION = 0.2;                    //motion between two frames regarded as still, in plane steps
+	const int PERIOD_FRAMES = 5;                      //frames measuring the frame period before the sweep starts
+	const long PERIOD_TIMEOUT = 2000;                 //max wait for the frame period, ms
+}
+
 namespace Z3_STAGE{
 	const long STAGE_WAITING = 5;                        //等待时间 ms
 
@@ -31,6 +114,8 @@ namespace Z3_STAGE{
 	const long Z3_SPEED = 5000;
 	const double Z3_PRECISION = 0.05;                   //光栅尺精度：0.05um/pulse
 	const long Z3_TOL = 3;
+	const long MOTION_MARGIN = 5;                       //polling starts before the predicted end of a motion, ms
+	const long MOTION_TIMEOUT = 3000;                   //extra time allowed over the predicted motion time, ms
 
 	// Focus Parameters
 	const int Z3_COARSEFOCUS_TIMES = 15;           //粗对焦步数
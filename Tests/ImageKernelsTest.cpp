@@ -0,0 +1,289 @@
+/*****************************************************************
+ImageKernelsTest : compares the SIMD kernels of ImageKernels with scalar references
+	on random images, returns the number of failed checks.
+	cl /O2 /EHsc /arch:AVX2 /I.. ImageKernelsTest.cpp ..\ImageKernels.cpp
+	without /arch:AVX2 only the SSSE3 path of UnpackMono12 is checked
+******************************************************************/
+#include "ImageKernels.h"
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <cmath>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* name, const char* detail)
+{
+	cout<<(ok ? "[PASS] " : "[FAIL] ")<<name<<" "<<detail<<endl;
+	if (!ok){
+		failures++;
+	}
+}
+
+static void RandomImage(vector<ushort>& image, ushort max_value)
+{
+	for (size_t i=0; i<image.size(); ++i){
+		image[i] = (ushort)(((rand()<<15) ^ rand()) % (max_value+1));
+	}
+}
+
+static void Downsample2x2_Reference(const ushort* src, int src_stride, int width, int height, ushort* dst)
+{
+	for (int y=0; y<height/2; ++y){
+		const ushort* r0 = src + (size_t)2*y*src_stride;
+		const ushort* r1 = r0 + src_stride;
+		for (int x=0; x<width/2; ++x){
+			dst[(size_t)y*(width/2)+x] = (ushort)((r0[2*x] + r0[2*x+1] + r1[2*x] + r1[2*x+1] + 2)/4);
+		}
+	}
+}
+
+static void TestDownsample2x2()
+{
+	const int sizes[][3] = { {64, 64, 64}, {38, 10, 41}, {514, 32, 520}, {7, 5, 7} }; //width, height, stride
+	char detail[64];
+	for (int k=0; k<4; ++k){
+		int width = sizes[k][0], height = sizes[k][1], stride = sizes[k][2];
+		//the full range and the saturated corner, where the 16 bits averages overflowed
+		for (int full=0; full<2; ++full){
+			vector<ushort> src((size_t)stride*height);
+			RandomImage(src, full ? 65535 : 4095);
+			if (full){
+				for (size_t i=0; i<src.size(); i+=7){ src[i] = 65535; }
+			}
+			vector<ushort> expected((size_t)(width/2)*(height/2)+1), result(expected.size());
+			Downsample2x2_Reference(&src[0], stride, width, height, &expected[0]);
+			Downsample2x2_SSE2(&src[0], stride, width, height, &result[0]);
+			sprintf(detail, "%dx%d stride %d max %d", width, height, stride, full ? 65535 : 4095);
+			Check(expected == result, "Downsample2x2_SSE2", detail);
+
+			//in place, as BinImage_SSE2 and the object tracking do
+			if (stride == width){
+				Downsample2x2_SSE2(&src[0], stride, width, height, &src[0]);
+				Check(equal(expected.begin(), expected.end()-1, src.begin()), "Downsample2x2_SSE2 in place", detail);
+			}
+		}
+	}
+}
+
+//counts ending inside a vector of every kernel, so the tails are checked as well
+static const int COUNTS[] = { 1024, 1037, 45, 15, 7, 1 };
+static const int COUNT_NUMBER = 6;
+
+static void TestThresholdImage()
+{
+	char detail[64];
+	for (int k=0; k<COUNT_NUMBER; ++k){
+		int count = COUNTS[k];
+		vector<ushort> src(count);
+		RandomImage(src, 4095);
+		//the threshold itself and its neighbours
+		ushort threshold = 2000;
+		for (int i=0; i<count; i+=5){ src[i] = (ushort)(threshold - 1 + i%3); }
+		vector<uchar> expected(count+1, 0xAB), result(count+1, 0xAB);
+		for (int i=0; i<count; ++i){
+			expected[i] = (src[i] > threshold) ? 255 : 0;
+		}
+		ThresholdImage_SSE2(&src[0], &result[0], count, threshold);
+		sprintf(detail, "count %d", count);
+		Check(expected == result, "ThresholdImage_SSE2", detail);
+	}
+}
+
+static void TestMaxPixel()
+{
+	char detail[64];
+	for (int k=0; k<COUNT_NUMBER; ++k){
+		int count = COUNTS[k];
+		vector<ushort> src(count);
+		RandomImage(src, 4095);
+		//above the signed range in the vector part, then in the tail
+		for (int place=0; place<2; ++place){
+			int i = place ? count-1 : count/2;
+			ushort saved = src[i];
+			src[i] = 40000;
+			ushort expected = *max_element(src.begin(), src.end());
+			sprintf(detail, "count %d max at %d", count, i);
+			Check(MaxPixel_SSE2(&src[0], count) == expected, "MaxPixel_SSE2", detail);
+			src[i] = saved;
+		}
+	}
+}
+
+static void TestRegionSum()
+{
+	const int width = 300, height = 40;
+	const int regions[][4] = { {0, 0, 300, 40}, {3, 5, 37, 9}, {17, 1, 7, 3}, {299, 39, 1, 1} }; //x, y, width, height
+	vector<ushort> image((size_t)width*height);
+	RandomImage(image, 65535);
+	char detail[64];
+	for (int k=0; k<4; ++k){
+		ImageRegion region;
+		region.x_offset = regions[k][0];
+		region.y_offset = regions[k][1];
+		region.width = regions[k][2];
+		region.height = regions[k][3];
+		ushort background = 1000;
+		double expected = 0;
+		for (int y=region.y_offset; y<region.y_offset+region.height; ++y){
+			for (int x=region.x_offset; x<region.x_offset+region.width; ++x){
+				ushort v = image[(size_t)y*width+x];
+				expected += v > background ? v-background : 0;
+			}
+		}
+		sprintf(detail, "%dx%d at %d,%d", region.width, region.height, region.x_offset, region.y_offset);
+		Check(RegionSum_SSE2(&image[0], width, region, background) == expected, "RegionSum_SSE2", detail);
+	}
+}
+
+static void TestRatioImage()
+{
+	char detail[64];
+	for (int k=0; k<COUNT_NUMBER; ++k){
+		int count = COUNTS[k];
+		vector<ushort> gcamp(count), rfp(count);
+		RandomImage(gcamp, 4095);
+		RandomImage(rfp, 400);
+		ushort gBackground = 100, rBackground = 100;
+		float minDenominator = 10.0f;
+		vector<float> expected(count), result(count);
+		for (int i=0; i<count; ++i){
+			float g = gcamp[i] > gBackground ? (float)(gcamp[i]-gBackground) : 0.0f;
+			float r = rfp[i] > rBackground ? (float)(rfp[i]-rBackground) : 0.0f;
+			expected[i] = r >= minDenominator ? g/r : 0.0f;
+		}
+		RatioImage_SSE2(&gcamp[0], &rfp[0], &result[0], count, gBackground, rBackground, minDenominator);
+		sprintf(detail, "count %d", count);
+		Check(expected == result, "RatioImage_SSE2", detail);
+	}
+}
+
+//the SSE conversions round to nearest even, the references too
+static void TestInterpolateImage()
+{
+	const float weights[] = { 0.0f, 0.5f, 0.25f, 0.3f, 1.0f };
+	char detail[64];
+	for (int k=0; k<COUNT_NUMBER; ++k){
+		int count = COUNTS[k];
+		vector<ushort> first(count), second(count);
+		RandomImage(first, 65535);
+		RandomImage(second, 65535);
+		for (int w=0; w<5; ++w){
+			vector<ushort> expected(count+1, 0xABCD), result(count+1, 0xABCD);
+			for (int i=0; i<count; ++i){
+				float a = (float)first[i], b = (float)second[i];
+				expected[i] = (ushort)nearbyintf(a + (b-a)*weights[w]);
+			}
+			InterpolateImage_SSE2(&first[0], &second[0], &result[0], count, weights[w]);
+			sprintf(detail, "count %d weight %.2f", count, weights[w]);
+			Check(expected == result, "InterpolateImage_SSE2", detail);
+		}
+	}
+}
+
+static void TestFloatToUChar()
+{
+	char detail[64];
+	for (int k=0; k<COUNT_NUMBER; ++k){
+		int count = COUNTS[k];
+		//halves, negative values and values far above the 8 bits range
+		vector<float> src(count);
+		for (int i=0; i<count; ++i){
+			src[i] = (i%4 == 0) ? (float)(rand()%600 - 50)*0.5f : (float)rand()/RAND_MAX*300.0f - 20.0f;
+		}
+		src[count-1] = 1.0e10f;
+		for (int s=0; s<2; ++s){
+			float scale = s ? 0.7f : 1.0f;
+			vector<uchar> expected(count+1, 0xAB), result(count+1, 0xAB);
+			for (int i=0; i<count; ++i){
+				float value = nearbyintf(src[i]*scale);
+				expected[i] = (uchar)(value < 0.0f ? 0.0f : (value > 255.0f ? 255.0f : value));
+			}
+			FloatToUChar_SSE2(&src[0], &result[0], count, scale);
+			sprintf(detail, "count %d scale %.1f", count, scale);
+			Check(expected == result, "FloatToUChar_SSE2", detail);
+		}
+	}
+}
+
+static void UnpackMono12_Reference(const uchar* src, int src_stride, int width, int height, ushort* dst)
+{
+	for (int y=0; y<height; ++y){
+		for (int x=0; x+2<=width; x+=2){
+			const uchar* p = src + (size_t)y*src_stride + x/2*3;
+			dst[(size_t)y*width+x] = (ushort)((p[0]<<4) | (p[1] & 0x0F));
+			dst[(size_t)y*width+x+1] = (ushort)((p[2]<<4) | (p[1]>>4));
+		}
+	}
+}
+
+typedef void (*UnpackFunction)(const uchar*, int, int, int, ushort*);
+
+static void TestUnpackMono12(UnpackFunction unpack, const char* name)
+{
+	//odd strides, rows shorter than one vector and rows ending inside a vector
+	const int sizes[][3] = { {2048, 16, 3072}, {2046, 7, 3073}, {34, 9, 55}, {16, 4, 25}, {10, 3, 17}, {2, 5, 3} }; //width, height, stride in bytes
+	char detail[64];
+	for (int k=0; k<6; ++k){
+		int width = sizes[k][0], height = sizes[k][1], stride = sizes[k][2];
+		vector<uchar> src((size_t)stride*height);
+		for (size_t i=0; i<src.size(); ++i){
+			src[i] = (uchar)rand();
+		}
+		//a guard pixel behind the image catches a write past its end
+		vector<ushort> expected((size_t)width*height+1, 0xABCD), result(expected.size(), 0xABCD);
+		UnpackMono12_Reference(&src[0], stride, width, height, &expected[0]);
+		unpack(&src[0], stride, width, height, &result[0]);
+		sprintf(detail, "%dx%d stride %d", width, height, stride);
+		Check(expected == result, name, detail);
+	}
+}
+
+//ms per full frame of the camera
+static double UnpackTime(UnpackFunction unpack, const vector<uchar>& src, vector<ushort>& dst, int width, int height, int repeats)
+{
+	clock_t start = clock();
+	for (int i=0; i<repeats; ++i){
+		unpack(&src[0], width/2*3, width, height, &dst[0]);
+	}
+	return (double)(clock()-start)*1000.0/CLOCKS_PER_SEC/repeats;
+}
+
+static void TestUnpackMono12Throughput()
+{
+	const int width = HAMAMATSU_PARAMS::FULLIMAGE_WIDTH, height = HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT, repeats = 50;
+	vector<uchar> src((size_t)width/2*3*height);
+	for (size_t i=0; i<src.size(); ++i){
+		src[i] = (uchar)rand();
+	}
+	vector<ushort> dst((size_t)width*height);
+	double scalar = UnpackTime(UnpackMono12_Reference, src, dst, width, height, repeats);
+	double ssse3 = UnpackTime(UnpackMono12_SSSE3, src, dst, width, height, repeats);
+	char detail[96];
+	sprintf(detail, "%dx%d: scalar %.2f ms, SSSE3 %.2f ms", width, height, scalar, ssse3);
+	Check(ssse3 < scalar, "UnpackMono12_SSSE3 throughput", detail);
+#ifdef __AVX2__
+	double avx2 = UnpackTime(UnpackMono12_AVX2, src, dst, width, height, repeats);
+	sprintf(detail, "%dx%d: scalar %.2f ms, AVX2 %.2f ms", width, height, scalar, avx2);
+	Check(avx2 < scalar, "UnpackMono12_AVX2 throughput", detail);
+#endif
+}
+
+int main()
+{
+	srand(12345);
+	TestDownsample2x2();
+	TestThresholdImage();
+	TestMaxPixel();
+	TestRegionSum();
+	TestRatioImage();
+	TestInterpolateImage();
+	TestFloatToUChar();
+	TestUnpackMono12(UnpackMono12_SSSE3, "UnpackMono12_SSSE3");
+#ifdef __AVX2__
+	TestUnpackMono12(UnpackMono12_AVX2, "UnpackMono12_AVX2");
+#endif
+	TestUnpackMono12Throughput();
+	cout<<failures<<" failed"<<endl;
+	return failures;
+}
@@ -1,5 +1,7 @@
 
 #include "Util.h"
+#include <QtCore/QElapsedTimer>
+#include <cmath>
 
 void ConvertImagingChannelSeqToArray(ImagingChannelsSeq seq, char array[], int & len){
 	// array length is 9
@@ -33,17 +35,55 @@ void ConvertImagingChannelSeqToArray(ImagingChannelsSeq seq, char array[], int &
 	}
 }
 
+double Get_ProfileTime(double speed, double acc, double dec, double distance)
+{
+	distance = fabs(distance);
+	if (speed <= 0 || distance == 0){
+		return 0;
+	}
+	if (acc <= 0 || dec <= 0){
+		return Get_MotionTime(speed, distance);
+	}
+	double peak = speed;
+	double rampDistance = peak*peak/(2*acc) + peak*peak/(2*dec);
+	if (rampDistance > distance){
+		peak = sqrt(2*distance*acc*dec/(acc+dec));
+		rampDistance = distance;
+	}
+	return 1.0e3*(peak/acc + peak/dec + (distance-rampDistance)/peak);
+}
+
+static QElapsedTimer StartClock()
+{
+	QElapsedTimer clock;
+	clock.start();
+	return clock;
+}
+
+//the clock starts at the first call, its initialization is thread safe
+long long Get_HostTime()
+{
+	static const QElapsedTimer clock = StartClock();
+	return clock.nsecsElapsed()/1000;
+}
+
+char Get_ImagingChannel(ImagingChannelsSeq seq, int offset, unsigned long image_num)
+{
+	char channelArray[IMAGING_CHANNEL_LEN];
+	int channel_len = 0;
+	ConvertImagingChannelSeqToArray(seq, channelArray, channel_len);
+	if (seq == SINGLE){
+		return channelArray[0];
+	}
+	return channelArray[(image_num+offset)%channel_len];
+}
+
 void CopyData(DATATYPE type, uchar* data, uchar* dst, int width, int height)
 {
 	int LoopHeight = height>>4;
 	int NewTotalHeight = LoopHeight<<4;
 
-	size_t rowBytes;
-	if (type == USHORT_TYPE){
-		rowBytes = sizeof(ushort)*width;
-	} else{
-		rowBytes = width;
-	}
+	size_t rowBytes = Get_ImageBytes(type, width, 1);
 	for(int i=0; i<LoopHeight; ++i){
 		int base = i<<4;
 		memcpy(dst+base*rowBytes, data+base*rowBytes, rowBytes);         //1st line
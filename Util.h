@@ -21,7 +21,7 @@ typedef unsigned short ushort;
 
 enum DeviceStatus{ OPENED, CONNECTED, DISCONNECTED }; //status for devices
 enum SerialStatus { SERIAL_OPENED, SERIAL_CLOSED};              //status for serial port
-enum DATATYPE{ UCHAR_TYPE, USHORT_TYPE };                       //image pixel format
+enum DATATYPE{ UCHAR_TYPE, USHORT_TYPE, MONO12P_TYPE };         //image pixel format, MONO12P_TYPE packs 2 pixels in 3 bytes
 enum DisplayWindowFlag{ HAMAMATSU_WINDOW, ANDOR_WINDOW, IO_WINDOW};
 enum DisplayWindowOrientation{ NORMAL, FLIP_UP_DOWN, FLIP_LEFT_RIGHT, FLIP_BOTH, ROT_90, ROT_180, ROT_270 };
 enum PixelEncodingType{ Mono8, Mono10, Mono12, Mono12Packed, Mono16, InvalidType };
@@ -36,6 +36,7 @@ struct WindowInfo{
 	int image_height;
 	int image_stride;
 	unsigned long image_num;
+	char image_channel;   //channel of the displayed frame
 	void* image_data;
 	DATATYPE data_type;
 	int channelOffset;
@@ -46,12 +47,30 @@ struct WindowInfo{
 	DisplayWindowOrientation windowOrientation;
 };
 
+//information of one acquired frame handed to the frame processors
+struct FrameInfo{
+	unsigned long frame_index;
+	long long timestamp;
+	int image_width;
+	int image_height;
+	int row_bytes;
+	DATATYPE data_type;
+	char channel;       //GCAMP_CHANNEL, RFP_CHANNEL or 0xFF for single channel imaging
+	int channelOffset;  //channel offset in effect when the frame was acquired
+	long long exposure_time; //host time (us, Get_HostTime) at the middle of the exposure
+	bool has_position;
+	double z_position;  //z1 encoder position interpolated at exposure_time, pulse
+};
+
 struct ImageBuffer{
 	long long timestamp;
 	int image_width;
 	int image_height;
 	void* image_data;
 	DATATYPE data_type;
+	long long exposure_time; //us
+	bool has_position;
+	double z_position;  //pulse
 };
 
 struct ImageSize{
@@ -84,13 +103,25 @@ struct PositionStatus{
 inline double Get_MotionTime(double speed, double distance){
 	return (1.0e3*abs(distance)/speed); // ms
 }
+//duration of a trapezoidal velocity profile (triangular for short distances), ms
+double Get_ProfileTime(double speed, double acc, double dec, double distance);
+//monotonic host clock (us) shared by the camera and stage threads to join their samples
+long long Get_HostTime();
+
 inline string GetErrorString(const string object, const string source, const string description){
 	return (object + "::" + source + ": " + description + "\n");
 }
 inline double Square(double value){ 
 	return value*value; 
 }
+//bytes of a width x height image, the packed rows have an even width
+inline size_t Get_ImageBytes(DATATYPE type, int width, int height){
+	size_t rowBytes = (type == USHORT_TYPE) ? width*sizeof(ushort) : (type == MONO12P_TYPE) ? width/2*3 : width;
+	return rowBytes*height;
+}
 void ConvertImagingChannelSeqToArray(ImagingChannelsSeq seq, char array[], int & len);
+char Get_ImagingChannel(ImagingChannelsSeq seq, int offset, unsigned long image_num);
+
 void CopyData(DATATYPE type, uchar* data, uchar*dst, int width, int height);
 
 #endif //_UTIL_H_
\ No newline at end of file
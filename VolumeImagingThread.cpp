@@ -0,0 +1,505 @@
+
+#include "VolumeImagingThread.h"
+#include "ImageKernels.h"
+#include <QtCore/QElapsedTimer>
+#include <cmath>
+#include <string.h>
+#include <algorithm>
+
+string VolumeImagingThread::OBJECT_NAME = "VolumeImagingThread";
+
+/********************************** ZSweepThread **********************************/
+ZSweepThread::ZSweepThread(Stage* stage, QObject* parent) : QThread(parent), stage(stage)
+{
+	isStopSweep = true;
+	low = 0;
+	high = 0;
+	center = 0;
+	legs = 0;
+}
+
+ZSweepThread::~ZSweepThread()
+{
+	StopSweep();
+	stage = NULL;
+}
+
+void ZSweepThread::StartSweep(double sweep_low, double sweep_high, double sweep_center)
+{
+	if (isRunning()){
+		return;
+	}
+	low = sweep_low;
+	high = sweep_high;
+	center = sweep_center;
+	legs = 0;
+	isStopSweep = false;
+	start();
+}
+
+//the running leg is completed, so the stage is never stopped off its profile
+void ZSweepThread::StopSweep()
+{
+	isStopSweep = true;
+	wait();
+}
+
+/*
+	Every leg is sent once the former one completes, so the turnaround costs
+	one deceleration, one acceleration and one round trip
+*/
+void ZSweepThread::run()
+{
+	try{
+		double speed = stage->Get_Speed();
+		double acc = stage->Get_ACCSpeed();
+		double dec = stage->Get_DECSpeed();
+		double commanded = stage->Get_CurrentPosition();
+		bool upward = false;
+		while (!isStopSweep){
+			double target = upward ? high : low;
+			long motorStep = long((target-commanded)/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
+			double motionTime = Get_ProfileTime(speed, acc, dec, motorStep);
+			stage->Move_Openloop_Realtime(target-commanded);
+			commanded += motorStep*Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL;
+			if (!stage->WaitMotionComplete(motionTime, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT)){
+				cout<<GetErrorString(VolumeImagingThread::OBJECT_NAME, "ZSweepThread::run()", "Sweep motion timeout");
+				break;
+			}
+			++legs;
+			upward = !upward;
+		}
+		stage->Move_Closeloop_Unrealtime(center-stage->Get_CurrentPosition());
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+}
+
+/********************************** VolumeImagingThread **********************************/
+VolumeImagingThread::VolumeImagingThread(Stage* stage, QObject* parent)
+	: QThread(parent), stage(stage), sweepThread(stage)
+{
+	isStopVolumes = true;
+	planes = 0;
+	step = 0;
+	firstPlane = 0;
+	originalSpeed = 0;
+	fillingSlot = -1;
+	isSweeping = false;
+	direction = 0;
+	sweepDone = false;
+	volumeCount = 0;
+	imageWidth = 0;
+	imageHeight = 0;
+	hasLastFrame = false;
+	lastPosition = 0;
+	lastTime = 0;
+	lastFrameTime = 0;
+	periodFrames = 0;
+	framePeriod = 0;
+	isRecording = false;
+	lastVolumeTime = 0;
+	statistics.volumes = 0;
+	statistics.droppedVolumes = 0;
+	statistics.partialVolumes = 0;
+	statistics.unplacedFrames = 0;
+	statistics.framePeriod = 0;
+	statistics.volumeRate = 0;
+}
+
+VolumeImagingThread::~VolumeImagingThread()
+{
+	StopVolumes();
+	StopRecording();
+	stage = NULL;
+}
+
+bool VolumeImagingThread::StartVolumes(int volume_planes, double volume_step)
+{
+	if (isRunning() || stage == NULL){
+		return false;
+	}
+	if (volume_planes < 2 || volume_planes > ZSTACK::MAX_PLANES || volume_step <= 0){
+		cout<<GetErrorString(OBJECT_NAME, "StartVolumes()", "Invalid volume");
+		return false;
+	}
+	double center = 0;
+	try{
+		center = stage->Get_CurrentPosition();
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+		return false;
+	}
+
+	QMutexLocker locker(&ringMutex);
+	planes = volume_planes;
+	step = volume_step/Z1_STAGE::Z1_PRECISION;
+	firstPlane = center - step*(planes-1)/2;
+	freeSlots.clear();
+	for (int i=0; i<VOLUME_IMAGING::RING_SIZE; ++i){
+		freeSlots.push_back(i);
+	}
+	readySlots.clear();
+	fillingSlot = -1;
+	isSweeping = false;
+	direction = 0;
+	sweepDone = false;
+	volumeCount = 0;
+	hasLastFrame = false;
+	periodFrames = 0;
+	framePeriod = 0;
+	lastVolumeTime = 0;
+	statistics.volumes = 0;
+	statistics.droppedVolumes = 0;
+	statistics.partialVolumes = 0;
+	statistics.unplacedFrames = 0;
+	statistics.framePeriod = 0;
+	statistics.volumeRate = 0;
+	statistics.planeJitter.assign(planes, 0.0);
+	jitterSquares.assign(planes, 0.0);
+	isStopVolumes = false;
+	start();
+	return true;
+}
+
+void VolumeImagingThread::StopVolumes()
+{
+	isStopVolumes = true;
+	volumeReady.wakeAll();
+	wait();
+}
+
+void VolumeImagingThread::AddVolumeProcessor(VolumeProcessor* processor)
+{
+	QMutexLocker locker(&processorMutex);
+	if (std::find(volumeProcessors.begin(), volumeProcessors.end(), processor) == volumeProcessors.end()){
+		volumeProcessors.push_back(processor);
+	}
+}
+
+void VolumeImagingThread::RemoveVolumeProcessor(VolumeProcessor* processor)
+{
+	QMutexLocker locker(&processorMutex);
+	volumeProcessors.erase(std::remove(volumeProcessors.begin(), volumeProcessors.end(), processor), volumeProcessors.end());
+}
+
+VolumeStatistics VolumeImagingThread::Get_Statistics()
+{
+	QMutexLocker locker(&ringMutex);
+	return statistics;
+}
+
+/*
+	Called in the acquisition thread. A frame is interpolated with the former one
+	onto every plane lying between their two positions, so the planes do not depend
+	on where the frames happen to be exposed. The sweep direction is taken from the
+	frame positions, and a reversal closes the planes of the former sweep.
+*/
+void VolumeImagingThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopVolumes || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+	QMutexLocker locker(&ringMutex);
+	if (periodFrames > 0){
+		double period = (double)(info.exposure_time-lastFrameTime);
+		framePeriod = (periodFrames == 1) ? period : 0.9*framePeriod + 0.1*period;
+		statistics.framePeriod = framePeriod/1.0e3;
+	}
+	lastFrameTime = info.exposure_time;
+	++periodFrames;
+	if (periodFrames > VOLUME_IMAGING::PERIOD_FRAMES){
+		volumeReady.wakeAll();
+	}
+	if (!isSweeping){
+		return;
+	}
+	if (!info.has_position){
+		++statistics.unplacedFrames;
+		return;
+	}
+
+	if (info.image_width != imageWidth || info.image_height != imageHeight){
+		ClosePlanes(false);
+		imageWidth = info.image_width;
+		imageHeight = info.image_height;
+		hasLastFrame = false;
+	}
+	currentFrame.resize((size_t)imageWidth*imageHeight);
+	for (int row=0; row<imageHeight; ++row){
+		memcpy(&currentFrame[(size_t)row*imageWidth], data + (size_t)row*info.row_bytes, imageWidth*sizeof(ushort));
+	}
+
+	if (hasLastFrame){
+		double motion = info.z_position - lastPosition;
+		if (fabs(motion) < VOLUME_IMAGING::MIN_MOTION*step){
+			return; //turning around, the next moving frame is paired with the last one
+		}
+		int frameDirection = (motion > 0) ? 1 : -1;
+		if (frameDirection != direction){
+			ClosePlanes(false);
+			direction = frameDirection;
+			sweepDone = false;
+		}
+		if (!sweepDone){
+			FillPlanes(&currentFrame[0], info.z_position, info.exposure_time);
+		}
+	}
+	lastFrame.swap(currentFrame);
+	lastPosition = info.z_position;
+	lastTime = info.exposure_time;
+	hasLastFrame = true;
+}
+
+//a free slot, or the oldest volume not dispatched yet when the processors fall behind
+int VolumeImagingThread::AcquireSlot()
+{
+	int slot = -1;
+	if (!freeSlots.empty()){
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	} else if (!readySlots.empty()){
+		slot = readySlots.front();
+		readySlots.pop_front();
+		++statistics.droppedVolumes;
+	} else{
+		return -1;
+	}
+	VolumeSlot& volume = ring[slot];
+	volume.image_width = imageWidth;
+	volume.image_height = imageHeight;
+	volume.data.resize((size_t)planes*imageWidth*imageHeight);
+	volume.volume_index = volumeCount++;
+	volume.direction = direction;
+	volume.filled = 0;
+	volume.planeFilled.assign(planes, 0);
+	volume.planeTimes.assign(planes, 0);
+	volume.planeOffsets.assign(planes, 0.0);
+	return slot;
+}
+
+void VolumeImagingThread::ClosePlanes(bool publish)
+{
+	if (fillingSlot < 0){
+		return;
+	}
+	if (publish){
+		readySlots.push_back(fillingSlot);
+		volumeReady.wakeAll();
+	} else{
+		++statistics.partialVolumes;
+		freeSlots.push_back(fillingSlot);
+	}
+	fillingSlot = -1;
+}
+
+void VolumeImagingThread::FillPlanes(const ushort* frame, double position, long long time)
+{
+	double lower = min(lastPosition, position);
+	double upper = max(lastPosition, position);
+	int pixels = imageWidth*imageHeight;
+	for (int k=0; k<planes; ++k){
+		double plane = firstPlane + k*step;
+		if (plane < lower || plane > upper){
+			continue;
+		}
+		if (fillingSlot < 0){
+			fillingSlot = AcquireSlot();
+			if (fillingSlot < 0){
+				return;
+			}
+		}
+		VolumeSlot& volume = ring[fillingSlot];
+		if (volume.planeFilled[k]){
+			continue;
+		}
+		double weight = (plane-lastPosition)/(position-lastPosition);
+		InterpolateImage_SSE2(&lastFrame[0], frame, &volume.data[(size_t)k*pixels], pixels, (float)weight);
+		volume.planeTimes[k] = lastTime + (long long)(weight*(time-lastTime));
+		volume.planeOffsets[k] = min(plane-lower, upper-plane);
+		volume.planeFilled[k] = 1;
+		++volume.filled;
+	}
+	if (fillingSlot >= 0 && ring[fillingSlot].filled == planes){
+		ClosePlanes(true);
+		sweepDone = true;
+	}
+}
+
+/*
+	The sweep speed crosses one plane step every FRAMES_PER_PLANE frames, so the
+	frame period is measured on the stream before the sweep starts
+*/
+void VolumeImagingThread::run()
+{
+	if (!WaitFramePeriod()){
+		if (!isStopVolumes){
+			cout<<GetErrorString(OBJECT_NAME, "run()", "No frame received, is the camera live?");
+		}
+		isStopVolumes = true;
+		emit VolumeFinishedSignal(0);
+		return;
+	}
+
+	originalSpeed = 0;
+	try{
+		originalSpeed = stage->Get_Speed();
+		ringMutex.lock();
+		double speed = step/(framePeriod*1.0e-6*VOLUME_IMAGING::FRAMES_PER_PLANE)/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL;
+		ringMutex.unlock();
+		stage->Set_Speed(speed);
+		double margin = VOLUME_IMAGING::SWEEP_MARGIN/Z1_STAGE::Z1_PRECISION;
+		sweepThread.StartSweep(firstPlane-margin, firstPlane+(planes-1)*step+margin, firstPlane+(planes-1)*step/2);
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+		isStopVolumes = true;
+	}
+
+	ringMutex.lock();
+	isSweeping = !isStopVolumes;
+	ringMutex.unlock();
+	while (!isStopVolumes){
+		ringMutex.lock();
+		if (readySlots.empty()){
+			volumeReady.wait(&ringMutex, 100);
+		}
+		if (readySlots.empty()){
+			ringMutex.unlock();
+			continue;
+		}
+		int slot = readySlots.front();
+		readySlots.pop_front();
+		ringMutex.unlock();
+
+		DispatchVolume(slot);
+
+		ringMutex.lock();
+		freeSlots.push_back(slot);
+		ringMutex.unlock();
+	}
+
+	ringMutex.lock();
+	isSweeping = false;
+	ClosePlanes(false);
+	unsigned long volumes = statistics.volumes;
+	ringMutex.unlock();
+	sweepThread.StopSweep();
+	try{
+		if (originalSpeed > 0){
+			stage->Set_Speed(originalSpeed);
+		}
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	}
+	emit VolumeFinishedSignal(volumes);
+}
+
+bool VolumeImagingThread::WaitFramePeriod()
+{
+	QMutexLocker locker(&ringMutex);
+	periodFrames = 0;
+	QElapsedTimer timer;
+	timer.start();
+	while (periodFrames <= VOLUME_IMAGING::PERIOD_FRAMES && !isStopVolumes){
+		long remain = VOLUME_IMAGING::PERIOD_TIMEOUT - (long)timer.elapsed();
+		if (remain <= 0){
+			break;
+		}
+		volumeReady.wait(&ringMutex, remain);
+	}
+	return (periodFrames > VOLUME_IMAGING::PERIOD_FRAMES && framePeriod > 0);
+}
+
+//the slot, with the frame size it was filled with, is owned by the volume thread until it is returned to the free slots
+void VolumeImagingThread::DispatchVolume(int slot)
+{
+	const VolumeSlot& volume = ring[slot];
+	VolumeInfo info;
+	info.volume_index = volume.volume_index;
+	info.planes = planes;
+	info.image_width = volume.image_width;
+	info.image_height = volume.image_height;
+	info.first_plane = firstPlane;
+	info.step = step;
+	info.direction = volume.direction;
+	info.start_time = *std::min_element(volume.planeTimes.begin(), volume.planeTimes.end());
+	info.end_time = *std::max_element(volume.planeTimes.begin(), volume.planeTimes.end());
+	info.plane_times = &volume.planeTimes[0];
+	info.plane_offsets = &volume.planeOffsets[0];
+
+	double maxJitter = 0;
+	double volumeRate = 0;
+	ringMutex.lock();
+	++statistics.volumes;
+	if (lastVolumeTime > 0 && info.start_time > lastVolumeTime){
+		double rate = 1.0e6/(info.start_time-lastVolumeTime);
+		statistics.volumeRate = (statistics.volumeRate == 0) ? rate : 0.9*statistics.volumeRate + 0.1*rate;
+	}
+	lastVolumeTime = info.start_time;
+	for (int k=0; k<planes; ++k){
+		jitterSquares[k] += Square(volume.planeOffsets[k]);
+		statistics.planeJitter[k] = sqrt(jitterSquares[k]/statistics.volumes)*Z1_STAGE::Z1_PRECISION;
+		maxJitter = max(maxJitter, statistics.planeJitter[k]);
+	}
+	volumeRate = statistics.volumeRate;
+	ringMutex.unlock();
+
+	processorMutex.lock();
+	for (size_t i=0; i<volumeProcessors.size(); ++i){
+		volumeProcessors[i]->ProcessVolume(&volume.data[0], info);
+	}
+	processorMutex.unlock();
+
+	recordMutex.lock();
+	if (isRecording){
+		volumeFile.write((const char*)&volume.data[0], (qint64)volume.data.size()*sizeof(ushort));
+		volumeInfoStream<<info.volume_index<<"\t"<<info.start_time<<"\t"<<info.end_time<<"\t"<<info.direction
+			<<"\t"<<info.image_width<<"\t"<<info.image_height<<"\t"<<info.planes;
+		for (int k=0; k<planes; ++k){
+			volumeInfoStream<<"\t"<<QString::number(info.plane_offsets[k]*Z1_STAGE::Z1_PRECISION, 'f', 3);
+		}
+		volumeInfoStream<<"\n";
+	}
+	recordMutex.unlock();
+
+	emit VolumeReadySignal(info.volume_index, volumeRate, maxJitter);
+}
+
+/*
+	Volumes are appended to prefix_volumes.raw as uint16 with the planes in increasing
+	z order, and listed in prefix_volumes.txt, one line per volume: index, start and end
+	time(us), direction, width, height, planes, distance of each plane to its nearest frame(um)
+*/
+bool VolumeImagingThread::StartRecording(QString folder, QString prefix)
+{
+	StopRecording();
+
+	QMutexLocker locker(&recordMutex);
+	volumeInfoFile.setFileName(folder + "\\" + prefix + "_volumes.txt");
+	if (!volumeInfoFile.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+volumeInfoFile.fileName().toStdString());
+		return false;
+	}
+	volumeFile.setFileName(folder + "\\" + prefix + "_volumes.raw");
+	if (!volumeFile.open(QIODevice::WriteOnly)){
+		cout<<GetErrorString(OBJECT_NAME, "StartRecording()", "cannot open "+volumeFile.fileName().toStdString());
+		volumeInfoFile.close();
+		return false;
+	}
+	volumeInfoStream.setDevice(&volumeInfoFile);
+	volumeInfoStream<<"volume\tstart_time(us)\tend_time(us)\tdirection\twidth\theight\tplanes\tplane_offset(um)\n";
+	isRecording = true;
+	return true;
+}
+
+void VolumeImagingThread::StopRecording()
+{
+	QMutexLocker locker(&recordMutex);
+	if (!isRecording){
+		return;
+	}
+	isRecording = false;
+	volumeInfoStream.flush();
+	volumeInfoFile.close();
+	volumeFile.close();
+}
@@ -0,0 +1,170 @@
+/*****************************************************************
+VolumeImagingThread : Continuous volumetric imaging. The z1 stage
+                      sweeps up and down through the volume while
+                      the camera streams, every frame is assigned by
+                      its measured position and the planes of one
+                      sweep are resampled onto fixed positions.
+                      The whole volumes are handed to the volume
+                      processors from a ring of buffers.
+ZSweepThread : Triangular sweep of a stage between two positions
+******************************************************************/
+#ifndef _VOLUME_IMAGING_THREAD_H_
+#define _VOLUME_IMAGING_THREAD_H_
+
+#include "FrameProcessor.h"
+#include "Stage.h"
+#include "Stage_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <vector>
+#include <deque>
+
+struct VolumeInfo{
+	unsigned long volume_index;
+	int planes;
+	int image_width;
+	int image_height;
+	double first_plane;     //position of plane 0, pulse
+	double step;            //plane step, pulse
+	int direction;          //1: planes acquired upwards, -1: downwards
+	long long start_time;   //host time of the first acquired plane, us
+	long long end_time;     //host time of the last acquired plane, us
+	const long long* plane_times;  //host time each plane was crossed, us
+	const double* plane_offsets;   //distance from each plane to its nearest frame, pulse
+};
+
+class VolumeProcessor
+{
+public:
+	virtual ~VolumeProcessor(){}
+
+	//Called in the volume thread, the planes are stored in increasing z order.
+	//The buffer is reused after the call returns.
+	virtual void ProcessVolume(const ushort* data, const VolumeInfo& info) = 0;
+};
+
+struct VolumeStatistics{
+	unsigned long volumes;          //volumes handed to the processors
+	unsigned long droppedVolumes;   //volumes overwritten because the processors fell behind
+	unsigned long partialVolumes;   //sweeps which missed some planes
+	unsigned long unplacedFrames;   //frames without a measured position
+	double framePeriod;             //ms
+	double volumeRate;              //volumes/s
+	vector<double> planeJitter;     //rms distance from each plane to its nearest frame, um
+};
+
+class ZSweepThread : public QThread
+{
+public:
+	explicit ZSweepThread(Stage* stage, QObject* parent = 0);
+	~ZSweepThread();
+
+	void StartSweep(double low, double high, double center); //pulse, returns to center after stopping
+	void StopSweep();
+	unsigned long Get_Legs(){ return legs; }
+
+protected:
+	virtual void run();
+
+private:
+	Stage* stage;
+	volatile bool isStopSweep;
+	double low;
+	double high;
+	double center;
+	volatile unsigned long legs;
+};
+
+class VolumeImagingThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	explicit VolumeImagingThread(Stage* stage, QObject* parent = 0);
+	~VolumeImagingThread();
+
+	bool StartVolumes(int planes, double step); //planes centered on the current position, step in um
+	void StopVolumes();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+
+	void AddVolumeProcessor(VolumeProcessor* processor);
+	void RemoveVolumeProcessor(VolumeProcessor* processor);
+	bool StartRecording(QString folder, QString prefix);
+	void StopRecording();
+	VolumeStatistics Get_Statistics();
+
+signals:
+	void VolumeReadySignal(unsigned long, double, double); //volume index, volumes/s and max plane jitter (um)
+	void VolumeFinishedSignal(unsigned long);               //volumes handed to the processors
+
+protected:
+	virtual void run();
+	bool WaitFramePeriod();
+	int AcquireSlot();
+	void ClosePlanes(bool publish);
+	void FillPlanes(const ushort* frame, double position, long long time);
+	void DispatchVolume(int slot);
+
+private:
+	struct VolumeSlot{
+		unsigned long volume_index;
+		int direction;
+		int filled;
+		int image_width;
+		int image_height;
+		vector<ushort> data;
+		vector<char> planeFilled;
+		vector<long long> planeTimes;
+		vector<double> planeOffsets;
+	};
+
+	Stage* stage;
+	ZSweepThread sweepThread;
+	volatile bool isStopVolumes;
+	int planes;
+	double step;        //pulse
+	double firstPlane;  //pulse
+	double originalSpeed;
+
+	//demultiplexing in the acquisition thread
+	QMutex ringMutex;
+	QWaitCondition volumeReady;
+	VolumeSlot ring[VOLUME_IMAGING::RING_SIZE];
+	vector<int> freeSlots;
+	std::deque<int> readySlots;
+	int fillingSlot;
+	bool isSweeping;
+	int direction;
+	bool sweepDone;       //all planes of the current sweep are filled
+	unsigned long volumeCount;
+	int imageWidth;
+	int imageHeight;
+	vector<ushort> lastFrame;
+	vector<ushort> currentFrame;
+	bool hasLastFrame;
+	double lastPosition;
+	long long lastTime;
+	long long lastFrameTime;
+	int periodFrames;
+	double framePeriod;   //us
+
+	QMutex processorMutex;
+	vector<VolumeProcessor*> volumeProcessors;
+
+	//recording
+	QMutex recordMutex;
+	bool isRecording;
+	QFile volumeFile;
+	QFile volumeInfoFile;
+	QTextStream volumeInfoStream;
+
+	VolumeStatistics statistics;
+	vector<double> jitterSquares;
+	long long lastVolumeTime;
+};
+
+#endif //_VOLUME_IMAGING_THREAD_H_
@@ -1,19 +1,32 @@
 ﻿
 #include "Z1Stage.h"
 #include <Windows.h>
+#include <QtCore/QElapsedTimer>
+#include <cmath>
+#include <string.h>
 
 string Z1Stage::DEVICE_NAME = "Z1 Stage";
 string Z1Stage::OBJECT_NAME = "Z1Stage";
 
-Z1Stage::Z1Stage(Galil* controller)
+Z1Stage::Z1Stage(StageController* controller)
 {
 	stage = controller;
 	state = OPENED;
+	closeloopThread = new CloseloopThread(controller, 'Y', 1.0/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL, Z1_STAGE::Z1_TOL);
+	profileSpeed = Z1_STAGE::Z1_SPEED;
+	profileAcc = 0;
+	profileDec = 0;
+	isCancelHoming = false;
+	hasOrigin = false;
+	memset(&homingStatistics, 0, sizeof(homingStatistics));
+	deviationSquares = 0;
 }
 
 Z1Stage::~Z1Stage()
 {
 	Disconnect();
+	delete closeloopThread;
+	closeloopThread = NULL;
 }
 
 bool Z1Stage::Connect()
@@ -25,10 +38,14 @@ bool Z1Stage::Connect()
 		//stage->command("SHY","\r",":");
 		sprintf(strCommand, "SPY=%ld", Z1_STAGE::Z1_SPEED);
 		stage->command(string(strCommand));
+		profileSpeed = Z1_STAGE::Z1_SPEED;
+		profileAcc = stage->commandValue("MG _ACY");
+		profileDec = stage->commandValue("MG _DCY");
 		Sleep(100);
 
 		success = true;
 		state = CONNECTED;
+		closeloopThread->StartThread();
 	} catch (string e){
 		throw QException(OBJECT_NAME, "Connect", e);
 	}
@@ -43,6 +60,7 @@ bool Z1Stage::IsConnected()
 void Z1Stage::Disconnect()
 {
 	Stop();
+	closeloopThread->StopThread();
 	stage = NULL;
 	state = DISCONNECTED;
 }
@@ -53,6 +71,7 @@ void Z1Stage::Move_Openloop_Realtime(double pulse)
 	long step = long(pulse/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
 	char strCommand[32];
 	if (step == 0 || !IsConnected()){return;}
+	closeloopThread->Reset();
 
 	try{
 		sprintf(strCommand,"IPY=%ld",step);
@@ -68,24 +87,22 @@ void Z1Stage::Move_Openloop_Unrealtime(double pulse)
 	long step = long(pulse/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
 	char strCommand[32];
 	if (step == 0 || !IsConnected()){return;}
+	closeloopThread->Reset();
 
 	try{
 		//Query whether the stage is busy
-		while (true){
-			if (stage->commandValue("MG _BGY")==0){break;}
-			Sleep(Z1_STAGE::STAGE_WAITING);
+		if (!WaitMotionComplete(0, Z1_STAGE::MOTION_TIMEOUT)){
+			throw string("Former motion timeout");
 		}
 
 		//Send motion instruction
 		sprintf(strCommand,"IPY=%ld",step);
 		stage->command(string(strCommand), "\r", ":", true);
-		double motionTime = Get_MotionTime(Z1_STAGE::Z1_SPEED, step);
-		Sleep(long(2*motionTime));
 
 		//Wait the instuction to finish
-		while (true){
-			if (stage->commandValue("MG _BGY")==0){break;}
-			Sleep(Z1_STAGE::STAGE_WAITING);
+		double motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, step);
+		if (!WaitMotionComplete(motionTime, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT)){
+			throw string("Motion timeout");
 		}
 	}catch(string e){
 		throw QException(OBJECT_NAME, "Move_Openloop_Unrealtime", e);
@@ -93,8 +110,24 @@ void Z1Stage::Move_Openloop_Unrealtime(double pulse)
 }
 
 //Z1轴升降台闭环实时运动(不需要等待运动完成而直接向控制器发送下一条运动指令)
+/*
+	The requested distances accumulate on a target position which the closed loop thread
+	tracks with the streamed encoder position, so that the error of the former steps is
+	corrected by the next one and the caller never waits for the stage
+*/
 void Z1Stage::Move_Closeloop_Realtime(double pulse)
 {
+	if (long(pulse) == 0 || !IsConnected()){return;}
+	Start_CloseloopMotion(pulse);
+}
+
+CloseloopMotion Z1Stage::Start_CloseloopMotion(double pulse)
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "Start_CloseloopMotion", "No Stage Connection");
+	}
+	double motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, pulse/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
+	return closeloopThread->MoveBy(pulse, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT, settleCriterion);
 }
 
 //Z1轴升降台闭环非实时运动(需要等待运动完成后再发送下一条运动指令)
@@ -106,12 +139,12 @@ void Z1Stage::Move_Closeloop_Unrealtime(double pulse)
 	char strCommand[32];
 
 	if (z_ideal == 0 || !IsConnected()){return;}
+	closeloopThread->Reset();
 
 	try{
 		//Query whether the stage is busy
-		while (true){
-			if (stage->commandValue("MG _BGY")==0){ break; }
-			Sleep(Z1_STAGE::STAGE_WAITING);
+		if (!WaitMotionComplete(0, Z1_STAGE::MOTION_TIMEOUT)){
+			throw string("Former motion timeout");
 		}
 
 		//Get the initial position
@@ -124,13 +157,11 @@ void Z1Stage::Move_Closeloop_Unrealtime(double pulse)
 			*/
 			sprintf(strCommand,"IPY=%ld",z_input);
 			stage->command(string(strCommand), "\r", ":", true);
-			double motionTime = Get_MotionTime(Z1_STAGE::Z1_SPEED, z_input);
-			Sleep(long(2*motionTime));
 
 			//Wait to finish motion instruction
-			while (true){
-				if (stage->commandValue("MG _BGY")==0){ break; }
-				Sleep(Z1_STAGE::STAGE_WAITING);
+			double motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, z_input);
+			if (!WaitMotionComplete(motionTime, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT)){
+				throw string("Motion timeout");
 			}
 
 			z_current = (long)stage->commandValue("MG _TPY");
@@ -144,10 +175,12 @@ void Z1Stage::Move_Closeloop_Unrealtime(double pulse)
 
 void Z1Stage::Stop()
 {
+	isCancelHoming = true;
 	if (!IsConnected()){
     	throw QException(OBJECT_NAME, "Stop", "No Stage Connection");
 	}
 	else{
+    	closeloopThread->Reset(CLOSELOOP_CANCELLED);
     	try{
     		stage->write("STY\r");//控制器急停指令
     	}catch(string e){
@@ -156,6 +189,30 @@ void Z1Stage::Stop()
 	}
 }
 
+bool Z1Stage::IsMoving()
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "IsMoving", "No Stage Connection");
+	}
+	try{
+		return (stage->commandValue("MG _BGY") != 0);
+	} catch (string e){
+		throw QException(OBJECT_NAME, "IsMoving", e);
+	}
+}
+
+bool Z1Stage::WaitMotionComplete(double motion_time, long timeout_ms)
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "WaitMotionComplete", "No Stage Connection");
+	}
+	try{
+		return WaitAxisSettled(stage, 'Y', motion_time, Z1_STAGE::MOTION_MARGIN, timeout_ms);
+	} catch (string e){
+		throw QException(OBJECT_NAME, "WaitMotionComplete", e);
+	}
+}
+
 bool  Z1Stage::InOrigin()
 {
 	if (!IsConnected()){
@@ -169,29 +226,112 @@ bool  Z1Stage::InOrigin()
 	}
 }
 
+/*
+	Two phase homing: a fast jog runs into the reverse limit, which the controller detects
+	and stops the axis itself, the stage backs off and approaches the switch again at a low
+	speed so that the trip position does not depend on the detection delay. The trip is the
+	new origin, its position in the former coordinates measures the repeatability.
+	Stop() cancels the homing between two polls.
+*/
 bool Z1Stage::ReturnOrigin()
 {
 	if (!IsConnected()){
 		throw QException(OBJECT_NAME, "ReturnOrigin", "No Stage Connection");
 	}
 
-	int isOrigin = 1;
+	char strCommand[32];
+	QElapsedTimer timer;
+	timer.start();
+	isCancelHoming = false;
+	closeloopThread->Reset();
 	try{
-		while (true){
-			isOrigin = (int)stage->commandValue("MG _LRY");//Z1 stage下限位！
-			if (isOrigin == 0){
-				break;
+		//fast phase
+		if (!InOrigin()){
+			StartJog(-HOMING::FAST_SPEED);
+			if (!WaitJogStop(HOMING::TIMEOUT)){
+				++homingStatistics.cancelled;
+				return false;
 			}
-			stage->command("IPY=-5000"); 
-			double motionTime = Get_MotionTime(Z1_STAGE::Z1_SPEED, 5000);
-			Sleep(long(2*motionTime));
 		}
+		double fastTime = (double)timer.elapsed();
+
+		//back off out of the switch
+		sprintf(strCommand, "PRY=%ld", HOMING::BACKOFF);
+		stage->command(string(strCommand));
+		stage->command("BGY");
+		double motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, HOMING::BACKOFF);
+		if (!WaitMotionComplete(motionTime, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT)){
+			throw string("Back off timeout");
+		}
+		if (isCancelHoming){
+			++homingStatistics.cancelled;
+			return false;
+		}
+		if (InOrigin()){
+			throw string("Limit switch is still active after backing off");
+		}
+
+		//slow phase
+		StartJog(-HOMING::SLOW_SPEED);
+		if (!WaitJogStop(HOMING::TIMEOUT)){
+			++homingStatistics.cancelled;
+			return false;
+		}
+		if (!InOrigin()){
+			throw string("Slow approach stopped before the limit switch");
+		}
+
+		double tripPosition = stage->commandValue("MG _TPY");
+		stage->command("DEY=0");
+
+		HomingStatistics& s = homingStatistics;
+		s.lastTime = (double)timer.elapsed();
+		s.fastTime = fastTime;
+		s.averageTime = (s.averageTime*s.homings + s.lastTime)/(s.homings+1);
+		++s.homings;
+		if (hasOrigin){
+			s.lastDeviation = tripPosition;
+			deviationSquares += tripPosition*tripPosition;
+			++s.comparisons;
+			s.rmsDeviation = sqrt(deviationSquares/s.comparisons);
+			s.maxDeviation = max(s.maxDeviation, fabs(tripPosition));
+		}
+		hasOrigin = true;
 	} catch (string e){
+		//the original error is reported even if the stop fails as well
+		try{
+			stage->write("STY\r");
+		} catch (string){
+		}
 		throw QException(OBJECT_NAME, "ReturnOrigin", e);
 	}
 	return true;
 }
 
+void Z1Stage::StartJog(long speed)
+{
+	char strCommand[32];
+	sprintf(strCommand, "JGY=%ld", speed);
+	stage->command(string(strCommand));
+	stage->command("BGY");
+}
+
+bool Z1Stage::WaitJogStop(long timeout_ms)
+{
+	QElapsedTimer timer;
+	timer.start();
+	while (stage->commandValue("MG _BGY") != 0){
+		if (isCancelHoming){
+			return false;
+		}
+		if (timer.elapsed() > timeout_ms){
+			throw string("Homing timeout");
+		}
+		Sleep(HOMING::POLL_INTERVAL);
+	}
+	return !isCancelHoming;
+}
+
 double Z1Stage::Get_CurrentPosition()
 {
 	if (!IsConnected()){
@@ -214,6 +354,7 @@ void Z1Stage::Set_CurrentPosition(double position)
     	throw QException(OBJECT_NAME, "Set_CurrentPosition", "No Stage Connection");
 	}
 	else{
+		closeloopThread->Reset();
     	try{
 			sprintf(strCommand, "DEY=%ld", long(position));
     		stage->command(string(strCommand), "\r", ":", true);
@@ -233,6 +374,7 @@ void Z1Stage::Set_Speed(double speed)
     	try{
     		sprintf(strCommand,"SPY=%ld", long(speed));
     		stage->command(string(strCommand), "\r", ":", true);
+    		profileSpeed = speed;
     	}catch(string e){
     		throw QException(OBJECT_NAME, "Set_Speed", e);
     	}
@@ -250,6 +392,7 @@ void Z1Stage::Set_ACCSpeed(double acc)
     	try{
     		sprintf(strCommand,"ACY=%ld",long(acc));
     		stage->command(string(strCommand), "\r", ":", true);
+    		profileAcc = acc;
     	}catch(string e){
     		throw QException(OBJECT_NAME, "Set_ACCSpeed", e);
     	}
@@ -267,6 +410,7 @@ void Z1Stage::Set_DECSpeed(double dec)
     	try{
     		sprintf(strCommand,"DCY=%ld",long(dec));
     		stage->command(string(strCommand), "\r", ":", true);
+    		profileDec = dec;
     	}catch(string e){
     		throw QException(OBJECT_NAME, "Set_DECSpeed", e);
     	}
@@ -5,16 +5,29 @@
 #ifndef _Z1Stage_H_
 #define _Z1Stage_H_
 
-#include "Galil.h"
+#include "StageController.h"
+#include "CloseloopThread.h"
 #include "Stage.h"
 #include "Stage_Params.h"
 #include "VirtualCoordinates.h"
 using namespace VIRTUAL_COORDINATE;
 
+struct HomingStatistics{
+	unsigned long homings;       //completed homings
+	unsigned long cancelled;
+	double lastTime;             //ms
+	double fastTime;             //fast jog of the last homing, ms
+	double averageTime;          //ms
+	unsigned long comparisons;   //homings started from a former origin
+	double lastDeviation;        //limit trip position in the coordinates of the former origin, pulse
+	double rmsDeviation;         //pulse
+	double maxDeviation;         //pulse
+};
+
 class Z1Stage : public Stage
 {
 public:
-	explicit Z1Stage(Galil* controller);
+	explicit Z1Stage(StageController* controller);
 	~Z1Stage();
 
 	static string DEVICE_NAME;
@@ -30,9 +43,13 @@ public:
 	void Move_Openloop_Unrealtime(double distance);
 	void Move_Closeloop_Realtime(double distance);
 	void Move_Closeloop_Unrealtime(double distance);
+	CloseloopMotion Start_CloseloopMotion(double distance); //non-blocking closed loop motion, returns its handle
 	void Stop();
 	bool ReturnOrigin(); //Returned state: true indicates reaching origin and false indicates stop
 	bool InOrigin();
+	HomingStatistics Get_HomingStatistics(){ return homingStatistics; }
+	bool IsMoving();
+	bool WaitMotionComplete(double motion_time, long timeout_ms);
 
 	//Position acquisition
 	double Get_CurrentPosition();
@@ -47,10 +64,23 @@ public:
 	double Get_DECSpeed();
 
 protected:
+	void StartJog(long speed);            //motor pulse/s, the controller stops the jog on the limit switch
+	bool WaitJogStop(long timeout_ms);    //false when the homing is cancelled
 
 private:
 	DeviceStatus state;
-	Galil* stage;
+	StageController* stage;
+
+	CloseloopThread* closeloopThread; //tracks the realtime closed loop motions
+
+	double profileSpeed;     //profile parameters used to predict the motion time
+	double profileAcc;
+	double profileDec;
+
+	volatile bool isCancelHoming;  //set by Stop
+	bool hasOrigin;
+	HomingStatistics homingStatistics;
+	double deviationSquares;
 };
 
 #endif
\ No newline at end of file
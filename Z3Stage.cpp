@@ -5,10 +5,13 @@
 string Z3Stage::DEVICE_NAME = "Z3 Stage";
 string Z3Stage::OBJECT_NAME = "Z3Stage";
 
-Z3Stage::Z3Stage(Galil* controller)
+Z3Stage::Z3Stage(StageController* controller)
 {
 	stage = controller;
 	state = OPENED;
+	profileSpeed = Z3_STAGE::Z3_SPEED;
+	profileAcc = 0;
+	profileDec = 0;
 }
 
 Z3Stage::~Z3Stage()
@@ -25,6 +28,9 @@ bool Z3Stage::Connect()
 		//stage->command("SHX","\r",":");
 		sprintf(strCommand, "SPX=%ld", Z3_STAGE::Z3_SPEED);
 		stage->command(string(strCommand));
+		profileSpeed = Z3_STAGE::Z3_SPEED;
+		profileAcc = stage->commandValue("MG _ACX");
+		profileDec = stage->commandValue("MG _DCX");
 		Sleep(100);
 
 		success = true;
@@ -45,7 +51,9 @@ bool Z3Stage::IsConnected()
 
 void Z3Stage::Disconnect()
 {
-	Stop();
+	if (IsConnected()){
+		Stop();
+	}
 	stage = NULL;
 	state = DISCONNECTED;
 }
@@ -75,21 +83,18 @@ void Z3Stage::Move_Openloop_Unrealtime(double pulse)
 
 	try{
 		//Query whether the stage is busy
-		while (true){
-			if (stage->commandValue("MG _BGX") == 0){ break; }
-			Sleep(Z3_STAGE::STAGE_WAITING);
+		if (!WaitMotionComplete(0, Z3_STAGE::MOTION_TIMEOUT)){
+			throw string("Former motion timeout");
 		}
 
 		//Send motion instruction
 		sprintf(strCommand, "IPX=%ld", step);
 		stage->command(string(strCommand), "\r", ":", true);
-		double motionTime = Get_MotionTime(Z3_STAGE::Z3_SPEED, step);
-		Sleep(long(2*motionTime));
 
 		//Wait the instuction to finish
-		while (true){
-			if (stage->commandValue("MG _BGX") == 0){ break; }
-			Sleep(Z3_STAGE::STAGE_WAITING);
+		double motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, step);
+		if (!WaitMotionComplete(motionTime, long(motionTime)+Z3_STAGE::MOTION_TIMEOUT)){
+			throw string("Motion timeout");
 		}
 	}
 	catch (string e){
@@ -123,6 +128,32 @@ void Z3Stage::Stop()
 	}
 }
 
+bool Z3Stage::IsMoving()
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "IsMoving", "No Stage Connection");
+	}
+	try{
+		return (stage->commandValue("MG _BGX") != 0);
+	}
+	catch (string e){
+		throw QException(OBJECT_NAME, "IsMoving", e);
+	}
+}
+
+bool Z3Stage::WaitMotionComplete(double motion_time, long timeout_ms)
+{
+	if (!IsConnected()){
+		throw QException(OBJECT_NAME, "WaitMotionComplete", "No Stage Connection");
+	}
+	try{
+		return WaitAxisSettled(stage, 'X', motion_time, Z3_STAGE::MOTION_MARGIN, timeout_ms);
+	}
+	catch (string e){
+		throw QException(OBJECT_NAME, "WaitMotionComplete", e);
+	}
+}
+
 bool Z3Stage::ReturnOrigin()
 {
 	if (!IsConnected()){
@@ -180,6 +211,7 @@ void Z3Stage::Set_Speed(double speed)
 		try{
 			sprintf(strCommand, "SPX=%ld", long(speed));
 			stage->command(string(strCommand), "\r", ":", true);
+			profileSpeed = speed;
 		}
 		catch (string e){
 			throw QException(OBJECT_NAME, "Set_Speed", e);
@@ -198,6 +230,7 @@ void Z3Stage::Set_ACCSpeed(double acc)
 		try{
 			sprintf(strCommand, "ACX=%ld", long(acc));
 			stage->command(string(strCommand), "\r", ":", true);
+			profileAcc = acc;
 		}
 		catch (string e){
 			throw QException(OBJECT_NAME, "Set_ACCSpeed", e);
@@ -216,6 +249,7 @@ void Z3Stage::Set_DECSpeed(double dec)
 		try{
 			sprintf(strCommand, "DCX=%ld", long(dec));
 			stage->command(string(strCommand), "\r", ":", true);
+			profileDec = dec;
 		}
 		catch (string e){
 			throw QException(OBJECT_NAME, "Set_DECSpeed", e);
@@ -5,7 +5,7 @@
 #ifndef _Z3Stage_H_
 #define _Z3Stage_H_
 
-#include "Galil.h"
+#include "StageController.h"
 #include "Stage.h"
 #include "Stage_Params.h"
 #include "VirtualCoordinates.h"
@@ -14,7 +14,7 @@ using namespace VIRTUAL_COORDINATE;
 class Z3Stage : public Stage
 {
 public:
-	explicit Z3Stage(Galil* controller);
+	explicit Z3Stage(StageController* controller);
 	~Z3Stage();
 
 	static string DEVICE_NAME;
@@ -32,6 +32,8 @@ public:
 	void Move_Closeloop_Unrealtime(double distance);
 	void Stop();
 	bool ReturnOrigin();
+	bool IsMoving();
+	bool WaitMotionComplete(double motion_time, long timeout_ms);
 
 	//Position acquisition
 	double Get_CurrentPosition();
@@ -49,7 +51,10 @@ protected:
 
 private:
 	DeviceStatus state;
-	Galil* stage;
+	StageController* stage;
+	double profileSpeed;     //profile parameters used to predict the motion time
+	double profileAcc;
+	double profileDec;
 };
 
 #endif
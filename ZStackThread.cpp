@@ -0,0 +1,260 @@
+
+#include "ZStackThread.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <string.h>
+#include <new>
+
+string ZStackThread::OBJECT_NAME = "ZStackThread";
+
+ZStackThread::ZStackThread(Stage* stage, StageController* controller, QObject* parent)
+	: QThread(parent), stage(stage), controller(controller)
+{
+	isStopStack = true;
+	plan.start = 0;
+	plan.step = 0;
+	plan.planes = 0;
+	plan.triggered = false;
+	plan.exposure = 0;
+	motionTime = 0;
+	profileSpeed = 0;
+	profileAcc = 0;
+	profileDec = 0;
+	waitingPlane = -1;
+	acceptTime = 0;
+	imageWidth = 0;
+	imageHeight = 0;
+}
+
+ZStackThread::~ZStackThread()
+{
+	StopStack();
+	stage = NULL;
+	controller = NULL;
+}
+
+bool ZStackThread::StartStack(const ZStackPlan& stack_plan, QString stack_folder, QString stack_prefix)
+{
+	if (isRunning() || stage == NULL){
+		return false;
+	}
+	if (stack_plan.planes <= 0 || stack_plan.planes > ZSTACK::MAX_PLANES || stack_plan.exposure <= 0
+		|| stack_plan.image_width <= 0 || stack_plan.image_height <= 0
+		|| (stack_plan.triggered && controller == NULL)){
+		cout<<GetErrorString(OBJECT_NAME, "StartStack()", "Invalid z-stack plan");
+		return false;
+	}
+	//the whole stack is held in memory until it is saved
+	double stackSize = (double)stack_plan.image_width*stack_plan.image_height*stack_plan.planes*sizeof(ushort)/(1024.0*1024.0);
+	if (stackSize > ZSTACK::MAX_STACK_SIZE){
+		char buf[64];
+		sprintf(buf, "The z-stack of %.0fMB exceeds %.0fMB", stackSize, ZSTACK::MAX_STACK_SIZE);
+		cout<<GetErrorString(OBJECT_NAME, "StartStack()", string(buf));
+		return false;
+	}
+	QMutexLocker locker(&frameMutex);
+	try{
+		stack.assign((size_t)stack_plan.image_width*stack_plan.image_height*stack_plan.planes, 0);
+	} catch (std::bad_alloc){
+		cout<<GetErrorString(OBJECT_NAME, "StartStack()", "Fail to allocate the z-stack");
+		return false;
+	}
+	plan = stack_plan;
+	folder = stack_folder;
+	prefix = stack_prefix;
+	waitingPlane = -1;
+	imageWidth = plan.image_width;
+	imageHeight = plan.image_height;
+	planes.assign(plan.planes, ZStackPlane());
+	locker.unlock();
+	isStopStack = false;
+	start();
+	return true;
+}
+
+void ZStackThread::StopStack()
+{
+	isStopStack = true;
+	frameReady.wakeAll();
+	wait();
+}
+
+vector<ZStackPlane> ZStackThread::Get_Planes()
+{
+	QMutexLocker locker(&frameMutex);
+	return planes;
+}
+
+/*
+	Called in the acquisition thread: the first frame exposed after the stage
+	settled on the waiting plane is copied into the stack
+*/
+void ZStackThread::ProcessFrame(const uchar* data, const FrameInfo& info)
+{
+	if (isStopStack || data == NULL || info.data_type != USHORT_TYPE){
+		return;
+	}
+	QMutexLocker locker(&frameMutex);
+	long long exposureStart = info.exposure_time - (long long)(plan.exposure*0.5e6);
+	if (waitingPlane < 0 || exposureStart < acceptTime){
+		return;
+	}
+	if (info.image_width != imageWidth || info.image_height != imageHeight){
+		return;
+	}
+	ushort* dst = &stack[(size_t)waitingPlane*imageWidth*imageHeight];
+	for (int row=0; row<imageHeight; ++row){
+		memcpy(dst + (size_t)row*imageWidth, data + (size_t)row*info.row_bytes, imageWidth*sizeof(ushort));
+	}
+	ZStackPlane& plane = planes[waitingPlane];
+	plane.exposure_time = info.exposure_time;
+	plane.frame_index = info.frame_index;
+	if (info.has_position){
+		plane.position = info.z_position;
+	}
+	waitingPlane = -1;
+	frameReady.wakeAll();
+}
+
+/*
+	Each plane waits for the stage to settle and starts its exposure, either by
+	an edge of the trigger output or by accepting the next free running frame.
+	A triggered exposure ends at a known time after its edge, so the move to the
+	next plane is sent then and overlaps the readout of the frame. A free running
+	frame may have started at any time, so the move waits for the frame.
+*/
+void ZStackThread::run()
+{
+	QElapsedTimer timer;
+	timer.start();
+	bool success = false;
+	int acquired = 0;
+	long exposure_ms = long(plan.exposure*1.0e3 + 0.5);
+	char strCommand[32];
+	try{
+		double base = stage->Get_CurrentPosition();
+		profileSpeed = stage->Get_Speed();
+		profileAcc = stage->Get_ACCSpeed();
+		profileDec = stage->Get_DECSpeed();
+		for (int k=0; k<plan.planes; ++k){
+			planes[k].target = base + (plan.start + k*plan.step)/Z1_STAGE::Z1_PRECISION;
+		}
+
+		//the stage holds the commanded position, so moves are chained without reading the encoder
+		double commanded = MoveTo(planes[0].target, base);
+		for (int k=0; k<plan.planes && !isStopStack; ++k){
+			if (!stage->WaitMotionComplete(motionTime, long(motionTime)+Z1_STAGE::MOTION_TIMEOUT)){
+				cout<<GetErrorString(OBJECT_NAME, "run()", "Motion timeout");
+				break;
+			}
+			double position = stage->Get_CurrentPosition();
+			frameMutex.lock();
+			planes[k].position = position;
+			acceptTime = Get_HostTime();
+			waitingPlane = k;
+			frameMutex.unlock();
+
+			if (plan.triggered){
+				sprintf(strCommand, "SB%d;CB%d", CAMERA_TRIGGER::CONTROLLER_OUTPUT, CAMERA_TRIGGER::CONTROLLER_OUTPUT);
+				controller->command(string(strCommand));
+				//the edge went out before the controller answered
+				long long exposureEnd = Get_HostTime() + (long long)(plan.exposure*1.0e6) + ZSTACK::TRIGGER_MARGIN*1000;
+				long long remain = exposureEnd - Get_HostTime();
+				if (remain > 0){
+					usleep((unsigned long)remain);
+				}
+				if (k+1 < plan.planes){
+					commanded = MoveTo(planes[k+1].target, commanded);
+				}
+			}
+			if (!WaitPlaneFrame(k, exposure_ms+ZSTACK::FRAME_TIMEOUT)){
+				break;
+			}
+			if (!plan.triggered && k+1 < plan.planes){
+				commanded = MoveTo(planes[k+1].target, commanded);
+			}
+			acquired = k+1;
+			emit ZStackPlaneSignal(k, planes[k].position*Z1_STAGE::Z1_PRECISION);
+		}
+		success = (acquired == plan.planes) && !isStopStack;
+	} catch (QException e){
+		cout<<e.getMessage()<<endl;
+	} catch (string e){
+		cout<<GetErrorString(OBJECT_NAME, "run()", e);
+	}
+
+	frameMutex.lock();
+	waitingPlane = -1;
+	frameMutex.unlock();
+	if (acquired > 0 && !SaveStack(acquired)){
+		success = false;
+	}
+	isStopStack = true;
+	emit ZStackFinishedSignal(success, acquired, (double)timer.elapsed());
+}
+
+//the stage moves by whole motor steps, the returned position is the one actually commanded
+double ZStackThread::MoveTo(double target, double current)
+{
+	long step = long((target-current)/Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL);
+	motionTime = Get_ProfileTime(profileSpeed, profileAcc, profileDec, step);
+	if (step != 0){
+		stage->Move_Openloop_Realtime(target-current);
+	}
+	return current + step*Z1_STAGE::Z1_VERTICAL_TO_HORIZONTAL;
+}
+
+bool ZStackThread::WaitPlaneFrame(int plane, long timeout_ms)
+{
+	QMutexLocker locker(&frameMutex);
+	QElapsedTimer timer;
+	timer.start();
+	while (waitingPlane == plane && !isStopStack){
+		long remain = timeout_ms - (long)timer.elapsed();
+		if (remain <= 0){
+			break;
+		}
+		frameReady.wait(&frameMutex, remain);
+	}
+	if (waitingPlane == plane){
+		if (!isStopStack){
+			char buf[64];
+			sprintf(buf, "No frame received for plane %d, is the camera live?", plane);
+			cout<<GetErrorString(OBJECT_NAME, "WaitPlaneFrame()", string(buf));
+		}
+		waitingPlane = -1;
+		return false;
+	}
+	return true;
+}
+
+/*
+	The planes are appended to prefix_zstack.raw as uint16 in acquisition order,
+	their targets and measured positions are listed in prefix_zstack.txt
+*/
+bool ZStackThread::SaveStack(int count)
+{
+	if (folder.isEmpty()){
+		return true;
+	}
+	QMutexLocker locker(&frameMutex);
+	QFile rawFile(folder + "\\" + prefix + "_zstack.raw");
+	QFile infoFile(folder + "\\" + prefix + "_zstack.txt");
+	if (!rawFile.open(QIODevice::WriteOnly) || !infoFile.open(QIODevice::WriteOnly | QIODevice::Text)){
+		cout<<GetErrorString(OBJECT_NAME, "SaveStack()", "Fail to create the z-stack files");
+		return false;
+	}
+	rawFile.write((const char*)&stack[0], (qint64)count*imageWidth*imageHeight*sizeof(ushort));
+	rawFile.close();
+
+	QTextStream stream(&infoFile);
+	stream<<"width\t"<<imageWidth<<"\theight\t"<<imageHeight<<"\tplanes\t"<<count<<"\tstep(um)\t"<<plan.step<<"\n";
+	stream<<"plane\ttarget(pulse)\tz1_position(pulse)\texposure_time(us)\tframe\n";
+	for (int k=0; k<count; ++k){
+		stream<<k<<"\t"<<QString::number(planes[k].target, 'f', 1)<<"\t"<<QString::number(planes[k].position, 'f', 1)
+			<<"\t"<<planes[k].exposure_time<<"\t"<<planes[k].frame_index<<"\n";
+	}
+	infoFile.close();
+	return true;
+}
@@ -0,0 +1,88 @@
+/*****************************************************************
+ZStackThread : Z-stack acquisition which moves the z1 stage to
+               the next plane as soon as the exposure of the current
+               one is over, so the stage never moves during an
+               exposure. In the triggered mode the controller output
+               starts every exposure once the stage has settled and
+               the move overlaps the readout; free running, the move
+               waits for the frame.
+******************************************************************/
+#ifndef _ZSTACK_THREAD_H_
+#define _ZSTACK_THREAD_H_
+
+#include "FrameProcessor.h"
+#include "StageController.h"
+#include "Stage.h"
+#include "Stage_Params.h"
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QString>
+#include <vector>
+
+struct ZStackPlan{
+	double start;     //offset of the first plane from the current position, um
+	double step;      //um
+	int planes;
+	bool triggered;   //the camera exposes on the edges of CAMERA_TRIGGER::CONTROLLER_OUTPUT
+	double exposure;  //exposure time of the camera, s
+	int image_width;  //size of the frames, after binning
+	int image_height;
+};
+
+struct ZStackPlane{
+	double target;           //pulse
+	double position;         //encoder position during the exposure, pulse
+	long long exposure_time; //us
+	unsigned long frame_index;
+};
+
+class ZStackThread : public QThread, public FrameProcessor
+{
+	Q_OBJECT
+public:
+	static string OBJECT_NAME;
+
+	//the trigger pulses are sent on controller, the stage motions on stage
+	ZStackThread(Stage* stage, StageController* controller, QObject* parent = 0);
+	~ZStackThread();
+
+	bool StartStack(const ZStackPlan& plan, QString folder, QString prefix);
+	void StopStack();
+	virtual void ProcessFrame(const uchar* data, const FrameInfo& info);
+	vector<ZStackPlane> Get_Planes();
+
+signals:
+	void ZStackPlaneSignal(int, double);          //plane index and its position, um
+	void ZStackFinishedSignal(bool, int, double); //success, acquired planes and elapsed ms
+
+protected:
+	virtual void run();
+	double MoveTo(double target, double current);
+	bool WaitPlaneFrame(int plane, long timeout_ms);
+	bool SaveStack(int count);
+
+private:
+	Stage* stage;
+	StageController* controller;
+	volatile bool isStopStack;
+	ZStackPlan plan;
+	QString folder;
+	QString prefix;
+	double motionTime;  //predicted duration of the running motion, ms
+	double profileSpeed;
+	double profileAcc;
+	double profileDec;
+
+	//frame exchange with the acquisition thread
+	QMutex frameMutex;
+	QWaitCondition frameReady;
+	int waitingPlane;        //-1 when no frame is expected
+	long long acceptTime;    //frames exposed before it are ignored, us
+	int imageWidth;
+	int imageHeight;
+	vector<ushort> stack;
+	vector<ZStackPlane> planes;
+};
+
+#endif //_ZSTACK_THREAD_H_
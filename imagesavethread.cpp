@@ -1,4 +1,6 @@
 #include "imagesavethread.h"
+#include "ImageKernels.h"
+#include <QtCore/QFile>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
@@ -45,7 +47,20 @@ void ImageSaveThread::run() {
 
 		QString filename = imageFolder+"\\"+prefix+"_"+QString::number(p_buffer->timestamp)+"."+imageFormat;
 
-		if (p_buffer->data_type == USHORT_TYPE){
+		//the raw files keep the pixels as they were recorded, packed ones included
+		if (imageFormat == "raw"){
+			QFile file(filename);
+			if (file.open(QIODevice::WriteOnly)){
+				file.write((const char*)p_buffer->image_data, Get_ImageBytes(p_buffer->data_type, p_buffer->image_width, p_buffer->image_height));
+				file.close();
+			}
+		}
+		else if (p_buffer->data_type == MONO12P_TYPE){
+			cv::Mat image(p_buffer->image_height, p_buffer->image_width, CV_16UC1);
+			UnpackMono12((const uchar*)p_buffer->image_data, p_buffer->image_width/2*3, p_buffer->image_width, p_buffer->image_height, (ushort*)image.data);
+			imwrite(filename.toStdString(), image);
+		}
+		else if (p_buffer->data_type == USHORT_TYPE){
 			ushort* image_data = (ushort*)(p_buffer->image_data);
 			cv::Mat image(p_buffer->image_height, p_buffer->image_width, CV_16UC1, image_data);
 			imwrite(filename.toStdString(), image);
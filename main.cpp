@@ -12,7 +12,7 @@ int HamamatsuSaveImageNum = 0;
 bool HamamatsuStartSaveImage = false;
 
 WindowInfo hamamatsuWindowInfo = {0, HAMAMATSU_PARAMS::FULLIMAGE_WIDTH, HAMAMATSU_PARAMS::FULLIMAGE_HEIGHT, 
-	                                                          HAMAMATSU_PARAMS::FULLIMAGE_WIDTH, 0,NULL, USHORT_TYPE, 0,SINGLE,Mono16, BIT_0, HAMAMATSU_WINDOW, NORMAL};
+	                                                          HAMAMATSU_PARAMS::FULLIMAGE_WIDTH, 0,(char)0xFF,NULL, USHORT_TYPE, 0,SINGLE,Mono16, BIT_0, HAMAMATSU_WINDOW, NORMAL};
 //current position and value for status bar
 PositionStatus positionStatus = {HAMAMATSU_WINDOW, 0, 0, 0};
 DisplayWindowFlag CurrentWindowFlag = HAMAMATSU_WINDOW;
@@ -23,6 +23,8 @@ int main(int argc, char* argv[])
 	QApplication a(argc, argv);
 	qRegisterMetaType<string>("string");
 	qRegisterMetaType<ImageRegion>("ImageRegion");
+	qRegisterMetaType<QVector<double> >("QVector<double>");
+
 
 	TrackingWindow w;
 	//QIcon windowIcon(".\\Resources\\Icons\\window.png");
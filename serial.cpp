@@ -1,6 +1,6 @@
 ﻿/*
 	serial 使用windows api进行串口编程
-	其中，串口波特率可调，8个数据位，无奇偶位，一个停止位，设置读写串口时无延迟
+	其中，串口波特率可调，8个数据位，无奇偶位，一个停止位，读写采用重叠I/O
 */
 #include "serial.h"
 #include "CharConvert.h"
@@ -12,6 +12,9 @@
 CSerialPort::CSerialPort()
 {
 	hComm = INVALID_HANDLE_VALUE;
+	memset(portname, 0, sizeof(portname));
+	memset(&readOverlapped, 0, sizeof(readOverlapped));
+	memset(&writeOverlapped, 0, sizeof(writeOverlapped));
 }
 
 CSerialPort::~CSerialPort()
@@ -31,10 +34,9 @@ int CSerialPort::Init_Com(char *devname, UINT baud_rate)
 		0,								// comm devices must be opened with exclusive access
 		NULL,						    // no security attributes
 		OPEN_EXISTING,					// comm devices must use OPEN_EXISTING
-		0,		                        // sync I/O
+		FILE_FLAG_OVERLAPPED,		    // overlapped I/O
 		NULL);							// template must be 0 for comm devices
 	//wcout << portName << endl;
-	SetupComm(hComm, 256, 256);//初始化缓冲区大小
 
 	//如果串口打开失败则返回连接错误
 	if (hComm == INVALID_HANDLE_VALUE)
@@ -42,16 +44,19 @@ int CSerialPort::Init_Com(char *devname, UINT baud_rate)
 		std::cout << "CSerialPort::Init_Com() : cannot open serial port" << std::endl;
 		return SERIAL_OPEN_PORT_ERROR;
 	}
+	SetupComm(hComm, MAX_BUFFER_SIZE, MAX_BUFFER_SIZE);//初始化缓冲区大小
 	sprintf_s(portname, "%s", devname);
+	readOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	writeOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	//设置串口的超时时间
-	//由于设置间隔时间为MAXDWORD，而读时间系数和读时间常量都为0，
-	//则在读一次输入缓冲区的内容后读操作就立即返回，而不管是否读入了要求的字符
+	//间隔时间和读时间系数都为MAXDWORD时，缓冲区有数据则读操作立即返回，
+	//否则收到第一个字节即返回，读时间常量只是上限，实际期限由Read()等待的时间决定
 	comTimeout.ReadIntervalTimeout = MAXDWORD;
-	comTimeout.ReadTotalTimeoutMultiplier = 0;
-	comTimeout.ReadTotalTimeoutConstant = 0;
+	comTimeout.ReadTotalTimeoutMultiplier = MAXDWORD;
+	comTimeout.ReadTotalTimeoutConstant = MAXDWORD - 1;
 	comTimeout.WriteTotalTimeoutMultiplier = 0;
-	comTimeout.WriteTotalTimeoutConstant = 0;
+	comTimeout.WriteTotalTimeoutConstant = SERIAL_RESPONSE_TIMEOUT;
 	if (!SetCommTimeouts(hComm, &comTimeout))
 	{ 
 		ProcessErrorMessage("SetCommTimeouts()");
@@ -79,7 +84,7 @@ int CSerialPort::Init_Com(char *devname, UINT baud_rate)
 		return SERIAL_PARAMS_SETTING_ERROR;
 	}
 
-	PurgeComm(hComm, PURGE_RXCLEAR | PURGE_TXCLEAR | PURGE_RXABORT | PURGE_TXABORT);//flush port
+	Flush();
 	return SERIAL_CONNECTION_SUCCESS;
 }
 
@@ -87,51 +92,58 @@ void CSerialPort::ClosePort()
 {
 	if (hComm != INVALID_HANDLE_VALUE)
 	{
+		CancelIo(hComm);
 		CloseHandle(hComm);
 		hComm = INVALID_HANDLE_VALUE;
 	}
+	if (readOverlapped.hEvent != NULL){
+		CloseHandle(readOverlapped.hEvent);
+		readOverlapped.hEvent = NULL;
+	}
+	if (writeOverlapped.hEvent != NULL){
+		CloseHandle(writeOverlapped.hEvent);
+		writeOverlapped.hEvent = NULL;
+	}
 }
 
-//从串口读取数据
-int CSerialPort::Receive_Data()
+//从串口读取数据，有数据到达即返回，超时取消读操作
+int CSerialPort::Read(char* buffer, int size, unsigned long timeout_ms)
 {
 	DWORD readBytes = 0;
-	memset(readBuffer, 0, sizeof(readBuffer)/sizeof(readBuffer[0]));
-	if (!ReadFile(hComm, readBuffer, sizeof(readBuffer), &readBytes, NULL)){
-		ProcessErrorMessage("Receive_Data()");
+	ResetEvent(readOverlapped.hEvent);
+	if (!ReadFile(hComm, buffer, size, &readBytes, &readOverlapped)){
+		if (GetLastError() != ERROR_IO_PENDING){
+			ProcessErrorMessage("Read()");
+			return -1;
+		}
+		if (WaitForSingleObject(readOverlapped.hEvent, timeout_ms) != WAIT_OBJECT_0){
+			CancelIo(hComm);
+		}
+		//取消后仍要等读操作结束，取消前读到的字节照常返回
+		if (!GetOverlappedResult(hComm, &readOverlapped, &readBytes, TRUE) && GetLastError() != ERROR_OPERATION_ABORTED){
+			ProcessErrorMessage("Read()");
+			return -1;
+		}
 	}
-	PurgeComm(hComm, PURGE_RXABORT | PURGE_RXCLEAR);
-	return readBytes;
+	return (int)readBytes;
 }
 
-//向串口发送命令
-void CSerialPort::Write_Data(char *command)
+//向串口发送命令，等待数据写入串口驱动
+bool CSerialPort::Write(const char* data, int size)
 {
 	DWORD dwError;
 	COMSTAT commstat;
-	DWORD dwWrittenBytes;//实际写串口的字符数
-	DWORD writeSize;     //要写串口的字符数
+	DWORD dwWrittenBytes = 0;//实际写串口的字符数
 
-	memset(writeBuffer, 0, sizeof(writeBuffer)/sizeof(writeBuffer[0]));//清空写数据缓冲区writeBuffer
-	writeSize = strlen(command);
-	strncpy(writeBuffer, command, sizeof(writeBuffer) / sizeof(writeBuffer[0]));
 	ClearCommError(hComm, &dwError, &commstat);
-	if (!WriteFile(hComm, writeBuffer, writeSize, &dwWrittenBytes, NULL)){	
-		ProcessErrorMessage("Write_Data()");
+	ResetEvent(writeOverlapped.hEvent);
+	if (!WriteFile(hComm, data, size, &dwWrittenBytes, &writeOverlapped)){
+		if (GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(hComm, &writeOverlapped, &dwWrittenBytes, TRUE)){
+			ProcessErrorMessage("Write()");
+			return false;
+		}
 	}
-	PurgeComm(hComm, PURGE_TXABORT | PURGE_TXCLEAR);
-}
-
-//清空readBuffer
-void CSerialPort::ClearReadBuffer()
-{
-	memset(readBuffer, 0, sizeof(readBuffer) / sizeof(readBuffer[0]));
-}
-
-//清空writeBuffer
-void CSerialPort::ClearWriteBuffer()
-{
-	memset(writeBuffer, 0, sizeof(writeBuffer) / sizeof(writeBuffer[0]));
+	return dwWrittenBytes == (DWORD)size;
 }
 
 void CSerialPort::ProcessErrorMessage(char* ErrorText)
@@ -140,7 +152,7 @@ void CSerialPort::ProcessErrorMessage(char* ErrorText)
 	sprintf(error_text, "ERROR:  %s Failed , port: %s\n",ErrorText, portname);
 }
 
-void CSerialPort::flush()
+void CSerialPort::Flush()
 {
 	PurgeComm(hComm, PURGE_RXCLEAR | PURGE_TXCLEAR | PURGE_RXABORT | PURGE_TXABORT);//flush port
-}
\ No newline at end of file
+}
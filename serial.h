@@ -1,6 +1,7 @@
 ﻿/****************************************************************************
 	serial 主要用于串口通信，使用windows api进行串口编程
-	其中，串口波特率可调，8个数据位，无奇偶位，一个停止位，设置读写串口时无延迟
+	其中，串口波特率可调，8个数据位，无奇偶位，一个停止位
+	读写采用重叠I/O：有数据到达即返回，超过期限则取消，不再固定延迟后读取
 	日期：2015-03-15
 ****************************************************************************/
 #ifndef __SERIAL_H__
@@ -10,14 +11,26 @@
 #define MAX_PORT_NAME_LENGTH 16          //串口大小
 #define MAX_BUFFER_SIZE 256              //有关串口数据发送，接收缓冲区大小
 #define MAX_ERROR_BUFFER_SIZE 1024       //有关串口错误信息缓冲区大小
-#define SERIAL_ISBUSY_DELAY 5            //查询串口是否Busy延迟 ms
-#define SERIAL_QUERY_DELAY 50            //查询串口状态延迟 ms
+#define SERIAL_RESPONSE_TIMEOUT 500      //等待一条应答的期限 ms
+#define SERIAL_PIPELINE_DEPTH 8          //未收到应答时可连续发送的命令数
 
 #define SERIAL_CONNECTION_SUCCESS    0 //成功打开串口
 #define SERIAL_OPEN_PORT_ERROR      -1 //打开串口错误
 #define SERIAL_PARAMS_SETTING_ERROR -2 //设置串口参数错误
 
-class CSerialPort
+//串口设备的收发端点，可以是串口，也可以是模拟设备
+class SerialEndpoint
+{
+public:
+	virtual ~SerialEndpoint(){}
+
+	virtual bool Write(const char* data, int size) = 0;
+	//有数据到达即返回读到的字节数，超时返回0，出错返回-1
+	virtual int Read(char* buffer, int size, unsigned long timeout_ms) = 0;
+	virtual void Flush() = 0;
+};
+
+class CSerialPort : public SerialEndpoint
 {
 public:
 	CSerialPort();
@@ -27,19 +40,17 @@ public:
 	HANDLE hComm;//串口
 	DCB dcb;     //包含了串口的各项参数设置，使用该结构配置串口
 	COMMTIMEOUTS comTimeout;
-	char readBuffer[MAX_BUFFER_SIZE];
 
 	int Init_Com(char *devname, UINT baud_rate);//初始化com口，只需要配置波特率
 	void ClosePort();
-	void Write_Data(char *command);
-	int Receive_Data();
-	void flush();
-	void ClearReadBuffer();
+	bool Write(const char* data, int size);
+	int Read(char* buffer, int size, unsigned long timeout_ms);
+	void Flush();
 	void ProcessErrorMessage(char *);
 
 private:
-	char writeBuffer[MAX_BUFFER_SIZE];
-	void ClearWriteBuffer();
+	OVERLAPPED readOverlapped;
+	OVERLAPPED writeOverlapped;
 };
 
 #endif